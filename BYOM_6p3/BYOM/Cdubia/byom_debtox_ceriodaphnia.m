@@ -229,7 +229,7 @@ prelim_checks % script to perform some preliminary checks and set things up
  
 % -------------------------------------------------------------------------
 % Configurations for the ODE solver
-glo.stiff = [0 3]; % ODE solver 0) ode45 (standard), 1) ode113 (moderately stiff), 2) ode15s (stiff)
+glo.stiff = [0 3]; % ODE solver 0) dopri5 in C++ (standard), 1) ode113 (moderately stiff), 2) rosenbrock4 in C++ (stiff), 3) dopri5 in C++ with closed form
 % Second argument is for default sloppy (0), normally tight (1), tighter
 % (2), or very tight (3) tolerances. Use 1 for quick analyses, but check
 % with 3 to see if there is a difference! Especially for time-varying
@@ -239,6 +239,10 @@ glo.break_time = 0; % break time vector up for ODE solver (1) or don't (0)
 % contains discontinuities. Don't use for continuous splines (type 1) as it
 % will be much slower. For FOCUS scenarios (high time resolution), breaking
 % up is not efficient and does not appear to be necessary.
+glo.batch = 2; % calculate all scenarios in one call to the C++ code (1), also the likelihood (2), or one call per scenario (0)
+% Note: the batched calculation is used only with the C++ solvers
+% (stiff(1)=0, 2 or 3); otherwise, call_deri is used per scenario. The
+% likelihood in C++ covers continuous and survival data (see call_loglik).
 % -------------------------------------------------------------------------
 
 opt_optim.fit    = 1; % fit the parameters (1), or don't (0)
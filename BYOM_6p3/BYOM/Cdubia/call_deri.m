@@ -52,7 +52,7 @@ zvd      = []; % additional zero-variate output, not used in this case
 % removed here. This packacge also always uses the events function, so the
 % option eventson is not used. Furthermore, simplefun.m is removed.
 
-stiff      = glo.stiff; % ODE solver 0) ode45 (standard), 1) ode113 (moderately stiff), 2) ode15s (stiff)
+stiff      = glo.stiff; % ODE solver 0) dopri5 in C++ (standard), 1) ode113 (moderately stiff), 2) rosenbrock4 in C++ (stiff), 3) dopri5 in C++ with closed form
 break_time = glo.break_time; % break time vector up for ODE solver (1) or don't (0)
 min_t      = 500; % minimum length of time vector (affects ODE stepsize only, when needed)
 names_sep  = glo.names_sep;
@@ -95,10 +95,36 @@ X0(glo.locL) = L0;        % put this estimate in the correct location of the ini
 %% Calculations
 % This part calls the ODE solver to calculate the output (the value of the
 % state variables over time). There is generally no need to modify this
-% part. The solver ode45 generally works well. For stiff problems, the
-% solver might become very slow; you can try ode15s instead.
+% part. The dopri5 solver in C++ generally works well. For stiff problems
+% (e.g., very high hazard rates in EPx calculations), the implicit
+% rosenbrock4 solver in C++ can be used instead (stiff(1)=2). Without
+% feedbacks, stiff(1)=3 uses the closed-form solution where it applies
+% (constant or linear exposure, damage below the thresholds), and dopri5
+% elsewhere.
 
 t     = t(:);   % force t to be a row vector (needed when useode=0)
+
+% tolerances for the ODE solver (see mex_settings.m, which also tells
+% whether the solver is one of the C++ solvers)
+[use_mex,~,AbsTol,RelTol] = mex_settings(glo);
+
+% The C++ solvers do all of the work below themselves: they build the same
+% time vector (events, brood-pouch points, extra points for glo.len=2),
+% follow break_time, and return only the requested time points, with the
+% output mapping applied (maximum length, survival not negative, and
+% brood-pouch delay). They work on a registered model (glo.feedb, glo.moa
+% and the exposure scenarios; see mex_handle.m), so that only a flat
+% vector with parameter values needs to be passed on each call. Repeated
+% calls (e.g., for the best fit in the plots) are taken from a cache in the
+% C++ code; see test_derivatives('cache') for the counters.
+if use_mex
+    [Xout,TE] = mex_handle(glo,'solve',t,X0,make_parvec(par,glo),c,stiff(1),AbsTol,RelTol,glo.Tbp,glo.len,break_time);
+    if isempty(TE) % if there is no event caught
+        TE = +inf; % return infinity
+    end
+    return
+end
+
 t_rem = t;      % remember the original time vector (as we will add to it)
 
 % The code below is meant for discontinous time-varying exposure. It will
@@ -163,17 +189,6 @@ options = odeset; % start with default options for the ODE solver
 % This needs further study ... events function removed. Events function
 % needs to be considered very carefully for this model (and would only be
 % useful for SD).
-switch stiff(2)
-    case 1 % for ODE15s, slightly tighter tolerances seem to suffice (for ODE113: not tested yet!)
-        RelTol  = 1e-4; % relative tolerance (tightened)
-        AbsTol  = 1e-7; % absolute tolerance (tightened)
-    case 2 % somewhat tighter tolerances ...
-        RelTol  = 1e-5; % relative tolerance (tightened)
-        AbsTol  = 1e-8; % absolute tolerance (tightened)
-    case 3 % for ODE45, very tight tolerances seem to be necessary in some cases
-        RelTol  = 1e-9; % relative tolerance (tightened)
-        AbsTol  = 1e-9; % absolute tolerance (tightened)
-end
 options = odeset(options,'RelTol',RelTol,'AbsTol',AbsTol,'Events',@eventsfun,'InitialStep',InitialStep,'MaxStep',MaxStep); % set options
 % Note: setting tolerances is pretty tricky. For some cases, tighter
 % tolerances are needed but not for others. For ODE45, tighter tolerances
@@ -219,14 +234,7 @@ t = unique([T;t;(T(1:end-1)+T(2:end))/2]); % combine T, t, and halfway-T into ne
 if break_time == 0 
     
     % simply use the ODE solver for the entire time vector
-    switch stiff(1)
-        case 0
-            [tout,Xout] = test_derivatives(t,X0,par,c,glo,options.InitialStep,options.AbsTol,options.RelTol,options.MaxStep);
-        case 1
-            [tout,Xout,TE,~,~] = ode113(@derivatives,t,X0,options,par,c,glo);
-        case 2
-            [tout,Xout,TE,~,~] = ode15s(@derivatives,t,X0,options,par,c,glo);
-    end
+    [tout,Xout,TE,~,~] = ode113(@derivatives,t,X0,options,par,c,glo);
     
 else
     
@@ -263,16 +271,7 @@ else
         % vector of two elements!
 
         % use ODE solver to find solution in this interval
-        % Note: the switch-case may be compromising calculation speed; however,
-        % it needs to be investigated which solver performs best
-        switch stiff(1)
-            case 0
-                [tout_tmp,Xout_tmp] = test_derivatives(t_tmp,X0,par,c,glo,options.InitialStep,options.AbsTol,options.RelTol,options.MaxStep);
-            case 1
-                [tout_tmp,Xout_tmp,TE,~,~] = ode113(@derivatives,t_tmp,X0,options,par,c,glo);
-            case 2
-                [tout_tmp,Xout_tmp,TE,~,~] = ode15s(@derivatives,t_tmp,X0,options,par,c,glo);
-        end
+        [tout_tmp,Xout_tmp,TE,~,~] = ode113(@derivatives,t_tmp,X0,options,par,c,glo);
         
         % collect output in correct location
         nt = length(tout_tmp); % length of the output time vector
@@ -290,8 +289,10 @@ end
 if isempty(TE) || all(TE == 0) % if there is no event caught
     TE = +inf; % return infinity
 end
-% This is not so useful as only the TE found in the last time period is
-% returned.
+% For break_time=1, this is not so useful as only the TE found in the last
+% time period is returned. The C++ solvers locate the events of eventsfun
+% themselves, and return the times of all crossings (they also restart the
+% stepper at each crossing, as these are kinks in the derivatives).
 
 %% Output mapping
 % _Xout_ contains a row for each state variable. It can be mapped to the
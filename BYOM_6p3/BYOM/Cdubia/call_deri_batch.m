@@ -0,0 +1,60 @@
+%% BYOM function call_deri_batch.m (calculates the model output for all scenarios)
+%
+%  Syntax: [Xout,zvd] = call_deri_batch(t,par,X0mat,glo)
+%
+% This function calculates the model output for all scenarios in _X0mat_
+% in one go. It is called from <transfer.html transfer.m> when glo.batch>0,
+% instead of calling <call_deri.html call_deri.m> for each concentration
+% separately. The C++ code in test_derivatives then solves all scenarios
+% in a single call, for the registered model (see mex_handle.m) with the
+% parameters as a flat vector (see make_parvec.m).
+%
+% As input, it gets:
+% * _t_     the time vector
+% * _par_   the parameter structure
+% * _X0mat_ the matrix with initial states: scenarios in columns, first
+%           row is the concentration (or scenario number)
+% * _glo_   the structure with various types of information (used to be global)
+%
+% The output _Xout_ is a 3D matrix with time in rows, states in columns,
+% and scenarios in the third dimension (in the order of the columns of
+% _X0mat_). The output is the same as calling call_deri for each scenario.
+% The batched solve is only available for the ODE solvers in C++ (stiff(1)
+% = 0, 2 or 3), and without data-set specific parameters (glo.break_time is
+% followed in C++ as well). For all other cases, this function simply calls
+% call_deri for each scenario. Output zvd is for zero-variate data (not
+% used here).
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function [Xout,zvd] = call_deri_batch(t,par,X0mat,glo)
+
+zvd = []; % additional zero-variate output, not used in this case
+
+t = t(:); % force t to be a column vector
+
+% Check whether the batched solve can be used (see mex_settings.m)
+[use_batch,solver,AbsTol,RelTol] = mex_settings(glo,X0mat(1,:));
+
+if ~use_batch % simply run call_deri for each scenario
+    Xout = zeros(length(t),size(X0mat,1)-1,size(X0mat,2));
+    for i = 1:size(X0mat,2) % run through all scenarios
+        Xout_tmp = call_deri(t,par,X0mat(:,i),glo);
+        if size(Xout_tmp,1) ~= length(t) % something went wrong in calculating the derivatives
+            Xout = Xout_tmp; % return the wrong size, so transfer will catch it
+            return
+        end
+        Xout(:,:,i) = Xout_tmp;
+    end
+    return
+end
+
+% The C++ code builds the time vector for each scenario in the same way as
+% call_deri.m (events from the exposure scenario, brood-pouch delay, and
+% extra points for glo.len=2), runs piece-wise across the events when
+% glo.break_time=1, and returns only the requested time points.
+Xout = mex_handle(glo,'batch',t,X0mat,make_parvec(par,glo),...
+    solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time);
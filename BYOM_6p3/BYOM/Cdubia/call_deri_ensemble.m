@@ -0,0 +1,60 @@
+%% BYOM function call_deri_ensemble.m (calculates the model output for many parameter sets)
+%
+%  Syntax: Xout = call_deri_ensemble(t,par_coll,X0mat,glo,n_threads)
+%
+% This function calculates the model output for all scenarios in _X0mat_,
+% for a whole collection of parameter sets, in one go. It is called from
+% <calc_conf.html calc_conf.m> when glo.batch>0, instead of calling
+% <call_deri.html call_deri.m> for each parameter set and scenario in a
+% (par)for loop. The C++ code in test_derivatives spreads the calculations
+% over a pool of threads, so the parallel toolbox is not needed.
+%
+% As input, it gets:
+% * _t_         the time vector
+% * _par_coll_  cell array with a parameter structure for each set
+% * _X0mat_     the matrix with initial states: scenarios in columns, first
+%               row is the concentration (or scenario number)
+% * _glo_       the structure with various types of information (used to be global)
+% * _n_threads_ number of threads to use (0 to use all available cores)
+%
+% The output _Xout_ is a 4D matrix with time in rows, states in columns,
+% scenarios in the third dimension, and parameter sets in the fourth. The
+% same restrictions apply as for <call_deri_batch.html call_deri_batch.m>
+% (see mex_settings.m); if the C++ code cannot be used, call_deri_batch is
+% called for each parameter set, one after the other (calc_conf.m then
+% uses its parfor loop instead). When a calculation fails there, the
+% output of call_deri_batch is returned, which has the wrong size.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function Xout = call_deri_ensemble(t,par_coll,X0mat,glo,n_threads)
+
+t      = t(:); % force t to be a column vector
+n_sets = length(par_coll); % number of parameter sets
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_batch,solver,AbsTol,RelTol] = mex_settings(glo,X0mat(1,:));
+
+if ~use_batch % simply run call_deri_batch for each parameter set
+    Xout = zeros(length(t),size(X0mat,1)-1,size(X0mat,2),n_sets);
+    for k = 1:n_sets % run through all parameter sets
+        Xout_tmp = call_deri_batch(t,par_coll{k},X0mat,glo);
+        if size(Xout_tmp,1) ~= length(t) % something went wrong in calculating the derivatives
+            Xout = Xout_tmp; % return the wrong size, as call_deri_batch does
+            return
+        end
+        Xout(:,:,:,k) = Xout_tmp;
+    end
+    return
+end
+
+par_sets = zeros(n_sets,22); % parameter sets in rows, in the order of the C++ code
+for k = 1:n_sets % run through all parameter sets
+    par_sets(k,:) = make_parvec(par_coll{k},glo);
+end
+
+Xout = mex_handle(glo,'ensemble',t,X0mat,par_sets,...
+    solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time,n_threads);
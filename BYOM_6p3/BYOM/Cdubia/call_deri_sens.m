@@ -0,0 +1,55 @@
+%% BYOM function call_deri_sens.m (model output with forward sensitivities in C++)
+%
+%  Syntax: [Xout,dXdp] = call_deri_sens(t,par,X0v,glo,names_sens)
+%
+% This function calculates the model output as <call_deri.html
+% call_deri.m>, together with the derivatives of all states to a selection
+% of the parameters. The C++ code solves the forward sensitivities (the
+% variational equations) along with the states, so all derivatives come
+% from a single run of the ODE solver, rather than from an extra run for
+% each parameter (as in calc_localsens.m). The derivatives also make a
+% Gauss-Newton or Levenberg-Marquardt step possible.
+%
+% As input, it gets:
+% * _t_          the time vector
+% * _par_        the parameter structure
+% * _X0v_        a vector with initial states and one concentration (scenario number)
+% * _glo_        the structure with various types of information (used to be global)
+% * _names_sens_ cell array with the names of the parameters
+%
+% The output _Xout_ provides a matrix with time in rows, and states in
+% columns (as call_deri.m). The output _dXdp_ has the derivatives of the
+% output to the parameters in _names_sens_, with time in rows, states in
+% columns, and parameters in the third dimension (on normal scale, also
+% for parameters that are fitted on log scale). Both are empty when the
+% C++ code cannot be used (other solvers, data-set specific parameters,
+% or parameters that are not in <make_parvec.html make_parvec.m>). The
+% sensitivities are always solved with dopri5, also when glo.stiff(1)=2 or 3.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function [Xout,dXdp] = call_deri_sens(t,par,X0v,glo,names_sens)
+
+Xout = []; % empty means: use call_deri.m
+dXdp = [];
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,X0v(1));
+if ~use_mex
+    return
+end
+
+% Location of each parameter in the vector of make_parvec.m (as in
+% mex_problem.m; the empty names are taken from glo)
+names_pvec = {'','','','','L0','Lp','Lm','rB','Rm','f','hb','Lf','Tlag',...
+    'kd','zb','bb','zs','bs','Lj','','','a'};
+[is_pvec,loc_par] = ismember(names_sens,names_pvec);
+if ~all(is_pvec)
+    return
+end
+
+[Xout,dXdp] = mex_handle(glo,'sens',t(:),X0v(2:end),make_parvec(par,glo),X0v(1),loc_par(:),...
+    AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time);
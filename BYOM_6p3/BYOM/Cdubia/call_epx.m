@@ -0,0 +1,50 @@
+%% BYOM function call_epx.m (effects for a range of multiplication factors in C++)
+%
+%  Syntax: [Xout,Xctrl] = call_epx(MF,t,par,X0v,glo,locX,n_threads)
+%
+% This function calculates the effects at the end of the time vector for a
+% whole range of multiplication factors in one call to the C++ code. It is
+% used in <calc_epx.html calc_epx.m> for the robust EPx calculation
+% (opt_ecx.rob_win=1), when glo.batch>0, instead of calling
+% <calc_epx_helper.html calc_epx_helper.m> for each multiplication factor
+% in a parfor loop. The C++ code solves the control and all multiplication
+% factors on a pool of threads; each one has its own step-size control, as
+% the events (e.g., damage reaching a threshold) differ between them.
+%
+% As input, it gets:
+% * _MF_        vector with multiplication factors for the exposure profile
+% * _t_         the time vector
+% * _par_       the parameter structure
+% * _X0v_       a vector with initial states and one concentration (scenario number)
+% * _glo_       the structure with various types of information (used to be global)
+% * _locX_      the states to return (as ind_traits in calc_epx.m)
+% * _n_threads_ number of threads to use (0 to use all cores)
+%
+% The output _Xout_ is a matrix with the final values of the traits
+% relative to the control, with multiplication factors in rows and traits
+% in columns (as Xout_coll2 in calc_epx.m), and _Xctrl_ has the final
+% values in the control. Both are empty when the C++ code cannot be used
+% (other solvers, data-set specific parameters, or traits that are not one
+% of the four states); in that case, calc_epx.m uses calc_epx_helper.m.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function [Xout,Xctrl] = call_epx(MF,t,par,X0v,glo,locX,n_threads)
+
+Xout  = []; % empty means: use calc_epx_helper.m
+Xctrl = [];
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,X0v(1));
+if ~use_mex
+    return
+end
+if isempty(locX) || any(locX < 1 | locX > 4) % the C++ code only returns the states D, L, R and S
+    return
+end
+
+[Xout,Xctrl] = mex_handle(glo,'epx',t(:),X0v(:),make_parvec(par,glo),MF(:),locX(:),...
+    solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time,n_threads);
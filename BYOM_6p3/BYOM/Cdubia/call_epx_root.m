@@ -0,0 +1,51 @@
+%% BYOM function call_epx_root.m (EPx for all traits and effect levels in C++)
+%
+%  Syntax: [EPx,n_sim] = call_epx_root(MF_range,XF,Feff,t,par,X0v,glo,locX)
+%
+% This function calculates the EPx for all combinations of traits and
+% effect levels in one call to the C++ code, instead of calling fzero with
+% <calc_epx_helper.html calc_epx_helper.m> for each combination. It is used
+% in <calc_epx.html calc_epx.m> when glo.batch>0 (for opt_ecx.rob_win=0).
+% The C++ code solves the control once, solves each MF once for all
+% traits, and uses the MFs that are already solved to narrow down the
+% interval of the next search. The zero is found with the same algorithm
+% as fzero.
+%
+% As input, it gets:
+% * _MF_range_ MF interval for each row of XF; with NaN as second element,
+%              the first one is a starting value (as for fzero)
+% * _XF_       matrix with a trait (index in locX) and an effect level
+%              (index in Feff) in each row
+% * _Feff_     the effect levels
+% * _t_        the time vector
+% * _par_      the parameter structure
+% * _X0v_      a vector with initial states and one concentration (scenario number)
+% * _glo_      the structure with various types of information (used to be global)
+% * _locX_     the states for the traits (as ind_traits in calc_epx.m)
+%
+% The output _EPx_ has the EPx for each row of XF (NaN when no change of
+% sign is found), and _n_sim_ the number of simulations that were needed.
+% Both are empty when the C++ code cannot be used (see
+% <call_epx.html call_epx.m>); in that case, calc_epx.m uses fzero.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function [EPx,n_sim] = call_epx_root(MF_range,XF,Feff,t,par,X0v,glo,locX)
+
+EPx   = []; % empty means: use fzero with calc_epx_helper.m
+n_sim = [];
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,X0v(1));
+if ~use_mex
+    return
+end
+if isempty(locX) || any(locX < 1 | locX > 4) % the C++ code only returns the states D, L, R and S
+    return
+end
+
+[EPx,n_sim] = mex_handle(glo,'epxroot',t(:),X0v(:),make_parvec(par,glo),locX(:),XF,Feff(:),MF_range,...
+    solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time);
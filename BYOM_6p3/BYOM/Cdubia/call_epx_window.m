@@ -0,0 +1,69 @@
+%% BYOM function call_epx_window.m (robust EPx for moving time windows in C++)
+%
+%  Syntax: [EPx,kept] = call_epx_window(par,X0v,Cw,Trange,Twin,opt_ecx,locX,glo,n_threads)
+%
+% This function calculates the robust EPx (opt_ecx.rob_win=1) for all
+% time windows of an exposure profile in one call to the C++ code. It is
+% used in <calc_epx_window.html calc_epx_window.m> when glo.batch>0 and no
+% CIs are needed, instead of calling <calc_epx.html calc_epx.m> for each
+% window. Each window starts with a new animal, so up to the first
+% exposure in a window, all MFs follow the unexposed control. The C++ code
+% solves that control once for all windows, and starts each window from
+% the control state at its first exposure. The windows are spread over a
+% pool of threads. The EPx are calculated as in calc_epx.m: the rough
+% exploration decides which traits are returned, and the EPx follow from
+% linear interpolation in the effects at the MFs in opt_ecx.rob_rng.
+%
+% As input, it gets:
+% * _par_       the parameter structure
+% * _X0v_       a vector with the initial states (without scenario number)
+% * _Cw_        the exposure profile (time and concentration in columns),
+%               extended as in calc_epx_window.m
+% * _Trange_    vector with the start of each window
+% * _Twin_      length of the windows
+% * _opt_ecx_   options structure for ECx and EPx calculations
+% * _locX_      the states for the traits (as ind_traits in calc_epx.m)
+% * _glo_       the structure with various types of information (used to be global)
+% * _n_threads_ number of threads to use (0 to use all cores)
+%
+% The output _EPx_ is a 3D matrix with windows in rows, traits in columns
+% and effect levels in the third dimension (NaN for windows without
+% exposure), and _kept_ has a 1 for the traits that calc_epx.m would
+% return for each window. Both are empty when the C++ code cannot be used
+% (other solvers, data-set specific parameters, or traits that are not one
+% of the four states); in that case, calc_epx_window.m calls calc_epx.m.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function [EPx,kept] = call_epx_window(par,X0v,Cw,Trange,Twin,opt_ecx,locX,glo,n_threads)
+
+EPx  = []; % empty means: use calc_epx.m for each window
+kept = [];
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,opt_ecx.id_sel(2));
+if ~use_mex
+    return
+end
+if isempty(locX) || any(locX < 1 | locX > 4) % the C++ code only returns the states D, L, R and S
+    return
+end
+
+% Remove background mortality, and set the extra parameters to zero, as
+% in calc_epx.m
+par.(opt_ecx.backhaz)(1) = 0;
+setzero = opt_ecx.setzero;
+if ~isempty(setzero)
+    if ~iscell(setzero) % just to make sure it will be a cell
+        setzero = {setzero}; % turn it into a cell array with one element
+    end
+    for i = 1:length(setzero)
+        par.(setzero{i})(1) = 0;
+    end
+end
+
+[EPx,kept] = mex_handle(glo,'epxwindow',X0v(:),make_parvec(par,glo),Cw,Trange(:),Twin,...
+    opt_ecx.rob_rng(:),opt_ecx.Feff(:),locX(:),solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time,n_threads);
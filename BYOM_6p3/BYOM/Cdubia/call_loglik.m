@@ -0,0 +1,57 @@
+%% BYOM function call_loglik.m (calculates the minus log-likelihood in C++)
+%
+%  Syntax: minloglik = call_loglik(t,par,X0mat,DATA,W,glo)
+%
+% This function calculates the minus log-likelihood for all data sets in
+% one call to the C++ code. It is called from <transfer.html transfer.m>
+% when glo.batch=2, and replaces both the calculation of the model output
+% for all scenarios and the comparison to the data in transfer.m. The C++
+% code solves all scenarios (as for glo.batch=1), and calculates the
+% log-likelihood for continuous data (sum of squares) and for survival
+% data (multinomial). Priors are added in transfer.m; with zero-variate
+% data (glo.zvd), the C++ code is not used, as in mex_problem.m.
+%
+% As input, it gets:
+% * _t_     the time vector
+% * _par_   the parameter structure
+% * _X0mat_ the matrix with initial states: scenarios in columns (in the
+%           order of glo2.ctot), first row is the concentration (or
+%           scenario number)
+% * _DATA_  the cell array with the data sets
+% * _W_     the cell array with the weight factors
+% * _glo_   the structure with various types of information (used to be global)
+%
+% The output _minloglik_ is the minus log-likelihood. It is empty when the
+% C++ code cannot be used (other solvers, data-set specific parameters,
+% data types other than continuous and multinomial survival data, or
+% zero-variate data); in that case, transfer.m calculates the likelihood
+% itself.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function minloglik = call_loglik(t,par,X0mat,DATA,W,glo)
+
+minloglik = []; % empty means: calculate the likelihood in transfer.m
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,X0mat(1,:));
+if ~use_mex
+    return
+end
+if isfield(glo,'zvd') && ~isempty(glo.zvd) % zero-variate data are calculated in transfer.m
+    return
+end
+% The C++ code only covers continuous data (lam >= 0) and survival data in
+% the multinomial setting (lam = -1).
+for i = 1:numel(DATA)
+    lam = DATA{i}(1,1);
+    if size(DATA{i},1) > 1 && lam < 0 && lam ~= -1
+        return
+    end
+end
+
+minloglik = mex_handle(glo,'loglik',t(:),X0mat,make_parvec(par,glo),DATA,W,...
+    solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time,glo.sameres,glo.var,glo.wts);
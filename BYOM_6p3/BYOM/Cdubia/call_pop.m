@@ -0,0 +1,65 @@
+%% BYOM function call_pop.m (intrinsic rate of increase in C++)
+%
+%  Syntax: rgr = call_pop(t,par_coll,fscen,X0mat,Th,glo,n_threads)
+%
+% This function calculates the intrinsic rate of increase from the
+% Euler-Lotka equation for all treatments, food levels and parameter sets
+% in one call to the C++ code. It is used in <calc_pop.html calc_pop.m>
+% when glo.batch>0, instead of calling fzero with
+% <calc_epx_helper.html calc_epx_helper.m> (calc_int=1) for each treatment
+% and food level, and for each set of the sample. The C++ code simulates
+% each combination once on _t_, and solves the Euler-Lotka equation on the
+% discretised kernel of that simulation (the same trapezium rule as
+% calc_epx_helper.m) with Newton steps. Everything runs on a pool of
+% threads, so the parallel computing toolbox is not needed.
+%
+% As input, it gets:
+% * _t_         the time vector for the population calculations
+% * _par_coll_  cell array with a parameter structure for each set
+% * _fscen_     the food levels (replacing par.f when there is more than one)
+% * _X0mat_     the matrix with initial states: treatments in columns,
+%               first row is the concentration (or scenario number)
+% * _Th_        the hatching time
+% * _glo_       the structure with various types of information (used to be global)
+% * _n_threads_ number of threads to use (0 to use all cores)
+%
+% The output _rgr_ has the intrinsic rate of increase with treatments in
+% rows, food levels in columns, and parameter sets in the third dimension
+% (NaN without reproduction, and 0 when it would be negative, as in
+% calc_epx_helper.m). It is empty when the C++ code cannot be used (other
+% solvers, data-set specific parameters, or other locations for
+% reproduction and survival); in that case, calc_pop.m uses
+% calc_epx_helper.m.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function rgr = call_pop(t,par_coll,fscen,X0mat,Th,glo,n_threads)
+
+rgr = []; % empty means: use calc_epx_helper.m
+
+% Same checks as in call_deri_batch.m (see mex_settings.m)
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,X0mat(1,:));
+if ~use_mex
+    return
+end
+if ~isfield(glo,'locS') || glo.locR ~= 3 || glo.locS ~= 4 % the C++ code takes R and S from the states D, L, R and S
+    return
+end
+
+if length(fscen) <= 1 % as calc_pop.m: f is only replaced for more than one food level
+    fscen = [];
+end
+
+glo.MF   = 1; % as calc_epx_helper.m is called with MF=1
+n_sets   = length(par_coll); % number of parameter sets
+par_sets = zeros(n_sets,22); % parameter sets in rows, in the order of the C++ code
+for k = 1:n_sets % run through all parameter sets
+    par_sets(k,:) = make_parvec(par_coll{k},glo);
+end
+
+rgr = mex_handle(glo,'pop',t(:),X0mat,par_sets,fscen(:),Th,...
+    solver,AbsTol,RelTol,glo.Tbp,glo.len,glo.break_time,n_threads);
+rgr = reshape(rgr,size(X0mat,2),max(1,length(fscen)),n_sets); % also for a single set
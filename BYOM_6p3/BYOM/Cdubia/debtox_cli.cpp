@@ -0,0 +1,258 @@
+/*
+  FILE: debtox_cli.cpp
+  for BYOM_v6/DEBtox2019_v45b
+
+ Command-line tool for the DEBtox2019 model in debtox_core.hpp, so that
+ large numbers of simulations (e.g., for EPx or confidence intervals) can
+ be run without MATLAB. See debtox_core.hpp for the licences and copyright
+ notices.
+
+ Build (no MATLAB needed):
+   g++ -std=c++17 -O2 -pthread -I<path to boost libraries> debtox_cli.cpp -o debtox_cli
+
+ Usage:
+   debtox_cli [options] parameter_file
+
+ The parameter file has one parameter set per line, with the 22 values in
+ the order of make_parvec.m:
+   FBV KRV kap yP L0 Lp Lm rB Rm f hb Lf Tlag kd zb bb zs bs Lj Lm_ref MF a
+ Empty lines and lines starting with % or # are skipped.
+
+ Options:
+   --exposure FILE  exposure profiles in the format of kunzexposure.txt:
+                    the first row has the scenario identifiers (from the
+                    second column on), the next rows the time and the
+                    concentration in each scenario
+   --type N         type of the exposure profiles, as in make_scen.m: 2 for
+                    block pulses, 4 for linear interpolation (default 4)
+   --conc LIST      constant concentrations to run as well (the scenario
+                    identifier is the concentration)
+   --times LIST     output time points, as a list (0,1,2,...) or as
+                    start:step:end (default 0:1:21)
+   --feedb LIST     feedbacks, glo.feedb (default 1,1,1,1)
+   --moa LIST       mode of action, glo.moa (default 0,1,0,0,0)
+   --x0 LIST        initial states D,L,R,S (default 0,0,0,1); L is set
+                    to the parameter L0
+   --solver N       0 for dopri5, 2 for rosenbrock4, 3 for dopri5 with the
+                    closed-form solution where it applies (default 0)
+   --tol ABS,REL    tolerances of the ODE solver (default 1e-7,1e-4)
+   --Tbp X          brood-pouch delay, glo.Tbp (default 0)
+   --len N          length switch, glo.len (default 2)
+   --break-time N   break the time vector up at the exposure events,
+                    glo.break_time (default 0)
+   --threads N      number of threads, 0 to use all cores (default 0)
+   --out FILE       output file (default: standard output)
+
+ Output: one line per parameter set, scenario and time point, with the
+ columns: set scenario t D L R S (sets are numbered from 1).
+ */
+
+#include "debtox_core.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+
+namespace {
+
+// Split a comma-separated list of numbers
+std::vector<double> parse_list(const std::string& s)
+{
+    std::vector<double> v;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')){
+        if (!item.empty()) v.push_back(std::stod(item));
+    }
+    return v;
+}
+
+// Time points as a list, or as start:step:end (as in MATLAB)
+std::vector<double> parse_times(const std::string& s)
+{
+    if (s.find(':') == std::string::npos){
+        return parse_list(s);
+    }
+    std::vector<double> r;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ':')){
+        r.push_back(std::stod(item));
+    }
+    if (r.size() != 3 || r[1] <= 0){
+        throw std::invalid_argument("--times needs start:step:end with a positive step");
+    }
+    std::vector<double> t;
+    size_t n = (size_t)std::floor((r[2] - r[0])/r[1] + 1e-10) + 1;
+    for (size_t i = 0; i < n; i++){
+        t.push_back(r[0] + i*r[1]);
+    }
+    return t;
+}
+
+// Rows of numbers from a text file (as load in MATLAB); empty lines and
+// lines starting with % or # are skipped
+table_type read_matrix(const std::string& file)
+{
+    std::ifstream in(file);
+    if (!in){
+        throw std::runtime_error("cannot open " + file);
+    }
+    table_type rows;
+    std::string line;
+    while (std::getline(in, line)){
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '%' || line[first] == '#') continue;
+        for (char& ch : line){
+            if (ch == ',' || ch == ';') ch = ' ';
+        }
+        std::stringstream ss(line);
+        std::vector<double> row;
+        std::string item;
+        while (ss >> item){
+            row.push_back(item == "NaN" || item == "nan" ? NAN : std::stod(item));
+        }
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+void usage()
+{
+    std::fprintf(stderr,
+        "Usage: debtox_cli [options] parameter_file\n"
+        "Options: --exposure FILE --type N --conc LIST --times LIST --feedb LIST --moa LIST\n"
+        "         --x0 LIST --solver N --tol ABS,REL --Tbp X --len N --break-time N\n"
+        "         --threads N --out FILE\n"
+        "See the top of debtox_cli.cpp for details.\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::string par_file, exp_file, out_file;
+    int type = 4, solver = 0, len = 2;
+    bool break_time = false;
+    unsigned n_threads = 0;
+    double abs_err = 1e-7, rel_err = 1e-4, Tbp = 0;
+    std::vector<double> concs, t_req = parse_times("0:1:21");
+    std::vector<double> x0 = {0, 0, 0, 1};
+    model_type model;
+    model.vector_pars = {{1, 1, 1, 1}, {0, 1, 0, 0, 0}};
+
+    try{
+        for (int i = 1; i < argc; i++){
+            std::string arg = argv[i];
+            if (arg == "-h" || arg == "--help"){
+                usage();
+                return 0;
+            }
+            if (arg.compare(0, 2, "--") != 0){
+                par_file = arg;
+                continue;
+            }
+            if (i+1 >= argc){
+                throw std::invalid_argument("missing value for " + arg);
+            }
+            std::string val = argv[++i];
+            if      (arg == "--exposure")   exp_file = val;
+            else if (arg == "--type")       type = std::stoi(val);
+            else if (arg == "--conc")       concs = parse_list(val);
+            else if (arg == "--times")      t_req = parse_times(val);
+            else if (arg == "--feedb")      model.vector_pars[0] = parse_list(val);
+            else if (arg == "--moa")        model.vector_pars[1] = parse_list(val);
+            else if (arg == "--x0")         x0 = parse_list(val);
+            else if (arg == "--solver")     solver = std::stoi(val);
+            else if (arg == "--Tbp")        Tbp = std::stod(val);
+            else if (arg == "--len")        len = std::stoi(val);
+            else if (arg == "--break-time") break_time = std::stoi(val) == 1;
+            else if (arg == "--threads")    n_threads = (unsigned)std::stoi(val);
+            else if (arg == "--out")        out_file = val;
+            else if (arg == "--tol"){
+                std::vector<double> tol = parse_list(val);
+                if (tol.size() != 2) throw std::invalid_argument("--tol needs ABS,REL");
+                abs_err = tol[0];
+                rel_err = tol[1];
+            }
+            else throw std::invalid_argument("unknown option " + arg);
+        }
+        if (par_file.empty()){
+            usage();
+            return 1;
+        }
+        if (model.vector_pars[0].size() != 4 || model.vector_pars[1].size() != 5 || x0.size() != 4){
+            throw std::invalid_argument("--feedb needs 4 values, --moa 5 values and --x0 4 values");
+        }
+        if (solver != 0 && solver != 2 && solver != 3){
+            throw std::invalid_argument("--solver must be 0 (dopri5), 2 (rosenbrock4) or 3 (dopri5 with closed form)");
+        }
+
+        table_type par_sets = read_matrix(par_file);
+        for (const std::vector<double>& p : par_sets){
+            if (p.size() != 22){
+                throw std::invalid_argument("each parameter set needs 22 values (in the order of make_parvec.m)");
+            }
+        }
+
+        // exposure profiles: one scenario for each column (as make_scen.m)
+        std::vector<double> scen_id(concs);
+        if (!exp_file.empty()){
+            table_type Cw = read_matrix(exp_file);
+            if (Cw.size() < 2){
+                throw std::invalid_argument("the exposure file needs a row with identifiers and at least one time point");
+            }
+            for (size_t j = 1; j < Cw[0].size(); j++){
+                std::vector<double> t, c;
+                for (size_t i = 1; i < Cw.size(); i++){
+                    t.push_back(Cw[i][0]);
+                    c.push_back(Cw[i][j]);
+                }
+                model.int_scen.push_back(Cw[0][j]);
+                model.int_coll.push_back(make_scen_table(type, t, c));
+                model.int_type.push_back(type);
+                scen_id.push_back(Cw[0][j]);
+            }
+        }
+        if (scen_id.empty()){
+            throw std::invalid_argument("no scenarios: use --exposure and/or --conc");
+        }
+        std::vector<scenario_type> scenarios;
+        for (double id : scen_id){
+            scenarios.push_back(model.scenario(id));
+        }
+
+        // one task is one scenario for one parameter set
+        size_t n_scen = scenarios.size(), n_sets = par_sets.size(), nt = t_req.size();
+        std::vector<double> out(nt*4*n_scen*n_sets);
+        if (n_threads == 0){
+            n_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        parallel_for(n_sets*n_scen, n_threads, [&](size_t task){
+            size_t k = task / n_scen; // parameter set
+            size_t j = task % n_scen; // scenario
+            solve_requested(par_sets[k], model.vector_pars, scenarios[j], x0, t_req,
+                            Tbp, len, break_time, abs_err, rel_err, solver, out.data() + nt*4*task);
+        });
+
+        std::FILE* fout = out_file.empty() ? stdout : std::fopen(out_file.c_str(), "w");
+        if (!fout){
+            throw std::runtime_error("cannot open " + out_file);
+        }
+        for (size_t task = 0; task < n_sets*n_scen; task++){
+            const double* X = out.data() + nt*4*task;
+            for (size_t i = 0; i < nt; i++){
+                std::fprintf(fout, "%zu %.10g %.10g %.10g %.10g %.10g %.10g\n",
+                             task/n_scen + 1, scen_id[task % n_scen], t_req[i],
+                             X[i], X[i+nt], X[i+2*nt], X[i+3*nt]);
+            }
+        }
+        if (fout != stdout) std::fclose(fout);
+    }
+    catch (const std::exception& e){
+        std::fprintf(stderr, "debtox_cli: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
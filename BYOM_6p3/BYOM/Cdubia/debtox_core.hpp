@@ -0,0 +1,3235 @@
+/*
+  FILE: debtox_core.hpp
+  for BYOM_v6/DEBtox2019_v45b
+
+ The DEBtox2019 model and the solvers, in plain C++ (no MATLAB headers).
+ This is used by the MEX function (test_derivatives.cpp) and by the
+ command-line tool (debtox_cli.cpp).
+ 
+ Below: all licences and copyright notices of the code used here.
+ 
+======================
+ 
+ Boost Software License - Version 1.0 - August 17th, 2003
+
+Permission is hereby granted, free of charge, to any person or organization
+obtaining a copy of the software and accompanying documentation covered by
+this license (the "Software") to use, reproduce, display, distribute,
+execute, and transmit the Software, and to prepare derivative works of the
+Software, and to permit third-parties to whom the Software is furnished to
+do so, all subject to the following:
+
+The copyright notices in the Software and this entire statement, including
+the above license grant, this restriction and the following disclaimer,
+must be included in all copies of the Software, in whole or in part, and
+all derivative works of the Software, unless such copies or derivative
+works are solely in the form of machine-executable object code generated by
+a source language processor.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+
+ Copyright 2010-2012 Karsten Ahnert
+ Copyright 2011-2013 Mario Mulansky
+ Copyright 2013 Pascal Germroth
+ Distributed under the Boost Software License, Version 1.0.
+ (See accompanying file LICENSE_1_0.txt or
+ copy at http://www.boost.org/LICENSE_1_0.txt)
+ 
+ =====================
+
+ % * Author: Tjalling Jager
+ % * Date: September 2020
+ % * Web support: <http://www.debtox.info/byom.html>
+ % * Back to index <walkthrough_debtox2019.html>
+
+ %  Copyright (c) 2012-2020, Tjalling Jager, all rights reserved.
+ %  This source code is licensed under the MIT-style license found in the
+ %  LICENSE.txt file in the root directory of BYOM. 
+ 
+ ======================
+
+ Edits to apply it to the problem at hand by Dr. Carlo Romoli - ibacon GmbH
+
+ Some of the technical solutions in the code have been taken from the example 
+ reported in the Boost-libraries documentation to solve differential
+ equations (see above copyright notice).
+
+ This C++ code is a translation of the DEBtox2019 MATLAB code 
+ developed by Dr. Tjalling Jager (see above copyright notice). The equations
+ are those reported in the derivatives.m and read_scen.m files of the 
+ DEBtox2019 package.
+
+ =======================
+ */
+
+#ifndef DEBTOX_CORE_HPP
+#define DEBTOX_CORE_HPP
+
+#include <iostream>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <exception>
+#include <map>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <stdexcept>
+#include <limits>
+#include <type_traits>
+
+#include <boost/numeric/odeint.hpp>
+
+/* The type of container used to hold the state vector (fixed size, so
+ * that the solver does not need the heap for the states) */
+typedef std::array< double , 4 > state_type;
+
+/* The type of container used to hold the scenario table (rows of int_coll) */
+typedef std::vector< std::vector< double > > table_type;
+
+// Exposure scenario for one treatment, derived from glo as in call_deri.m.
+// Everything is copied into plain C++ containers, so that the scenarios can
+// be solved outside of the MATLAB thread.
+struct scenario_type
+{
+    double conc;                        // concentration or scenario identifier
+    std::vector<double> timevar;        // [1 0] for time-varying exposure, [0 0] otherwise
+    int int_type;                       // type of scenario
+    std::vector<double> Tev;            // times of the exposure events
+    // the scenario table, flattened into contiguous arrays for read_scen
+    // (for type 3, without the last line with the disappearance rate)
+    std::vector<double> ev_c;           // concentration at each event
+    std::vector<double> ev_s;           // slope after each event (types 1 and 4)
+    std::vector<double> ev_c2;          // quadratic coefficient after each event (type 1)
+    std::vector<double> ev_c3;          // cubic coefficient after each event (type 1)
+    double kc = 0;                      // disappearance rate (type 3)
+};
+
+/* The parameters of the model as a plain structure: the elements of
+ * scalar_pars (in the same order, see read_pars), the feedbacks (glo.feedb)
+ * and the modes of action (glo.moa) */
+struct deb_pars
+{
+    double FBV, KRV, kap, yP;         // globals for the energy budget
+    double L0, Lp, Lm, rB, Rm, f, hb; // basic life history
+    double Lf, Tlag;                  // extra parameters for specific cases
+    double kd, zb, bb, zs, bs;        // response to toxicants
+    double Lj, Lm_ref, MF, a;
+    double feedb[4];                  // feedbacks
+    double moa[5];                    // modes of action
+
+    deb_pars(const std::vector<double>& scalar_pars,
+             const std::vector<std::vector<double>>& vector_pars)
+    {
+        FBV = scalar_pars[0];  KRV = scalar_pars[1];  kap = scalar_pars[2];  yP = scalar_pars[3];
+        L0  = scalar_pars[4];  Lp  = scalar_pars[5];  Lm  = scalar_pars[6];  rB = scalar_pars[7];
+        Rm  = scalar_pars[8];  f   = scalar_pars[9];  hb  = scalar_pars[10];
+        Lf  = scalar_pars[11]; Tlag = scalar_pars[12];
+        kd  = scalar_pars[13]; zb  = scalar_pars[14]; bb  = scalar_pars[15];
+        zs  = scalar_pars[16]; bs  = scalar_pars[17];
+        Lj  = scalar_pars[18]; Lm_ref = scalar_pars[19]; MF = scalar_pars[20]; a = scalar_pars[21];
+        for (int i = 0; i < 4; i++) feedb[i] = vector_pars[0][i];
+        for (int i = 0; i < 5; i++) moa[i]   = vector_pars[1][i];
+    }
+};
+
+
+class DEBderi {
+	// the parameters were originally in a structure.
+	// this has been converted into a plain structure for easieness and performance
+	deb_pars p;                                // parameters of the model
+    double ci;                                 // external concentration that apparently is a double
+    const double* ev_t;                        // times of the exposure events (owned by the caller)
+    const double* ev_c;                        // concentration at each event
+    const double* ev_s;                        // slope after each event (types 1 and 4)
+    const double* ev_c2;                       // quadratic coefficient after each event (type 1)
+    const double* ev_c3;                       // cubic coefficient after each event (type 1)
+    size_t n_ev;                               // number of events
+    double kc;                                 // disappearance rate (type 3)
+    int int_type;                              // type of scenario (1 for spline, 2 for constant, 3 for renewal, 4 for linear interpolation)
+    double timevar[2];                         // 2 element array telling if we have a variable profile or not
+    mutable size_t cursor = 0;                 // interval found in the last call to read_scen
+    bool m_closed;                             // the closed-form solution can apply (see advance_analytic)
+    bool m_effects;                            // damage above zb has effects on the energy budget
+
+    // Exponentials of advance_closed for the last step size. The time grid
+    // is nearly uniform (up to rounding in the spacing), so they can mostly
+    // be reused.
+    struct step_exp
+    {
+        double dt = -1;
+        double e_kd, e_rB;        // expm1_ratio of kd and rB
+        double s_hb;              // survival from the background hazard (a=1)
+    };
+    mutable step_exp m_step;
+
+    // The right-hand side used by operator(), selected once in the
+    // constructor (see select_rhs)
+    typedef void (DEBderi::*rhs_type)(state_type &x, state_type &dxdt, const double t) const;
+    rhs_type m_rhs;
+    
+	public:
+		DEBderi(const deb_pars& pars,
+                const scenario_type& scen) : p(pars), // initializer list (scen must outlive this object)
+                                             ci(scen.conc),
+                                             ev_t(scen.Tev.data()),
+                                             ev_c(scen.ev_c.data()),
+                                             ev_s(scen.ev_s.data()),
+                                             ev_c2(scen.ev_c2.data()),
+                                             ev_c3(scen.ev_c3.data()),
+                                             n_ev(scen.ev_c.size()),
+                                             kc(scen.kc),
+                                             int_type(scen.int_type){
+            timevar[0] = scen.timevar[0];
+            timevar[1] = scen.timevar[1];
+            m_rhs = select_rhs();
+            m_closed = p.feedb[0] == 0 && p.feedb[1] == 0 && p.feedb[2] == 0 && p.feedb[3] == 0
+                       && !(p.Lf > 0) && !(p.Lj > 0)
+                       && ((int)timevar[0] != 1 || int_type == 2 || int_type == 4);
+            m_effects = p.bb != 0 && (p.moa[0] != 0 || p.moa[1] != 0 || p.moa[2] != 0 || p.moa[3] != 0 || p.moa[4] != 0);
+        }
+
+        // Tell read_scen which part of the scenario table we're in (as
+        // glo.timevar(2) in call_deri.m for break_time=1)
+        void set_interval(int ind_Tev){
+            timevar[1] = ind_Tev;
+        }
+
+		void operator() ( state_type &x , state_type &dxdt , const double t ) // not declaring x as constant otherwise bad?
+		{
+            (this->*m_rhs)(x, dxdt, t);
+        }
+
+        // The derivatives for any configuration of the model. This is used
+        // when there is no specialised version (see rhs_config).
+		void rhs_general( state_type &x , state_type &dxdt , const double t ) const
+		{
+			/* insert all the derivatives from the DEB model */
+            // unpack parameters. They will need to be passed in the same
+            // order by the main function. Unless we generate a new structure
+            // we will not have the name of the fields available
+
+            // The parameters are passed through a C++ vector to this class
+            // in order to increase speed. Reading the MATLAB object in the
+            // class with the derivatives would be to heavy
+            double FBV = p.FBV;
+            double KRV = p.KRV;     // part. coeff. repro buffer and structure (kg/kg)
+            double kap = p.kap;     // approximation for kappa (-)
+            double yP  = p.yP;      // product of yVA and yAV (-)
+
+            double L0   = p.L0;   // body length at start (mm)
+            double Lp   = p.Lp;   // body length at puberty (mm)
+            double Lm   = p.Lm;   // maximum body length (mm)
+            double rB   = p.rB;   // von Bertalanffy growth rate constant (1/d)
+            double Rm   = p.Rm;   // maximum reproduction rate (#/d)
+            double f    = p.f;    // scaled functional response (-)
+            double hb   = p.hb;   // background hazard rate (d-1)
+ 
+            // unpack extra parameters for specific cases
+            double Lf   = p.Lf;   // body length at half-saturation feeding (mm)
+            double Tlag = p.Tlag; // lag time for start development (d)
+            // unpack model parameters for the response to toxicants
+            double kd   = p.kd;   // dominant rate constant (d-1)
+            double zb   = p.zb;   // effect threshold energy budget ([C])
+            double bb   = p.bb;   // effect strength energy-budget effects (1/[C])
+            double zs   = p.zs;   // effect threshold survival ([C])
+            double bs   = p.bs;   // effect strength survival (1/([C] d))
+
+            double Lj = p.Lj; // length at metamorphosis (for abj models) No need for Daphnia
+            double Lm_ref = p.Lm_ref;
+			double MF = p.MF;
+			double a = p.a;
+			
+			if (a != 1){
+			    hb = a * std::pow(hb,a) * std::pow(t,(a-1)); // option for Weibull mortalty when a is not 1
+			}
+
+            double feedbacks[4] = {p.feedb[0], p.feedb[1], p.feedb[2], p.feedb[3]};
+            const double* moa = p.moa;
+
+            // initial conditions read from the input and set so that they
+            // do not become negative (as in original code)
+            x[0]=std::max(x[0],0.);
+            x[1]=std::max(x[1],0.);
+            x[2]=std::max(x[2],0.);
+            x[3]=std::max(x[3],0.);
+            
+            double c=ci;  // concentration or concentration scenario
+            
+            // only in case we have variable concentrations
+			if ((int)timevar[0] == 1){
+                c = read_scen(ci, t, MF); // for time varying concentrations
+            }
+
+            x[1] = std::max(1e-3 * L0, x[1]);
+            
+            if (Lf > 0){
+                f = f / (1 + (Lf * Lf * Lf)/(x[1] * x[1] * x[1])); // hyperbolic relationship for f with body volume
+            }
+            if (Lj > 0) {// to include acceleration until metamorphosis ...
+                f = f * std::min(1.,x[1]/Lj); // this implies lower f for L<Lj
+            }
+            
+            double s = bb*std::max(0.,x[0]-zb); // stress level for metabolic effects
+            double h = bs*std::max(0.,x[0]-zs); // hazard rate for effects on survival
+			
+			h = std::min(111.,h);  // maximise the hazard rate to 99% mortality in 1 hour
+			// Note: this helps in extreme conditions, as the system becomes stiff for
+            // very high hazard rates. This is especially needed for EPx calculations,
+            // where the MF is increased until there is effect on all endpoints!
+            
+            // 5 MODE OF ACTION
+            double sA = std::min(1.,moa[0] * s); // assimilation/feeding (maximise to 1 to avoid negative values for 1-sA)
+            double sM = moa[1] * s;              // maintenance (somatic and maturity)
+            double sG = moa[2] * s;              // growth costs
+            double sR = moa[3] * s;              // reproduction costs
+            double sH = moa[4] * s;              // also include hazard to reproduction
+
+            dxdt[1] = rB * ((1+sM)/(1+sG)) * (f*Lm*((1-sA)/(1+sM)) - x[1]); // ODE for body length
+            
+            double fR = f; // if there is no starvation, f for reproduction is the standard f
+            // starvation rules can modify the outputs here
+            if (dxdt[1] < 0){ // then we are looking at starvation and need to correct things
+                fR = (f - kap * (x[1]/Lm) * ((1+sM)/(1-sA)))/(1-kap); // new f for reproduction alone
+                if (fR >= 0){  // then we are in the first stage of starvation: 1-kappa branch can help pay maintenance
+                    dxdt[1] = 0; // stop growth, but don't shrink
+                } else {        // we are in stage 2 of starvation and need to shrink to pay maintenance
+                    fR = 0; // nothing left for reproduction
+                    dxdt[1] = (rB*(1+sM)/yP) * ((f*Lm/kap)*((1-sA)/(1+sM)) - x[1]); // shrinking rate
+                }
+            }
+
+            double R  = 0; // reproduction rate is zero, unless ... 
+            if (x[1] >= Lp){ // if we are above the length at puberty, reproduce
+                //R = std::max(0.,(Rm/(1+sR)) * (fR*Lm*(x[1]*x[1])*(1-sA) - (Lp*Lp*Lp)*(1+sM))/(Lm*Lm*Lm - Lp*Lp*Lp));
+                R = std::max(0.,(exp(-sH)*Rm/(1+sR)) * (fR*Lm*(x[1]*x[1])*(1-sA) - (Lp*Lp*Lp)*(1+sM))/(Lm*Lm*Lm - Lp*Lp*Lp));
+            }
+            dxdt[2] = R;                 // cumulative reproduction rate
+            dxdt[3]  = -(h + hb) * x[3]; // change in survival probability (incl. background mort.)
+
+            // For the damage dynamics, there are four feedback factors x* that obtain a
+            // value based on the settings in the configuration vector glo.feedb: a
+            // vector with switches for various feedbacks: [surface:volume on uptake,
+            // surface:volume on elimination, growth dilution, losses with
+            // reproduction].
+
+            // this operation has to be handled with care
+            // element-wise product
+            feedbacks[0] = feedbacks[0] * Lm_ref/x[1];
+            feedbacks[1] = feedbacks[1] * Lm_ref/x[1];
+            feedbacks[2] = feedbacks[2] * (3/x[1])*dxdt[1];
+            feedbacks[3] = feedbacks[3] * R*FBV*KRV;
+            
+            //double xu = std::max(1.,feedbacks[0]); // if switch for surf:vol scaling is zero, the factor must be 1 and not 0!
+            //double xe = std::max(1.,feedbacks[1]); // if switch for surf:vol scaling is zero, the factor must be 1 and not 0!
+            double xu = feedbacks[0];
+            if (feedbacks[0] == 0) {xu = 1;}
+            double xe = feedbacks[1];
+            if (feedbacks[1] == 0) {xe = 1;}
+            double xG = feedbacks[2];              // factor for growth dilution
+            double xR = feedbacks[3];              // factor for losses with repro
+
+            xG = std::max(0.,xG); 
+            // NOTE NOTE: reverse growth dilution (concentration by shrinking) is now
+            // turned OFF as it leads to runaway situations that lead to failure of the
+            // ODE solvers. However, this needs some further thought!
+            dxdt[0] = kd * (xu * c - xe * x[0]) - (xG + xR) * x[0]; // ODE for scaled damage
+
+            if (x[1] <= 0.5 * L0){ // if an animal has size less than half the start size ...
+                dxdt[1] = 0.; // don't let it grow or shrink any further (to avoid numerical issues)
+            }
+            
+            if (t<Tlag){
+                //derivatives are non-zero only if time is greater than Tlag
+                dxdt[0] = 0;
+                dxdt[1] = 0;
+                dxdt[2] = 0;
+                dxdt[3] = 0;
+            }
+	    }
+
+        // The derivatives of rhs_general, for one configuration known at
+        // compile time: a single pMoA (MOA is its index in glo.moa), the
+        // feedbacks that are switched on (bit i of FB for glo.feedb(i+1)),
+        // the exposure (0 for constant, otherwise the type of the
+        // time-varying scenario) and the Weibull background hazard (WB for
+        // a~=1). The terms of the other pMoAs and feedbacks are zero, and
+        // are left out; the remaining operations are the same as in
+        // rhs_general, so that both give the same result.
+        template< int MOA , unsigned FB , int EXPO , bool WB >
+        void rhs_config( state_type &x , state_type &dxdt , const double t ) const
+        {
+            const double L0 = p.L0, Lp = p.Lp, Lm = p.Lm, rB = p.rB, Rm = p.Rm, kap = p.kap, yP = p.yP;
+            double f  = p.f;
+            double hb = p.hb;
+            if (WB){
+                hb = p.a * std::pow(hb,p.a) * std::pow(t,(p.a-1)); // Weibull mortality
+            }
+
+            x[0]=std::max(x[0],0.);
+            x[1]=std::max(x[1],0.);
+            x[2]=std::max(x[2],0.);
+            x[3]=std::max(x[3],0.);
+
+            double c = ci;
+            if (EXPO != 0){
+                c = read_scen_type<EXPO>(t, p.MF);
+            }
+
+            x[1] = std::max(1e-3 * L0, x[1]);
+            if (p.Lf > 0){
+                f = f / (1 + (p.Lf * p.Lf * p.Lf)/(x[1] * x[1] * x[1]));
+            }
+            if (p.Lj > 0) {
+                f = f * std::min(1.,x[1]/p.Lj);
+            }
+
+            const double s = p.bb*std::max(0.,x[0]-p.zb);
+            double h = p.bs*std::max(0.,x[0]-p.zs);
+            h = std::min(111.,h);
+
+            const double sA = (MOA == 0) ? std::min(1.,p.moa[0] * s) : 0.;
+            const double sM = (MOA == 1) ? p.moa[1] * s : 0.;
+            const double sG = (MOA == 2) ? p.moa[2] * s : 0.;
+            const double sR = (MOA == 3) ? p.moa[3] * s : 0.;
+            const double sH = (MOA == 4) ? p.moa[4] * s : 0.;
+
+            dxdt[1] = rB * ((1+sM)/(1+sG)) * (f*Lm*((1-sA)/(1+sM)) - x[1]);
+
+            double fR = f;
+            if (dxdt[1] < 0){
+                fR = (f - kap * (x[1]/Lm) * ((1+sM)/(1-sA)))/(1-kap);
+                if (fR >= 0){
+                    dxdt[1] = 0;
+                } else {
+                    fR = 0;
+                    dxdt[1] = (rB*(1+sM)/yP) * ((f*Lm/kap)*((1-sA)/(1+sM)) - x[1]);
+                }
+            }
+
+            double R = 0;
+            if (x[1] >= Lp){
+                const double eH = (MOA == 4) ? exp(-sH) : 1.;
+                R = std::max(0.,(eH*Rm/(1+sR)) * (fR*Lm*(x[1]*x[1])*(1-sA) - (Lp*Lp*Lp)*(1+sM))/(Lm*Lm*Lm - Lp*Lp*Lp));
+            }
+            dxdt[2] = R;
+            dxdt[3] = -(h + hb) * x[3];
+
+            const double xu = (FB & 1) ? p.feedb[0] * p.Lm_ref/x[1] : 1.;
+            const double xe = (FB & 2) ? p.feedb[1] * p.Lm_ref/x[1] : 1.;
+            const double xG = (FB & 4) ? std::max(0.,p.feedb[2] * (3/x[1])*dxdt[1]) : 0.;
+            const double xR = (FB & 8) ? p.feedb[3] * R*p.FBV*p.KRV : 0.;
+            if (FB & 12){
+                dxdt[0] = p.kd * (xu * c - xe * x[0]) - (xG + xR) * x[0];
+            }
+            else{
+                dxdt[0] = p.kd * (xu * c - xe * x[0]);
+            }
+
+            if (x[1] <= 0.5 * L0){
+                dxdt[1] = 0.;
+            }
+            if (t<p.Tlag){
+                dxdt[0] = 0;
+                dxdt[1] = 0;
+                dxdt[2] = 0;
+                dxdt[3] = 0;
+            }
+        }
+
+        // Select the right-hand side for the parameters and the scenario of
+        // this object, once: rhs_config when there is a single pMoA and a
+        // known type of exposure, and rhs_general otherwise (e.g., for
+        // several pMoAs at once). The feedbacks, the exposure and the
+        // Weibull hazard are turned into template arguments one at a time.
+        rhs_type select_rhs() const
+        {
+            int moa = -1;
+            for (int i = 0; i < 5; i++){
+                if (p.moa[i] != 0){
+                    if (moa != -1) return &DEBderi::rhs_general; // more than one pMoA
+                    moa = i;
+                }
+            }
+            unsigned fb = 0;
+            for (int i = 0; i < 4; i++){
+                if (p.feedb[i] != 0) fb |= 1u << i;
+            }
+            int expo = ((int)timevar[0] == 1) ? int_type : 0; // 0 for constant exposure
+            if (moa == -1 || ((int)timevar[0] == 1 && (expo < 1 || expo > 4))){
+                return &DEBderi::rhs_general;
+            }
+            switch (moa){
+                case 0: return select_fb<0>(fb, expo, std::integral_constant<unsigned,0>());
+                case 1: return select_fb<1>(fb, expo, std::integral_constant<unsigned,0>());
+                case 2: return select_fb<2>(fb, expo, std::integral_constant<unsigned,0>());
+                case 3: return select_fb<3>(fb, expo, std::integral_constant<unsigned,0>());
+                default: return select_fb<4>(fb, expo, std::integral_constant<unsigned,0>());
+            }
+        }
+
+        template< int MOA , unsigned FB >
+        rhs_type select_fb(unsigned fb, int expo, std::integral_constant<unsigned,FB>) const
+        {
+            if (fb != FB){
+                return select_fb<MOA>(fb, expo, std::integral_constant<unsigned,FB+1>());
+            }
+            switch (expo){
+                case 0:  return select_wb<MOA,FB,0>();
+                case 1:  return select_wb<MOA,FB,1>();
+                case 2:  return select_wb<MOA,FB,2>();
+                case 3:  return select_wb<MOA,FB,3>();
+                default: return select_wb<MOA,FB,4>();
+            }
+        }
+
+        template< int MOA >
+        rhs_type select_fb(unsigned, int, std::integral_constant<unsigned,16>) const
+        {
+            return &DEBderi::rhs_general; // not reached: there are four feedbacks
+        }
+
+        template< int MOA , unsigned FB , int EXPO >
+        rhs_type select_wb() const
+        {
+            if (p.a != 1) return &DEBderi::rhs_config<MOA,FB,EXPO,true>;
+            return &DEBderi::rhs_config<MOA,FB,EXPO,false>;
+        }
+
+        // (1-exp(-r*d))/r, which is d for r=0
+        static double expm1_ratio(double r, double d){
+            return (r == 0) ? d : -std::expm1(-r*d)/r;
+        }
+
+        // Advance the state x from t0 towards t1 with the closed-form
+        // solution (for glo.stiff(1)=3), and return the time reached.
+        // Without feedbacks, with f independent of length (Lf and Lj zero),
+        // and with an exposure that is constant or linear in time (constant
+        // exposure, or types 2 and 4 between two events), scaled damage
+        // follows a linear ODE. As long as the damage stays at or below zb
+        // (or there are no effects on the energy budget), length follows
+        // von Bertalanffy growth, and reproduction and survival follow from
+        // the integrals of length squared and of the hazard rate. When the
+        // damage reaches zb (or the maximum hazard rate) within the step,
+        // the state is advanced to just before that crossing, so that the
+        // ODE solver starts at the kink. It returns t0, with x unchanged,
+        // when the closed form does not apply at all (an event or Tlag
+        // within the step, starvation, or effects from the start).
+        double advance_analytic(state_type &x, const double t0, const double t1, std::vector<double> &TE) const
+        {
+            double tau_lim = 0, tau_tmp;
+            if (advance_closed(x, t0, t1, TE, tau_lim)){
+                return t1;
+            }
+            if (tau_lim > 0 && advance_closed(x, t0, t0 + tau_lim, TE, tau_tmp)){
+                return t0 + tau_lim;
+            }
+            return t0;
+        }
+
+        // The closed-form solution of advance_analytic over the whole step
+        // from t0 to t1. The crossings of the event functions are added to
+        // TE, as in integrate_times_events. When it does not apply, it
+        // returns false with x unchanged, and tau_lim is the time from t0
+        // up to which it would (0 if none).
+        bool advance_closed(state_type &x, const double t0, const double t1, std::vector<double> &TE, double &tau_lim) const
+        {
+            tau_lim = 0;
+            if (t1 <= p.Tlag){
+                return true; // derivatives are zero before the lag time
+            }
+            if (t0 < p.Tlag || !m_closed){
+                return false;
+            }
+
+            // exposure c0 + m*tau, with tau the time since t0
+            double c0 = ci, m = 0;
+            if ((int)timevar[0] == 1){
+                size_t ii = (timevar[1] > 0) ? (size_t)timevar[1]-1 : locate_event(t0);
+                if (timevar[1] <= 0 && ii+1 < n_ev && ev_t[ii+1] < t1 && ev_t[ii+1] > t0){
+                    return false; // an exposure event within the step
+                }
+                c0 = read_scen(ci, t0, p.MF);
+                if (int_type == 4){
+                    m = ev_s[ii] * p.MF;
+                }
+            }
+            const double dt = t1 - t0;
+            if (c0 < 0 || c0 + m * dt < 0){
+                return false;
+            }
+
+            // length (von Bertalanffy, no starvation)
+            const double A = p.f * p.Lm, La = x[1], rB = p.rB;
+            if (La > A || La <= 0.5 * p.L0 || La < 1e-3 * p.L0){
+                return false;
+            }
+
+            // scaled damage, its integral, and its extremes within the step
+            const double kd = p.kd, D0 = x[0];
+            auto damage = [&](double tau){
+                const double e = expm1_ratio(kd, tau);
+                return D0 + (c0 - D0) * kd * e + m * (tau - e);
+            };
+            auto damage_int = [&](double tau){ // integral of damage from 0 to tau
+                const double e = expm1_ratio(kd, tau);
+                double q; // integral of (u - expm1_ratio(kd,u)) from 0 to tau
+                if (kd * tau < 1e-3){
+                    q = kd * tau*tau*tau/6 * (1 - kd * tau/4 * (1 - kd * tau/5));
+                }
+                else{
+                    q = tau*tau/2 - (tau - e)/kd;
+                }
+                return D0 * tau + (c0 - D0) * (tau - e) + m * q;
+            };
+            double tau_st = -1; // time of the extreme in the damage (if within the step)
+            const double den = m - kd * (c0 - D0);
+            if (kd > 0 && den != 0){
+                const double e_st = m / den; // exp(-kd*tau) at the extreme
+                if (e_st > 0 && e_st < 1){
+                    tau_st = -std::log(e_st) / kd;
+                    if (tau_st >= dt) tau_st = -1;
+                }
+            }
+            // for a step that differs from the last one by rounding only, a
+            // first-order correction of the exponentials is exact
+            double delta = dt - m_step.dt;
+            if (std::fabs(delta) > 1e-9 * dt){
+                m_step.dt   = dt;
+                m_step.e_kd = expm1_ratio(kd, dt);
+                m_step.e_rB = expm1_ratio(p.rB, dt);
+                m_step.s_hb = std::exp(-p.hb * dt);
+                delta = 0;
+            }
+            const double e_kd  = m_step.e_kd + (1 - kd * m_step.e_kd) * delta;
+            const double e_rB  = m_step.e_rB + (1 - p.rB * m_step.e_rB) * delta;
+            const double e_2rB = e_rB * (2 - p.rB * e_rB) / 2; // expm1_ratio of 2*rB
+            const double s_hb  = m_step.s_hb * (1 - p.hb * delta);
+            const double D1 = D0 + (c0 - D0) * kd * e_kd + m * (dt - e_kd);
+            const double D_st = (tau_st > 0) ? damage(tau_st) : D1;
+            const double Dmax = std::max(std::max(D0, D1), D_st);
+            const double Dmin = std::min(std::min(D0, D1), D_st);
+
+            // crossings of level z by the damage (the damage is monotonous
+            // on both sides of tau_st), located by bisection to the same
+            // precision as in integrate_times_events; just past each
+            // crossing, or just before it for before=true
+            auto crossings = [&](double z, std::vector<double>& tau_cross, bool before){
+                if (!(Dmin < z && z < Dmax)) return;
+                double pts[3] = {0, tau_st, dt};
+                double g_a = D0 - z;
+                for (int j = (tau_st > 0) ? 1 : 2, i_a = 0; j < 3; i_a = j, j++){
+                    double a = pts[i_a], b = pts[j];
+                    double g_b = ((j == 2) ? D1 : D_st) - z;
+                    if (g_a * g_b < 0){
+                        const double g_0 = g_a;
+                        while (b - a > 1e-10 * std::max(1., std::fabs(t0 + b))){
+                            double mid = (a + b) / 2;
+                            if ((damage(mid) - z) * g_0 > 0) a = mid; else b = mid;
+                        }
+                        tau_cross.push_back(before ? a : b);
+                    }
+                    g_a = g_b;
+                }
+            };
+
+            const double D_cap = p.zs + 111./p.bs; // damage at the maximum hazard rate
+            if ((m_effects && Dmax > p.zb) || (p.bs > 0 && Dmax > D_cap)){
+                std::vector<double> tau_cross;
+                if (m_effects && D0 < p.zb) crossings(p.zb, tau_cross, true);
+                if (p.bs > 0 && D0 < D_cap) crossings(D_cap, tau_cross, true);
+                if (!tau_cross.empty()){
+                    tau_lim = *std::min_element(tau_cross.begin(), tau_cross.end());
+                }
+                return false;
+            }
+
+            std::vector<double> t_ev, tau_zs;
+            crossings(p.zb, t_ev, false);
+            crossings(p.zs, tau_zs, false);
+            t_ev.insert(t_ev.end(), tau_zs.begin(), tau_zs.end());
+
+            // reproduction from the time that length reaches Lp
+            const double L1 = La + (A - La) * rB * e_rB;
+            double R = 0;
+            if (L1 >= p.Lp){
+                const double B = A - La;
+                double intL2 = A*A*dt - 2*A*B*e_rB + B*B*e_2rB, d = dt;
+                if (La < p.Lp){ // puberty within the step
+                    double tau_p = std::log((A - La)/(A - p.Lp)) / rB;
+                    tau_p = std::min(std::max(tau_p, 0.), dt);
+                    t_ev.push_back(tau_p);
+                    d = dt - tau_p;
+                    const double ep = std::exp(-rB * tau_p);
+                    intL2 = A*A*d - 2*A*B*ep*expm1_ratio(rB, d) + B*B*ep*ep*expm1_ratio(2*rB, d);
+                }
+                const double Lp3 = p.Lp * p.Lp * p.Lp;
+                R = std::max(0., p.Rm * (A * intL2 - Lp3 * d)/(p.Lm*p.Lm*p.Lm - Lp3));
+            }
+
+            // survival: background hazard, and the hazard for the parts of
+            // the step with the damage above zs
+            double H = (p.a != 1) ? std::pow(p.hb,p.a) * (std::pow(t1,p.a) - std::pow(t0,p.a)) : 0.;
+            if (p.bs != 0 && Dmax > p.zs){
+                double a = 0;
+                for (size_t j = 0; j <= tau_zs.size(); j++){
+                    double b = (j < tau_zs.size()) ? tau_zs[j] : dt;
+                    if (b > a && (tau_zs.empty() || damage((a + b)/2) > p.zs)){
+                        H += p.bs * (damage_int(b) - damage_int(a) - p.zs * (b - a));
+                    }
+                    a = b;
+                }
+            }
+
+            std::sort(t_ev.begin(), t_ev.end());
+            for (double tau : t_ev){
+                TE.push_back(t0 + tau);
+            }
+            x[0] = D1;
+            x[1] = L1;
+            x[2] = x[2] + R;
+            x[3] = x[3] * ((p.a != 1) ? 1. : s_hb) * ((H != 0) ? std::exp(-H) : 1.);
+            return true;
+        }
+
+        // First exposure event or lag time after t (where the closed form of
+        // advance_analytic needs a new start), or infinity
+        double next_switch(double t) const
+        {
+            double t_sw = (p.Tlag > t) ? p.Tlag : INFINITY;
+            if ((int)timevar[0] == 1 && timevar[1] <= 0){
+                const double* it = std::upper_bound(ev_t, ev_t + n_ev, t);
+                if (it != ev_t + n_ev) t_sw = std::min(t_sw, *it);
+            }
+            return t_sw;
+        }
+
+        // Analytic Jacobian of the system in operator(), for the implicit
+        // (Rosenbrock) solver. J[i][j] is the derivative of dxdt[i] with
+        // respect to x[j], and dfdt the explicit derivative with respect to
+        // time (from the exposure scenario and the Weibull background
+        // hazard). The same branches are followed as in operator(); at the
+        // switches themselves (thresholds, starvation, puberty) the
+        // derivative of the active branch is used.
+        void jacobian(const state_type &x_in, double J[4][4], const double t, double dfdt[4])
+        {
+            double FBV = p.FBV;
+            double KRV = p.KRV;
+            double kap = p.kap;
+            double yP  = p.yP;
+            double L0  = p.L0;
+            double Lp  = p.Lp;
+            double Lm  = p.Lm;
+            double rB  = p.rB;
+            double Rm  = p.Rm;
+            double f   = p.f;
+            double hb  = p.hb;
+            double Lf  = p.Lf;
+            double Tlag = p.Tlag;
+            double kd  = p.kd;
+            double zb  = p.zb;
+            double bb  = p.bb;
+            double zs  = p.zs;
+            double bs  = p.bs;
+            double Lj  = p.Lj;
+            double Lm_ref = p.Lm_ref;
+            double MF  = p.MF;
+            double a   = p.a;
+
+            for (int i = 0; i < 4; i++){
+                dfdt[i] = 0;
+                for (int j = 0; j < 4; j++){
+                    J[i][j] = 0;
+                }
+            }
+            if (t<Tlag){ // no change before the lag time
+                return;
+            }
+
+            double dhbdt = 0; // time derivative of the Weibull background hazard
+            if (a != 1 && t > 0){
+                dhbdt = a * (a-1) * std::pow(hb,a) * std::pow(t,(a-2));
+            }
+            hb = a * std::pow(hb,a) * std::pow(t,(a-1));
+
+            double D = std::max(x_in[0],0.);
+            double L = std::max(x_in[1],0.);
+            double S = std::max(x_in[3],0.);
+            double dLL = 1; // derivative of the bounded L with respect to the state
+            if (L < 1e-3 * L0){
+                L = 1e-3 * L0;
+                dLL = 0;
+            }
+
+            double c = ci, dcdt = 0;
+            if ((int)timevar[0] == 1){
+                c = read_scen(ci, t, MF);
+                dcdt = read_scen_slope(c, t, MF);
+            }
+
+            double dfdL = 0; // derivative of f with respect to L
+            if (Lf > 0){
+                double q = 1 + (Lf * Lf * Lf)/(L * L * L);
+                dfdL = f * 3 * (Lf * Lf * Lf)/(L * L * L * L)/(q * q);
+                f = f / q;
+            }
+            if (Lj > 0 && L < Lj) {
+                dfdL = dfdL * L/Lj + f/Lj;
+                f = f * L/Lj;
+            }
+            dfdL = dfdL * dLL;
+
+            double s   = bb*std::max(0.,D-zb);
+            double dsD = (D > zb) ? bb : 0.;
+            double h   = bs*std::max(0.,D-zs);
+            double dhD = (D > zs) ? bs : 0.;
+            if (h > 111.){
+                h = 111.;
+                dhD = 0;
+            }
+
+            double sA = std::min(1.,p.moa[0] * s);
+            double dsA = (p.moa[0] * s < 1.) ? p.moa[0] * dsD : 0.;
+            double sM = p.moa[1] * s, dsM = p.moa[1] * dsD;
+            double sG = p.moa[2] * s, dsG = p.moa[2] * dsD;
+            double sR = p.moa[3] * s, dsR = p.moa[3] * dsD;
+            double sH = p.moa[4] * s, dsH = p.moa[4] * dsD;
+
+            // body length: dL = rB/(1+sG) * (f*Lm*(1-sA) - (1+sM)*L)
+            double gL  = f*Lm*(1-sA) - (1+sM)*L;
+            double dL  = rB/(1+sG) * gL;
+            double dLdL = rB/(1+sG) * (dfdL*Lm*(1-sA) - (1+sM)*dLL);
+            double dLdD = rB * (-dsG/((1+sG)*(1+sG)) * gL + (-f*Lm*dsA - dsM*L)/(1+sG));
+
+            double fR = f, dfRdL = dfdL, dfRdD = 0;
+            if (dL < 0){ // starvation
+                double q   = (1+sM)/(1-sA);
+                double dqD = (dsM*(1-sA) + (1+sM)*dsA)/((1-sA)*(1-sA));
+                fR = (f - kap * (L/Lm) * q)/(1-kap);
+                if (fR >= 0){ // first stage: stop growth, but don't shrink
+                    dfRdL = (dfdL - kap * q * dLL/Lm)/(1-kap);
+                    dfRdD = -kap * (L/Lm) * dqD/(1-kap);
+                    dL = 0;
+                    dLdL = 0;
+                    dLdD = 0;
+                } else {      // second stage: shrinking
+                    fR = 0;
+                    dfRdL = 0;
+                    dfRdD = 0;
+                    dL   = (rB/yP) * (f*Lm*(1-sA)/kap - (1+sM)*L);
+                    dLdL = (rB/yP) * (dfdL*Lm*(1-sA)/kap - (1+sM)*dLL);
+                    dLdD = (rB/yP) * (-f*Lm*dsA/kap - dsM*L);
+                }
+            }
+
+            double R = 0, dRdL = 0, dRdD = 0;
+            if (L >= Lp){
+                double A  = std::exp(-sH)*Rm/(1+sR)/(Lm*Lm*Lm - Lp*Lp*Lp);
+                double dAD = A * (-dsH - dsR/(1+sR));
+                double B  = fR*Lm*(L*L)*(1-sA) - (Lp*Lp*Lp)*(1+sM);
+                if (A*B > 0){
+                    R = A*B;
+                    double dBD = dfRdD*Lm*(L*L)*(1-sA) - fR*Lm*(L*L)*dsA - (Lp*Lp*Lp)*dsM;
+                    double dBL = dfRdL*Lm*(L*L)*(1-sA) + 2*fR*Lm*L*(1-sA)*dLL;
+                    dRdD = dAD*B + A*dBD;
+                    dRdL = A*dBL;
+                }
+            }
+
+            // scaled damage with the feedbacks
+            const double* fb = p.feedb;
+            double xu = (fb[0] == 0) ? 1. : fb[0] * Lm_ref/L;
+            double dxuL = (fb[0] == 0) ? 0. : -fb[0] * Lm_ref/(L*L) * dLL;
+            double xe = (fb[1] == 0) ? 1. : fb[1] * Lm_ref/L;
+            double dxeL = (fb[1] == 0) ? 0. : -fb[1] * Lm_ref/(L*L) * dLL;
+            double xG = fb[2] * (3/L) * dL, dxGL = 0, dxGD = 0;
+            if (xG > 0){
+                dxGL = fb[2] * 3 * (dLdL/L - dL*dLL/(L*L));
+                dxGD = fb[2] * (3/L) * dLdD;
+            } else {
+                xG = 0;
+            }
+            double xR = fb[3] * R * FBV * KRV;
+            double dxRL = fb[3] * dRdL * FBV * KRV;
+            double dxRD = fb[3] * dRdD * FBV * KRV;
+
+            J[0][0] = -kd * xe - (xG + xR) - D * (dxGD + dxRD);
+            J[0][1] = kd * (dxuL * c - dxeL * D) - D * (dxGL + dxRL);
+            dfdt[0] = kd * xu * dcdt;
+
+            if (x_in[1] > 0.5 * L0){ // otherwise length does not change
+                J[1][0] = dLdD;
+                J[1][1] = dLdL;
+            }
+
+            J[2][0] = dRdD;
+            J[2][1] = dRdL;
+
+            J[3][0] = -dhD * S;
+            J[3][3] = -(h + hb);
+            dfdt[3] = -dhbdt * S;
+        }
+
+        // Analytic derivatives of the system in operator() with respect to
+        // the parameter at location loc in scalar_pars (see deb_pars), for
+        // the forward sensitivities (DEBsens). Each quantity q of
+        // operator() is paired with its derivative d_q, following the same
+        // branches as in jacobian. The lag time is left out (zero): it only
+        // shifts the start, which is handled by DEBsens::lag_jump.
+        void param_derivatives(const state_type &x_in, const double t, const size_t loc, double dfdp[4]) const
+        {
+            for (int i = 0; i < 4; i++){
+                dfdp[i] = 0;
+            }
+            if (t<p.Tlag || loc == 12){
+                return;
+            }
+            auto e = [loc](size_t i){ return (loc == i) ? 1. : 0.; }; // seed for the parameter
+            const double d_FBV = e(0), d_KRV = e(1), d_kap = e(2), d_yP = e(3);
+            const double d_L0 = e(4), d_Lp = e(5), d_Lm = e(6), d_rB = e(7);
+            const double d_Rm = e(8), d_f0 = e(9), d_hb0 = e(10), d_Lf = e(11);
+            const double d_kd = e(13), d_zb = e(14), d_bb = e(15), d_zs = e(16);
+            const double d_bs = e(17), d_Lj = e(18), d_Lm_ref = e(19), d_MF = e(20), d_a = e(21);
+
+            const double kap = p.kap, yP = p.yP, Lp = p.Lp, Lm = p.Lm, rB = p.rB, Lf = p.Lf, Lj = p.Lj;
+
+            // background hazard (Weibull for a~=1, which is smooth in a)
+            double hb = p.hb, d_hb = d_hb0;
+            if (p.a != 1){
+                hb = p.a * std::pow(p.hb,p.a) * std::pow(t,(p.a-1));
+                d_hb = (d_hb0 != 0) ? p.a * p.a * std::pow(p.hb,(p.a-1)) * std::pow(t,(p.a-1)) : 0.;
+            }
+            if (d_a != 0){
+                d_hb = (hb > 0 && t > 0) ? hb * (1/p.a + std::log(p.hb) + std::log(t)) : 0.;
+            }
+
+            const double D = std::max(x_in[0],0.);
+            double L = std::max(x_in[1],0.), d_L = 0; // the state itself does not depend on the parameter
+            const double S = std::max(x_in[3],0.);
+            if (L < 1e-3 * p.L0){
+                L = 1e-3 * p.L0;
+                d_L = 1e-3 * d_L0;
+            }
+
+            double c = ci, d_c = 0;
+            if ((int)timevar[0] == 1){
+                c = read_scen(ci, t, p.MF);
+                d_c = read_scen(ci, t, 1.) * d_MF; // the scenario is linear in MF
+            }
+
+            double f = p.f, d_f = d_f0;
+            if (Lf > 0){
+                const double q = 1 + (Lf * Lf * Lf)/(L * L * L);
+                const double d_q = 3 * (Lf * Lf)/(L * L * L) * d_Lf - 3 * (Lf * Lf * Lf)/(L * L * L * L) * d_L;
+                d_f = d_f/q - f/(q * q) * d_q;
+                f = f / q;
+            }
+            if (Lj > 0 && L < Lj){
+                d_f = d_f * L/Lj + f * d_L/Lj - f * L/(Lj * Lj) * d_Lj;
+                f = f * L/Lj;
+            }
+
+            double s = 0, d_s = 0;
+            if (D > p.zb){
+                s   = p.bb * (D - p.zb);
+                d_s = d_bb * (D - p.zb) - p.bb * d_zb;
+            }
+            double h = 0, d_h = 0;
+            if (D > p.zs){
+                h   = p.bs * (D - p.zs);
+                d_h = d_bs * (D - p.zs) - p.bs * d_zs;
+            }
+            if (h > 111.){
+                h = 111.;
+                d_h = 0;
+            }
+
+            double sA = std::min(1.,p.moa[0] * s);
+            double d_sA = (p.moa[0] * s < 1.) ? p.moa[0] * d_s : 0.;
+            double sM = p.moa[1] * s, d_sM = p.moa[1] * d_s;
+            double sG = p.moa[2] * s, d_sG = p.moa[2] * d_s;
+            double sR = p.moa[3] * s, d_sR = p.moa[3] * d_s;
+            double sH = p.moa[4] * s, d_sH = p.moa[4] * d_s;
+
+            // body length: dL = rB/(1+sG) * (f*Lm*(1-sA) - (1+sM)*L)
+            double gL   = f*Lm*(1-sA) - (1+sM)*L;
+            double d_gL = (d_f*Lm + f*d_Lm)*(1-sA) - f*Lm*d_sA - d_sM*L - (1+sM)*d_L;
+            double dL   = rB/(1+sG) * gL;
+            double d_dL = (d_rB - rB*d_sG/(1+sG)) * gL/(1+sG) + rB/(1+sG) * d_gL;
+
+            double fR = f, d_fR = d_f;
+            if (dL < 0){ // starvation
+                const double q   = (1+sM)/(1-sA);
+                const double d_q = (d_sM*(1-sA) + (1+sM)*d_sA)/((1-sA)*(1-sA));
+                fR   = (f - kap * (L/Lm) * q)/(1-kap);
+                d_fR = (d_f - d_kap * (L/Lm) * q - kap * (d_L/Lm - L*d_Lm/(Lm*Lm)) * q - kap * (L/Lm) * d_q)/(1-kap)
+                       + fR * d_kap/(1-kap);
+                if (fR >= 0){ // first stage: stop growth, but don't shrink
+                    dL = 0;
+                    d_dL = 0;
+                } else {      // second stage: shrinking
+                    fR = 0;
+                    d_fR = 0;
+                    const double g2   = f*Lm*(1-sA)/kap - (1+sM)*L;
+                    const double d_g2 = ((d_f*Lm + f*d_Lm)*(1-sA) - f*Lm*d_sA)/kap - f*Lm*(1-sA)/(kap*kap)*d_kap
+                                        - d_sM*L - (1+sM)*d_L;
+                    dL   = (rB/yP) * g2;
+                    d_dL = (d_rB/yP - rB*d_yP/(yP*yP)) * g2 + (rB/yP) * d_g2;
+                }
+            }
+
+            double R = 0, d_R = 0;
+            if (L >= Lp){
+                const double V   = Lm*Lm*Lm - Lp*Lp*Lp;
+                const double d_V = 3*Lm*Lm*d_Lm - 3*Lp*Lp*d_Lp;
+                const double A   = std::exp(-sH)*p.Rm/(1+sR)/V;
+                const double d_A = A * (-d_sH - d_sR/(1+sR) - d_V/V) + std::exp(-sH)/(1+sR)/V * d_Rm;
+                const double B   = fR*Lm*(L*L)*(1-sA) - (Lp*Lp*Lp)*(1+sM);
+                if (A*B > 0){
+                    R = A*B;
+                    const double d_B = (d_fR*Lm + fR*d_Lm)*(L*L)*(1-sA) + 2*fR*Lm*L*d_L*(1-sA) - fR*Lm*(L*L)*d_sA
+                                       - 3*(Lp*Lp)*d_Lp*(1+sM) - (Lp*Lp*Lp)*d_sM;
+                    d_R = d_A*B + A*d_B;
+                }
+            }
+
+            // scaled damage with the feedbacks
+            const double* fb = p.feedb;
+            const double xu   = (fb[0] == 0) ? 1. : fb[0] * p.Lm_ref/L;
+            const double d_xu = (fb[0] == 0) ? 0. : fb[0] * (d_Lm_ref/L - p.Lm_ref*d_L/(L*L));
+            const double xe   = (fb[1] == 0) ? 1. : fb[1] * p.Lm_ref/L;
+            const double d_xe = (fb[1] == 0) ? 0. : fb[1] * (d_Lm_ref/L - p.Lm_ref*d_L/(L*L));
+            double xG = fb[2] * (3/L) * dL, d_xG = 0;
+            if (xG > 0){
+                d_xG = fb[2] * 3 * (d_dL/L - dL*d_L/(L*L));
+            } else {
+                xG = 0;
+            }
+            const double d_xR = fb[3] * (d_R * p.FBV * p.KRV + R * d_FBV * p.KRV + R * p.FBV * d_KRV);
+
+            dfdp[0] = d_kd * (xu * c - xe * D) + p.kd * (d_xu * c + xu * d_c - d_xe * D) - (d_xG + d_xR) * D;
+            if (x_in[1] > 0.5 * p.L0){ // otherwise length does not change
+                dfdp[1] = d_dL;
+            }
+            dfdp[2] = d_R;
+            dfdp[3] = -(d_h + d_hb) * S;
+        }
+
+        // Index of the last exposure event at or before time t (as
+        // find(int_coll(:,1)<=t,1,'last') in read_scen.m). The solver moves
+        // forward in small steps, so the search starts from the interval of
+        // the previous call, and only falls back to a binary search after a
+        // jump. This keeps long exposure profiles (many events) as fast as
+        // short ones.
+        size_t locate_event(double t) const {
+            size_t i = cursor;
+            if (ev_t[i] <= t){
+                if (i+1 == n_ev || t < ev_t[i+1]) return i;             // same interval
+                if (i+2 == n_ev || t < ev_t[i+2]) return cursor = i+1;  // next interval
+            }
+            size_t j = std::upper_bound(ev_t, ev_t + n_ev, t) - ev_t;
+            cursor = (j > 0) ? j-1 : 0;
+            return cursor;
+        }
+
+        double read_scen(double /*c*/, double t, double MF) const {
+            // function copied from DEBtox to avoid calling matlab code from here
+            // it copied only the case with -1, the case called from the derivatives file
+			
+            // the interval is known when the time vector is broken up
+            size_t ii = (timevar[1] > 0) ? (size_t)timevar[1]-1 : locate_event(t);
+            switch (int_type){
+                case 1: // piecewise polynomial of the spline (see mex_scen.m)
+                    {
+                    double dt = t - ev_t[ii];
+                    return MF * (ev_c[ii] + dt * (ev_s[ii] + dt * (ev_c2[ii] + dt * ev_c3[ii])));
+                    }
+                case 2:
+                    return MF * ev_c[ii];
+                case 3:
+                    return MF * ev_c[ii] * exp(-kc*(t - ev_t[ii]));
+                case 4:
+                    return ev_c[ii] * MF + (t - ev_t[ii]) * ev_s[ii] * MF;
+            }
+            return 0;
+        }
+
+        // read_scen for a type of scenario known at compile time (for
+        // rhs_config)
+        template< int TYPE >
+        double read_scen_type(double t, double MF) const {
+            size_t ii = (timevar[1] > 0) ? (size_t)timevar[1]-1 : locate_event(t);
+            if (TYPE == 1){
+                double dt = t - ev_t[ii];
+                return MF * (ev_c[ii] + dt * (ev_s[ii] + dt * (ev_c2[ii] + dt * ev_c3[ii])));
+            }
+            if (TYPE == 2){
+                return MF * ev_c[ii];
+            }
+            if (TYPE == 3){
+                return MF * ev_c[ii] * exp(-kc*(t - ev_t[ii]));
+            }
+            return ev_c[ii] * MF + (t - ev_t[ii]) * ev_s[ii] * MF;
+        }
+
+        // Values of the event functions (as eventsfun in call_deri.m). Each
+        // crossing of zero is a kink in the derivatives (the max(0,x-z)
+        // switches, and the start of reproduction at Lp).
+        template< class State >
+        void events(const State &x, double value[3]) const {
+            value[0] = x[0] - p.zb; // scaled damage exceeds the effect threshold for the energy budget
+            value[1] = x[0] - p.zs; // scaled damage exceeds the effect threshold for survival
+            value[2] = x[1] - p.Lp;  // body length exceeds length at puberty
+        }
+
+        // Time derivative of the exposure concentration c at time t (as
+        // returned by read_scen), needed for the Jacobian
+        double read_scen_slope(double c, double t, double MF) const {
+            switch (int_type){
+                case 1:
+                    {
+                    size_t ii = (timevar[1] > 0) ? (size_t)timevar[1]-1 : locate_event(t);
+                    double dt = t - ev_t[ii];
+                    return MF * (ev_s[ii] + dt * (2 * ev_c2[ii] + dt * 3 * ev_c3[ii])); // derivative of the spline
+                    }
+                case 3:
+                    return -kc * c; // first-order disappearance
+                case 4:
+                    {
+                    size_t ii = (timevar[1] > 0) ? (size_t)timevar[1]-1 : locate_event(t);
+                    return ev_s[ii] * MF; // slope of the linear interpolation
+                    }
+            }
+            return 0; // constant within the interval
+        }
+};
+
+//[ integrate_observer
+// structure containing the function to store the states at each step
+struct push_back_state_and_time
+{
+    std::vector< state_type >& m_states;
+    std::vector< double >& m_times;
+
+    push_back_state_and_time( std::vector< state_type > &states , std::vector< double > &times )
+    : m_states( states ) , m_times( times ) { }
+
+    void operator()( const state_type &x , double t )
+    {
+        m_states.push_back( x );
+        m_times.push_back( t );
+    }
+
+    // version for the ublas state of the implicit stepper
+    void operator()( const boost::numeric::ublas::vector< double > &x , double t )
+    {
+        state_type xs;
+        std::copy( x.begin() , x.end() , xs.begin() );
+        m_states.push_back( xs );
+        m_times.push_back( t );
+    }
+};
+//]
+
+//[ stiff_system
+// The implicit Rosenbrock stepper of odeint works with ublas vectors and
+// matrices, so the model and its analytic Jacobian are wrapped here.
+typedef boost::numeric::ublas::vector< double > vector_type;
+typedef boost::numeric::ublas::matrix< double > matrix_type;
+
+struct DEBderi_stiff
+{
+    DEBderi m_deri;
+
+    DEBderi_stiff( const DEBderi &deri ) : m_deri( deri ) { }
+
+    void operator()( const vector_type &x , vector_type &dxdt , double t )
+    {
+        state_type xs , dxs;
+        std::copy( x.begin() , x.end() , xs.begin() );
+        m_deri( xs , dxs , t );
+        std::copy( dxs.begin() , dxs.end() , dxdt.begin() );
+    }
+};
+
+struct DEBjacobi_stiff
+{
+    DEBderi m_deri;
+
+    DEBjacobi_stiff( const DEBderi &deri ) : m_deri( deri ) { }
+
+    void operator()( const vector_type &x , matrix_type &J , const double &t , vector_type &dfdt )
+    {
+        state_type xs;
+        std::copy( x.begin() , x.end() , xs.begin() );
+        double Jm[4][4] , df[4];
+        m_deri.jacobian( xs , Jm , t , df );
+        for( size_t i=0 ; i<4 ; i++ )
+        {
+            dfdt( i ) = df[i];
+            for( size_t j=0 ; j<4 ; j++ )
+                J( i , j ) = Jm[i][j];
+        }
+    }
+};
+//]
+
+//[ time_grid
+// The time vector for the ODE solver is built in the same way as in
+// call_deri.m, so that the batched solve gives the same output as calling
+// call_deri for each scenario separately.
+struct time_grid
+{
+    std::vector<double> t;      // time vector for the ODE solver
+    std::vector<double> T;      // times of the events (intervals for break_time=1)
+    std::vector<size_t> loc;    // location of the requested time points in t
+    std::vector<size_t> loc_bp; // location of the brood-pouch time points in t (one per requested time point)
+    double initial_step;        // initial step size for the solver
+    double max_step;            // maximum step size for the solver
+};
+
+// sort a vector and remove the duplicates (as MATLAB unique)
+inline void unique_sorted(std::vector<double>& v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+// location of the value val in the sorted vector v (val must be in v)
+inline size_t locate_time(const std::vector<double>& v, double val)
+{
+    return std::lower_bound(v.begin(), v.end(), val) - v.begin();
+}
+
+inline time_grid make_time_grid(const std::vector<double>& t_req, // requested time points
+                         const std::vector<double>& Tev,   // times of the exposure events
+                         bool timevar,                     // time-varying exposure or not
+                         double Tlag,                      // lag time (par.Tlag)
+                         double Tbp,                       // brood-pouch delay (glo.Tbp)
+                         int len,                          // length switch (glo.len)
+                         bool break_time)                  // break time vector up for the solver (glo.break_time)
+{
+    time_grid g;
+    double t_end = t_req.back();
+    size_t min_t = 500; // minimum length of time vector
+
+    g.initial_step = *std::max_element(t_req.begin(), t_req.end())/100;
+    g.max_step     = *std::max_element(t_req.begin(), t_req.end())/10;
+    if (timevar){
+        // for very long exposure profiles use a larger time vector (twice
+        // the number of relevant points in the scenario)
+        size_t n_ev = std::count_if(Tev.begin(), Tev.end(), [&](const double& i){return i<t_end;});
+        min_t = std::max(min_t, 2*n_ev);
+        if (!break_time){ // when breaking the time vector, limiting step size is not needed
+            g.initial_step = t_end/(10.*min_t);
+            g.max_step     = t_end/min_t;
+        }
+    }
+
+    std::vector<double> t(t_req);
+    std::vector<double> tbp; // extra times needed to calculate brood-pouch delay
+    if (Tbp > 0){
+        for (double ti : t_req){
+            if (ti > Tbp) tbp.push_back(ti - Tbp);
+        }
+        t.insert(t.end(), tbp.begin(), tbp.end());
+        unique_sorted(t);
+    }
+
+    // when an animal cannot shrink in length, we need a long time vector
+    // to catch the maximum length over time
+    if (len == 2 && t.size() < min_t){
+        double t1 = t.front(), t2 = t.back();
+        for (size_t i = 0; i < min_t - 1; i++){
+            t.push_back(t1 + i*(t2-t1)/(min_t-1));
+        }
+        t.push_back(t2);
+        unique_sorted(t);
+    }
+
+    // time vector with events, limited to the requested time range
+    std::vector<double> T;
+    for (double ti : Tev){
+        if (ti <= t_end) T.push_back(ti);
+    }
+    if (T.empty() || T.back() < t_end){
+        T.push_back(t_end);
+    }
+    if (Tlag > 0){ // a lag time is also a switch for the solver
+        T.push_back(Tlag);
+        unique_sorted(T);
+    }
+
+    // combine T, t, and halfway-T into the new time vector
+    size_t nT = T.size();
+    t.insert(t.end(), T.begin(), T.end());
+    for (size_t i = 0; i+1 < nT; i++){
+        t.push_back((T[i]+T[i+1])/2);
+    }
+    unique_sorted(t);
+
+    for (double ti : t_req){
+        g.loc.push_back(locate_time(t, ti));
+        if (Tbp > 0 && ti > Tbp){
+            g.loc_bp.push_back(locate_time(t, ti - Tbp));
+        }
+        else{
+            g.loc_bp.push_back(t.size()); // no brood-pouch point for this time
+        }
+    }
+    g.t = t;
+    g.T = T;
+    return g;
+}
+//]
+
+//[ scenario_solver
+//[ model_handle
+// Everything from glo that stays the same during an optimisation run: the
+// configuration for feedbacks and modes of action, and the exposure
+// scenarios. A model can be registered once, after which calls refer to
+// it with a handle and pass the parameter values as a flat vector (see
+// make_parvec.m).
+struct model_type
+{
+    std::vector<std::vector<double>> vector_pars; // feedb and moa
+    std::vector<double> int_scen;                 // identifiers of the exposure scenarios
+    std::vector<table_type> int_coll;             // scenario tables
+    std::vector<int> int_type;                    // type of each scenario
+
+    // Exposure scenario for one treatment (as derived in call_deri.m)
+    scenario_type scenario(double conc) const
+    {
+        scenario_type scen;
+        scen.conc     = conc;
+        scen.timevar  = {0., 0.};
+        scen.int_type = 2;
+        scen.Tev      = {0.}; // without anything else, exposure is constant
+
+        // check on time-varying exposure scenarios
+        auto it = std::find(int_scen.begin(), int_scen.end(), conc);
+        if (it != int_scen.end()){
+            size_t int_loc = it - int_scen.begin();
+            scen.timevar[0] = 1;
+            scen.int_type   = int_type[int_loc];
+            const table_type& tab = int_coll[int_loc];
+            size_t n_ev = tab.size();
+            if (scen.int_type == 3){ // the last line contains the disappearance rate
+                n_ev--;
+                scen.kc = tab[n_ev][1];
+            }
+            scen.Tev.resize(n_ev);
+            scen.ev_c.resize(n_ev);
+            scen.ev_s.assign(n_ev, 0.);
+            scen.ev_c2.assign(n_ev, 0.);
+            scen.ev_c3.assign(n_ev, 0.);
+            for (size_t i = 0; i < n_ev; i++){
+                scen.Tev[i]  = tab[i][0];
+                scen.ev_c[i] = tab[i][1];
+                if (tab[i].size() > 2) scen.ev_s[i] = tab[i][2];
+                if (tab[i].size() > 4){ // spline coefficients
+                    scen.ev_c2[i] = tab[i][3];
+                    scen.ev_c3[i] = tab[i][4];
+                }
+            }
+        }
+        return scen;
+    }
+};
+//]
+
+// Scenario table for one exposure profile (times t and concentrations c),
+// as make_scen.m builds it for glo.int_coll: type 2 gives block pulses
+// (the table is the profile itself), type 4 linear interpolation (time,
+// concentration and slope for each interval, pruned as in make_scen.m).
+// Splines (type 1) are made by mex_scen.m in MATLAB.
+inline table_type make_scen_table(int type, const std::vector<double>& t, const std::vector<double>& c)
+{
+    table_type tab;
+    if (type == 2){
+        for (size_t i = 0; i < t.size(); i++){
+            tab.push_back({t[i], c[i]});
+        }
+        return tab;
+    }
+    if (type != 4){
+        throw std::invalid_argument("make_scen_table: only scenario types 2 and 4 are supported");
+    }
+
+    table_type Cw; // profile without the NaNs in the concentration
+    for (size_t i = 0; i < t.size(); i++){
+        if (!std::isnan(c[i])) Cw.push_back({t[i], c[i]});
+    }
+    for (size_t i = 0; i+1 < Cw.size(); i++){ // third column is the slope in this interval
+        tab.push_back({Cw[i][0], Cw[i][1], (Cw[i+1][1]-Cw[i][1])/(Cw[i+1][0]-Cw[i][0])});
+    }
+    if (tab.empty()){ // only an entry at t=0: take constant concentration
+        tab.push_back({Cw[0][0], Cw[0][1], 0.});
+        tab.push_back({t.back(), Cw[0][1], 0.});
+    }
+
+    // prune it: remove intervals where the slope remains the same (before
+    // removing NaNs and INFs, as there may be double time points)
+    table_type tmp(1, tab[0]);
+    for (size_t i = 1; i < tab.size(); i++){
+        if (tab[i][2] - tab[i-1][2] != 0) tmp.push_back(tab[i]);
+    }
+    tab.clear();
+    for (const std::vector<double>& row : tmp){ // remove slopes that are NaN or INF
+        if (std::isfinite(row[2])) tab.push_back(row);
+    }
+    if (tab.back()[0] < Cw.back()[0]){ // last row marks the end of the scenario with slope zero
+        tab.push_back({Cw.back()[0], Cw.back()[1], 0.});
+    }
+
+    // second round of pruning: the end of interval i is the start of
+    // interval i+1, with the same slope
+    tmp.assign(1, tab[0]);
+    for (size_t i = 1; i < tab.size(); i++){
+        double c_end = tab[i-1][1] + tab[i-1][2]*(tab[i][0]-tab[i-1][0]);
+        if (!(c_end == tab[i][1] && tab[i-1][2] == tab[i][2])) tmp.push_back(tab[i]);
+    }
+    return tmp;
+}
+
+//[ event_detection
+// Nothing happens to the state at an event (see integrate_times_events)
+struct no_jump
+{
+    template< class State >
+    void operator()( const State & , double , State & , double , int ) const { }
+};
+
+// Integrate with a dense stepper up to the times in time_vector, while
+// following the event functions of DEBderi. When one of them changes sign
+// within a step, the crossing is located by bisection on the dense output,
+// its time is added to TE, and the stepper is restarted at that point.
+// This way, no step of the solver spans one of the kinks in the
+// derivatives. The observations are made as in integrate_times of odeint.
+// Before the restart, jump(x_a,t_a,x_b,t_b,i) may change the state x_b
+// just past the crossing of event i (x_a is the state just before it);
+// this is used for the sensitivities.
+template< class Stepper , class System , class State , class Observer , class Jump >
+size_t integrate_times_events(Stepper &st, System system, State &x, const DEBderi &deri,
+                              const std::vector<double> &time_vector, double &dt,
+                              Observer observer, std::vector<double> &TE, Jump jump)
+{
+    using boost::numeric::odeint::detail::less_eq_with_sign;
+    typename boost::numeric::odeint::unwrap_reference< Observer >::type &obs = observer;
+
+    size_t steps = 0;
+    auto t_it = time_vector.begin();
+    double t_last = time_vector.back();
+    State x_tmp( x ); // state for the bisection
+    State x_bef( x ); // state just before a crossing
+
+    st.initialize( x , *t_it , dt );
+    obs( x , *t_it++ );
+    double g0[3] , g1[3] , gm[3]; // event functions at start, end and within a step
+    deri.events( x , g0 );
+
+    while( t_it != time_vector.end() )
+    {
+        // do a real step, but not beyond the last time point
+        if( !less_eq_with_sign( st.current_time() + st.current_time_step() , t_last , st.current_time_step() ) )
+            st.initialize( st.current_state() , st.current_time() , t_last - st.current_time() );
+        st.do_step( system );
+        steps++;
+
+        // locate the first crossing of an event function within this step
+        double t_end = st.current_time();
+        std::vector< std::pair< double , int > > t_cross; // crossing and event
+        double t_bef[3]; // just before each crossing
+        deri.events( st.current_state() , g1 );
+        for( int i=0 ; i<3 ; i++ )
+        {
+            if( g0[i] * g1[i] >= 0 ) continue; // no crossing for this event
+            double a = st.previous_time() , b = st.current_time();
+            while( b - a > 1e-10 * std::max( 1. , std::fabs( b ) ) )
+            {
+                double m = ( a + b ) / 2;
+                st.calc_state( m , x_tmp );
+                deri.events( x_tmp , gm );
+                if( gm[i] * g0[i] > 0 ) a = m; else b = m;
+            }
+            t_cross.push_back( std::make_pair( b , i ) ); // just past the crossing
+            t_bef[i] = a;
+        }
+        if( !t_cross.empty() )
+        {
+            std::sort( t_cross.begin() , t_cross.end() );
+            t_end = t_cross[0].first;
+            for( const auto &te : t_cross ) // events crossing at the same time
+                if( te.first == t_end ) TE.push_back( te.first );
+        }
+
+        while( t_it != time_vector.end() && less_eq_with_sign( *t_it , t_end , st.current_time_step() ) )
+        {
+            st.calc_state( *t_it , x );
+            obs( x , *t_it++ );
+        }
+
+        if( t_cross.empty() )
+        {
+            std::copy( g1 , g1+3 , g0 );
+        }
+        else if( t_it != time_vector.end() ) // restart the stepper at the event
+        {
+            st.calc_state( t_end , x_tmp );
+            for( const auto &te : t_cross )
+            {
+                if( te.first != t_end ) continue;
+                st.calc_state( t_bef[te.second] , x_bef );
+                jump( x_bef , t_bef[te.second] , x_tmp , t_end , te.second );
+            }
+            deri.events( x_tmp , g0 );
+            st.initialize( x_tmp , t_end , st.current_time_step() );
+        }
+    }
+    dt = st.current_time_step();
+    return steps;
+}
+
+template< class Stepper , class System , class State , class Observer >
+size_t integrate_times_events(Stepper &st, System system, State &x, const DEBderi &deri,
+                              const std::vector<double> &time_vector, double &dt,
+                              Observer observer, std::vector<double> &TE)
+{
+    return integrate_times_events(st, system, x, deri, time_vector, dt, observer, TE, no_jump());
+}
+//]
+
+// Observer that passes everything on to obs, except the first point (the
+// start of an interval is the end of the previous one)
+template< class Observer >
+struct skip_first_observer
+{
+    Observer& m_obs;
+    bool m_first;
+
+    skip_first_observer( Observer &obs ) : m_obs( obs ) , m_first( true ) { }
+
+    template< class State >
+    void operator()( const State &x , double t )
+    {
+        if( m_first ) m_first = false; else m_obs( x , t );
+    }
+};
+
+// Solve the ODE system with the explicit dopri5 stepper (see
+// integrate_scenario)
+template< class Observer >
+size_t integrate_dopri5(DEBderi deri, state_type& x, const std::vector<double>& time_vector,
+                        double& dt, double abs_err, double rel_err, double max_step,
+                        Observer obs, std::vector<double>& TE)
+{
+    using namespace boost::numeric::odeint;
+
+    // Define the stepper type (in this case a dense stepper)
+    typedef runge_kutta_dopri5<state_type> stepper_type;
+
+    // solve the ODE using the stepper already defined. The times are those passed
+    // by the user
+    auto stepper = make_dense_output(abs_err , rel_err, max_step, stepper_type() );
+    return integrate_times_events(stepper, boost::ref( deri ), x, deri, time_vector, dt, obs, TE);
+}
+
+// Solve with the closed-form solution of DEBderi::advance_analytic from one
+// time point to the next, as long as it applies. From the point where it
+// stops, the dopri5 stepper takes over up to the next exposure event or
+// Tlag, after which the closed form is tried again. For control
+// treatments and constant exposure below the thresholds, no ODE solver is
+// needed at all. The number of steps only counts the steps of dopri5.
+template< class Observer >
+size_t integrate_analytic(const DEBderi& deri, state_type& x, const std::vector<double>& time_vector,
+                          double& dt, double abs_err, double rel_err, double max_step,
+                          Observer obs, std::vector<double>& TE)
+{
+    typedef typename boost::numeric::odeint::unwrap_reference< Observer >::type obs_type;
+    obs_type &o = obs;
+
+    size_t steps = 0;
+    size_t k = 0, n = time_vector.size();
+    o( x , time_vector[0] );
+    while (k+1 < n){
+        double t_a = deri.advance_analytic(x, time_vector[k], time_vector[k+1], TE);
+        if (t_a == time_vector[k+1]){
+            k++;
+            o( x , time_vector[k] );
+            continue;
+        }
+        double t_sw = deri.next_switch(time_vector[k]);
+        size_t k_end = std::lower_bound(time_vector.begin() + k + 1, time_vector.end(), t_sw) - time_vector.begin();
+        k_end = std::min(k_end, n-1);
+        std::vector<double> t_num(time_vector.begin() + k, time_vector.begin() + k_end + 1);
+        if (t_a > t_num[0]){ // the closed form stopped just before a kink: start with a small step
+            t_num[0] = t_a;
+            dt = std::min(dt, (t_num[1] - t_a)/100);
+        }
+        steps += integrate_dopri5(deri, x, t_num, dt, abs_err, rel_err, max_step,
+                                  skip_first_observer<obs_type>( o ), TE);
+        k = k_end;
+    }
+    return steps;
+}
+
+// Solve the ODE system with a dense stepper and pass the states at the
+// times in time_vector to the observer obs (called as obs(x,t)). The
+// solver follows glo.stiff(1): 0 for the explicit dopri5 stepper, 2 for
+// the implicit rosenbrock4 stepper (for stiff systems, e.g., high hazard
+// rates in EPx calculations), and 3 for dopri5 with the closed-form
+// solution where it applies (see integrate_analytic). On return, dt holds
+// the last step size of the stepper, and the times of the events are
+// added to TE.
+template< class Observer >
+size_t integrate_scenario(DEBderi deri, state_type& x, const std::vector<double>& time_vector,
+                          double& dt, double abs_err, double rel_err, double max_step,
+                          Observer obs, std::vector<double>& TE, int solver = 0)
+{
+    using namespace boost::numeric::odeint;
+
+    if (solver == 3){
+        return integrate_analytic(deri, x, time_vector, dt, abs_err, rel_err, max_step, obs, TE);
+    }
+    if (solver == 2){
+        typedef rosenbrock4< double > stiff_stepper_type;
+        vector_type xs( x.size() );
+        std::copy( x.begin() , x.end() , xs.begin() );
+        auto stepper = make_dense_output(abs_err , rel_err, max_step, stiff_stepper_type() );
+        auto system = std::make_pair( DEBderi_stiff( deri ) , DEBjacobi_stiff( deri ) );
+        size_t steps = integrate_times_events(stepper, boost::ref( system ),
+                                              xs, deri, time_vector, dt, obs, TE);
+        std::copy( xs.begin() , xs.end() , x.begin() );
+        return steps;
+    }
+    return integrate_dopri5(deri, x, time_vector, dt, abs_err, rel_err, max_step, obs, TE);
+}
+
+// Same, storing the times and states in x_vec and times
+inline size_t integrate_scenario(DEBderi deri, state_type& x, const std::vector<double>& time_vector,
+                          double& dt, double abs_err, double rel_err, double max_step,
+                          std::vector<state_type>& x_vec, std::vector<double>& times,
+                          std::vector<double>& TE, int solver = 0)
+{
+    return integrate_scenario(deri, x, time_vector, dt, abs_err, rel_err, max_step,
+                              push_back_state_and_time( x_vec , times ), TE, solver);
+}
+
+// State of a piece-wise solve (break_time=1) at the start of one of the
+// intervals between the events in T. The stepper is restarted there from
+// the last state and the last step size, so these are all that is needed
+// to resume the solve from this point with the same result.
+struct interval_checkpoint
+{
+    size_t interval; // interval of T that starts here
+    state_type x;    // states at T[interval]
+    double dt;       // step size for the restart
+};
+
+// Run the ODE solver piece-wise across all exposure events in T (as in
+// call_deri.m for break_time=1), so that the discontinuities in the
+// exposure profile are no problem for the solver. The time vector t must
+// contain all elements of T. The stepper is restarted at each event, from
+// the last state and the last step size of the previous interval. There
+// are no double time points in the output.
+// This version runs from the checkpoint cp up to the start of interval
+// i_stop, and leaves the checkpoint there in cp. Only the first interval
+// passes its first time point to the observer.
+template< class Observer >
+size_t integrate_intervals(DEBderi deri, interval_checkpoint& cp, size_t i_stop,
+                           const std::vector<double>& t, const std::vector<double>& T,
+                           const std::vector<double>& Tev, double abs_err, double rel_err,
+                           double max_step, Observer& obs, std::vector<double>& TE, int solver = 0)
+{
+    size_t steps = 0;
+    state_type& x = cp.x;
+    double& dt = cp.dt;
+    for (size_t i = cp.interval; i < i_stop && i+1 < T.size(); i++, cp.interval++){ // run through the intervals between events
+        // time points from t between start and end time for this period
+        std::vector<double> t_tmp(t.begin() + locate_time(t, T[i]),
+                                  t.begin() + locate_time(t, T[i+1]) + 1);
+        // tell read_scen which part of Tev we're in (last event before T(i),
+        // as Tlag is in T but not in Tev)
+        deri.set_interval(std::upper_bound(Tev.begin(), Tev.end(), T[i]) - Tev.begin());
+
+        if (i == 0){
+            steps += integrate_scenario(deri, x, t_tmp, dt, abs_err, rel_err, max_step,
+                                        boost::ref( obs ), TE, solver);
+        }
+        else{ // start of this interval is the end of the previous one
+            steps += integrate_scenario(deri, x, t_tmp, dt, abs_err, rel_err, max_step,
+                                        skip_first_observer<Observer>( obs ), TE, solver);
+        }
+    }
+    return steps;
+}
+
+// Same, over all intervals, from the states x
+template< class Observer >
+size_t integrate_intervals(DEBderi deri, state_type& x, const std::vector<double>& t,
+                           const std::vector<double>& T, const std::vector<double>& Tev,
+                           double dt, double abs_err, double rel_err, double max_step,
+                           Observer& obs, std::vector<double>& TE, int solver = 0)
+{
+    interval_checkpoint cp = {0, x, dt};
+    size_t steps = integrate_intervals(deri, cp, T.size(), t, T, Tev, abs_err, rel_err,
+                                       max_step, obs, TE, solver);
+    x = cp.x;
+    return steps;
+}
+
+// Same, storing the times and states in x_vec and times
+inline size_t integrate_intervals(DEBderi deri, state_type& x, const std::vector<double>& t,
+                           const std::vector<double>& T, const std::vector<double>& Tev,
+                           double dt, double abs_err, double rel_err, double max_step,
+                           std::vector<state_type>& x_vec, std::vector<double>& times,
+                           std::vector<double>& TE, int solver = 0)
+{
+    push_back_state_and_time obs( x_vec , times );
+    return integrate_intervals(deri, x, t, T, Tev, dt, abs_err, rel_err, max_step, obs, TE, solver);
+}
+
+// Run from the checkpoint cp up to the start of interval i_stop, as
+// integrate_intervals does for break_time=1. For break_time=0, the stepper
+// runs across the events, and is only restarted at the checkpoints (from
+// the states and the step size in cp).
+template< class Observer >
+size_t integrate_to_checkpoint(DEBderi deri, interval_checkpoint& cp, size_t i_stop, bool break_time,
+                               const std::vector<double>& t, const std::vector<double>& T,
+                               const std::vector<double>& Tev, double abs_err, double rel_err,
+                               double max_step, Observer& obs, std::vector<double>& TE, int solver = 0)
+{
+    if (break_time){
+        return integrate_intervals(deri, cp, i_stop, t, T, Tev, abs_err, rel_err, max_step, obs, TE, solver);
+    }
+    size_t i_end = std::min(i_stop, T.size() - 1);
+    if (i_end <= cp.interval){
+        return 0;
+    }
+    std::vector<double> t_tmp(t.begin() + locate_time(t, T[cp.interval]),
+                              t.begin() + locate_time(t, T[i_end]) + 1);
+    size_t steps;
+    if (cp.interval == 0){
+        steps = integrate_scenario(deri, cp.x, t_tmp, cp.dt, abs_err, rel_err, max_step,
+                                   boost::ref( obs ), TE, solver);
+    }
+    else{ // the first point was passed to the observer before the checkpoint
+        steps = integrate_scenario(deri, cp.x, t_tmp, cp.dt, abs_err, rel_err, max_step,
+                                   skip_first_observer<Observer>( obs ), TE, solver);
+    }
+    cp.interval = i_end;
+    return steps;
+}
+
+//[ requested_output
+// Observer that writes the states at the requested time points straight
+// into out (a column-major block of nt x 4), with the output mapping of
+// call_deri.m: the length is the maximum length so far (for len=2),
+// survival does not get negative, and reproduction is taken from the
+// brood-pouch time points (for Tbp>0). It is called for all points of the
+// time grid in order; the other points are only needed for the maximum
+// length, so no states are stored.
+struct requested_output_observer
+{
+    double* m_out;
+    size_t m_nt;
+    bool m_maxL; // keep the maximum length (len=2)
+    bool m_bp;   // reproduction from the brood-pouch time points
+    std::vector< std::pair< size_t , size_t > > m_rows; // grid point and output row (rows from nt on are brood-pouch points)
+    size_t m_next; // next element of m_rows
+    size_t m_k;    // grid point of the next observation
+    double m_L;    // maximum length so far
+
+    requested_output_observer( const time_grid &g , bool maxL , bool bp , double *out )
+    : m_out( out ) , m_nt( g.loc.size() ) , m_maxL( maxL ) , m_bp( bp ) , m_next( 0 ) , m_k( 0 ) , m_L( 0. )
+    {
+        for( size_t i=0 ; i<m_nt ; i++ )
+        {
+            m_rows.push_back( std::make_pair( g.loc[i] , i ) );
+            if( m_bp && g.loc_bp[i] < g.t.size() )
+                m_rows.push_back( std::make_pair( g.loc_bp[i] , i + m_nt ) );
+        }
+        std::sort( m_rows.begin() , m_rows.end() );
+        if( m_bp ) // no brood-pouch point means no reproduction yet
+            std::fill( m_out + 2*m_nt , m_out + 3*m_nt , 0. );
+    }
+
+    template< class State >
+    void operator()( const State &x , double )
+    {
+        if( m_maxL ) // as cummax in call_deri.m
+            m_L = ( m_k == 0 ) ? x[1] : std::max( x[1] , m_L );
+        for( ; m_next < m_rows.size() && m_rows[m_next].first == m_k ; m_next++ )
+        {
+            size_t i = m_rows[m_next].second;
+            if( i >= m_nt ) // shift reproduction for the brood-pouch delay
+            {
+                m_out[i + m_nt] = x[2];
+                continue;
+            }
+            m_out[i]          = x[0];
+            m_out[i + m_nt]   = m_maxL ? m_L : x[1];
+            if( !m_bp )
+                m_out[i + 2*m_nt] = x[2];
+            m_out[i + 3*m_nt] = std::max( 0. , x[3] ); // survival should not get negative
+        }
+        m_k++;
+    }
+};
+//]
+
+// Solve one scenario on the time vector that call_deri.m would use, and
+// write the states at the requested times into out (a column-major block
+// of nt x 4, see requested_output_observer). The times of the events are
+// added to TE.
+inline void solve_requested(const std::vector<double>& scalar_pars,
+                     const std::vector<std::vector<double>>& vector_pars,
+                     const scenario_type& scen,
+                     const std::vector<double>& x0,
+                     const std::vector<double>& t_req,
+                     double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                     int solver, double* out, std::vector<double>& TE)
+{
+    double L0   = scalar_pars[4];
+    double Tlag = scalar_pars[12];
+
+    time_grid g = make_time_grid(t_req, scen.Tev, scen.timevar[0] == 1, Tlag, Tbp, len, break_time);
+
+    state_type x;
+    std::copy(x0.begin(), x0.end(), x.begin());
+    x[1] = L0; // initial body length is a parameter
+
+    requested_output_observer obs(g, len == 2, Tbp > 0, out);
+    DEBderi deri(deb_pars(scalar_pars, vector_pars), scen);
+    if (break_time){ // run the solver piece-wise across all exposure events
+        integrate_intervals(deri, x, g.t, g.T, scen.Tev, g.initial_step, abs_err, rel_err,
+                            g.max_step, obs, TE, solver);
+    }
+    else{
+        integrate_scenario(deri, x, g.t, g.initial_step, abs_err, rel_err, g.max_step,
+                           boost::ref( obs ), TE, solver);
+    }
+}
+
+// Same, without the times of the events
+inline void solve_requested(const std::vector<double>& scalar_pars,
+                     const std::vector<std::vector<double>>& vector_pars,
+                     const scenario_type& scen,
+                     const std::vector<double>& x0,
+                     const std::vector<double>& t_req,
+                     double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                     int solver, double* out)
+{
+    std::vector<double> TE;
+    solve_requested(scalar_pars, vector_pars, scen, x0, t_req, Tbp, len, break_time,
+                    abs_err, rel_err, solver, out, TE);
+}
+//]
+
+//[ requested_checkpoint
+// Checkpoint of solve_requested at the start of one of the intervals of
+// the time grid: the grid, the solver (see interval_checkpoint), the
+// observer with the output rows written so far, and the events so far. Solves that only differ after the checkpoint (e.g.,
+// other MFs before the first exposure) can all resume from it. The
+// observer only writes into out while solving up to the checkpoint; a
+// resumed solve copies it and points it to its own output.
+struct requested_checkpoint
+{
+    time_grid g;
+    bool break_time;
+    interval_checkpoint cp;
+    std::vector<double> out; // nt x 4, rows up to the checkpoint
+    requested_output_observer obs;
+    std::vector<double> TE;
+
+    requested_checkpoint( const time_grid &grid , bool break_time , int len , double Tbp )
+    : g( grid ) , break_time( break_time ) , out( grid.loc.size()*4 ) , obs( g , len == 2 , Tbp > 0 , out.data() ) { }
+};
+
+// The last event in the time grid at or before t_cp (as interval)
+inline size_t checkpoint_interval(const time_grid& g, double t_cp)
+{
+    size_t i = std::upper_bound(g.T.begin(), g.T.end(), t_cp) - g.T.begin();
+    return std::min(std::max(i, (size_t)1), g.T.size() - 1) - 1;
+}
+
+// Solve as solve_requested, up to the start of the interval at each of the
+// requested checkpoint times in t_cp (the last event at or before it), and
+// return the checkpoints there. The solve up to the last checkpoint is done
+// once; with break_time=0, the stepper is restarted at each checkpoint.
+inline std::vector<requested_checkpoint> solve_to_checkpoints(const std::vector<double>& scalar_pars,
+                     const std::vector<std::vector<double>>& vector_pars,
+                     const scenario_type& scen,
+                     const std::vector<double>& x0,
+                     const std::vector<double>& t_req,
+                     double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                     int solver, std::vector<double> t_cp)
+{
+    double L0   = scalar_pars[4];
+    double Tlag = scalar_pars[12];
+
+    requested_checkpoint rc(make_time_grid(t_req, scen.Tev, scen.timevar[0] == 1, Tlag, Tbp, len, break_time),
+                            break_time, len, Tbp);
+    rc.cp.interval = 0;
+    std::copy(x0.begin(), x0.end(), rc.cp.x.begin());
+    rc.cp.x[1] = L0; // initial body length is a parameter
+    rc.cp.dt = rc.g.initial_step;
+
+    std::sort(t_cp.begin(), t_cp.end());
+    std::vector<requested_checkpoint> cps;
+    DEBderi deri(deb_pars(scalar_pars, vector_pars), scen);
+    for (double tc : t_cp){
+        integrate_to_checkpoint(deri, rc.cp, checkpoint_interval(rc.g, tc), break_time, rc.g.t, rc.g.T,
+                                scen.Tev, abs_err, rel_err, rc.g.max_step, rc.obs, rc.TE, solver);
+        cps.push_back(rc);
+        cps.back().obs.m_out = cps.back().out.data(); // the observer of the copy writes into its own rows
+    }
+    return cps;
+}
+
+// Same, for one checkpoint
+inline requested_checkpoint solve_to_checkpoint(const std::vector<double>& scalar_pars,
+                     const std::vector<std::vector<double>>& vector_pars,
+                     const scenario_type& scen,
+                     const std::vector<double>& x0,
+                     const std::vector<double>& t_req,
+                     double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                     int solver, double t_cp)
+{
+    std::vector<requested_checkpoint> cps = solve_to_checkpoints(scalar_pars, vector_pars, scen, x0, t_req,
+                                                Tbp, len, break_time, abs_err, rel_err, solver, {t_cp});
+    return std::move(cps.front()); // (moving out keeps the rows the observer points to)
+}
+
+// Resume from the checkpoint up to the end of the time grid, with
+// parameters that give the same solution up to the checkpoint. The output
+// is that of solve_requested (out gets nt x 4, and TE the times of the
+// events, including those before the checkpoint).
+inline void solve_from_checkpoint(const requested_checkpoint& rc,
+                     const std::vector<double>& scalar_pars,
+                     const std::vector<std::vector<double>>& vector_pars,
+                     const scenario_type& scen,
+                     double abs_err, double rel_err, int solver,
+                     double* out, std::vector<double>& TE)
+{
+    std::copy(rc.out.begin(), rc.out.end(), out);
+    TE.insert(TE.end(), rc.TE.begin(), rc.TE.end());
+    interval_checkpoint cp = rc.cp;
+    requested_output_observer obs = rc.obs;
+    obs.m_out = out;
+
+    DEBderi deri(deb_pars(scalar_pars, vector_pars), scen);
+    integrate_to_checkpoint(deri, cp, rc.g.T.size(), rc.break_time, rc.g.t, rc.g.T, scen.Tev,
+                            abs_err, rel_err, rc.g.max_step, obs, TE, solver);
+}
+
+// Time up to which the solution does not depend on the multiplication
+// factor of the exposure: the first event of the scenario with a non-zero
+// concentration (or slope). For constant exposure, this is zero unless the
+// concentration is zero. (A later lag time does not help: the last stage
+// of the step that ends at Tlag already sees the exposure.)
+inline double mf_free_until(const scenario_type& scen)
+{
+    double tau = INFINITY;
+    if (scen.timevar[0] != 1){
+        if (scen.conc != 0) tau = 0.;
+    }
+    else{
+        for (size_t i = 0; i < scen.Tev.size(); i++){
+            if (scen.ev_c[i] != 0 || scen.ev_s[i] != 0 || scen.ev_c2[i] != 0 || scen.ev_c3[i] != 0){
+                tau = scen.Tev[i];
+                break;
+            }
+        }
+    }
+    return tau;
+}
+//]
+
+//[ solve_cache
+// Bounded cache for solve_requested, so that repeated requests (the same
+// best fit and the same control in the plots, the CIs and the ECx) are
+// not solved again. The key holds everything that the output depends on:
+// the model handle, the parameter vector (with MF), the scenario, the
+// initial states, the settings of the solver and the requested times.
+// Keys are hashed and compared bit by bit. When the cache is full, the
+// least recently used entry is dropped.
+class solve_cache
+{
+public:
+    struct entry
+    {
+        std::vector<double> out; // nt x 4, column major (as solve_requested)
+        std::vector<double> TE;  // times of the events
+    };
+
+    explicit solve_cache(size_t capacity = 100) : m_capacity(capacity), m_hits(0), m_misses(0) {}
+
+    // The key of one solve; the requested times go last, as they are the
+    // only part with a variable length
+    static std::vector<double> make_key(int handle, const std::vector<double>& scalar_pars, double conc,
+                                        const std::vector<double>& x0, const std::vector<double>& t_req,
+                                        int solver, double abs_err, double rel_err, double Tbp, int len,
+                                        bool break_time)
+    {
+        std::vector<double> key{(double)handle, conc, (double)solver, abs_err, rel_err, Tbp,
+                                (double)len, break_time ? 1. : 0., (double)x0.size()};
+        key.insert(key.end(), scalar_pars.begin(), scalar_pars.end());
+        key.insert(key.end(), x0.begin(), x0.end());
+        key.insert(key.end(), t_req.begin(), t_req.end());
+        return key;
+    }
+
+    // The stored solution for key (it becomes the most recent one), or
+    // nullptr when it is not there
+    const entry* find(const std::vector<double>& key)
+    {
+        auto it = m_map.find(&key);
+        if (it == m_map.end()){
+            m_misses++;
+            return nullptr;
+        }
+        m_hits++;
+        m_list.splice(m_list.begin(), m_list, it->second);
+        return &it->second->second;
+    }
+
+    void insert(std::vector<double> key, entry e)
+    {
+        if (m_capacity == 0 || m_map.count(&key) > 0) return;
+        m_list.emplace_front(std::move(key), std::move(e));
+        m_map[&m_list.front().first] = m_list.begin();
+        shrink(m_capacity);
+    }
+
+    // Drop the entries of a released model
+    void erase_handle(int handle)
+    {
+        for (auto it = m_list.begin(); it != m_list.end(); ){
+            if (it->first[0] == handle){
+                m_map.erase(&it->first);
+                it = m_list.erase(it);
+            }
+            else it++;
+        }
+    }
+
+    // Drop all entries (and reset the counters)
+    void clear(bool counters = true)
+    {
+        m_map.clear();
+        m_list.clear();
+        if (counters) m_hits = m_misses = 0;
+    }
+
+    // Maximum number of entries (0 switches the cache off)
+    void set_capacity(size_t capacity)
+    {
+        m_capacity = capacity;
+        shrink(capacity);
+    }
+
+    size_t capacity() const { return m_capacity; }
+    size_t size() const { return m_list.size(); }
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+
+private:
+    typedef std::list< std::pair< std::vector<double> , entry > > list_type;
+
+    // FNV-1a over the bits of the key
+    struct key_hash
+    {
+        size_t operator()(const std::vector<double>* key) const
+        {
+            uint64_t h = 14695981039346656037ULL;
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(key->data());
+            for (size_t i = 0; i < key->size()*sizeof(double); i++){
+                h = (h ^ b[i])*1099511628211ULL;
+            }
+            return (size_t)h;
+        }
+    };
+    struct key_equal
+    {
+        bool operator()(const std::vector<double>* a, const std::vector<double>* b) const
+        {
+            return a->size() == b->size() && std::memcmp(a->data(), b->data(), a->size()*sizeof(double)) == 0;
+        }
+    };
+
+    void shrink(size_t n)
+    {
+        while (m_list.size() > n){
+            m_map.erase(&m_list.back().first);
+            m_list.pop_back();
+        }
+    }
+
+    size_t m_capacity;
+    size_t m_hits, m_misses;
+    list_type m_list; // most recently used first
+    std::unordered_map< const std::vector<double>* , list_type::iterator , key_hash , key_equal > m_map; // keys point into m_list
+};
+//]
+
+//[ sensitivities
+// Forward sensitivities of the states to a selection of the parameters
+// (elements of scalar_pars): the variational equations dS/dt = J*S + df/dp
+// are solved together with the states, with J the analytic Jacobian of
+// DEBderi and df/dp its analytic derivatives to the parameters (see
+// DEBderi::param_derivatives). The switches in the derivatives (e.g.,
+// reproduction starting at Lp) are handled by the jumps below. The state
+// vector holds the four states, followed by the four sensitivities for
+// each parameter.
+typedef std::vector< double > sens_state_type;
+
+struct DEBsens
+{
+    DEBderi m_deri;
+    std::vector< size_t > m_loc;     // location of each parameter in scalar_pars
+
+    DEBsens( const std::vector<double> &scalar_pars , const std::vector<std::vector<double>> &vector_pars ,
+             const scenario_type &scen , const std::vector<size_t> &loc_par )
+    : m_deri( deb_pars( scalar_pars , vector_pars ) , scen ) , m_loc( loc_par )
+    { }
+
+    void set_interval( int ind_Tev )
+    {
+        m_deri.set_interval( ind_Tev );
+    }
+
+    // derivatives of the states only
+    state_type rates( const sens_state_type &xs , double t )
+    {
+        state_type x , f;
+        std::copy( xs.begin() , xs.begin() + 4 , x.begin() );
+        m_deri( x , f , t );
+        return f;
+    }
+
+    void operator()( const sens_state_type &xs , sens_state_type &dxdt , double t )
+    {
+        state_type x , f;
+        std::copy( xs.begin() , xs.begin() + 4 , x.begin() );
+        double J[4][4] , dfdt[4] , dfdp[4];
+        m_deri.jacobian( x , J , t , dfdt );
+        f = rates( xs , t );
+        std::copy( f.begin() , f.end() , dxdt.begin() );
+        for( size_t k=0 ; k<m_loc.size() ; k++ )
+        {
+            const double *S = &xs[4*(k+1)];
+            m_deri.param_derivatives( x , t , m_loc[k] , dfdp );
+            for( size_t i=0 ; i<4 ; i++ )
+            {
+                double dS = dfdp[i];
+                for( size_t j=0 ; j<4 ; j++ )
+                    dS += J[i][j] * S[j];
+                dxdt[4*(k+1)+i] = dS;
+            }
+        }
+    }
+
+    // Jump in the sensitivities where an event function crosses zero (the
+    // derivatives switch there, e.g., reproduction starts at Lp): with the
+    // derivatives f_a just before and f_b just after the crossing, and the
+    // shift in the time of the crossing dtau = -(dg/dx*S + dg/dp)/(dg/dt),
+    // the sensitivities jump by (f_a - f_b)*dtau.
+    void operator()( const sens_state_type &x_a , double t_a , sens_state_type &x_b , double t_b , int i_ev )
+    {
+        const size_t loc_z[3] = { 14 , 16 , 5 }; // zb, zs and Lp in scalar_pars
+        size_t j = ( i_ev == 2 ) ? 1 : 0;        // state in the event function (D or L)
+        state_type f_a = rates( x_a , t_a ) , f_b = rates( x_b , t_b );
+        if( f_a[j] == 0 ) // the crossing does not move
+            return;
+        for( size_t k=0 ; k<m_loc.size() ; k++ )
+        {
+            double dg = x_b[4*(k+1)+j] - ( ( m_loc[k] == loc_z[i_ev] ) ? 1. : 0. );
+            double dtau = -dg / f_a[j];
+            for( size_t i=0 ; i<4 ; i++ )
+                x_b[4*(k+1)+i] += ( f_a[i] - f_b[i] ) * dtau;
+        }
+    }
+
+    // Jump at the lag time: nothing changes before Tlag, so a later start
+    // shifts the whole solution (the derivatives jump from 0 to f at Tlag).
+    void lag_jump( sens_state_type &xs , double Tlag )
+    {
+        state_type f = rates( xs , Tlag );
+        for( size_t k=0 ; k<m_loc.size() ; k++ )
+            if( m_loc[k] == 12 )
+                for( size_t i=0 ; i<4 ; i++ )
+                    xs[4*(k+1)+i] -= f[i];
+    }
+};
+
+// Event jumps of DEBsens, passed to integrate_times_events by reference
+struct sens_jump
+{
+    DEBsens &m_sys;
+    sens_jump( DEBsens &sys ) : m_sys( sys ) { }
+    void operator()( const sens_state_type &x_a , double t_a , sens_state_type &x_b , double t_b , int i_ev ) const
+    {
+        m_sys( x_a , t_a , x_b , t_b , i_ev );
+    }
+};
+
+// Observer for the sensitivities at the requested time points, with the
+// same output mapping as requested_output_observer: for len=2 the
+// sensitivity of the length at the time of the maximum length, for Tbp>0
+// the sensitivity of reproduction at the brood-pouch time point, and zero
+// for survival where it is set to zero. The states themselves are passed
+// on to a requested_output_observer. dout is a column-major block of
+// nt x 4 x n_par.
+struct requested_sens_observer
+{
+    requested_output_observer m_obs;
+    double* m_dout;
+    size_t m_nt , m_np;
+    bool m_maxL , m_bp;
+    std::vector< std::pair< size_t , size_t > > m_rows; // as in requested_output_observer
+    size_t m_next , m_k;
+    double m_L;                  // maximum length so far
+    std::vector< double > m_SL;  // sensitivities of the length at that point
+
+    requested_sens_observer( const time_grid &g , bool maxL , bool bp , size_t n_par , double *out , double *dout )
+    : m_obs( g , maxL , bp , out ) , m_dout( dout ) , m_nt( g.loc.size() ) , m_np( n_par ) ,
+      m_maxL( maxL ) , m_bp( bp ) , m_rows( m_obs.m_rows ) , m_next( 0 ) , m_k( 0 ) , m_L( 0. ) , m_SL( n_par , 0. )
+    {
+        if( m_bp )
+            for( size_t k=0 ; k<m_np ; k++ )
+                std::fill( m_dout + (2 + 4*k)*m_nt , m_dout + (3 + 4*k)*m_nt , 0. );
+    }
+
+    void operator()( const sens_state_type &x , double t )
+    {
+        m_obs( x , t );
+        if( m_maxL && ( m_k == 0 || x[1] > m_L ) )
+        {
+            m_L = x[1];
+            for( size_t k=0 ; k<m_np ; k++ )
+                m_SL[k] = x[4*(k+1)+1];
+        }
+        for( ; m_next < m_rows.size() && m_rows[m_next].first == m_k ; m_next++ )
+        {
+            size_t i = m_rows[m_next].second;
+            for( size_t k=0 ; k<m_np ; k++ )
+            {
+                const double *S = &x[4*(k+1)];
+                double *d = m_dout + 4*k*m_nt;
+                if( i >= m_nt ) // reproduction at the brood-pouch point
+                {
+                    d[i + m_nt] = S[2];
+                    continue;
+                }
+                d[i]          = S[0];
+                d[i + m_nt]   = m_maxL ? m_SL[k] : S[1];
+                if( !m_bp )
+                    d[i + 2*m_nt] = S[2];
+                d[i + 3*m_nt] = ( x[3] > 0 ) ? S[3] : 0.; // survival is set to zero below zero
+            }
+        }
+        m_k++;
+    }
+};
+
+// Solve one scenario with the sensitivities to the parameters at loc_par
+// (locations in scalar_pars), on the time vector of call_deri.m. The
+// states at the requested times go into out (nt x 4, as solve_requested),
+// the sensitivities into dout (nt x 4 x n_par). The augmented system is
+// always solved with dopri5 (the Jacobian of the variational equations is
+// not available for rosenbrock4). With break_time, the solver runs
+// piece-wise across the exposure events, as integrate_intervals; without,
+// it only stops at the lag time.
+inline void solve_sensitivities(const std::vector<double>& scalar_pars,
+                     const std::vector<std::vector<double>>& vector_pars,
+                     const scenario_type& scen,
+                     const std::vector<double>& x0,
+                     const std::vector<double>& t_req,
+                     const std::vector<size_t>& loc_par,
+                     double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                     double* out, double* dout)
+{
+    using namespace boost::numeric::odeint;
+
+    double L0   = scalar_pars[4];
+    double Tlag = scalar_pars[12];
+    size_t n_par = loc_par.size();
+
+    time_grid g = make_time_grid(t_req, scen.Tev, scen.timevar[0] == 1, Tlag, Tbp, len, break_time);
+
+    sens_state_type x(4*(1 + n_par), 0.);
+    std::copy(x0.begin(), x0.end(), x.begin());
+    x[1] = L0; // initial body length is a parameter
+    for (size_t k = 0; k < n_par; k++){
+        if (loc_par[k] == 4) x[4*(k+1)+1] = 1.; // so its sensitivity starts at 1
+    }
+
+    // the pieces for the solver
+    std::vector<double> T;
+    if (break_time){
+        T = g.T;
+    }
+    else{
+        T = {g.t.front(), g.t.back()};
+        if (Tlag > g.t.front() && Tlag < g.t.back()){
+            T.insert(T.begin()+1, Tlag);
+        }
+    }
+
+    requested_sens_observer obs(g, len == 2, Tbp > 0, n_par, out, dout);
+    DEBsens sys(scalar_pars, vector_pars, scen, loc_par);
+    typedef runge_kutta_dopri5< sens_state_type > stepper_type;
+    double dt = g.initial_step;
+    std::vector<double> TE;
+    for (size_t i = 0; i+1 < T.size(); i++){
+        std::vector<double> t_tmp(g.t.begin() + locate_time(g.t, T[i]),
+                                  g.t.begin() + locate_time(g.t, T[i+1]) + 1);
+        if (break_time){ // as in integrate_intervals
+            sys.set_interval(std::upper_bound(scen.Tev.begin(), scen.Tev.end(), T[i]) - scen.Tev.begin());
+        }
+        if (T[i] == Tlag){ // (at the start for Tlag = 0: the derivative for a positive Tlag)
+            sys.lag_jump(x, Tlag);
+        }
+        auto stepper = make_dense_output(abs_err, rel_err, g.max_step, stepper_type());
+        if (i == 0){
+            integrate_times_events(stepper, boost::ref( sys ), x, sys.m_deri, t_tmp, dt,
+                                   boost::ref( obs ), TE, sens_jump( sys ));
+        }
+        else{ // start of this piece is the end of the previous one
+            integrate_times_events(stepper, boost::ref( sys ), x, sys.m_deri, t_tmp, dt,
+                                   skip_first_observer<requested_sens_observer>( obs ), TE, sens_jump( sys ));
+        }
+    }
+}
+//]
+
+//[ likelihood
+// One data set from DATA (with the matching element of W), reduced to the
+// rows and columns that are in ttot and ctot, as in transfer.m
+struct data_set
+{
+    double lam;               // -1 for survival data, 0-1 for continuous data (transformation when lam<1)
+    size_t n_t = 0, n_c = 0;  // number of rows (times) and columns (treatments) of D
+    std::vector<size_t> locT; // location in ttot for each row of D
+    std::vector<size_t> locC; // location in ctot for each column of D
+    std::vector<double> D;    // data (column-major, n_t x n_c)
+    std::vector<double> w;    // weight factors (missing animals for survival data)
+};
+
+// Log-likelihood for survival data in the multinomial setting (lam = -1).
+// Each treatment is treated separately, without the NaNs in the data.
+inline double loglik_survival(const data_set& ds, const double* X, size_t nt)
+{
+    double loglik = 0.;
+    std::vector<double> D_i, M_i, w_i;
+    for (size_t c = 0; c < ds.n_c; c++){ // run through treatments in data set
+        D_i.clear();
+        M_i.clear();
+        w_i.clear();
+        for (size_t r = 0; r < ds.n_t; r++){
+            double d = ds.D[r + ds.n_t*c];
+            if (std::isnan(d)) continue; // remove the entries with NaNs
+            D_i.push_back(d);
+            M_i.push_back(X[ds.locT[r] + nt*4*ds.locC[c]]);
+            w_i.push_back(ds.w[r + ds.n_t*c]);
+        }
+        for (size_t r = 0; r < D_i.size(); r++){
+            double D_next  = (r+1 < D_i.size()) ? D_i[r+1] : 0.;
+            double M_next  = (r+1 < M_i.size()) ? M_i[r+1] : 0.;
+            double Ndeaths = D_i[r] - D_next - w_i[r];                  // numbers of deaths, corrected for missing animals
+            double Mdeaths = std::max(M_i[r] - M_next, 1e-50);          // conditional probabilities of deaths
+            if (Ndeaths < 0){
+                throw std::runtime_error("Negative deaths discovered. Please check the weights matrix in the data set.");
+            }
+            loglik += Ndeaths*std::log(Mdeaths) + w_i[r]*std::log(std::max(M_i[r], 1e-50));
+        }
+    }
+    return loglik;
+}
+
+// Weighted sums of squares for continuous data (lam >= 0), after the
+// transformation with lam. The result holds wssq, wssq2, n, N and the mean
+// of the transformed data.
+inline std::array<double,5> ssq_continuous(const data_set& ds, const double* X, size_t nt)
+{
+    double wssq = 0., wssq2 = 0., n = 0., N = 0., sum_D = 0.;
+    for (size_t c = 0; c < ds.n_c; c++){
+        for (size_t r = 0; r < ds.n_t; r++){
+            double d  = ds.D[r + ds.n_t*c];
+            double wi = ds.w[r + ds.n_t*c];
+            if (!std::isfinite(d) || wi == 0) continue; // only finite data with a weight
+            double m = std::max(0., X[ds.locT[r] + nt*4*ds.locC[c]]);
+            double res;
+            if (ds.lam == 0){ // log-transformation before taking residuals
+                d = std::log(std::max(d, 1e-10));
+                res = d - std::log(std::max(m, 1e-10));
+            }
+            else{ // power transformation (none if lam=1)
+                d = std::pow(d, ds.lam);
+                res = d - std::pow(m, ds.lam);
+            }
+            wssq  += wi*res*res;
+            wssq2 += wi*wi*res*res;
+            sum_D += d;
+            n     += 1;
+            N     += wi;
+        }
+    }
+    return {{wssq, wssq2, n, N, sum_D/n}};
+}
+
+// Minus log-likelihood for all data sets, as calculated in transfer.m. The
+// model output in Xall is time x state x scenario (column-major, with the
+// scenarios in the order of ctot). Data set i (linear index in DATA)
+// belongs to state i/n_D. datavar and datawts are glo.var and glo.wts (can
+// be empty).
+inline double calc_minloglik(const std::vector<data_set>& data, size_t n_D, const double* Xall, size_t nt,
+                      bool sameres, const std::vector<double>& datavar,
+                      const std::vector<double>& datawts)
+{
+    const double Fsdmin = 0.; // minimum for the sd of the residuals, relative to the mean (as in transfer.m)
+    size_t ndata = data.size();
+    std::vector<double> loglik(ndata, 0.);
+    std::map<size_t, std::array<double,5>> rem_ssq; // summed wssq, wssq2, n and N per state (sameres=1), and the first data set
+    for (size_t i = 0; i < ndata; i++){
+        const data_set& ds = data[i];
+        if (ds.n_t == 0 || ds.n_c == 0) continue; // no data to fit
+        size_t i_st = i / n_D;             // the state that data set i belongs to
+        const double* X = Xall + nt*i_st;  // model output for this state
+
+        if (ds.lam == -1){ // survival data, in multinomial context
+            loglik[i] = loglik_survival(ds, X, nt);
+        }
+        else if (ds.lam >= 0){ // continuous response data
+            std::array<double,5> ssq = ssq_continuous(ds, X, nt);
+            double wssq = ssq[0], wssq2 = ssq[1], n = ssq[2], N = ssq[3], mn = ssq[4];
+            if (datavar.empty() || std::isnan(datavar[i])){
+                // set a minimum for the wssq (NaN is ignored, as by max in MATLAB)
+                double min2 = N*std::pow(Fsdmin*mn, 2), min1 = n*std::pow(Fsdmin*mn, 2);
+                if (min2 > wssq2) wssq2 = min2;
+                if (min1 > wssq)  wssq  = min1;
+                if (n_D == 1 || !sameres){
+                    loglik[i] = -(n/2)*std::log(wssq2) - N*wssq/(2*wssq2);
+                }
+                else{ // combine the data sets for this state below
+                    auto it = rem_ssq.find(i_st);
+                    if (it == rem_ssq.end()){
+                        rem_ssq[i_st] = {{wssq, wssq2, n, N, (double)i}};
+                    }
+                    else{
+                        std::array<double,5>& s = it->second;
+                        s[0] += wssq;
+                        s[1] += wssq2;
+                        s[2] += n;
+                        s[3] += N;
+                    }
+                }
+            }
+            else{ // variance provided in glo.var
+                loglik[i] = -1/(2*datavar[i]) * wssq;
+            }
+        }
+    }
+    for (const auto& r : rem_ssq){ // single residual sd per state
+        const std::array<double,5>& s = r.second;
+        loglik[(size_t)s[4]] = -(s[2]/2)*std::log(s[1]) - s[3]*s[0]/(2*s[1]);
+    }
+    if (!datawts.empty() && !sameres){ // weights for the data sets
+        for (size_t i = 0; i < ndata; i++){
+            loglik[i] *= datawts[i];
+            if (std::isnan(loglik[i]) && datawts[i] == 0) loglik[i] = 0; // a state can be NaN with weight zero
+        }
+    }
+    double sum = 0.;
+    for (double l : loglik) sum += l;
+    return -sum;
+}
+
+// Everything that transfer.m needs (from WRAP) to calculate the minus
+// log-likelihood for a parameter vector: the scenarios in the order of
+// ctot with their initial states, the data sets, and the settings of the
+// solver. minloglik() only reads from the structure, so it can be called
+// from several threads at once.
+struct loglik_problem
+{
+    std::vector<std::vector<double>> vector_pars; // feedb and moa
+    std::vector<scenario_type> scenarios;          // scenarios in the order of ctot
+    table_type x0;                                 // initial states for each scenario
+    std::vector<double> ttot;                      // requested time points
+    std::vector<data_set> data;                    // data sets in the order of DATA (states in columns)
+    size_t n_D = 1;                                // number of data sets per state
+    double Tbp = 0., abs_err = 1e-7, rel_err = 1e-4;
+    int len = 2, solver = 0;
+    bool break_time = false, sameres = false;
+    std::vector<double> datavar, datawts;          // glo.var and glo.wts (can be empty)
+
+    double minloglik(const std::vector<double>& scalar_pars) const
+    {
+        size_t nt = ttot.size();
+        std::vector<double> Xall(nt*4*scenarios.size());
+        for (size_t k = 0; k < scenarios.size(); k++){
+            solve_requested(scalar_pars, vector_pars, scenarios[k], x0[k], ttot,
+                            Tbp, len, break_time, abs_err, rel_err, solver, Xall.data() + nt*4*k);
+        }
+        return calc_minloglik(data, n_D, Xall.data(), nt, sameres, datavar, datawts);
+    }
+};
+
+// The fitted parameters of pmat, and where they go in scalar_pars. The
+// values in pfit are on the fitting scale (log10 where pmat(:,5)=0); all
+// other elements of scalar_pars are fixed at their value in pvec.
+struct fitted_pars
+{
+    std::vector<double> pvec;   // parameter vector with the fixed values (see make_parvec.m)
+    std::vector<size_t> loc;    // element of pvec for each fitted parameter
+    std::vector<bool> logscale; // fitted parameters on log10 scale
+    table_type bnds;            // min-max bounds of the fitted parameters (on the fitting scale)
+
+    size_t size() const { return loc.size(); }
+
+    // The parameter vector for pfit, or an empty vector when pfit is
+    // outside the bounds (as in transfer.m, on the fitting scale)
+    std::vector<double> scalar_pars(const double* pfit) const
+    {
+        std::vector<double> p(pvec);
+        for (size_t i = 0; i < loc.size(); i++){
+            if (pfit[i] < bnds[i][0] || pfit[i] > bnds[i][1]){
+                return std::vector<double>();
+            }
+            p[loc[i]] = logscale[i] ? std::pow(10., pfit[i]) : pfit[i];
+        }
+        return p;
+    }
+};
+
+// Minus log-likelihood for the fitted parameters in pfit, as transfer.m
+// without priors: +inf outside the bounds, and for NaN results
+inline double minloglik(const loglik_problem& prob, const fitted_pars& fit, const double* pfit)
+{
+    std::vector<double> p = fit.scalar_pars(pfit);
+    if (p.empty()){
+        return INFINITY;
+    }
+    double mll = prob.minloglik(p);
+    if (std::isinf(mll)){ // the minloglik should not be calculated as infinite ...
+        throw std::runtime_error("The min-log-likelihood is calculated to be infinite ... check data set and derivatives");
+    }
+    if (std::isnan(mll)){ // give it a really bad likelihood value so the optimisation ignores it
+        return INFINITY;
+    }
+    return mll;
+}
+//]
+
+//[ thread_pool
+// Run fn(i) for i = 0 ... n_tasks-1 on n_threads threads. Tasks are handed
+// out one at a time from a shared counter, so that threads that finish
+// early take over the remaining work (parameter sets can differ a lot in
+// calculation time). The first exception thrown by a task stops the
+// remaining tasks and is thrown again in the calling thread.
+inline void parallel_for(size_t n_tasks, unsigned n_threads, const std::function<void(size_t)>& fn)
+{
+    std::atomic<size_t> next(0);
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+
+    auto worker = [&](){
+        size_t i;
+        while ((i = next++) < n_tasks){
+            try{
+                fn(i);
+            }
+            catch (...){
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next = n_tasks; // no need to start new tasks
+            }
+        }
+    };
+
+    n_threads = std::max(1u, std::min(n_threads, (unsigned)n_tasks));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < n_threads; i++){
+        pool.emplace_back(worker);
+    }
+    worker(); // the calling thread also does its share
+    for (auto& th : pool){
+        th.join();
+    }
+    if (error) std::rethrow_exception(error);
+}
+//]
+
+//[ epx
+// Final states at the end of t_req for one multiplication factor of the
+// exposure (glo.MF, element 20 of scalar_pars), as calc_epx_helper.m with
+// calc_int = 0. With a checkpoint of the control (see epx_checkpoint), the
+// solve resumes from there.
+inline std::array<double,4> epx_final_states(const std::vector<double>& scalar_pars,
+                        const std::vector<std::vector<double>>& vector_pars,
+                        const scenario_type& scen,
+                        const std::vector<double>& x0,
+                        const std::vector<double>& t_req,
+                        double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                        int solver, double MF, const requested_checkpoint* rc = nullptr)
+{
+    size_t nt = t_req.size();
+    std::vector<double> p(scalar_pars);
+    p[20] = MF;
+    std::vector<double> X(nt*4);
+    if (rc){
+        std::vector<double> TE;
+        solve_from_checkpoint(*rc, p, vector_pars, scen, abs_err, rel_err, solver, X.data(), TE);
+    }
+    else{
+        solve_requested(p, vector_pars, scen, x0, t_req, Tbp, len, break_time,
+                        abs_err, rel_err, solver, X.data());
+    }
+    std::array<double,4> Xend;
+    for (size_t j = 0; j < 4; j++){
+        Xend[j] = X[nt-1 + nt*j];
+    }
+    return Xend;
+}
+
+// Checkpoint of the control for the EPx: up to the first exposure, all
+// MFs follow the control, so they only need to be solved from there, on
+// the same time grid. The checkpoint is at the requested time t_cp, or at
+// the first exposure when that is earlier. With break_time=0, the control
+// and all MFs restart the stepper at the checkpoint (as the windows in
+// epx_window do), so they still share the solution before it.
+inline std::shared_ptr<const requested_checkpoint> epx_checkpoint(const std::vector<double>& scalar_pars,
+                        const std::vector<std::vector<double>>& vector_pars,
+                        const scenario_type& scen,
+                        const std::vector<double>& x0,
+                        const std::vector<double>& t_req,
+                        double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                        int solver, double t_cp = INFINITY)
+{
+    std::vector<double> p(scalar_pars);
+    p[20] = 0.;
+    return std::make_shared<const requested_checkpoint>(solve_to_checkpoint(p, vector_pars, scen, x0, t_req,
+        Tbp, len, break_time, abs_err, rel_err, solver, std::min(t_cp, mf_free_until(scen))));
+}
+
+// Relative effects on the traits at the end of t_req, for a range of
+// multiplication factors. The control is the same scenario with MF = 0.
+// Each MF is solved with its own step control (the events, such as damage
+// crossing a threshold, differ between the MFs), and the MFs are spread
+// over the thread pool. out gets the final values of the traits relative
+// to the control (n_MF x n_traits, column-major), and Xctrl the final
+// values in the control.
+inline void epx_effects(const std::vector<double>& scalar_pars,
+                        const std::vector<std::vector<double>>& vector_pars,
+                        const scenario_type& scen,
+                        const std::vector<double>& x0,
+                        const std::vector<double>& t_req,
+                        double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                        int solver, const std::vector<double>& MF,
+                        const std::vector<size_t>& traits, unsigned n_threads,
+                        double* out, std::vector<double>& Xctrl)
+{
+    size_t n_MF = MF.size();
+    std::shared_ptr<const requested_checkpoint> rc = epx_checkpoint(scalar_pars, vector_pars, scen, x0, t_req,
+                                                                    Tbp, len, break_time, abs_err, rel_err, solver);
+    std::vector<std::array<double,4>> Xend(n_MF+1); // final states, control first
+    parallel_for(n_MF+1, n_threads, [&](size_t task){
+        Xend[task] = epx_final_states(scalar_pars, vector_pars, scen, x0, t_req, Tbp, len,
+                                      break_time, abs_err, rel_err, solver,
+                                      (task == 0) ? 0. : MF[task-1], rc.get());
+    });
+    Xctrl.resize(traits.size());
+    for (size_t j = 0; j < traits.size(); j++){
+        Xctrl[j] = Xend[0][traits[j]];
+        for (size_t i = 0; i < n_MF; i++){
+            out[i + n_MF*j] = Xend[i+1][traits[j]] / Xctrl[j];
+        }
+    }
+}
+
+// The effects of one parameter set and scenario, for the EPx search with
+// fzero in calc_epx.m. The control is solved once, and each MF is solved
+// once for all traits: the results are kept, so that the searches for the
+// other traits and effect levels can use them. All MFs resume from a
+// checkpoint of the control (see epx_checkpoint).
+struct epx_evaluator
+{
+    epx_evaluator(const std::vector<double>& scalar_pars,
+                  const std::vector<std::vector<double>>& vector_pars,
+                  const scenario_type& scen,
+                  const std::vector<double>& x0,
+                  const std::vector<double>& t_req,
+                  double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                  int solver, const std::vector<size_t>& traits)
+        : scalar_pars(scalar_pars), vector_pars(vector_pars), scen(scen), x0(x0), t_req(t_req),
+          Tbp(Tbp), len(len), break_time(break_time), abs_err(abs_err), rel_err(rel_err),
+          solver(solver), traits(traits), n_sim(0)
+    {
+        rc = epx_checkpoint(scalar_pars, vector_pars, scen, x0, t_req, Tbp, len, break_time,
+                            abs_err, rel_err, solver);
+        std::array<double,4> X = final_states(0.);
+        for (size_t loc : traits){
+            Xctrl.push_back(X[loc]);
+        }
+    }
+
+    // final values of the traits relative to the control
+    const std::vector<double>& effects(double MF)
+    {
+        auto it = cache.find(MF);
+        if (it == cache.end()){
+            std::array<double,4> X = final_states(MF);
+            std::vector<double> rel(traits.size());
+            for (size_t j = 0; j < traits.size(); j++){
+                rel[j] = X[traits[j]] / Xctrl[j];
+            }
+            it = cache.emplace(MF, rel).first;
+        }
+        return it->second;
+    }
+
+    std::vector<double> scalar_pars;
+    std::vector<std::vector<double>> vector_pars;
+    scenario_type scen;
+    std::vector<double> x0, t_req;
+    double Tbp;
+    int len;
+    bool break_time;
+    double abs_err, rel_err;
+    int solver;
+    std::vector<size_t> traits;
+
+    std::vector<double> Xctrl;
+    std::map<double, std::vector<double>> cache; // MF -> effects
+    size_t n_sim; // number of simulations (including the control)
+    std::shared_ptr<const requested_checkpoint> rc; // checkpoint of the control
+
+private:
+    std::array<double,4> final_states(double MF)
+    {
+        n_sim++;
+        return epx_final_states(scalar_pars, vector_pars, scen, x0, t_req, Tbp, len,
+                                break_time, abs_err, rel_err, solver, MF, rc.get());
+    }
+};
+
+// The MF where trait j reaches an effect Feff, as fzero(@calc_epx_helper,...)
+// in calc_epx.m: with the interval [a b], or with b = NaN, starting from a
+// and searching for an interval first (as fzero does for a scalar starting
+// point, but not below MF = 0). The interval is narrowed down to the first
+// change of sign among the effects that are already known, and the zero is
+// found with the algorithm of fzero (bisection, secant and inverse
+// quadratic interpolation) to the precision of fzero. Returns NaN when no
+// change of sign is found.
+inline double epx_root(epx_evaluator& ev, size_t j, double Feff, double a, double b)
+{
+    auto f = [&](double MF){ return ev.effects(MF)[j] - (1. - Feff); };
+    const double tol_x = std::numeric_limits<double>::epsilon(); // default TolX of fzero
+    double fa, fb;
+
+    if (std::isnan(a)){
+        return NAN;
+    }
+    fa = f(a);
+    if (fa == 0){
+        return a;
+    }
+    if (std::isnan(b)){ // search for an interval around the starting point
+        double x = a, fx = fa;
+        double dx = (x != 0) ? std::fabs(x)/50 : 1./50;
+        fb = fx;
+        b = x;
+        for (int i = 0; (fa > 0) == (fb > 0); i++){
+            if (i == 100 || !std::isfinite(fa) || !std::isfinite(fb)){
+                return NAN;
+            }
+            dx *= std::sqrt(2.);
+            a  = std::max(x - dx, 0.);
+            fa = f(a);
+            if ((fa > 0) != (fb > 0)) break;
+            b  = x + dx;
+            fb = f(b);
+        }
+    }
+    else{
+        fb = f(b);
+    }
+    if (fb == 0){
+        return b;
+    }
+    if (!std::isfinite(fa) || !std::isfinite(fb) || (fa > 0) == (fb > 0)){
+        return NAN;
+    }
+
+    // first change of sign among the known effects in the interval
+    if (a > b){
+        std::swap(a, b);
+        std::swap(fa, fb);
+    }
+    for (auto it = ev.cache.upper_bound(a); it != ev.cache.end() && it->first < b; ++it){
+        double fi = it->second[j] - (1. - Feff);
+        if (std::isnan(fi)) continue;
+        if ((fi > 0) != (fa > 0)){
+            b  = it->first;
+            fb = fi;
+            break;
+        }
+        a  = it->first;
+        fa = fi;
+    }
+    if (fa == 0) return a;
+    if (fb == 0) return b;
+
+    // as in fzero.m
+    double c = a, fc = fb, d = b - a, e = d;
+    while (fb != 0 && a != b){
+        if ((fb > 0) == (fc > 0)){
+            c  = a;
+            fc = fa;
+            d  = b - a;
+            e  = d;
+        }
+        if (std::fabs(fc) < std::fabs(fb)){
+            a  = b;  b  = c;  c  = a;
+            fa = fb; fb = fc; fc = fa;
+        }
+        double m     = 0.5*(c - b);
+        double toler = 2.0*tol_x*std::max(std::fabs(b), 1.0);
+        if (std::fabs(m) <= toler || fb == 0){
+            break;
+        }
+        if (std::fabs(e) < toler || std::fabs(fa) <= std::fabs(fb)){ // bisection
+            d = m;
+            e = m;
+        }
+        else{
+            double s = fb/fa, p, q;
+            if (a == c){ // secant
+                p = 2.0*m*s;
+                q = 1.0 - s;
+            }
+            else{ // inverse quadratic interpolation
+                q = fa/fc;
+                double r = fb/fc;
+                p = s*(2.0*m*q*(q - r) - (b - a)*(r - 1.0));
+                q = (q - 1.0)*(r - 1.0)*(s - 1.0);
+            }
+            if (p > 0) q = -q;
+            else p = -p;
+            if (2.0*p < std::min(3.0*m*q - std::fabs(toler*q), std::fabs(e*q))){
+                e = d;
+                d = p/q;
+            }
+            else{
+                d = m;
+                e = m;
+            }
+        }
+        a  = b;
+        fa = fb;
+        if (std::fabs(d) > toler) b += d;
+        else if (b > c) b -= toler;
+        else b += toler;
+        fb = f(b);
+        if (std::isnan(fb)){
+            return NAN;
+        }
+    }
+    return b;
+}
+//]
+
+//[ epx_window
+// Robust EPx for moving time windows over an exposure profile, as
+// calc_epx_window.m with opt_ecx.rob_win = 1 (calling calc_epx.m for each
+// window). Each window starts with a new animal at t = 0, so up to the
+// first exposure in a window (tau), all MFs follow the unexposed control.
+// The control is solved once for all windows, with checkpoints at the tau
+// of each window; the MFs of a window, and its control (MF = 0), are only
+// solved from its checkpoint onwards, on the same time grid.
+struct epx_window_problem
+{
+    std::vector<double> scalar_pars;               // parameters (background hazard already zero)
+    std::vector<std::vector<double>> vector_pars;  // feedb and moa
+    std::vector<double> x0;                        // initial states
+    table_type Cw;                                 // exposure profile (time, concentration), extended as in calc_epx_window.m
+    std::vector<double> Trange;                    // start of each window
+    double Twin;                                   // length of the windows
+    size_t N_t;                                    // number of time points in a window (as in calc_epx.m)
+    double Tbp;                                    // brood-pouch delay (glo.Tbp)
+    int len;                                       // length switch (glo.len)
+    bool break_time;                               // break time vector up for the solver (glo.break_time)
+    double abs_err, rel_err;                       // tolerances of the ODE solver
+    int solver;                                    // 0 for dopri5, 2 for rosenbrock4
+    std::vector<double> MF_test;                   // MFs for the robust EPx (opt_ecx.rob_rng)
+    std::vector<double> Feff;                      // effect levels
+    std::vector<size_t> traits;                    // states for the traits
+};
+
+// The profile of one window, as calc_epx_window.m cuts it from Cw: from T1
+// up to the first time point at or after T1+Twin, starting with an
+// interpolated point at T1, and with the time shifted to start at zero.
+inline table_type cut_window(const table_type& Cw, double T1, double Twin)
+{
+    auto first_at = [&](double T){
+        size_t i = 0;
+        while (i < Cw.size() && Cw[i][0] < T) i++;
+        return i;
+    };
+    size_t ind_1 = first_at(T1), ind_2 = first_at(T1 + Twin);
+    table_type w(Cw.begin() + ind_1, (ind_2 < Cw.size()) ? Cw.begin() + ind_2 + 1 : Cw.end());
+    if (w.empty() || w[0][0] > T1){ // interpolate to the exact point (interp1)
+        double c0 = NAN;
+        if (ind_1 > 0 && ind_1 < Cw.size()){
+            const std::vector<double>& a = Cw[ind_1-1];
+            const std::vector<double>& b = Cw[ind_1];
+            c0 = a[1] + (b[1] - a[1])*(T1 - a[0])/(b[0] - a[0]);
+        }
+        w.insert(w.begin(), {T1, c0});
+    }
+    for (std::vector<double>& row : w){
+        row[0] -= T1;
+    }
+    return w;
+}
+
+// Observer for a window from its checkpoint: the final states, the maximum
+// length so far (len=2) and the reproduction at the brood-pouch time point
+struct window_observer
+{
+    state_type m_x;
+    double m_L;    // maximum length so far
+    double m_t_bp; // brood-pouch time point (NaN when not needed)
+    double m_R_bp; // reproduction at that point
+
+    window_observer( double L , double t_bp , double R_bp )
+    : m_L( L ) , m_t_bp( t_bp ) , m_R_bp( R_bp ) { }
+
+    template< class State >
+    void operator()( const State &x , double t )
+    {
+        std::copy( x.begin() , x.end() , m_x.begin() );
+        m_L = std::max( m_L , x[1] );
+        if( t == m_t_bp )
+            m_R_bp = x[2];
+    }
+};
+
+// EPx for all windows. EPx gets n_win x n_traits x n_Feff values
+// (column-major), and kept n_win x n_traits flags for the traits that
+// calc_epx.m returns for a window; windows without exposure are skipped
+// (NaN). The windows are spread over the thread pool.
+inline void epx_window(const epx_window_problem& prob, unsigned n_threads, double* EPx, double* kept)
+{
+    size_t n_win = prob.Trange.size(), n_X = prob.traits.size(), n_F = prob.Feff.size();
+    std::fill(EPx, EPx + n_win*n_X*n_F, NAN);
+    std::fill(kept, kept + n_win*n_X, 0.);
+    double L0   = prob.scalar_pars[4];
+    double Tlag = prob.scalar_pars[12];
+    double F_max = *std::max_element(prob.Feff.begin(), prob.Feff.end());
+    double F_min = *std::min_element(prob.Feff.begin(), prob.Feff.end());
+
+    // the windows, their first exposure and their end
+    std::vector<table_type> wins(n_win);
+    std::vector<double> tau(n_win), t_end(n_win), t_ctrl;
+    std::vector<bool> exposed(n_win, false);
+    for (size_t i = 0; i < n_win; i++){
+        wins[i] = cut_window(prob.Cw, prob.Trange[i], prob.Twin);
+        size_t j = 0;
+        while (j < wins[i].size() && wins[i][j][1] == 0) j++;
+        exposed[i] = j < wins[i].size(); // if there is no exposure, there is no effect
+        tau[i]   = (j > 0) ? wins[i][j-1][0] : 0.;
+        t_end[i] = wins[i].back()[0];
+        t_ctrl.push_back(tau[i]);
+        if (prob.Tbp > 0 && t_end[i] > prob.Tbp){ // reproduction when it is before tau
+            t_ctrl.push_back(t_end[i] - prob.Tbp);
+        }
+    }
+    t_ctrl.push_back(0.);
+    unique_sorted(t_ctrl);
+
+    // the control up to the checkpoints, once for all windows
+    scenario_type scen_0 = model_type().scenario(0.);
+    state_type x;
+    std::copy(prob.x0.begin(), prob.x0.end(), x.begin());
+    x[1] = L0; // initial body length is a parameter
+    std::vector<double> p0(prob.scalar_pars);
+    p0[20] = 0.;
+    // (with the step sizes of a time-varying exposure, as for the windows)
+    time_grid g0 = make_time_grid(t_ctrl, scen_0.Tev, true, Tlag, 0., prob.len, prob.break_time);
+    std::vector<state_type> X_ctrl;
+    std::vector<double> t_grid, TE;
+    DEBderi deri_0(deb_pars(p0, prob.vector_pars), scen_0);
+    if (prob.break_time){
+        integrate_intervals(deri_0, x, g0.t, g0.T, scen_0.Tev, g0.initial_step, prob.abs_err, prob.rel_err,
+                            g0.max_step, X_ctrl, t_grid, TE, prob.solver);
+    }
+    else{
+        integrate_scenario(deri_0, x, g0.t, g0.initial_step, prob.abs_err, prob.rel_err,
+                           g0.max_step, X_ctrl, t_grid, TE, prob.solver);
+    }
+    std::vector<double> L_max(t_grid.size()); // maximum length so far (as cummax in call_deri.m)
+    for (size_t k = 0; k < t_grid.size(); k++){
+        L_max[k] = (k == 0) ? X_ctrl[k][1] : std::max(L_max[k-1], X_ctrl[k][1]);
+    }
+    auto at = [&](double t){ return locate_time(t_grid, t); };
+
+    parallel_for(n_win, n_threads, [&](size_t i){
+        if (!exposed[i]) return;
+
+        // exposure scenario of this window (linear interpolation, as in calc_epx.m)
+        std::vector<double> tw, cw;
+        for (const std::vector<double>& row : wins[i]){
+            tw.push_back(row[0]);
+            cw.push_back(row[1]);
+        }
+        model_type m;
+        m.int_scen = {1.};
+        m.int_coll = {make_scen_table(4, tw, cw)};
+        m.int_type = {4};
+        scenario_type scen = m.scenario(1.);
+
+        double t_bp = (prob.Tbp > 0) ? t_end[i] - prob.Tbp : NAN;
+        std::vector<double> t_req;
+        for (size_t k = 0; k < prob.N_t; k++){
+            t_req.push_back(t_end[i]*k/(prob.N_t - 1)); // linspace
+        }
+        t_req.back() = t_end[i];
+        if (t_bp > tau[i]) t_req.push_back(t_bp);
+        unique_sorted(t_req);
+
+        // the time grid of call_deri.m, from the checkpoint at tau on
+        time_grid g = make_time_grid(t_req, scen.Tev, true, Tlag, 0., prob.len, prob.break_time);
+        std::vector<double> t_w(1, tau[i]), T_w(1, tau[i]);
+        for (double tk : g.t) if (tk > tau[i]) t_w.push_back(tk);
+        for (double tk : g.T) if (tk > tau[i]) T_w.push_back(tk);
+
+        // final states for one MF (control for MF = 0), from the checkpoint
+        auto final_states = [&](double MF){
+            size_t k = at(tau[i]);
+            state_type xw = X_ctrl[k];
+            std::vector<double> p(prob.scalar_pars);
+            p[20] = MF;
+            double R_bp = (t_bp > 0 && t_bp <= tau[i]) ? X_ctrl[at(t_bp)][2] : 0.;
+            window_observer obs(L_max[k], t_bp, R_bp);
+            std::vector<double> TE_w;
+            DEBderi deri(deb_pars(p, prob.vector_pars), scen);
+            if (prob.break_time){
+                integrate_intervals(deri, xw, t_w, T_w, scen.Tev, g.initial_step, prob.abs_err,
+                                    prob.rel_err, g.max_step, obs, TE_w, prob.solver);
+            }
+            else{
+                integrate_scenario(deri, xw, t_w, g.initial_step, prob.abs_err, prob.rel_err,
+                                   g.max_step, boost::ref( obs ), TE_w, prob.solver);
+            }
+            std::array<double,4> Xend = obs.m_x;
+            if (prob.len == 2) Xend[1] = obs.m_L;
+            if (prob.Tbp > 0) Xend[2] = obs.m_R_bp;
+            Xend[3] = std::max(0., Xend[3]); // survival should not get negative
+            return Xend;
+        };
+        std::array<double,4> Xc = final_states(0.);
+        auto effects = [&](double MF){
+            std::array<double,4> X = final_states(MF);
+            std::vector<double> rel(n_X);
+            for (size_t j = 0; j < n_X; j++){
+                rel[j] = X[prob.traits[j]] / Xc[prob.traits[j]];
+            }
+            return rel;
+        };
+
+        // rough exploration of the MF range, as in calc_epx.m, to see which
+        // traits have enough effect
+        std::vector<double> rmin(n_X, INFINITY), rmax(n_X, -INFINITY);
+        auto add_rough = [&](double MF, bool nan_is_one){
+            std::vector<double> rel = effects(MF);
+            for (size_t j = 0; j < n_X; j++){
+                double r = (std::isnan(rel[j]) && nan_is_one) ? 1. : rel[j]; // NaN is no effect
+                if (std::isnan(r)) continue; // min and max skip NaNs
+                rmin[j] = std::min(rmin[j], r);
+                rmax[j] = std::max(rmax[j], r);
+            }
+        };
+        double MF = 1;
+        add_rough(MF, false);
+        while (MF < 1e6 && !std::all_of(rmin.begin(), rmin.end(), [&](double r){ return r < 1-F_max; })){
+            MF *= 10;
+            add_rough(MF, true);
+        }
+        MF = 1;
+        while (MF > 1e-3 && !std::all_of(rmax.begin(), rmax.end(), [&](double r){ return r > 1-F_min; })){
+            MF /= 10;
+            add_rough(MF, true);
+        }
+        if (MF == 1e-3){
+            throw std::runtime_error("It appears that there are effects at MFs much lower than 1; either the risk is very high or something has gone wrong!");
+        }
+
+        // robust EPx: all MFs, and linear interpolation
+        size_t n_MF = prob.MF_test.size();
+        std::vector<std::vector<double>> Xout(n_MF);
+        for (size_t k = 0; k < n_MF; k++){
+            Xout[k] = effects(prob.MF_test[k]);
+        }
+        for (size_t j = 0; j < n_X; j++){
+            if (rmin[j] > 1-F_min) continue; // trait is removed in calc_epx.m
+            kept[i + n_win*j] = 1.;
+            for (size_t f = 0; f < n_F; f++){
+                double y = 1 - prob.Feff[f], val;
+                if (Xout[n_MF-1][j] > y){ // not enough effect at the end
+                    val = prob.MF_test[n_MF-1];
+                }
+                else if (Xout[0][j] < y){ // too much effect at the start
+                    val = prob.MF_test[0];
+                }
+                else{ // first place that has a crossing
+                    size_t k = 1;
+                    while (k < n_MF && !(Xout[k][j] < y)) k++;
+                    if (k == n_MF){
+                        val = NAN;
+                    }
+                    else{
+                        double e0 = Xout[k-1][j], e1 = Xout[k][j];
+                        val = prob.MF_test[k-1] + (y - e0)*(prob.MF_test[k] - prob.MF_test[k-1])/(e1 - e0);
+                    }
+                }
+                EPx[i + n_win*(j + n_X*f)] = val;
+            }
+        }
+    });
+}
+//]
+
+//[ pop_growth
+// Intrinsic rate of increase from the Euler-Lotka equation, as
+// calc_epx_helper.m with calc_int = 1 (used by calc_pop.m). The
+// reproduction rate Rp (differences of R on t) and the mean survival Sp in
+// each interval of t are taken at the midpoints t2, and r follows from
+// trapz(t2,Rp.*Sp.*exp(-r*(t2+Th))) = 1. The kernel is kept as the terms of
+// the trapezium rule, c_i*exp(-r*a_i) with a_i = t2_i + Th, so that each
+// evaluation for another r is only a sum.
+struct euler_lotka_kernel
+{
+    std::vector<double> a; // t2 + Th
+    std::vector<double> c; // Rp.*Sp with the weights of the trapezium rule
+    bool repro = false;    // any(Rp>0)
+
+    // sum of the kernel for rate r, minus 1, and its derivative to r
+    double crit(double r, double* dcrit = nullptr) const
+    {
+        double f = 0, df = 0;
+        for (size_t i = 0; i < a.size(); i++){
+            double ci = c[i]*std::exp(-r*a[i]);
+            f  += ci;
+            df -= a[i]*ci;
+        }
+        if (dcrit) *dcrit = df;
+        return f - 1;
+    }
+};
+
+// Kernel from the output of solve_requested on t (nt x 4, column-major)
+inline euler_lotka_kernel make_euler_lotka_kernel(const std::vector<double>& t, const double* X, double Th)
+{
+    euler_lotka_kernel k;
+    size_t nt = t.size();
+    if (nt < 2) return k;
+    const double* Rc = X + 2*nt; // cumulative reproduction
+    const double* S  = X + 3*nt; // survival
+    std::vector<double> t2(nt-1), K(nt-1);
+    for (size_t i = 0; i+1 < nt; i++){
+        t2[i] = (t[i] + t[i+1])/2;
+        double Rp = (Rc[i+1] - Rc[i])/(t[i+1] - t[i]);
+        if (Rp > 0) k.repro = true;
+        K[i] = Rp*(S[i] + S[i+1])/2;
+    }
+    k.a.resize(nt-1);
+    k.c.assign(nt-1, 0.);
+    for (size_t i = 0; i+1 < nt; i++){
+        k.a[i] = t2[i] + Th;
+        if (i+2 < nt){ // interval from t2(i) to t2(i+1)
+            double w = (t2[i+1] - t2[i])/2;
+            k.c[i]   += w*K[i];
+            k.c[i+1] += w*K[i+1];
+        }
+    }
+    return k;
+}
+
+// The rate r where the kernel sums to 1: NaN without reproduction, and 0
+// when the kernel does not reach 1 for r = 0 (as calc_epx_helper.m, no
+// negative rates). The sum decreases with r and is convex, so Newton steps
+// approach the root from below; the steps are kept inside the interval
+// that is known to hold the root, with bisection as a fall-back (e.g.,
+// when some terms are negative). The precision is that of fzero.
+inline double euler_lotka_rate(const euler_lotka_kernel& k, double r_init = 1.)
+{
+    const double tol_x = std::numeric_limits<double>::epsilon();
+    if (!k.repro) return NAN;
+    if (!(k.crit(0.) > 0)) return 0.; // don't calculate negative rates
+
+    double lo = 0, hi = INFINITY; // crit > 0 at lo, and < 0 at hi
+    double r = (r_init > 0 && std::isfinite(r_init)) ? r_init : 1.;
+    for (int iter = 0; iter < 200; iter++){
+        double df, f = k.crit(r, &df);
+        if (f == 0) return r;
+        if (f > 0) lo = r; else hi = r;
+        double r_new = r - f/df;
+        if (!(r_new > lo && r_new < hi)){ // outside the interval: bisection (or doubling)
+            r_new = std::isinf(hi) ? 2*std::max(r, 1.) : (lo + hi)/2;
+        }
+        if (std::fabs(r_new - r) <= 2*tol_x*std::max(std::fabs(r_new), 1.) || hi - lo <= 2*tol_x*std::max(hi, 1.)){
+            return r_new;
+        }
+        r = r_new;
+    }
+    return r;
+}
+
+// Intrinsic rate of increase for all treatments (scenarios, with initial
+// states x0), food levels and parameter sets, as calc_pop.m does with
+// calc_epx_helper.m for each of them. The food level replaces f (element 9
+// of scalar_pars); with an empty fscen, the f of each set is used. Each
+// combination is simulated once on t, and r is found on the kernel of
+// that simulation. The combinations are spread over the thread pool. rgr
+// gets n_c x n_f x n_sets values (column-major).
+inline void pop_growth_rates(const table_type& par_sets,
+                             const std::vector<std::vector<double>>& vector_pars,
+                             const std::vector<scenario_type>& scenarios,
+                             const std::vector<std::vector<double>>& x0,
+                             const std::vector<double>& fscen,
+                             const std::vector<double>& t, double Th,
+                             double Tbp, int len, bool break_time, double abs_err, double rel_err,
+                             int solver, unsigned n_threads, double* rgr)
+{
+    size_t n_c = scenarios.size(), n_f = std::max<size_t>(fscen.size(), 1), n_sets = par_sets.size();
+    size_t nt = t.size();
+    parallel_for(n_c*n_f*n_sets, n_threads, [&](size_t task){
+        size_t j = task % n_c;         // treatment
+        size_t i = (task / n_c) % n_f; // food level
+        size_t k = task / (n_c*n_f);   // parameter set
+        std::vector<double> p(par_sets[k]);
+        if (!fscen.empty()) p[9] = fscen[i];
+        std::vector<double> X(nt*4);
+        solve_requested(p, vector_pars, scenarios[j], x0[j], t, Tbp, len, break_time,
+                        abs_err, rel_err, solver, X.data());
+        rgr[task] = euler_lotka_rate(make_euler_lotka_kernel(t, X.data(), Th));
+    });
+}
+//]
+
+#endif // DEBTOX_CORE_HPP
@@ -0,0 +1,28 @@
+%% BYOM function make_parvec.m (flattens the model parameters for the C++ code)
+%
+%  Syntax: pvec = make_parvec(par,glo)
+%
+% This function collects the parameters that test_derivatives needs into a
+% single row vector, in the same order as the vector scalar_pars in the C++
+% code. This is used for the modes of test_derivatives that take parameter
+% values as plain numbers, rather than as the structures par and glo.
+%
+% As input, it gets:
+% * _par_ the parameter structure
+% * _glo_ the structure with various types of information (used to be global)
+%
+% The output _pvec_ is a row vector with 22 elements:
+% [FBV KRV kap yP L0 Lp Lm rB Rm f hb Lf Tlag kd zb bb zs bs Lj Lm_ref MF a]
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function pvec = make_parvec(par,glo)
+
+pvec = [glo.FBV glo.KRV glo.kap glo.yP ... % globals for the energy budget
+    par.L0(1) par.Lp(1) par.Lm(1) par.rB(1) par.Rm(1) par.f(1) par.hb(1) ... % basic life history
+    par.Lf(1) par.Tlag(1) ... % extra parameters for specific cases
+    par.kd(1) par.zb(1) par.bb(1) par.zs(1) par.bs(1) ... % response to toxicants
+    par.Lj(1) glo.Lm_ref glo.MF par.a(1)];
@@ -0,0 +1,89 @@
+%% BYOM function mex_handle.m (calls the C++ code for the registered model)
+%
+%  Syntax: h = mex_handle(glo)
+%          varargout = mex_handle(glo,mode,varargin)
+%
+% This function registers the parts of _glo_ that define the model (glo.feedb,
+% glo.moa and the exposure scenarios in glo.int_scen, glo.int_coll and
+% glo.int_type) with test_derivatives. Calls to test_derivatives with the
+% handle only need the parameter values as a flat vector (see
+% <make_parvec.html make_parvec.m>), which saves decoding the structures par
+% and glo in C++ for each call. In an optimisation, the parameters change
+% but these fields of glo do not, so the model is registered only once.
+% When these fields change (e.g., for another MoA in automatic_runs, or a
+% scenario multiplied by a factor in make_scen.m), the model is registered
+% again. To keep this check cheap, the scenarios in glo.int_coll are
+% compared by their size and the sum of their values, and not element by
+% element.
+%
+% With only _glo_ as input, the handle is returned. With a _mode_, this
+% function calls test_derivatives(mode,h,varargin{:}) and returns its
+% outputs. When the first input in _varargin_ is a structure (the problem
+% from <mex_problem.html mex_problem.m>), the handle goes into its field h
+% instead. After clear mex, the C++ code forgets the registered models;
+% test_derivatives then ends with the error identifier
+% test_derivatives:unknownHandle, and this function registers the model
+% again and repeats the call. Use the second syntax for all calls with a
+% handle, as a handle alone cannot be checked without calling the C++ code.
+%
+% As input, it gets:
+% * _glo_      the structure with various types of information (used to be global)
+% * _mode_     the mode of test_derivatives (e.g., 'solve' or 'batch')
+% * _varargin_ the other inputs for test_derivatives, without the handle
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function varargout = mex_handle(glo,mode,varargin)
+
+persistent h_rem glo_rem % remember the handle and the registered fields
+
+glo_mod = {glo.feedb,glo.moa,[],[],[]}; % fields of glo that define the model
+if isfield(glo,'int_scen') && ~isempty(glo.int_scen)
+    glo_mod(3:5) = {glo.int_scen,glo.int_type,cellfun(@coll_sum,glo.int_coll)};
+end
+
+if isempty(h_rem) || ~isequal(glo_mod,glo_rem) % new or changed model
+    if ~isempty(h_rem)
+        test_derivatives('release',h_rem); % the old model is not needed anymore
+    end
+    h_rem   = test_derivatives('register',mex_scen(glo)); % splines as tables
+    glo_rem = glo_mod;
+end
+
+if nargin < 2
+    varargout{1} = h_rem;
+    return
+end
+
+for i_try = 1:2 % the second try is after registering again
+    args = varargin;
+    if isstruct(args{1}) % problem from mex_problem.m
+        args{1}.h = h_rem;
+    else
+        args = [{h_rem} args];
+    end
+    try
+        [varargout{1:nargout}] = test_derivatives(mode,args{:});
+        return
+    catch ME
+        if i_try == 2 || ~strcmp(ME.identifier,'test_derivatives:unknownHandle')
+            rethrow(ME)
+        end
+        h_rem = test_derivatives('register',mex_scen(glo)); % the MEX file was cleared
+    end
+end
+
+%% Checksum of one exposure scenario
+
+function chk = coll_sum(int_coll)
+
+if isa(int_coll,'griddedInterpolant')
+    x   = int_coll.GridVectors{1};
+    v   = int_coll.Values;
+    chk = numel(x) + sum(x) + sum(v);
+else
+    chk = numel(int_coll) + sum(int_coll(:));
+end
@@ -0,0 +1,95 @@
+%% BYOM function mex_problem.m (collects the likelihood problem for the C++ code)
+%
+%  Syntax: prob = mex_problem(pmat,WRAP)
+%
+% This function collects everything that test_derivatives needs to
+% calculate the minus log-likelihood for a set of fitted parameters, as
+% <transfer.html transfer.m> does: the model handle, the data, the initial
+% states, the settings of the solver, and where each fitted parameter of
+% _pmat_ goes in the parameter vector of <make_parvec.html make_parvec.m>.
+% It is used for the 'parspace', 'mutate', 'slice' and 'proflik' modes of
+% test_derivatives, which calculate the likelihood of many parameter sets
+% on a pool of threads (see calc_parspace.m, rand_mutations.m,
+% calc_slice.m and calc_proflik.m in engine_par).
+%
+% As input, it gets:
+% * _pmat_ the parameter matrix (log-scale parameters on log10 scale, as
+%          in calc_parspace.m)
+% * _WRAP_ a wrapper for things that used to be global (e.g., glo and DATA)
+%
+% The output _prob_ is a structure, or empty when the C++ code cannot be
+% used. That is the case for other solvers than the ones in C++, for
+% data-set specific parameters, for priors and zero-variate data, for extra
+% data (glo2.n_X2>0), for data types other than continuous and multinomial
+% survival data (as <call_loglik.html call_loglik.m>), and when a fitted
+% parameter is not one of the parameters in make_parvec.m.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function prob = mex_problem(pmat,WRAP)
+
+prob = []; % empty means: use transfer.m
+glo  = WRAP.glo;
+glo2 = WRAP.glo2;
+
+% Same checks as in call_loglik.m, and for the parts of transfer.m that are
+% not in C++.
+[use_mex,solver,AbsTol,RelTol] = mex_settings(glo,glo2.ctot);
+if ~use_mex
+    return
+end
+if glo2.n_X2 > 0 || ~isempty(glo2.pri) || (isfield(glo,'zvd') && ~isempty(glo.zvd))
+    return
+end
+for i = 1:numel(WRAP.DATA)
+    lam = WRAP.DATA{i}(1,1);
+    if size(WRAP.DATA{i},1) > 1 && lam < 0 && lam ~= -1
+        return
+    end
+end
+
+% Location of each fitted parameter in the vector of make_parvec.m (the
+% empty names are taken from glo).
+names_pvec = {'','','','','L0','Lp','Lm','rB','Rm','f','hb','Lf','Tlag',...
+    'kd','zb','bb','zs','bs','Lj','','','a'};
+ind_fit = find(pmat(:,2) == 1);
+[is_pvec,loc_fit] = ismember(glo2.names(ind_fit),names_pvec);
+if ~all(is_pvec)
+    return
+end
+
+% Parameter vector with the values in pmat (on normal scale); the fitted
+% ones are replaced in C++.
+p = pmat(:,1);
+p(pmat(:,5)==0) = 10.^(p(pmat(:,5)==0));
+par = packunpack(2,0,p,WRAP);
+
+% Bounds of the fitted parameters, on log10 scale where needed (as in transfer.m)
+bnds = pmat(ind_fit,[3 4]);
+log_fit = pmat(ind_fit,5) == 0;
+bnds(log_fit,:) = log10(bnds(log_fit,:));
+
+[~,locX0] = ismember(glo2.ctot,WRAP.X0mat(1,:)); % location of each concentration in X0mat
+
+prob.h          = mex_handle(glo);
+prob.ttot       = glo2.ttot(:);
+prob.X0mat      = WRAP.X0mat(:,locX0);
+prob.DATA       = WRAP.DATA;
+prob.W          = WRAP.W;
+prob.stiff      = solver;
+prob.AbsTol     = AbsTol;
+prob.RelTol     = RelTol;
+prob.Tbp        = glo.Tbp;
+prob.len        = glo.len;
+prob.break_time = glo.break_time;
+prob.sameres    = glo.sameres;
+prob.var        = glo.var;
+prob.wts        = glo.wts;
+prob.pvec       = make_parvec(par,glo);
+prob.loc_fit    = loc_fit(:);
+prob.log_fit    = double(log_fit);
+prob.bnds       = bnds;
+prob.n_cores    = glo2.n_cores;
@@ -0,0 +1,61 @@
+%% BYOM function mex_scen.m (prepares the exposure scenarios for the C++ code)
+%
+%  Syntax: glo = mex_scen(glo)
+%
+% The C++ code in test_derivatives reads the exposure scenarios in
+% glo.int_coll as numerical tables. Scenarios of type 1 (splines, see
+% make_scen.m) are stored as griddedInterpolant objects, which C++ cannot
+% read. This function replaces those by a table with the piecewise
+% polynomial of the same interpolation. Each row contains the start of an
+% interval (the grid points of the spline) and the coefficients of the
+% cubic polynomial in that interval:
+%
+%   [t_i c0 c1 c2 c3], with c(t) = c0 + c1*dt + c2*dt^2 + c3*dt^3 and dt = t-t_i
+%
+% The last row holds the last grid point with a constant concentration, as
+% the interpolant extrapolates with the nearest value. The other types of
+% scenario are left as they are.
+%
+% As input, it gets:
+% * _glo_ the structure with various types of information (used to be global)
+%
+% The output _glo_ is the same structure, with the modified glo.int_coll.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function glo = mex_scen(glo)
+
+if ~isfield(glo,'int_type') || isempty(glo.int_type)
+    return % no time-varying exposure scenarios
+end
+
+for i = find(glo.int_type == 1) % run through all spline scenarios
+    if isa(glo.int_coll{i},'griddedInterpolant') % it may already be a table
+        glo.int_coll{i} = spline_table(glo.int_coll{i});
+    end
+end
+
+%% Piecewise polynomial for one interpolant
+
+function tab = spline_table(G)
+
+x = G.GridVectors{1}(:); % grid points of the spline
+v = G.Values(:);         % values at the grid points
+
+switch G.Method % same interpolation as the griddedInterpolant
+    case 'pchip'
+        pp = pchip(x,v);
+    case 'spline'
+        pp = spline(x,v);
+    case 'linear'
+        pp = mkpp(x,[diff(v)./diff(x) v(1:end-1)]);
+    otherwise
+        error(['Interpolation method ',G.Method,' for exposure scenarios is not supported in C++.'])
+end
+
+[~,coefs] = unmkpp(pp); % coefficients, highest power first
+coefs = [zeros(size(coefs,1),4-size(coefs,2)) coefs]; % make them all cubic
+tab   = [x(1:end-1) fliplr(coefs); x(end) v(end) 0 0 0];
@@ -0,0 +1,56 @@
+%% BYOM function mex_settings.m (solver settings for the C++ code)
+%
+%  Syntax: [use_mex,solver,AbsTol,RelTol] = mex_settings(glo,scen)
+%
+% This function collects the settings that all calls to the C++ code in
+% test_derivatives need, so that they are the same everywhere: whether the
+% C++ code can be used at all, the ODE solver, and the tolerances for
+% glo.stiff(2). It is used by <call_deri.html call_deri.m> and by the
+% functions that call the special modes of test_derivatives (e.g.,
+% call_deri_batch.m, call_loglik.m and call_epx.m).
+%
+% As input, it gets:
+% * _glo_  the structure with various types of information (used to be global)
+% * _scen_ the concentrations or scenario identifiers that will be solved
+%          (optional)
+%
+% The output _use_mex_ is false when the C++ code cannot be used: for an ODE
+% solver that is not available in C++ (glo.stiff(1) other than 0, 2 or 3),
+% or with data-set specific parameters (glo.names_sep) for scenario
+% identifiers of 100 and above, as par then depends on the scenario. The
+% output _solver_ is glo.stiff(1), and _AbsTol_ and _RelTol_ are the
+% tolerances for the ODE solver.
+
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+%% Start
+
+function [use_mex,solver,AbsTol,RelTol] = mex_settings(glo,scen)
+
+stiff = glo.stiff; % ODE solver 0) dopri5 in C++ (standard), 1) ode113 (moderately stiff), 2) rosenbrock4 in C++ (stiff), 3) dopri5 in C++ with closed form
+if length(stiff) == 1 % second element is used for tolerances
+    stiff(2) = 1; % by default: normally tightened tolerances
+end
+solver = stiff(1);
+
+use_mex = ismember(solver,[0 2 3]); % solvers that are available in C++
+if use_mex && nargin > 1 && ~isempty(glo.names_sep) && any(scen(:) >= 100)
+    use_mex = false; % data-set specific parameters
+end
+
+% tolerances for the ODE solver
+switch stiff(2)
+    case 1 % for ODE15s, slightly tighter tolerances seem to suffice (for ODE113: not tested yet!)
+        RelTol  = 1e-4; % relative tolerance (tightened)
+        AbsTol  = 1e-7; % absolute tolerance (tightened)
+    case 2 % somewhat tighter tolerances ...
+        RelTol  = 1e-5; % relative tolerance (tightened)
+        AbsTol  = 1e-8; % absolute tolerance (tightened)
+    case 3 % for ODE45, very tight tolerances seem to be necessary in some cases
+        RelTol  = 1e-9; % relative tolerance (tightened)
+        AbsTol  = 1e-9; % absolute tolerance (tightened)
+    otherwise % sloppy: the default tolerances of odeset
+        RelTol  = 1e-3; % relative tolerance (default)
+        AbsTol  = 1e-6; % absolute tolerance (default)
+end
@@ -0,0 +1,564 @@
+/*
+  FILE: parspace.hpp
+  for BYOM_v6/DEBtox2019_v45b
+
+ Translation of the sampling rounds of the parameter-space explorer
+ (calc_parspace.m, rand_mutations.m and prune_mat.m in engine_par/parspace)
+ for the model in debtox_core.hpp. The minus log-likelihood of all parameter
+ sets in a round is calculated on a pool of threads, without going back to
+ MATLAB. It is used from test_derivatives ('parspace' and 'mutate' modes);
+ the profiling, the extra sampling rounds and the final optimisation stay in
+ calc_parspace.m.
+
+ =========================================================================
+ Copyright (c) 2018-2022, Tjalling Jager (tjalling@debtox.nl). The algorithm
+ is that of the <calc_parspace> and <rand_mutations> code that is
+ distributed as part of the Matlab version of openGUTS (see
+ http://www.openguts.info). Therefore, this code is distributed under the
+ same license as openGUTS (GPLv3).
+
+ This program is free software: you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by the
+ Free Software Foundation, either version 3 of the License, or (at your
+ option) any later version.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ Public License for more details.
+
+ You should have received a copy of the GNU General Public License along
+ with this program. If not, see <https://www.gnu.org/licenses/>.
+ =========================================================================
+ */
+
+#ifndef PARSPACE_HPP
+#define PARSPACE_HPP
+
+#include "debtox_core.hpp"
+
+#include <random>
+#include <set>
+#include <string>
+#include <sstream>
+#include <limits>
+
+/* Minus log-likelihood for a parameter set (fitted parameters only, on the
+ * fitting scale). Must be safe to call from several threads at once. */
+typedef std::function<double(const double*)> objective_type;
+
+/* Messages for the screen (disp in calc_parspace.m) */
+typedef std::function<void(const std::string&)> display_type;
+
+// Settings for the sampling rounds, as derived from SETTINGS_OPTIM and
+// opt_optim at the start of calc_parspace.m. The criteria are on the scale
+// of the log-likelihood (chi2 criterion divided by 2).
+struct parspace_settings
+{
+    std::vector<double> chicrit_rnd; // criterion to select sets for continuation, per round
+    std::vector<double> n_tr;        // number of mutations per set, per round
+    std::vector<double> f_d;         // maximum step as factor of grid spacing, per round
+    double chicrit_joint  = 0.;      // criterion for the joint 95% CI
+    double chicrit_single = 0.;      // criterion for the single-parameter CIs (inner rim)
+    double chicrit_max    = 0.;      // criterion for pruning the sample
+    size_t n_ok      = 1;            // number of sets that will at least continue to the next round
+    size_t n_conf[2] = {1, 1};       // stop criterion: sets in the joint CI and in the inner rim
+    size_t tries     = 10;           // number of grid points per parameter in round 1
+    size_t n_max     = 12;           // maximum number of rounds
+    size_t n_opt     = 1;            // number of rough optimisations in each round
+    bool rough = true;               // opt_optim.ps_rough
+    bool dupl  = false;              // remove duplicates when the rounds are finished
+    int loc_kd = -1, loc_mw = -1;    // fitted kd and mw, for catching slow kinetics (-1 to skip)
+    double slowkin_corr = 0.7, slowkin_pars = 0.05;
+};
+
+// Result of the sampling rounds. When slow kinetics is caught, minmax has
+// the edges of the tested cloud (normal scale) and coll_all is incomplete.
+struct parspace_result
+{
+    table_type coll_all; // fitted parameters and MLL in the last column, sorted on MLL
+    size_t n_rnd = 1;    // number of rounds done
+    bool slowkin = false;
+    table_type minmax;
+};
+
+//[ parspace_tools
+// Sort the sets on MLL (last column), keeping the order of equal values
+// (as sortrows)
+inline void sort_coll(table_type& coll)
+{
+    std::stable_sort(coll.begin(), coll.end(),
+        [](const std::vector<double>& a, const std::vector<double>& b){ return a.back() < b.back(); });
+}
+
+// Remove sets with MLL at or above mll_crit (sel_mll) and duplicate sets,
+// keeping the first (sel_dupl), as prune_mat.m
+inline void prune_mat(table_type& coll, double mll_crit, bool sel_mll, bool sel_dupl)
+{
+    if (sel_mll){
+        coll.erase(std::remove_if(coll.begin(), coll.end(),
+            [mll_crit](const std::vector<double>& r){ return !(r.back() < mll_crit); }), coll.end());
+    }
+    if (sel_dupl){
+        std::set<std::vector<double>> seen;
+        coll.erase(std::remove_if(coll.begin(), coll.end(),
+            [&seen](const std::vector<double>& r){ return !seen.insert(r).second; }), coll.end());
+    }
+}
+
+// Number of the last set (counting from 1) with MLL below crit, or 0 when
+// there is none (find(...,1,'last') on a sorted matrix)
+inline size_t last_below(const table_type& coll, double crit)
+{
+    for (size_t i = coll.size(); i > 0; i--){
+        if (coll[i-1].back() < crit) return i;
+    }
+    return 0;
+}
+
+// Sets first ... last (counting from 1, as in MATLAB), within the matrix
+inline table_type coll_rows(const table_type& coll, size_t first, size_t last)
+{
+    first = std::max<size_t>(first, 1);
+    last  = std::min(last, coll.size());
+    if (first > last) return table_type();
+    return table_type(coll.begin() + (first-1), coll.begin() + last);
+}
+
+// Fill in the MLL (last column) of all sets on the thread pool
+inline void evaluate_sets(table_type& coll, const objective_type& mll, unsigned n_threads)
+{
+    parallel_for(coll.size(), n_threads, [&](size_t i){
+        coll[i].back() = mll(coll[i].data());
+    });
+}
+
+// Randomly mutate each set in coll_ok n_tr_i times, with a step of at most
+// d_grid_i for each parameter (within the bounds), and calculate the MLL of
+// the new sets. The sets with an infinite MLL are removed, and the rest is
+// sorted on MLL (as rand_mutations.m).
+inline table_type rand_mutations(const table_type& coll_ok, const table_type& bnds, size_t n_tr_i,
+                                 const std::vector<double>& d_grid_i, std::mt19937& rng,
+                                 const objective_type& mll, unsigned n_threads)
+{
+    size_t n_fit = bnds.size();
+    std::uniform_real_distribution<double> unif(0., 1.);
+    table_type coll_tries(coll_ok.size()*n_tr_i, std::vector<double>(n_fit+1, INFINITY));
+    for (size_t i_ok = 0; i_ok < coll_ok.size(); i_ok++){ // run through the ok parameter sets
+        for (size_t i_p = 0; i_p < n_fit; i_p++){
+            for (size_t i_t = 0; i_t < n_tr_i; i_t++){ // random number between -1 and 1, times the max jump
+                double p = coll_ok[i_ok][i_p] + (unif(rng)*2 - 1)*d_grid_i[i_p];
+                coll_tries[i_ok*n_tr_i + i_t][i_p] = std::min(std::max(p, bnds[i_p][0]), bnds[i_p][1]);
+            }
+        }
+    }
+    evaluate_sets(coll_tries, mll, n_threads);
+    prune_mat(coll_tries, INFINITY, true, false); // remove the ones that are INF for the MLL
+    sort_coll(coll_tries);
+    return coll_tries;
+}
+
+// Nelder-Mead simplex, as fminsearch (same initial simplex, coefficients
+// and stop criteria). Returns the best point with its MLL in the last
+// element.
+inline std::vector<double> fminsearch(const objective_type& fun, std::vector<double> x0,
+                                      double tol_x, double tol_fun, size_t max_fun_evals)
+{
+    const double rho = 1, chi = 2, psi = 0.5, sigma = 0.5;
+    const double eps = std::numeric_limits<double>::epsilon();
+    size_t n = x0.size();
+    size_t max_iter = 200*n;
+    table_type v(n+1, x0);
+    std::vector<double> fv(n+1);
+    fv[0] = fun(v[0].data());
+    for (size_t j = 0; j < n; j++){ // initial simplex: 5% steps (0.00025 for zeros)
+        v[j+1][j] = (x0[j] != 0) ? 1.05*x0[j] : 0.00025;
+        fv[j+1] = fun(v[j+1].data());
+    }
+    auto sort_simplex = [&](){
+        std::vector<size_t> ind(n+1);
+        for (size_t j = 0; j <= n; j++) ind[j] = j;
+        std::stable_sort(ind.begin(), ind.end(), [&](size_t a, size_t b){ return fv[a] < fv[b]; });
+        table_type v2(n+1);
+        std::vector<double> fv2(n+1);
+        for (size_t j = 0; j <= n; j++){
+            v2[j]  = v[ind[j]];
+            fv2[j] = fv[ind[j]];
+        }
+        v.swap(v2);
+        fv.swap(fv2);
+    };
+    sort_simplex();
+    size_t func_evals = n+1, iter = 1;
+    std::vector<double> xbar(n), xr(n), xe(n), xc(n);
+    auto point = [&](double a, std::vector<double>& x){ // x = (1+a)*xbar - a*v(:,end)
+        for (size_t i = 0; i < n; i++) x[i] = (1+a)*xbar[i] - a*v[n][i];
+    };
+    while (func_evals < max_fun_evals && iter < max_iter){
+        double dfv = 0., dv = 0., vmax = -INFINITY;
+        for (size_t j = 1; j <= n; j++){
+            dfv = std::max(dfv, std::abs(fv[0] - fv[j]));
+            for (size_t i = 0; i < n; i++) dv = std::max(dv, std::abs(v[j][i] - v[0][i]));
+        }
+        for (size_t i = 0; i < n; i++) vmax = std::max(vmax, v[0][i]);
+        if (dfv <= std::max(tol_fun, 10*eps*std::abs(fv[0])) && dv <= std::max(tol_x, 10*eps*std::abs(vmax))){
+            break;
+        }
+        std::fill(xbar.begin(), xbar.end(), 0.);
+        for (size_t j = 0; j < n; j++){
+            for (size_t i = 0; i < n; i++) xbar[i] += v[j][i]/n;
+        }
+        point(rho, xr); // reflect
+        double fxr = fun(xr.data());
+        func_evals++;
+        bool shrink = false;
+        if (fxr < fv[0]){
+            point(rho*chi, xe); // expand
+            double fxe = fun(xe.data());
+            func_evals++;
+            if (fxe < fxr){
+                v[n] = xe;
+                fv[n] = fxe;
+            }
+            else{
+                v[n] = xr;
+                fv[n] = fxr;
+            }
+        }
+        else if (fxr < fv[n-1]){
+            v[n] = xr;
+            fv[n] = fxr;
+        }
+        else if (fxr < fv[n]){
+            point(psi*rho, xc); // contract outside
+            double fxc = fun(xc.data());
+            func_evals++;
+            if (fxc <= fxr){
+                v[n] = xc;
+                fv[n] = fxc;
+            }
+            else shrink = true;
+        }
+        else{
+            point(-psi, xc); // contract inside
+            double fxcc = fun(xc.data());
+            func_evals++;
+            if (fxcc < fv[n]){
+                v[n] = xc;
+                fv[n] = fxcc;
+            }
+            else shrink = true;
+        }
+        if (shrink){
+            for (size_t j = 1; j <= n; j++){
+                for (size_t i = 0; i < n; i++) v[j][i] = v[0][i] + sigma*(v[j][i] - v[0][i]);
+                fv[j] = fun(v[j].data());
+            }
+            func_evals += n;
+        }
+        sort_simplex();
+        iter++;
+    }
+    std::vector<double> res(v[0]);
+    res.push_back(fv[0]);
+    return res;
+}
+
+// Latin-hypercube sample of n_tries sets between 0 and 1 (one random
+// value in each of the n_tries strata, for each parameter)
+inline table_type latin_hypercube(size_t n_tries, size_t n_fit, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> unif(0., 1.);
+    table_type s(n_tries, std::vector<double>(n_fit+1, INFINITY));
+    std::vector<size_t> perm(n_tries);
+    for (size_t i_p = 0; i_p < n_fit; i_p++){
+        for (size_t i = 0; i < n_tries; i++) perm[i] = i;
+        std::shuffle(perm.begin(), perm.end(), rng);
+        for (size_t i = 0; i < n_tries; i++){
+            s[i][i_p] = (perm[i] + unif(rng))/n_tries;
+        }
+    }
+    return s;
+}
+//]
+
+//[ parspace_rounds
+// Round 1 (regular grid or Latin hypercube) and the subsequent rounds of
+// mutations of calc_parspace.m (BLOCK 3 and 4), until there are enough
+// sets in the joint CI and in the inner rim, or n_max rounds are done. Each
+// round includes n_opt rough optimisations, starting from the best sets.
+inline parspace_result explore_parspace(const fitted_pars& fit, const objective_type& mll_fun,
+                                        parspace_settings s, std::mt19937& rng, unsigned n_threads,
+                                        const display_type& disp)
+{
+    size_t n_fit = fit.size();
+    const table_type& bnds = fit.bnds;
+    parspace_result res;
+    table_type& coll_all = res.coll_all;
+    std::ostringstream msg;
+    auto show = [&](){ disp(msg.str()); msg.str(""); };
+
+    // BLOCK 3.2. Grid spacing for each parameter
+    std::vector<double> d_grid(n_fit);
+    for (size_t i_p = 0; i_p < n_fit; i_p++){
+        d_grid[i_p] = (bnds[i_p][1] - bnds[i_p][0])/(s.tries - 1);
+    }
+
+    // BLOCK 3.3. Regular grid, or Latin-hypercube sampling for many parameters
+    size_t n_tries;
+    if (n_fit < 5 || (n_fit == 5 && !s.rough)){
+        n_tries = 1;
+        for (size_t i_p = 0; i_p < n_fit; i_p++) n_tries *= s.tries;
+        coll_all.assign(n_tries, std::vector<double>(n_fit+1, INFINITY));
+        for (size_t i = 0; i < n_tries; i++){ // all combinations, first parameter varies slowest (as allcomb)
+            size_t k = i;
+            for (size_t i_p = n_fit; i_p-- > 0; ){
+                size_t j = k % s.tries; // last grid point exactly on the bound (as linspace)
+                coll_all[i][i_p] = (j == s.tries - 1) ? bnds[i_p][1] : bnds[i_p][0] + j*d_grid[i_p];
+                k /= s.tries;
+            }
+        }
+    }
+    else{
+        n_tries = 10000;
+        if (!s.rough){
+            n_tries = n_fit < 6 ? 30000 : (n_fit < 8 ? 60000 : 100000);
+        }
+        s.n_ok = std::min<size_t>(s.n_ok, 500);
+        coll_all = latin_hypercube(n_tries, n_fit, rng);
+        disp("Using latin-hypercube sampling in first round, instead of regular grid.");
+        if (n_fit > 5 && s.chicrit_joint < 6){
+            disp("Using a limited outer rim (based of df=5 rather than the actual number of parameters)");
+            disp("   This implies that the blue points can no longer be interpreted as the joint CI!");
+        }
+        for (std::vector<double>& r : coll_all){
+            for (size_t i_p = 0; i_p < n_fit; i_p++){
+                r[i_p] = r[i_p]*(bnds[i_p][1] - bnds[i_p][0]) + bnds[i_p][0];
+            }
+        }
+    }
+
+    // BLOCK 3.4. Likelihood for all sets of round 1
+    disp(" ");
+    msg << "Starting round 1 with initial grid of " << n_tries << " parameter sets";
+    show();
+    evaluate_sets(coll_all, mll_fun, n_threads);
+
+    // BLOCK 3.5. Select the sets to continue with
+    prune_mat(coll_all, INFINITY, true, false); // remove the ones that have INF as minloglik
+    if (coll_all.empty()){
+        throw std::runtime_error("None of the parameter sets in round 1 gave a finite min-log-likelihood");
+    }
+    sort_coll(coll_all);
+    double mll = coll_all[0].back();
+    size_t ind_cont = last_below(coll_all, mll + s.chicrit_rnd[0]);
+    ind_cont = std::min(std::max(ind_cont, s.n_ok), coll_all.size());
+    if (ind_cont > s.n_conf[0]){ // if we already have more than what we finally need ...
+        size_t ind_cont2 = coll_all.size();
+        for (size_t i = 0; i < coll_all.size(); i++){ // how many within *next* chi2 criterion?
+            if (coll_all[i].back() - mll > s.chicrit_rnd[1]){
+                ind_cont2 = i+1;
+                break;
+            }
+        }
+        ind_cont = std::max(s.n_conf[0], ind_cont2);
+    }
+    table_type coll_ok = coll_rows(coll_all, 1, ind_cont);
+
+    // BLOCK 3.6. Settings for the next round
+    msg << "  Status: best fit so far is (minloglik) " << mll;
+    show();
+    size_t& n_rnd = res.n_rnd;
+    n_rnd = 2;
+    auto round_setting = [&](const std::vector<double>& v){
+        return n_rnd <= v.size() ? v[n_rnd-1] : v.back();
+    };
+    size_t n_tr_i    = (size_t)round_setting(s.n_tr);
+    double f_d_i     = round_setting(s.f_d);
+    double chicrit_i = round_setting(s.chicrit_rnd);
+    if (ind_cont > 0.5*s.n_conf[0]){ // if we have more than half of what we finally need ...
+        n_tr_i = n_tr_i/2;
+        if (ind_cont >= s.n_conf[0]){
+            n_tr_i = n_tr_i/2;
+        }
+    }
+    n_tr_i = std::min(n_tr_i, std::max<size_t>(2, (size_t)std::floor(10.*s.n_conf[0]/ind_cont)));
+
+    prune_mat(coll_all, mll + s.chicrit_max, true, false);
+
+    // BLOCK 4. Subsequent rounds
+    bool flag_stop = false, flag_inner = false;
+    std::vector<double> d_grid_i(n_fit);
+    while (!flag_stop){
+        msg << "Starting round " << n_rnd << ", refining a selection of " << coll_ok.size()
+            << " parameter sets, with " << n_tr_i << " tries each";
+        show();
+
+        // BLOCK 4.1. Mutate <coll_ok>
+        for (size_t i_p = 0; i_p < n_fit; i_p++) d_grid_i[i_p] = f_d_i*d_grid[i_p];
+        table_type coll_tries = rand_mutations(coll_ok, bnds, n_tr_i, d_grid_i, rng, mll_fun, n_threads);
+        coll_all.insert(coll_all.end(), coll_tries.begin(), coll_tries.end());
+        sort_coll(coll_all);
+
+        // BLOCK 4.2. Rough optimisations from the best sets, added at the top
+        size_t n_opt = std::min(s.n_opt, coll_all.size());
+        table_type pcol(n_opt);
+        parallel_for(n_opt, n_threads, [&](size_t i){
+            std::vector<double> pfit(coll_all[i].begin(), coll_all[i].end()-1);
+            pcol[i] = fminsearch(mll_fun, pfit, 1e-2, 1e-2, 30*n_fit);
+        });
+        coll_all.insert(coll_all.begin(), pcol.begin(), pcol.end());
+        sort_coll(coll_all);
+        mll = coll_all[0].back();
+
+        // BLOCK 4.3. Indices in <coll_all> and <coll_tries>
+        size_t ind_final   = last_below(coll_all, mll + s.chicrit_joint);
+        size_t ind_single  = last_below(coll_all, mll + s.chicrit_single);
+        size_t ind_cont_t  = last_below(coll_tries, mll + chicrit_i);
+        size_t ind_cont_a  = last_below(coll_all, mll + chicrit_i);
+        size_t ind_inner   = last_below(coll_all, mll + s.chicrit_single + 0.2);
+        size_t ind_cont_t2 = last_below(coll_tries, mll + s.chicrit_max);
+        size_t ind_cont_a2 = last_below(coll_all, mll + s.chicrit_max);
+
+        msg << "  Status: " << ind_final << " sets within total CI and " << ind_single
+            << " within inner. Best fit: " << mll;
+        show();
+
+        // BLOCK 4.4. Catch slow kinetics: <mw> and <kd> correlated, and
+        // either of them close to its lower bound
+        if (s.loc_kd != -1){
+            table_type coll_tst = coll_rows(coll_all, 1, std::max(ind_final, s.n_ok));
+            size_t kd = s.loc_kd, mw = s.loc_mw;
+            double min_mw = INFINITY, min_kd = INFINITY;
+            double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0, n = coll_tst.size();
+            for (const std::vector<double>& r : coll_tst){
+                min_mw = std::min(min_mw, r[mw]);
+                min_kd = std::min(min_kd, r[kd]);
+                double x = std::log10(r[mw]), y = r[kd];
+                sx += x; sy += y; sxx += x*x; syy += y*y; sxy += x*y;
+            }
+            double check_corr = (sxy - sx*sy/n)/std::sqrt((sxx - sx*sx/n)*(syy - sy*sy/n));
+            double crit_mw = (min_mw - bnds[mw][0])/(bnds[mw][1] - bnds[mw][0]);
+            double crit_kd = (min_kd - bnds[kd][0])/(bnds[kd][1] - bnds[kd][0]);
+            if (check_corr > s.slowkin_corr && (crit_mw < s.slowkin_pars || crit_kd < s.slowkin_pars)){
+                res.slowkin = true;
+                res.minmax.assign(n_fit, {INFINITY, -INFINITY});
+                for (const std::vector<double>& r : coll_tst){
+                    for (size_t i_p = 0; i_p < n_fit; i_p++){
+                        res.minmax[i_p][0] = std::min(res.minmax[i_p][0], r[i_p]);
+                        res.minmax[i_p][1] = std::max(res.minmax[i_p][1], r[i_p]);
+                    }
+                }
+                for (size_t i_p = 0; i_p < n_fit; i_p++){ // and put on normal scale where needed
+                    if (fit.logscale[i_p]){
+                        res.minmax[i_p][0] = std::pow(10., res.minmax[i_p][0]);
+                        res.minmax[i_p][1] = std::pow(10., res.minmax[i_p][1]);
+                    }
+                }
+                return res;
+            }
+        }
+
+        // BLOCK 4.5. Select the sets for continuation in <coll_ok>
+        if (ind_final >= s.n_conf[0]){ // enough sets in the total joint CI?
+            if (ind_single >= s.n_conf[1]){ // and also enough in the inner rim?
+                flag_stop = true;
+            }
+            else{ // focus on the inner rim
+                disp("  Next round will focus on inner rim (outer rim has enough points)");
+                coll_ok = coll_rows(coll_all, 1, ind_inner);
+                flag_inner = true;
+                if (ind_inner < s.n_ok){
+                    coll_ok = coll_rows(coll_all, 1, s.n_ok);
+                }
+                else if (ind_inner > 0.5*s.n_conf[1]){ // the <n_ok> sets on both sides of the cut-off
+                    coll_ok = coll_rows(coll_all, ind_single > s.n_ok ? ind_single - s.n_ok : 1, ind_single + s.n_ok);
+                    coll_ok.push_back(coll_all[0]);
+                }
+            }
+        }
+        else{ // not enough accepted parameter sets in the total joint CI
+            if (ind_cont_t > s.n_ok){ // enough in <coll_tries> to continue with
+                if (ind_cont_t > 2*s.n_conf[0]){
+                    if (ind_final > 0.5*s.n_conf[0]){ // focus around the edge of the inner rim
+                        coll_ok = coll_rows(coll_tries, ind_single > s.n_ok ? ind_single - s.n_ok : 1,
+                                            std::min(ind_cont_t, ind_single + s.n_ok));
+                    }
+                    else{
+                        if (coll_tries[2*s.n_conf[0]-1].back() > mll + s.chicrit_max){
+                            ind_cont_t = 2*s.n_conf[0];
+                        }
+                        else{
+                            ind_cont_t = ind_cont_t2;
+                        }
+                        coll_ok = coll_rows(coll_tries, 1, ind_cont_t);
+                    }
+                }
+                else{
+                    coll_ok = coll_rows(coll_tries, 1, ind_cont_t);
+                }
+                coll_ok.push_back(coll_all[0]); // also add the optimised best value
+            }
+            else{ // look at <coll_all>
+                if (ind_cont_a > s.n_ok){
+                    if (ind_cont_a > 2*s.n_conf[0]){
+                        if (coll_all[2*s.n_conf[0]-1].back() > mll + s.chicrit_max){
+                            ind_cont_a = 2*s.n_conf[0];
+                        }
+                        else{
+                            ind_cont_a = ind_cont_a2;
+                        }
+                    }
+                    coll_ok = coll_rows(coll_all, 1, ind_cont_a);
+                }
+                else{
+                    coll_ok = coll_rows(coll_all, 1, s.n_ok);
+                }
+            }
+        }
+
+        // BLOCK 4.6. Prepare for a new round
+        if (n_rnd == s.n_max && !flag_stop){
+            flag_stop = true;
+            disp(" ");
+            msg << "We have now done " << n_rnd << " rounds without reaching the stopping criterion ... we stop here!";
+            show();
+        }
+        if (!flag_stop){
+            n_rnd++;
+            n_tr_i    = (size_t)round_setting(s.n_tr);
+            f_d_i     = round_setting(s.f_d);
+            chicrit_i = round_setting(s.chicrit_rnd);
+
+            double crit_ntry = flag_inner ? (double)ind_single/s.n_conf[1] : (double)ind_final/s.n_conf[0];
+            size_t n_conf_i  = s.n_conf[flag_inner ? 1 : 0];
+            if (crit_ntry > 0.75 || coll_ok.size() > 2000){
+                n_tr_i = n_tr_i/2;
+            }
+            else if (n_rnd > 3){ // starting at round 4, worry if we haven't found so many yet
+                if (coll_ok.size() < 0.5*n_conf_i && coll_ok.size() < 1000){
+                    n_tr_i = 2*n_tr_i;
+                    if (n_rnd > 4 && crit_ntry < 0.25){
+                        n_tr_i = 2*n_tr_i;
+                    }
+                }
+                else if (n_rnd > 7){
+                    n_tr_i = 2*n_tr_i;
+                }
+            }
+            n_tr_i = std::min(n_tr_i, std::max<size_t>(2, (size_t)std::floor(10.*n_conf_i/coll_ok.size())));
+        }
+
+        // Prune <coll_all> to remove all values that are outside highest chi2 criterion.
+        if (!flag_stop){
+            prune_mat(coll_all, mll + s.chicrit_max, true, false);
+        }
+        else if (s.dupl){
+            prune_mat(coll_all, mll + s.chicrit_max, true, true);
+        }
+    }
+    return res;
+}
+//]
+
+#endif // PARSPACE_HPP
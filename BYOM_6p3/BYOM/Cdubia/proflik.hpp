@@ -0,0 +1,207 @@
+/*
+  FILE: proflik.hpp
+  for BYOM_v6/DEBtox2019_v45b
+
+ Translation of the profiling of calc_proflik.m (sub_proflik in
+ engine_par) for the model in debtox_core.hpp. The branches (each profiled
+ parameter, down and up from the best fit) run on a pool of threads, and
+ all sub-optimisations use the minus log-likelihood in C++. Each step
+ starts its optimisation from the result of the previous step. It is used
+ from test_derivatives ('proflik' mode); the plots, the intervals and the
+ re-fitting when a better optimum is found stay in calc_proflik.m.
+
+ %  Copyright (c) 2012-2026, Tjalling Jager, all rights reserved.
+ %  This source code is licensed under the MIT-style license found in the
+ %  LICENSE.txt file in the root directory of BYOM.
+ */
+
+#ifndef PROFLIK_HPP
+#define PROFLIK_HPP
+
+#include "parspace.hpp"
+
+// Settings for the profiling, from opt_prof in calc_proflik.m
+struct proflik_settings
+{
+    int detail      = 2;    // detailed (1) or a coarse (2) calculation
+    size_t n_sub    = 0;    // number of sub-optimisations with perturbed starting values
+    double Fsub_opt = 5;    // maximum factor on parameters for the sub-optimisations
+    int brkprof     = 0;    // stop the branch when it gets worse again after a better optimum
+    double chicritJ = 0;    // chi-square criterion for the joint 95% region
+    size_t n_par    = 1;    // number of parameters in pmat (for the maximum function evaluations)
+};
+
+// Result of one branch: the profiled values (fitting scale) with their
+// likelihood ratio, the sets in the joint 95% region (fitted parameters
+// and likelihood ratio), and the set with the lowest likelihood ratio when
+// that is better than the best fit (all parameters of the problem).
+struct proflik_branch
+{
+    std::vector<double> Xcoll, loglikrat;
+    table_type sample_acc;
+    std::vector<double> p_better;
+    double loglikmax = 0; // log-likelihood of the best fit
+};
+
+//[ proflik_branch
+// Profile parameter i_prof of phat (all parameters of the problem, on the
+// fitting scale) down (proffact=-1) or up (proffact=1), with the variable
+// stepsize of sub_proflik. The parameters marked in fitted (except i_prof)
+// are optimised in each step.
+inline proflik_branch profile_branch(const objective_type& mll_fun, const std::vector<double>& phat,
+                                     const table_type& bnds, const std::vector<bool>& logscale,
+                                     const std::vector<bool>& fitted, size_t i_prof, int proffact,
+                                     const proflik_settings& s, std::mt19937& rng)
+{
+    proflik_branch res;
+    const double Xhat = phat[i_prof];
+    std::uniform_real_distribution<double> unif(0., 1.);
+
+    double Fstep_min, Fstep_max = 30, Fstep_abs, Lcrit_max, Lcrit_min, Lcrit_stop;
+    if (s.detail == 1){ // detailed options
+        Fstep_min  = 0.001;
+        Fstep_abs  = Xhat == 0 ? 1e-4 : 1e-3*std::abs(Xhat);
+        Lcrit_max  = 1;
+        Lcrit_min  = 0.2;
+        Lcrit_stop = s.chicritJ + 5;
+    }
+    else{ // coarse options
+        Fstep_min  = 0.005;
+        Fstep_abs  = Xhat == 0 ? 1e-3 : 1e-2*std::abs(Xhat);
+        Lcrit_max  = 2;
+        Lcrit_min  = 0.7;
+        Lcrit_stop = s.chicritJ + 2;
+    }
+    const double sub_opt[2] = {s.Fsub_opt - 1/s.Fsub_opt, 1/s.Fsub_opt};
+    const double sub_opt_log[2] = {std::log10(sub_opt[0] + sub_opt[1]) - std::log10(sub_opt[1]), std::log10(sub_opt[1])};
+    const size_t max_fun1 = 30*(s.n_par - 1), max_fun2 = 50*(s.n_par - 1);
+
+    // the parameters to optimise, with the profiled one fixed in p_try
+    std::vector<size_t> ind_sub;
+    for (size_t k = 0; k < phat.size(); k++){
+        if (fitted[k] && k != i_prof) ind_sub.push_back(k);
+    }
+    std::vector<double> p_try(phat);
+    objective_type mll_sub = [&](const double* x){
+        std::vector<double> p(p_try);
+        for (size_t k = 0; k < ind_sub.size(); k++) p[ind_sub[k]] = x[k];
+        return mll_fun(p.data());
+    };
+    auto sub_vector = [&](){
+        std::vector<double> x(ind_sub.size());
+        for (size_t k = 0; k < ind_sub.size(); k++) x[k] = p_try[ind_sub[k]];
+        return x;
+    };
+
+    const double mll_hat = mll_fun(phat.data());
+    res.loglikmax = -mll_hat;
+    const double parmin = bnds[i_prof][0], parmax = bnds[i_prof][1];
+
+    bool flag_better = false;
+    double logliklowest = 0;
+    double Xtry = Xhat, logliktmp = 0;
+    res.Xcoll.push_back(Xtry);
+    res.loglikrat.push_back(0);
+    bool flag = false;
+    double Fstep = Fstep_min;
+    bool flagmin = false;
+
+    while (!flag){
+        bool flag_try = false;
+        const double Xtry_old = Xtry, logliktmp_old = logliktmp;
+
+        while (!flag_try && !flag){
+            if (Xtry_old == 0){ // relative stepsize cannot be used
+                Xtry    = Xtry_old + proffact*Fstep_abs;
+                Fstep   = Fstep_min;
+                flagmin = true;
+            }
+            else if (Fstep*std::abs(Xtry_old) >= Fstep_abs){
+                Xtry    = Xtry_old + proffact*Fstep*std::abs(Xtry_old);
+                flagmin = !(Fstep*std::abs(Xtry_old) > 1.5*Fstep_abs && Fstep > 1.5*Fstep_min);
+            }
+            else{
+                Xtry    = Xtry_old + proffact*Fstep_abs;
+                Fstep   = Fstep_abs/std::abs(Xtry_old);
+                flagmin = true;
+            }
+            Xtry = std::min(std::max(Xtry, parmin), parmax);
+            p_try[i_prof] = Xtry;
+
+            // rough optimisation from the previous step, with optional
+            // sub-optimisations from perturbed starting values, and a
+            // better one to finish it
+            std::vector<double> p_fit = sub_vector();
+            std::vector<double> best = fminsearch(mll_sub, p_fit, 1e-2, 1e-2, max_fun1);
+            for (size_t i_sub = 0; i_sub < s.n_sub; i_sub++){
+                std::vector<double> modpar(p_fit.size());
+                for (size_t k = 0; k < p_fit.size(); k++){
+                    size_t ip = ind_sub[k];
+                    if (logscale[ip]) modpar[k] = p_fit[k] + unif(rng)*sub_opt_log[0] + sub_opt_log[1];
+                    else modpar[k] = p_fit[k]*(unif(rng)*sub_opt[0] + sub_opt[1]);
+                    modpar[k] = std::min(std::max(modpar[k], bnds[ip][0]), bnds[ip][1]);
+                }
+                std::vector<double> sub = fminsearch(mll_sub, modpar, 1e-2, 1e-2, max_fun1);
+                if (sub.back() < best.back()) best = sub;
+            }
+            best.pop_back();
+            best = fminsearch(mll_sub, best, 1e-2, 1e-2, max_fun2);
+            const double mll_new = best.back();
+            for (size_t k = 0; k < ind_sub.size(); k++) p_try[ind_sub[k]] = best[k];
+
+            logliktmp = 2*(mll_new - mll_hat); // likelihood ratio that follows a chi square
+            const double deltaL = std::abs(logliktmp - logliktmp_old);
+
+            if (logliktmp <= s.chicritJ){ // in the total 95% region: accepted set
+                std::vector<double> acc;
+                for (size_t k = 0; k < p_try.size(); k++){
+                    if (fitted[k]) acc.push_back(p_try[k]);
+                }
+                acc.push_back(logliktmp);
+                res.sample_acc.push_back(acc);
+            }
+
+            bool skippit = false;
+            const bool at_bound = Xtry == parmin || Xtry == parmax;
+            if (deltaL > Lcrit_max){
+                if (!flagmin){ // try again with half the stepsize
+                    Fstep   = std::max(Fstep/2, Fstep_min);
+                    skippit = true;
+                }
+                else if (at_bound){
+                    flag = true;
+                }
+            }
+            else if (at_bound){
+                flag = true;
+            }
+
+            if (!skippit){
+                flag_try = true;
+                res.loglikrat.push_back(logliktmp);
+                res.Xcoll.push_back(Xtry);
+
+                if (s.brkprof > 0 && flag_better && logliktmp > logliklowest){
+                    return res; // a better optimum was found, and it gets worse again
+                }
+                if (logliktmp < logliklowest){ // remember the better set
+                    if (logliktmp < -0.01){ // ignore tiny improvements
+                        flag_better = true;
+                    }
+                    logliklowest = logliktmp;
+                    res.p_better = p_try;
+                }
+                if (logliktmp > Lcrit_stop){
+                    flag = true;
+                }
+                else if (deltaL < Lcrit_min){
+                    Fstep = std::min(Fstep*2, Fstep_max);
+                }
+            }
+        }
+    }
+    return res;
+}
+//]
+
+#endif // PROFLIK_HPP
@@ -0,0 +1,140 @@
+/*
+  FILE: slice.hpp
+  for BYOM_v6/DEBtox2019_v45b
+
+ Slice sampler for the posterior of the fitted parameters, with several
+ independent chains on a pool of threads. The steps are those of
+ slicesample in the MATLAB statistics toolbox (Neal, 2003, Annals of
+ Statistics 31: 705-767), as used in calc_slice.m: a hyperrectangle of the
+ slice width is placed randomly around the current point (stepping out
+ only for a single parameter), and shrunk until a point inside the slice is
+ found. It is used from test_derivatives ('slice' mode), with the minus
+ log-likelihood of debtox_core.hpp.
+
+ %  Copyright (c) 2012-2026, Tjalling Jager, all rights reserved.
+ %  This source code is licensed under the MIT-style license found in the
+ %  LICENSE.txt file in the root directory of BYOM.
+ */
+
+#ifndef SLICE_HPP
+#define SLICE_HPP
+
+#include "parspace.hpp"
+
+// Settings of the sampler, from opt_slice in calc_slice.m
+struct slice_settings
+{
+    size_t nrs    = 1;             // number of samples, for all chains together
+    size_t thin   = 1;             // keep one in every 'thin' samples
+    size_t burn   = 0;             // number of burn-in samples, for each chain
+    std::vector<double> width;     // initial width of the slice, per parameter
+    size_t n_chains = 1;           // number of independent chains
+    size_t max_iter = 200;         // maximum steps for stepping out and shrinking (as slicesample)
+};
+
+//[ slice_sampler
+// One chain of n_samples samples, starting from x0. The minus
+// log-likelihood of the current point is kept, so each step only
+// evaluates new points. The sample has the fitted parameters and the MLL
+// in the last column.
+inline table_type slice_chain(const objective_type& mll_fun, std::vector<double> x0, size_t n_samples,
+                              const slice_settings& s, std::mt19937& rng)
+{
+    size_t dim = x0.size();
+    std::uniform_real_distribution<double> unif(0., 1.);
+    std::exponential_distribution<double> expo(1.);
+    const double* w = s.width.data();
+
+    double mll0 = mll_fun(x0.data());
+    if (!(mll0 < INFINITY)){
+        throw std::runtime_error("The slice sampler needs a starting point with a finite min-log-likelihood");
+    }
+    table_type rnd(n_samples, std::vector<double>(dim+1));
+    std::vector<double> xl(dim), xr(dim), xp(dim);
+
+    for (long i = 1 - (long)s.burn; i <= (long)n_samples; i++){
+        for (size_t k = 0; k < s.thin; k++){
+            double z = -mll0 - expo(rng); // log-density level of the slice
+            auto inside = [&](const std::vector<double>& x, double& mll){
+                mll = mll_fun(x.data());
+                return -mll > z;
+            };
+            for (size_t j = 0; j < dim; j++){ // randomly positioned hyperrectangle around x0
+                xl[j] = x0[j] - w[j]*unif(rng);
+                xr[j] = xl[j] + w[j];
+            }
+            double mll = INFINITY;
+            size_t iter = 0;
+            if (dim == 1){ // stepping out, only for a single parameter
+                while (inside(xl, mll) && iter < s.max_iter){
+                    xl[0] -= w[0];
+                    iter++;
+                }
+                if (iter >= s.max_iter || xl[0] < -std::sqrt(std::numeric_limits<double>::max())){
+                    throw std::runtime_error("The slice sampler exceeded the maximum number of steps to step out (check the width)");
+                }
+                iter = 0;
+                while (inside(xr, mll) && iter < s.max_iter){
+                    xr[0] += w[0];
+                    iter++;
+                }
+                if (iter >= s.max_iter || xr[0] > std::sqrt(std::numeric_limits<double>::max())){
+                    throw std::runtime_error("The slice sampler exceeded the maximum number of steps to step out (check the width)");
+                }
+            }
+            for (size_t j = 0; j < dim; j++) xp[j] = unif(rng)*(xr[j] - xl[j]) + xl[j];
+            iter = 0;
+            while (!inside(xp, mll) && iter < s.max_iter){ // shrink the hyperrectangle towards x0
+                for (size_t j = 0; j < dim; j++){
+                    if (xp[j] > x0[j]) xr[j] = xp[j];
+                    else xl[j] = xp[j];
+                    xp[j] = unif(rng)*(xr[j] - xl[j]) + xl[j];
+                }
+                iter++;
+            }
+            if (iter >= s.max_iter){
+                throw std::runtime_error("The slice sampler exceeded the maximum number of steps to shrink in (check the width)");
+            }
+            x0 = xp;
+            mll0 = mll;
+        }
+        if (i > 0){
+            std::copy(x0.begin(), x0.end(), rnd[i-1].begin());
+            rnd[i-1][dim] = mll0;
+        }
+    }
+    return rnd;
+}
+
+// The sample of all chains, one after the other. Each chain starts from
+// x0, has its own burn-in and its own random numbers (seeded from rng),
+// and the chains run on the pool of threads. The samples are divided
+// over the chains as evenly as possible.
+inline table_type slice_sample(const objective_type& mll_fun, const std::vector<double>& x0,
+                               slice_settings s, std::mt19937& rng, unsigned n_threads)
+{
+    if (s.width.size() == 1) s.width.assign(x0.size(), s.width[0]);
+    s.thin = std::max<size_t>(s.thin, 1);
+    size_t n_chains = std::max<size_t>(1, std::min(s.n_chains, s.nrs));
+
+    std::vector<size_t> n_samples(n_chains, s.nrs/n_chains);
+    for (size_t c = 0; c < s.nrs % n_chains; c++) n_samples[c]++;
+    std::vector<std::mt19937::result_type> seeds(n_chains);
+    for (size_t c = 0; c < n_chains; c++) seeds[c] = rng();
+
+    std::vector<table_type> chains(n_chains);
+    parallel_for(n_chains, n_threads, [&](size_t c){
+        std::mt19937 rng_c(seeds[c]);
+        chains[c] = slice_chain(mll_fun, x0, n_samples[c], s, rng_c);
+    });
+
+    table_type rnd;
+    rnd.reserve(s.nrs);
+    for (const table_type& chain : chains){
+        rnd.insert(rnd.end(), chain.begin(), chain.end());
+    }
+    return rnd;
+}
+//]
+
+#endif // SLICE_HPP
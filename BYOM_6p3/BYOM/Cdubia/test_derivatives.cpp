@@ -62,17 +62,17 @@ DEALINGS IN THE SOFTWARE.
  DEBtox2019 package.
 
  The connection between C++ and MATLAB has been done using the 
- MATLAB C++ MEX APIs
+ MATLAB C++ MEX APIs. The model and the solvers are in debtox_core.hpp;
+ this file only converts between MATLAB and C++.
  
  =======================
  */
 
 
-#include <iostream>
-#include <vector>
-#include <algorithm>
-
-#include <boost/numeric/odeint.hpp>
+#include "debtox_core.hpp"
+#include "parspace.hpp"
+#include "slice.hpp"
+#include "proflik.hpp"
 
 #include "mex.hpp"
 #include "mexAdapter.hpp"
@@ -81,290 +81,18 @@ using matlab::mex::ArgumentList;
 using namespace matlab::data;
 using namespace matlab::mex;
 
-/* The type of container used to hold the state vector */
-typedef std::vector< double > state_type;
-
-// call a global pointer to start the matlab engine so that it is always
-// available and does not need to be called all the time
-//std::unique_ptr<matlab::engine::MATLABEngine> matlabPtr = connectMATLAB();
-
-class DEBderi {
-	// the parameters were originally in a structure.
-	// this has been converted into vectors for easieness and performance
-	std::vector<std::vector<double>> vectors;  // parameters of the model
-	std::vector<double> scalars;               // more global parameters of the model
-    double ci;                                 // external concentration that apparently is a double
-    matlab::data::TypedArray<double> int_coll; // 2D vector containing the scenario table
-	std::vector<double> int_coll_times;        // time vector of the scenario table
-    int int_type;                              // type of scenario (2 for constant, 4 for linear interpolation)
-    std::vector<double> timevar;               // 2 element array telling if we have a variable profile or not
-    std::shared_ptr<matlab::engine::MATLABEngine> mateng; // MATLAB engine for debugging purposes (to allow printouts)
-    
-	public:
-		DEBderi(std::vector<double> scalar_pars,
-                std::vector<std::vector<double>> vector_pars,
-                double conc,
-                matlab::data::TypedArray<double> int_coll_arr,
-				std::vector<double> int_coll_times_arr,
-                int int_type_val,
-                std::vector<double> timevar_arr,
-                std::shared_ptr<matlab::engine::MATLABEngine> mateng2) : scalars(scalar_pars), // initializer list
-                                                                         vectors(vector_pars),
-                                                                         ci(conc),
-                                                                         int_coll(int_coll_arr),
-							                                             int_coll_times(int_coll_times_arr),
-                                                                         int_type(int_type_val),
-                                                                         timevar(timevar_arr),
-                                                                         mateng(mateng2){}
-		void operator() ( state_type &x , state_type &dxdt , const double t ) // not declaring x as constant otherwise bad?
-		{
-			/* insert all the derivatives from the DEB model */
-            // unpack parameters. They will need to be passed in the same
-            // order by the main function. Unless we generate a new structure
-            // we will not have the name of the fields available
-
-            // The parameters are passed through a C++ vector to this class
-            // in order to increase speed. Reading the MATLAB object in the
-            // class with the derivatives would be to heavy
-            double FBV = scalars[0];
-            double KRV = scalars[1];     // part. coeff. repro buffer and structure (kg/kg)
-            double kap = scalars[2];     // approximation for kappa (-)
-            double yP  = scalars[3];      // product of yVA and yAV (-)
-
-            double L0   = scalars[4];   // body length at start (mm)
-            double Lp   = scalars[5];   // body length at puberty (mm)
-            double Lm   = scalars[6];   // maximum body length (mm)
-            double rB   = scalars[7];   // von Bertalanffy growth rate constant (1/d)
-            double Rm   = scalars[8];   // maximum reproduction rate (#/d)
-            double f    = scalars[9];    // scaled functional response (-)
-            double hb   = scalars[10];   // background hazard rate (d-1)
- 
-            // unpack extra parameters for specific cases
-            double Lf   = scalars[11];   // body length at half-saturation feeding (mm)
-            double Tlag = scalars[12]; // lag time for start development (d)
-            // unpack model parameters for the response to toxicants
-            double kd   = scalars[13];   // dominant rate constant (d-1)
-            double zb   = scalars[14];   // effect threshold energy budget ([C])
-            double bb   = scalars[15];   // effect strength energy-budget effects (1/[C])
-            double zs   = scalars[16];   // effect threshold survival ([C])
-            double bs   = scalars[17];   // effect strength survival (1/([C] d))
-
-            double Lj = scalars[18]; // length at metamorphosis (for abj models) No need for Daphnia
-            double Lm_ref = scalars[19];
-			double MF = scalars[20];
-			double a = scalars[21];
-			
-			hb = a * std::pow(hb,a) * std::pow(t,(a-1)); // option for Weibull mortalty when a is not 1
-
-            std::vector<double> feedbacks(vectors[0]);
-            std::vector<double> moa(vectors[1]);
-
-            // initial conditions read from the input and set so that they
-            // do not become negative (as in original code)
-            x[0]=std::max(x[0],0.);
-            x[1]=std::max(x[1],0.);
-            x[2]=std::max(x[2],0.);
-            x[3]=std::max(x[3],0.);
-            
-            double c=ci;  // concentration or concentration scenario
-            
-            // only in case we have variable concentrations
-			if ((int)timevar[0] == 1){
-                //stream << "calling external function\n";
-                //displayOnMATLAB(stream);
-                c = read_scen(ci, t, MF, int_coll, int_coll_times, int_type, timevar); // for time varying concentrations
-            }
-
-            x[1] = std::max(1e-3 * L0, x[1]);
-            
-            if (Lf > 0){
-                f = f / (1 + (Lf * Lf * Lf)/(x[1] * x[1] * x[1])); // hyperbolic relationship for f with body volume
-            }
-            if (Lj > 0) {// to include acceleration until metamorphosis ...
-                f = f * std::min(1.,x[1]/Lj); // this implies lower f for L<Lj
-            }
-            
-            double s = bb*std::max(0.,x[0]-zb); // stress level for metabolic effects
-            double h = bs*std::max(0.,x[0]-zs); // hazard rate for effects on survival
-			
-			h = std::min(111.,h);  // maximise the hazard rate to 99% mortality in 1 hour
-			// Note: this helps in extreme conditions, as the system becomes stiff for
-            // very high hazard rates. This is especially needed for EPx calculations,
-            // where the MF is increased until there is effect on all endpoints!
-            
-            // 5 MODE OF ACTION
-            double sA = std::min(1.,moa[0] * s); // assimilation/feeding (maximise to 1 to avoid negative values for 1-sA)
-            double sM = moa[1] * s;              // maintenance (somatic and maturity)
-            double sG = moa[2] * s;              // growth costs
-            double sR = moa[3] * s;              // reproduction costs
-            double sH = moa[4] * s;              // also include hazard to reproduction
-
-            dxdt[1] = rB * ((1+sM)/(1+sG)) * (f*Lm*((1-sA)/(1+sM)) - x[1]); // ODE for body length
-            
-            double fR = f; // if there is no starvation, f for reproduction is the standard f
-            // starvation rules can modify the outputs here
-            if (dxdt[1] < 0){ // then we are looking at starvation and need to correct things
-                fR = (f - kap * (x[1]/Lm) * ((1+sM)/(1-sA)))/(1-kap); // new f for reproduction alone
-                if (fR >= 0){  // then we are in the first stage of starvation: 1-kappa branch can help pay maintenance
-                    dxdt[1] = 0; // stop growth, but don't shrink
-                } else {        // we are in stage 2 of starvation and need to shrink to pay maintenance
-                    fR = 0; // nothing left for reproduction
-                    dxdt[1] = (rB*(1+sM)/yP) * ((f*Lm/kap)*((1-sA)/(1+sM)) - x[1]); // shrinking rate
-                }
-            }
-
-            double R  = 0; // reproduction rate is zero, unless ... 
-            if (x[1] >= Lp){ // if we are above the length at puberty, reproduce
-                //R = std::max(0.,(Rm/(1+sR)) * (fR*Lm*(x[1]*x[1])*(1-sA) - (Lp*Lp*Lp)*(1+sM))/(Lm*Lm*Lm - Lp*Lp*Lp));
-                R = std::max(0.,(exp(-sH)*Rm/(1+sR)) * (fR*Lm*(x[1]*x[1])*(1-sA) - (Lp*Lp*Lp)*(1+sM))/(Lm*Lm*Lm - Lp*Lp*Lp));
-            }
-            dxdt[2] = R;                 // cumulative reproduction rate
-            dxdt[3]  = -(h + hb) * x[3]; // change in survival probability (incl. background mort.)
-
-            // For the damage dynamics, there are four feedback factors x* that obtain a
-            // value based on the settings in the configuration vector glo.feedb: a
-            // vector with switches for various feedbacks: [surface:volume on uptake,
-            // surface:volume on elimination, growth dilution, losses with
-            // reproduction].
-
-            // this operation has to be handled with care
-            // element-wise product
-            feedbacks[0] = feedbacks[0] * Lm_ref/x[1];
-            feedbacks[1] = feedbacks[1] * Lm_ref/x[1];
-            feedbacks[2] = feedbacks[2] * (3/x[1])*dxdt[1];
-            feedbacks[3] = feedbacks[3] * R*FBV*KRV;
-            
-            //double xu = std::max(1.,feedbacks[0]); // if switch for surf:vol scaling is zero, the factor must be 1 and not 0!
-            //double xe = std::max(1.,feedbacks[1]); // if switch for surf:vol scaling is zero, the factor must be 1 and not 0!
-            double xu = feedbacks[0];
-            if (feedbacks[0] == 0) {xu = 1;}
-            double xe = feedbacks[1];
-            if (feedbacks[1] == 0) {xe = 1;}
-            double xG = feedbacks[2];              // factor for growth dilution
-            double xR = feedbacks[3];              // factor for losses with repro
-
-            xG = std::max(0.,xG); 
-            // NOTE NOTE: reverse growth dilution (concentration by shrinking) is now
-            // turned OFF as it leads to runaway situations that lead to failure of the
-            // ODE solvers. However, this needs some further thought!
-            dxdt[0] = kd * (xu * c - xe * x[0]) - (xG + xR) * x[0]; // ODE for scaled damage
-
-            if (x[1] <= 0.5 * L0){ // if an animal has size less than half the start size ...
-                dxdt[1] = 0.; // don't let it grow or shrink any further (to avoid numerical issues)
-            }
-            
-            if (t<Tlag){
-                //derivatives are non-zero only if time is greater than Tlag
-                dxdt[0] = 0;
-                dxdt[1] = 0;
-                dxdt[2] = 0;
-                dxdt[3] = 0;
-            }
-	    }
-
-        double read_scen(double c, double t, double MF, matlab::data::TypedArray<double> int_coll,
-		                 std::vector<double> int_coll_times, int int_type, std::vector<double> timevar){
-            // function copied from DEBtox to avoid calling matlab code from here
-            // it copied only the case with -1, the case called from the derivatives file
-			
-            double out_c=0;
-            int size_t_int_coll = (int)int_coll.getDimensions()[0];
-            switch (int_type){
-                case 1:
-                    {
-                    // should not be needed.
-                        break;
-                    }
-                case 2:
-                    {
-                    if (timevar.size()==2 && timevar[1] > 0){
-                        out_c = MF * int_coll[(int)timevar[1]-1][1];
-                    }
-                    else{
-                        // substitute the find function here with a C++ implementation of this case
-                        // should not be needed now, but who knows
-                        //out_c = MF * int_coll(find(int_coll(:,1)<=t,1,'last'),2);
-                        // use std::find_if increases the performance massively!
-                        auto it = std::find_if(int_coll_times.rbegin(),int_coll_times.rend(),[&](const double& i){return i<=t;});
-						int ii = it - int_coll_times.rbegin();
-                        ii = int_coll_times.size() - 1 - ii;
-                        out_c = MF * int_coll[ii][1];    
-                    }
-                    break;
-                    }
-                case 3:
-                    {
-                    double kc = int_coll[size_t_int_coll-1][1];
-                    if (timevar.size()==2 && timevar[1] > 0){
-                        int ind_i = (int)timevar[1]-1;
-                        double c0 = int_coll[ind_i][1];
-                        double t0 = t - int_coll[ind_i][0];
-                        out_c = MF * c0 * exp(-kc*t0);
-                    }
-                    else{
-                        auto it = std::find_if(int_coll_times.rbegin(),int_coll_times.rend(),[&](const double& i){return i<=t;});
-						int ii = it - int_coll_times.rbegin();
-                        ii = int_coll_times.size() - 1 - ii;
-                        double c0 = int_coll[ii][1];
-                        double t0 = t - int_coll[ii][0];
-                        out_c = MF * c0 * exp(-kc*t0);                    
-                        }
-                    break;
-                    }
-                case 4:
-                    {
-                    if (timevar.size()==2 && timevar[1] > 0){
-                        int ind_i = (int)timevar[1]-1;   
-                        out_c = int_coll[ind_i][1] * MF + (t - int_coll[ind_i][0]) * int_coll[ind_i][2] * MF;
-                    }
-                    else{
-						auto it = std::find_if(int_coll_times.rbegin(),int_coll_times.rend(),[&](const double& i){return i<=t;});
-						int ii = it - int_coll_times.rbegin();
-                        ii = int_coll_times.size() - 1 - ii;
-                        out_c = int_coll[ii][1] * MF + (t-int_coll[ii][0]) * int_coll[ii][2] * MF;
-                    }
-                    break;
-                    }
-            }
-            return out_c;
-        }
-
-        void displayOnMATLAB(std::ostringstream& stream) {
-			// function to printout stuff.
-			// Work on a wat to make the inheritance instead of
-			// duplicating code
-            ArrayFactory factory;
-            // Pass stream content to MATLAB fprintf function
-            mateng->feval(u"fprintf", 0,
-              std::vector<Array>({ factory.createScalar(stream.str()) }));
-            // Clear stream buffer
-            stream.str("");
-        }
-};
-
-//[ integrate_observer
-// structure containing the function to store the states at each step
-struct push_back_state_and_time
-{
-    std::vector< state_type >& m_states;
-    std::vector< double >& m_times;
-
-    push_back_state_and_time( std::vector< state_type > &states , std::vector< double > &times )
-    : m_states( states ) , m_times( times ) { }
-
-    void operator()( const state_type &x , double t )
-    {
-        m_states.push_back( x );
-        m_times.push_back( t );
-    }
-};
-//]
-
 class MexFunction : public matlab::mex::Function { 
     // create pointer to matlab engine
     std::shared_ptr<matlab::engine::MATLABEngine> matlabPtr2 = getEngine();
     // Factory to create MATLAB data arrays
     ArrayFactory factory;
+    // Registered models (see model_type). These stay in memory as long as
+    // the MEX file is loaded (until clear mex).
+    std::map<int, model_type> models;
+    int next_handle = 1;
+    // Solutions of the 'solve' mode, for repeated requests (see
+    // solve_cache and the 'cache' mode)
+    solve_cache cache;
     public:
       // Print strings during exectution. Useful for DEBUG
       void displayOnMATLAB(std::ostringstream& stream) {
@@ -375,48 +103,99 @@ class MexFunction : public matlab::mex::Function {
           stream.str("");
       }
 
-      void operator()(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){    
-          using namespace std;
-          using namespace boost::numeric::odeint;
-          // Create an output stream
-          // ostringstream stream; // needed in case of needing DEBUG
+      // Throw an error in MATLAB (this also ends the MEX call)
+      void throwError(const std::string& message) {
+          matlabPtr2->feval(u"error", 0,
+              std::vector<Array>({ factory.createScalar(message) }));
+      }
 
-          /* input parameters in the same order as they appear in derivatives.m
-           * -time range, 
-           * -initial conditions
-           * -par
-           * -c
-           * -glo
-           * -initial step (intial dt for the solver)
-		   * -abstol (error tolerances of the ODE solver)
-		   * -reltol
-		   * -max step size
-		   * (the maximum step size is needed to avoid the dense adaptive stepper to 
-		   * perform steps that are too large)
-           */
+      // The same, with an identifier that MATLAB can catch (see mex_handle.m)
+      void throwError(const std::string& id, const std::string& message) {
+          matlabPtr2->feval(u"error", 0,
+              std::vector<Array>({ factory.createScalar(id), factory.createScalar(message) }));
+      }
 
-          // time range
-          matlab::data::TypedArray<double> inArray = inputs[0];
-          vector<double> time_vector(inArray.begin(), inArray.end());
-          // initial conditions
-          matlab::data::TypedArray<double> inArray2 = inputs[1];
-          vector<double> init_states(inArray2.begin(), inArray2.end());
-          // par structure
-          matlab::data::StructArray inStructArrayPar = inputs[2];
-          // concentration c
-          double conc = inputs[3][0];
-          // glo structure
-	      matlab::data::StructArray inStructArrayGlo = inputs[4];
-	      // additional argument as I need an initial dt to be passed for the solver
-          double dt = inputs[5][0];
-          double AbsErr = inputs[6][0]; // tolerances for the ODE solver
-          double RelErr = inputs[7][0];
-		  double MaxStep = inputs[8][0]; // maximum step-size
+      void operator()(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){    
+          // a character array as first input selects one of the special modes
+          if (inputs.size() > 0 && inputs[0].getType() == ArrayType::CHAR){
+              matlab::data::CharArray mode_arr = inputs[0];
+              std::string mode = mode_arr.toAscii();
+              if (mode == "batch"){
+                  solve_batch(outputs, inputs);
+              }
+              else if (mode == "ensemble"){
+                  solve_ensemble(outputs, inputs);
+              }
+              else if (mode == "register"){
+                  // register glo once, and return a handle for 'solve'
+                  matlab::data::StructArray inStructArrayGlo = inputs[1];
+                  models[next_handle] = read_model(inStructArrayGlo);
+                  outputs[0] = factory.createScalar((double)next_handle++);
+              }
+              else if (mode == "solve"){
+                  solve_handle(outputs, inputs);
+              }
+              else if (mode == "sens"){
+                  solve_sens(outputs, inputs);
+              }
+              else if (mode == "loglik"){
+                  calc_loglik(outputs, inputs);
+              }
+              else if (mode == "epx"){
+                  solve_epx(outputs, inputs);
+              }
+              else if (mode == "epxroot"){
+                  solve_epx_root(outputs, inputs);
+              }
+              else if (mode == "epxwindow"){
+                  solve_epx_window(outputs, inputs);
+              }
+              else if (mode == "pop"){
+                  solve_pop(outputs, inputs);
+              }
+              else if (mode == "parspace"){
+                  explore_parspace(outputs, inputs);
+              }
+              else if (mode == "mutate"){
+                  mutate_sets(outputs, inputs);
+              }
+              else if (mode == "slice"){
+                  sample_slice(outputs, inputs);
+              }
+              else if (mode == "proflik"){
+                  profile_likelihood(outputs, inputs);
+              }
+              else if (mode == "cache"){
+                  cache_settings(outputs, inputs);
+              }
+              else if (mode == "release"){
+                  // release one handle, or all of them
+                  if (inputs.size() > 1){
+                      int h = (int)(double)inputs[1][0];
+                      models.erase(h);
+                      cache.erase_handle(h);
+                  }
+                  else{
+                      models.clear();
+                      cache.clear(false);
+                  }
+              }
+              else{
+                  throwError("test_derivatives: unknown mode '" + mode + "'");
+              }
+              return;
+          }
+          solve_single(outputs, inputs);
+      }
 
-          vector<double> scalar_pars;
-          vector<std::vector<double>> vector_pars;
+      // Extract all the parameters from glo and par. The order in
+      // scalar_pars is the one used in DEBderi::operator()
+      void read_pars(matlab::data::StructArray& inStructArrayPar,
+                     matlab::data::StructArray& inStructArrayGlo,
+                     std::vector<double>& scalar_pars,
+                     std::vector<std::vector<double>>& vector_pars){
+          using namespace std;
 
-          // Extract all the parameters from glo and par
           matlab::data::Array tempconv = inStructArrayGlo[0]["FBV"];
           scalar_pars.push_back(tempconv[0]);
           tempconv = inStructArrayGlo[0]["KRV"];
@@ -465,6 +244,14 @@ class MexFunction : public matlab::mex::Function {
           tempconv = inStructArrayGlo[0]["Lm_ref"];
           scalar_pars.push_back(tempconv[0]);
 
+          matlab::data::TypedArray<double> glo_mf = inStructArrayGlo[0]["MF"];             
+          double MF = glo_mf[0];
+          scalar_pars.push_back(MF);
+		  
+		  matlab::data::TypedArray<double> par_a = inStructArrayPar[0]["a"];  // % Weibull background hazard coefficient (-)
+		  double a = par_a[0];
+		  scalar_pars.push_back(a);
+
           // feebacks
           matlab::data::TypedArray<double> feedb = inStructArrayGlo[0]["feedb"];
           std::vector<double> feedbacks(feedb.begin(), feedb.end());
@@ -474,55 +261,292 @@ class MexFunction : public matlab::mex::Function {
           matlab::data::TypedArray<double> moac = inStructArrayGlo[0]["moa"];
           std::vector<double> moa(moac.begin(), moac.end());
           vector_pars.push_back(moa);
+      }
 
-          // get here some global settings to avoid too much work in read_scen
-          matlab::data::TypedArray<double> glo_int_scen = inStructArrayGlo[0]["int_scen"]; // should have just doubles inside 
-          std::vector<double> glo_int_scen_vec(glo_int_scen.begin(), glo_int_scen.end());
+      // Solver selected with glo.stiff(1): 0 for dopri5, 2 for rosenbrock4, 3 for
+      // dopri5 with the closed-form solution where it applies
+      int read_solver(matlab::data::StructArray& inStructArrayGlo){
+          matlab::data::TypedArray<double> glo_stiff = inStructArrayGlo[0]["stiff"];
+          return (int)glo_stiff[0];
+      }
 
-          matlab::data::TypedArray<double> glo_int_type = inStructArrayGlo[0]["int_type"];
-          std::vector<double> glo_int_type_vec(glo_int_type.begin(), glo_int_type.end());
+      // Copy a scenario table from MATLAB into rows of doubles
+      table_type read_table(const matlab::data::TypedArray<double>& arr){
+          size_t n_rows = arr.getDimensions()[0];
+          size_t n_cols = arr.getDimensions()[1];
+          table_type table(n_rows, std::vector<double>(n_cols));
+          for (size_t i = 0; i < n_rows; i++){
+              for (size_t j = 0; j < n_cols; j++){
+                  table[i][j] = arr[i][j];
+              }
+          }
+          return table;
+      }
 
+      // Copy the parts of glo that define the model (see model_type)
+      model_type read_model(matlab::data::StructArray& inStructArrayGlo){
+          using namespace std;
+          model_type model;
 
-          matlab::data::TypedArray<double> glo_timevar = inStructArrayGlo[0]["timevar"];   // this is also just an array of doubles ([v1, v2])
-          std::vector<double> timevar(glo_timevar.begin(), glo_timevar.end());
+          matlab::data::TypedArray<double> feedb = inStructArrayGlo[0]["feedb"];
+          model.vector_pars.push_back(vector<double>(feedb.begin(), feedb.end()));
+          matlab::data::TypedArray<double> moac = inStructArrayGlo[0]["moa"];
+          model.vector_pars.push_back(vector<double>(moac.begin(), moac.end()));
 
-          matlab::data::TypedArray<double> glo_mf = inStructArrayGlo[0]["MF"];             
-          double MF = glo_mf[0];
-          scalar_pars.push_back(MF);
-		  
-		  matlab::data::TypedArray<double> par_a = inStructArrayPar[0]["a"];  // % Weibull background hazard coefficient (-)
-		  double a = par_a[0];
-		  scalar_pars.push_back(a);
-		  
-		  // define here the vector int_coll that will be passed afterwards to the solver
-          matlab::data::TypedArray<matlab::data::Array> glo_int_coll = inStructArrayGlo[0]["int_coll"];
+          // the scenario information is only read when there are scenarios
+          matlab::data::TypedArray<double> glo_int_scen = inStructArrayGlo[0]["int_scen"];
+          model.int_scen.assign(glo_int_scen.begin(), glo_int_scen.end());
+          if (!model.int_scen.empty()){
+              matlab::data::TypedArray<matlab::data::Array> glo_int_coll = inStructArrayGlo[0]["int_coll"];
+              matlab::data::TypedArray<double> glo_int_type = inStructArrayGlo[0]["int_type"];
+              for (size_t i = 0; i < model.int_scen.size(); i++){
+                  matlab::data::TypedArray<double> int_coll = glo_int_coll[i];
+                  model.int_coll.push_back(read_table(int_coll));
+                  model.int_type.push_back((int)glo_int_type[i]);
+              }
+          }
+          return model;
+      }
+
+      // Derive the exposure scenario for each column of X0mat from glo, in
+      // the same way as call_deri.m does for each scenario
+      std::vector<scenario_type> read_scenarios(const model_type& model,
+                                                matlab::data::TypedArray<double>& X0mat){
+          size_t n_scen = X0mat.getDimensions()[1];
+          std::vector<scenario_type> scenarios;
+          for (size_t k = 0; k < n_scen; k++){
+              scenarios.push_back(model.scenario(X0mat[0][k]));
+          }
+          return scenarios;
+      }
+
+      // Copy one data set (DATA{i} with weights W{i}) into a data_set, keeping
+      // only the times in ttot and the treatments in ctot (as in transfer.m)
+      data_set read_data(const matlab::data::TypedArray<double>& data,
+                         const matlab::data::TypedArray<double>& weights,
+                         const std::vector<double>& ttot, const std::vector<double>& ctot){
+          data_set ds;
+          size_t n_rows = data.getDimensions()[0];
+          size_t n_cols = data.getDimensions()[1];
+          ds.lam = data[0][0];
+          if (n_rows == 1){ // only scenarios, or just a zero: ignore it
+              return ds;
+          }
+          std::vector<size_t> rows, cols; // rows and columns of DATA{i} to use
+          for (size_t r = 1; r < n_rows; r++){
+              auto it = std::find(ttot.begin(), ttot.end(), (double)data[r][0]);
+              if (it == ttot.end()) continue; // time is not in the model output
+              ds.locT.push_back(it - ttot.begin());
+              rows.push_back(r);
+          }
+          for (size_t c = 1; c < n_cols; c++){
+              auto it = std::find(ctot.begin(), ctot.end(), (double)data[0][c]);
+              if (it == ctot.end()) continue; // treatment is not in the model output
+              ds.locC.push_back(it - ctot.begin());
+              cols.push_back(c);
+          }
+          ds.n_t = rows.size();
+          ds.n_c = cols.size();
+          for (size_t c : cols){
+              for (size_t r : rows){
+                  ds.D.push_back(data[r][c]);
+                  ds.w.push_back(weights[r-1][c-1]);
+              }
+          }
+          return ds;
+      }
+
+      // Collect everything for the likelihood (the inputs of the 'loglik'
+      // mode, see calc_loglik) into a loglik_problem
+      loglik_problem read_problem(const model_type& model,
+                                  matlab::data::TypedArray<double> ttot,
+                                  matlab::data::TypedArray<double> X0mat,
+                                  matlab::data::TypedArray<matlab::data::Array> data_cell,
+                                  matlab::data::TypedArray<matlab::data::Array> w_cell,
+                                  int solver, double abs_err, double rel_err, double Tbp,
+                                  int len, bool break_time, bool sameres,
+                                  matlab::data::TypedArray<double> datavar,
+                                  matlab::data::TypedArray<double> datawts){
+          loglik_problem prob;
+          prob.vector_pars = model.vector_pars;
+          prob.ttot.assign(ttot.begin(), ttot.end());
+          prob.scenarios = read_scenarios(model, X0mat);
+          size_t n_scen = X0mat.getDimensions()[1];
+          std::vector<double> ctot(n_scen);
+          for (size_t k = 0; k < n_scen; k++){
+              ctot[k] = X0mat[0][k];
+              std::vector<double> x0(4);
+              for (size_t j = 0; j < 4; j++){
+                  x0[j] = X0mat[j+1][k];
+              }
+              prob.x0.push_back(x0);
+          }
 
-          auto it = find(glo_int_scen_vec.begin(),glo_int_scen_vec.end(), conc);
-		  int int_loc = it - glo_int_scen_vec.begin();
+          // data sets in the order of DATA (states in columns)
+          prob.n_D = data_cell.getDimensions()[0];
+          size_t n_X = data_cell.getDimensions()[1];
+          for (size_t j = 0; j < n_X; j++){
+              for (size_t i = 0; i < prob.n_D; i++){
+                  matlab::data::TypedArray<double> data_i = data_cell[i][j];
+                  matlab::data::TypedArray<double> w_i = w_cell[i][j];
+                  prob.data.push_back(read_data(data_i, w_i, prob.ttot, ctot));
+              }
+          }
+
+          prob.solver     = solver;
+          prob.abs_err    = abs_err;
+          prob.rel_err    = rel_err;
+          prob.Tbp        = Tbp;
+          prob.len        = len;
+          prob.break_time = break_time;
+          prob.sameres    = sameres;
+          prob.datavar.assign(datavar.begin(), datavar.end());
+          prob.datawts.assign(datawts.begin(), datawts.end());
+          return prob;
+      }
+
+      // A scalar field of a structure
+      double read_scalar(matlab::data::StructArray& inStruct, const std::string& name){
+          matlab::data::TypedArray<double> field = inStruct[0][name];
+          return field[0];
+      }
+
+      // Read the structure from mex_problem.m: the likelihood problem, and
+      // where the fitted parameters of pmat go in the parameter vector.
+      // Returns false (after an error in MATLAB) for an unknown handle.
+      bool read_fitted(matlab::data::StructArray& inStruct, loglik_problem& prob, fitted_pars& fit){
+          auto it = models.find((int)read_scalar(inStruct, "h"));
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return false;
+          }
+          prob = read_problem(it->second, inStruct[0]["ttot"], inStruct[0]["X0mat"],
+              inStruct[0]["DATA"], inStruct[0]["W"], (int)read_scalar(inStruct, "stiff"),
+              read_scalar(inStruct, "AbsTol"), read_scalar(inStruct, "RelTol"), read_scalar(inStruct, "Tbp"),
+              (int)read_scalar(inStruct, "len"), read_scalar(inStruct, "break_time") == 1,
+              read_scalar(inStruct, "sameres") == 1, inStruct[0]["var"], inStruct[0]["wts"]);
+
+          matlab::data::TypedArray<double> pvec = inStruct[0]["pvec"];
+          matlab::data::TypedArray<double> loc  = inStruct[0]["loc_fit"];
+          matlab::data::TypedArray<double> logf = inStruct[0]["log_fit"];
+          matlab::data::TypedArray<double> bnds = inStruct[0]["bnds"];
+          fit.pvec.assign(pvec.begin(), pvec.end());
+          for (size_t i = 0; i < loc.getNumberOfElements(); i++){
+              fit.loc.push_back((size_t)loc[i] - 1); // MATLAB counts from 1
+              fit.logscale.push_back(logf[i] == 1);
+              fit.bnds.push_back({bnds[i][0], bnds[i][1]});
+          }
+          return true;
+      }
+
+      // Copy a matrix of parameter sets (rows) into a table, and back
+      table_type read_coll(matlab::data::TypedArray<double> coll){
+          size_t n_rows = coll.getDimensions()[0];
+          size_t n_cols = coll.getDimensions()[1];
+          table_type table(n_rows, std::vector<double>(n_cols));
+          for (size_t i = 0; i < n_rows; i++){
+              for (size_t j = 0; j < n_cols; j++){
+                  table[i][j] = coll[i][j];
+              }
+          }
+          return table;
+      }
+
+      matlab::data::TypedArray<double> write_coll(const table_type& table, size_t n_cols){
+          matlab::data::TypedArray<double> coll = factory.createArray<double>({table.size(), n_cols});
+          for (size_t i = 0; i < table.size(); i++){
+              for (size_t j = 0; j < n_cols; j++){
+                  coll[i][j] = table[i][j];
+              }
+          }
+          return coll;
+      }
+
+      // Return times, states and event times of a single solve to MATLAB
+      void write_solution(matlab::mex::ArgumentList& outputs,
+                          const std::vector<double>& times,
+                          const std::vector<state_type>& x_vec,
+                          const std::vector<double>& TE){
+          // initialize the arrays to store the output
+          matlab::data::TypedArray<double> doubleArray = factory.createArray(
+              {times.size(),1}, times.data(), times.data()+times.size());
+          matlab::data::TypedArray<double> doubleArray2 = factory.createArray<double>({x_vec.size(),x_vec[0].size()});
           
-          int size_t_int_coll = 0;
-          int size_t_int_coll2 = 0;
-          //displayOnMATLAB(stream);
-          if (timevar[0] == 0){
-			  // trick to avoid index error on int_coll calls..
-			  // should not affect things
-              int_loc = 0;    
-          }
-          matlab::data::TypedArray<double> int_coll=glo_int_coll[int_loc];
-          size_t_int_coll = (int)int_coll.getDimensions()[0];
-          size_t_int_coll2 = (int)int_coll.getDimensions()[1];
-		  vector <double> int_coll_times;
-          int ii =0;
-		  while (ii < size_t_int_coll){
-			  int_coll_times.push_back(int_coll[ii][0]);
-              ii++;
-		  }
-
-          int int_type = glo_int_type[int_loc];
+          /* output */
+          for( size_t i=0; i<x_vec.size(); i++ )
+          {
+              doubleArray2[i][0]=x_vec[i][0];
+              doubleArray2[i][1]=x_vec[i][1];
+              doubleArray2[i][2]=x_vec[i][2];
+              doubleArray2[i][3]=x_vec[i][3];
+          }
+          outputs[0] = doubleArray;  // vector of times
+          outputs[1] = doubleArray2; // vector of states
+          if (outputs.size() > 2){
+              outputs[2] = factory.createArray({TE.size(),1}, TE.data(), TE.data()+TE.size()); // times of the events
+          }
+      }
+
+      void solve_single(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){    
+          using namespace std;
+          // Create an output stream
+          // ostringstream stream; // needed in case of needing DEBUG
+
+          /* input parameters in the same order as they appear in derivatives.m
+           * -time range, 
+           * -initial conditions
+           * -par
+           * -c
+           * -glo
+           * -initial step (intial dt for the solver)
+		   * -abstol (error tolerances of the ODE solver)
+		   * -reltol
+		   * -max step size
+		   * (the maximum step size is needed to avoid the dense adaptive stepper to 
+		   * perform steps that are too large)
+		   * -times of the exposure events T (optional, for break_time=1). The
+		   * solver then runs piece-wise across all intervals between the
+		   * events, which must all be in the time range.
+           * Output: times, states, and (optional) the times at which the
+           * event functions of DEBderi cross zero (TE, as from eventsfun)
+           */
+
+          // time range
+          matlab::data::TypedArray<double> inArray = inputs[0];
+          vector<double> time_vector(inArray.begin(), inArray.end());
+          // initial conditions
+          matlab::data::TypedArray<double> inArray2 = inputs[1];
+          vector<double> init_states(inArray2.begin(), inArray2.end());
+          // par structure
+          matlab::data::StructArray inStructArrayPar = inputs[2];
+          // concentration c
+          double conc = inputs[3][0];
+          // glo structure
+	      matlab::data::StructArray inStructArrayGlo = inputs[4];
+	      // additional argument as I need an initial dt to be passed for the solver
+          double dt = inputs[5][0];
+          double AbsErr = inputs[6][0]; // tolerances for the ODE solver
+          double RelErr = inputs[7][0];
+		  double MaxStep = inputs[8][0]; // maximum step-size
+          vector<double> T; // event times, when breaking the time vector
+          if (inputs.size() > 9){
+              matlab::data::TypedArray<double> inArray3 = inputs[9];
+              T.assign(inArray3.begin(), inArray3.end());
+          }
+
+          vector<double> scalar_pars;
+          vector<std::vector<double>> vector_pars;
+          read_pars(inStructArrayPar, inStructArrayGlo, scalar_pars, vector_pars);
+
+          // exposure scenario for this treatment (the flag for time-varying
+          // exposure is set in call_deri.m)
+          scenario_type scen = read_model(inStructArrayGlo).scenario(conc);
+          matlab::data::TypedArray<double> glo_timevar = inStructArrayGlo[0]["timevar"];   // this is also just an array of doubles ([v1, v2])
+          scen.timevar.assign(glo_timevar.begin(), glo_timevar.end());
 
           // pass the value to the initial conditions
           //[ state_initialization
-          state_type x(4); // in DEB there are 4 states		  
+          state_type x; // in DEB there are 4 states		  
 		  // initial conditions
           x[0] = init_states[0]; 
           x[1] = init_states[1];
@@ -532,46 +556,1078 @@ class MexFunction : public matlab::mex::Function {
 
           vector<state_type> x_vec; // states
           vector<double> times;     // times
-          
-          // Define the stepper type (in this case a dense stepper)
-          typedef runge_kutta_dopri5<state_type> stepper_type;
+          vector<double> TE;        // times of the events
 
           // CHANGE HERE THE TOLERANCES according to what is in call_deri.m
           double abs_err = AbsErr , rel_err = RelErr , a_x = 1.0 , a_dxdt = 1.0;
 		  double max_step = MaxStep;
 
-          // solve the ODE using the stepper already defined. The times are those passed
-          // by the user
-          size_t steps = integrate_times(make_dense_output(abs_err , rel_err, max_step, stepper_type() ),
-                                         DEBderi(scalar_pars,
-                                                 vector_pars,
-                                                 conc,
-                                                 int_coll,
-												 int_coll_times,
-                                                 int_type,
-                                                 timevar,
-                                                 matlabPtr2),
-                                         x, time_vector, dt, 
-                                         push_back_state_and_time( x_vec , times ));
-          
-          // initialize the arrays to store the output
-          matlab::data::TypedArray<double> doubleArray = factory.createArray(
-              {times.size(),1}, times.data(), times.data()+times.size());
-          matlab::data::TypedArray<double> doubleArray2 = factory.createArray({x_vec.size(),x_vec[0].size()},
-                                                                               x_vec[0].data(),
-                                                                               x_vec[0].data()+x_vec[0].size());
-          
-          /* output */
-          // manually copy the values of the 4 states (can be improved with another cycle)
-          for( int i=0; i<=x_vec.size()-1; i++ )
-          {
-              // can I avoid this and copy directly the content of the vector?
-              doubleArray2[i][0]=x_vec[i][0];
-              doubleArray2[i][1]=x_vec[i][1];
-              doubleArray2[i][2]=x_vec[i][2];
-              doubleArray2[i][3]=x_vec[i][3];
+          DEBderi deri(deb_pars(scalar_pars, vector_pars), scen);
+          size_t steps;
+          if (T.size() > 1){
+              steps = integrate_intervals(deri, x, time_vector, T, scen.Tev, dt, abs_err, rel_err, max_step,
+                                          x_vec, times, TE, read_solver(inStructArrayGlo));
           }
-          outputs[0] = doubleArray;  // vector of times
-          outputs[1] = doubleArray2; // vector of states
+          else{
+              steps = integrate_scenario(deri, x, time_vector, dt, abs_err, rel_err, max_step,
+                                         x_vec, times, TE, read_solver(inStructArrayGlo));
+          }
+          
+          write_solution(outputs, times, x_vec, TE);
        }
-};
\ No newline at end of file
+
+      void solve_handle(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Complete replacement of the calculations in call_deri.m for a
+           * registered model, so that the structures par and glo do not
+           * need to be decoded. The time vector for the solver is built
+           * here (as in the batched solve), and only the requested time
+           * points are returned, with the output mapping of call_deri.m
+           * (maximum length, survival not negative, brood-pouch delay).
+           * Input parameters:
+           * -'solve'
+           * -model handle (from 'register')
+           * -time vector (the requested time points)
+           * -initial conditions
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m)
+           * -c
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * Output: states at the requested time points, and the times at
+           * which the event functions of DEBderi cross zero (TE)
+           * When the same request was solved before, the output is taken
+           * from the cache.
+           */
+
+          int h = (int)(double)inputs[1][0];
+          auto it = models.find(h);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t_req(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> inArray2 = inputs[3];
+          vector<double> x0(inArray2.begin(), inArray2.end());
+          matlab::data::TypedArray<double> inArray3 = inputs[4];
+          vector<double> scalar_pars(inArray3.begin(), inArray3.end());
+          double conc     = inputs[5][0];
+          int solver      = (int)(double)inputs[6][0];
+          double abs_err  = inputs[7][0];
+          double rel_err  = inputs[8][0];
+          double Tbp      = inputs[9][0];
+          int len         = (int)(double)inputs[10][0];
+          bool break_time = (double)inputs[11][0] == 1;
+          if (scalar_pars.size() != 22){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars)");
+              return;
+          }
+
+          size_t nt = t_req.size();
+          buffer_ptr_t<double> out_buf = factory.createBuffer<double>(nt*4);
+          vector<double> TE; // times of the events
+          vector<double> key = solve_cache::make_key(h, scalar_pars, conc, x0, t_req, solver,
+                                                     abs_err, rel_err, Tbp, len, break_time);
+          if (const solve_cache::entry* e = cache.find(key)){
+              std::copy(e->out.begin(), e->out.end(), out_buf.get());
+              TE = e->TE;
+          }
+          else{
+              solve_requested(scalar_pars, model.vector_pars, model.scenario(conc), x0, t_req,
+                              Tbp, len, break_time, abs_err, rel_err, solver, out_buf.get(), TE);
+              cache.insert(std::move(key), {vector<double>(out_buf.get(), out_buf.get() + nt*4), TE});
+          }
+
+          outputs[0] = factory.createArrayFromBuffer<double>({nt, 4}, std::move(out_buf));
+          if (outputs.size() > 1){
+              outputs[1] = factory.createArray({TE.size(),1}, TE.data(), TE.data()+TE.size());
+          }
+      }
+
+      void cache_settings(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+
+          /* Settings and counters of the cache of the 'solve' mode.
+           * Input parameters:
+           * -'cache'
+           * -(optional) maximum number of entries (0 switches the cache
+           *  off), or 'clear' to drop all entries and reset the counters
+           * Output: [hits misses entries capacity]
+           */
+
+          if (inputs.size() > 1){
+              if (inputs[1].getType() == ArrayType::CHAR){
+                  matlab::data::CharArray opt_arr = inputs[1];
+                  if (opt_arr.toAscii() != "clear"){
+                      throwError("test_derivatives: unknown option '" + opt_arr.toAscii() + "' for the cache");
+                      return;
+                  }
+                  cache.clear();
+              }
+              else{
+                  double n = inputs[1][0];
+                  if (!(n >= 0)){
+                      throwError("test_derivatives: the size of the cache cannot be negative");
+                      return;
+                  }
+                  cache.set_capacity((size_t)std::min(n, 1e9));
+              }
+          }
+          if (outputs.size() > 0){
+              outputs[0] = factory.createArray<double>({1, 4}, {(double)cache.hits(), (double)cache.misses(),
+                                                               (double)cache.size(), (double)cache.capacity()});
+          }
+      }
+
+      void solve_pop(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Intrinsic rate of increase (Euler-Lotka equation) for all
+           * treatments, food levels and parameter sets in one call, as
+           * calc_pop.m does with calc_epx_helper.m (calc_int = 1) for each
+           * of them (see pop_growth_rates in debtox_core.hpp). All of them
+           * are solved on a pool of threads.
+           * Input parameters:
+           * -'pop'
+           * -model handle (from 'register')
+           * -time vector
+           * -X0mat (first row is the scenario identifier, next rows the initial states)
+           * -matrix with parameter sets in rows (in the order of scalar_pars, see make_parvec.m)
+           * -food levels (replacing f; empty to keep the f of each set)
+           * -hatching time (Th)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * -number of threads (0 to use all available cores)
+           * Output: the intrinsic rate of increase, with treatments in
+           * rows, food levels in columns and parameter sets in the third
+           * dimension
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> X0mat = inputs[3];
+          table_type par_sets = read_coll(inputs[4]);
+          matlab::data::TypedArray<double> inArray2 = inputs[5];
+          vector<double> fscen(inArray2.begin(), inArray2.end());
+          double Th       = inputs[6][0];
+          int solver      = (int)(double)inputs[7][0];
+          double abs_err  = inputs[8][0];
+          double rel_err  = inputs[9][0];
+          double Tbp      = inputs[10][0];
+          int len         = (int)(double)inputs[11][0];
+          bool break_time = (double)inputs[12][0] == 1;
+          unsigned n_threads = (unsigned)(double)inputs[13][0];
+          if (X0mat.getDimensions()[0] != 5 || (!par_sets.empty() && par_sets[0].size() != 22)){
+              throwError("test_derivatives: the parameter sets need 22 columns (in the order of scalar_pars), and X0mat 5 rows (scenario and states)");
+              return;
+          }
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+
+          vector<scenario_type> scenarios = read_scenarios(model, X0mat);
+          size_t n_c = scenarios.size(), n_f = std::max<size_t>(fscen.size(), 1), n_sets = par_sets.size();
+          vector<vector<double>> x0(n_c, vector<double>(4));
+          for (size_t j = 0; j < n_c; j++){
+              for (size_t i = 0; i < 4; i++){
+                  x0[j][i] = X0mat[i+1][j];
+              }
+          }
+
+          buffer_ptr_t<double> out_buf = factory.createBuffer<double>(n_c*n_f*n_sets);
+          try{
+              pop_growth_rates(par_sets, model.vector_pars, scenarios, x0, fscen, t, Th, Tbp, len,
+                               break_time, abs_err, rel_err, solver, n_threads, out_buf.get());
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          outputs[0] = factory.createArrayFromBuffer<double>({n_c, n_f, n_sets}, std::move(out_buf));
+      }
+
+      void solve_sens(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* As 'solve', but with the forward sensitivities of the states
+           * to a selection of the parameters (see solve_sensitivities in
+           * debtox_core.hpp). The sensitivities are solved with dopri5.
+           * Input parameters:
+           * -'sens'
+           * -model handle (from 'register')
+           * -time vector (the requested time points)
+           * -initial conditions
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m)
+           * -c
+           * -parameters for the sensitivities (locations in the parameter vector, counting from 1)
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * Output: states at the requested time points, and their
+           * derivatives to the parameters (time, state, parameter)
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t_req(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> inArray2 = inputs[3];
+          vector<double> x0(inArray2.begin(), inArray2.end());
+          matlab::data::TypedArray<double> inArray3 = inputs[4];
+          vector<double> scalar_pars(inArray3.begin(), inArray3.end());
+          double conc     = inputs[5][0];
+          matlab::data::TypedArray<double> inArray4 = inputs[6];
+          vector<size_t> loc_par;
+          for (double loc : inArray4){
+              loc_par.push_back((size_t)loc - 1); // MATLAB counts from 1
+          }
+          double abs_err  = inputs[7][0];
+          double rel_err  = inputs[8][0];
+          double Tbp      = inputs[9][0];
+          int len         = (int)(double)inputs[10][0];
+          bool break_time = (double)inputs[11][0] == 1;
+          if (scalar_pars.size() != 22){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars)");
+              return;
+          }
+          for (size_t loc : loc_par){
+              if (loc > 21){
+                  throwError("test_derivatives: parameters for the sensitivities must be elements 1 to 22 of the parameter vector");
+                  return;
+              }
+          }
+
+          size_t nt = t_req.size(), n_par = loc_par.size();
+          buffer_ptr_t<double> out_buf  = factory.createBuffer<double>(nt*4);
+          buffer_ptr_t<double> dout_buf = factory.createBuffer<double>(nt*4*n_par);
+          solve_sensitivities(scalar_pars, model.vector_pars, model.scenario(conc), x0, t_req, loc_par,
+                              Tbp, len, break_time, abs_err, rel_err, out_buf.get(), dout_buf.get());
+
+          outputs[0] = factory.createArrayFromBuffer<double>({nt, 4}, std::move(out_buf));
+          if (outputs.size() > 1){
+              outputs[1] = factory.createArrayFromBuffer<double>({nt, 4, n_par}, std::move(dout_buf));
+          }
+      }
+
+      void solve_epx(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Effects at the end of the time vector for a whole range of
+           * multiplication factors (MF_test in calc_epx.m) in one call,
+           * relative to the control (MF = 0), as calc_epx_helper.m with
+           * calc_int = 0. The MFs are solved on a pool of threads.
+           * Input parameters:
+           * -'epx'
+           * -model handle (from 'register', with the exposure profile)
+           * -time vector
+           * -initial conditions (first element is the scenario identifier)
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m)
+           * -vector with the multiplication factors
+           * -traits (states to return, counting from 1)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * -number of threads (0 to use all available cores)
+           * Output: the final values of the traits relative to the control
+           * (MFs in rows, traits in columns), and the control values
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t_req(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> inArray2 = inputs[3];
+          double conc = inArray2[0];
+          vector<double> x0(inArray2.begin()+1, inArray2.end());
+          matlab::data::TypedArray<double> inArray3 = inputs[4];
+          vector<double> scalar_pars(inArray3.begin(), inArray3.end());
+          matlab::data::TypedArray<double> inArray4 = inputs[5];
+          vector<double> MF(inArray4.begin(), inArray4.end());
+          matlab::data::TypedArray<double> inArray5 = inputs[6];
+          vector<size_t> traits;
+          for (double loc : inArray5){
+              traits.push_back((size_t)loc - 1); // MATLAB counts from 1
+          }
+          int solver      = (int)(double)inputs[7][0];
+          double abs_err  = inputs[8][0];
+          double rel_err  = inputs[9][0];
+          double Tbp      = inputs[10][0];
+          int len         = (int)(double)inputs[11][0];
+          bool break_time = (double)inputs[12][0] == 1;
+          unsigned n_threads = (unsigned)(double)inputs[13][0];
+          if (scalar_pars.size() != 22 || x0.size() != 4){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars), and X0 5 (scenario and states)");
+              return;
+          }
+          for (size_t loc : traits){
+              if (loc > 3){
+                  throwError("test_derivatives: traits must be states 1 to 4");
+                  return;
+              }
+          }
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+
+          size_t n_MF = MF.size();
+          buffer_ptr_t<double> out_buf = factory.createBuffer<double>(n_MF*traits.size());
+          vector<double> Xctrl;
+          try{
+              epx_effects(scalar_pars, model.vector_pars, model.scenario(conc), x0, t_req,
+                          Tbp, len, break_time, abs_err, rel_err, solver, MF, traits, n_threads,
+                          out_buf.get(), Xctrl);
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          outputs[0] = factory.createArrayFromBuffer<double>({n_MF, traits.size()}, std::move(out_buf));
+          if (outputs.size() > 1){
+              outputs[1] = factory.createArray({1, Xctrl.size()}, Xctrl.data(), Xctrl.data()+Xctrl.size());
+          }
+      }
+
+      void solve_epx_root(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* EPx for all combinations of traits and effect levels of one
+           * parameter set, as the calls to fzero(@calc_epx_helper,...) in
+           * calc_epx.m. The control is solved once, and each MF once for
+           * all traits; the searches use the MFs that are already solved
+           * to narrow down their interval.
+           * Input parameters:
+           * -'epxroot'
+           * -model handle (from 'register', with the exposure profile)
+           * -time vector
+           * -initial conditions (first element is the scenario identifier)
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m)
+           * -traits (states to return, counting from 1)
+           * -matrix XF with a trait (index in the traits) and an effect
+           *  level (index in Feff) in each row, counting from 1
+           * -effect levels Feff
+           * -MF interval for each row of XF (with NaN as second element,
+           *  the first one is a starting value, as for fzero)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * Output: EPx for each row of XF (NaN when there is no change
+           * of sign), and the number of simulations
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t_req(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> inArray2 = inputs[3];
+          double conc = inArray2[0];
+          vector<double> x0(inArray2.begin()+1, inArray2.end());
+          matlab::data::TypedArray<double> inArray3 = inputs[4];
+          vector<double> scalar_pars(inArray3.begin(), inArray3.end());
+          matlab::data::TypedArray<double> inArray4 = inputs[5];
+          vector<size_t> traits;
+          for (double loc : inArray4){
+              traits.push_back((size_t)loc - 1); // MATLAB counts from 1
+          }
+          matlab::data::TypedArray<double> XF = inputs[6];
+          matlab::data::TypedArray<double> inArray5 = inputs[7];
+          vector<double> Feff(inArray5.begin(), inArray5.end());
+          matlab::data::TypedArray<double> MF_range = inputs[8];
+          int solver      = (int)(double)inputs[9][0];
+          double abs_err  = inputs[10][0];
+          double rel_err  = inputs[11][0];
+          double Tbp      = inputs[12][0];
+          int len         = (int)(double)inputs[13][0];
+          bool break_time = (double)inputs[14][0] == 1;
+          if (scalar_pars.size() != 22 || x0.size() != 4){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars), and X0 5 (scenario and states)");
+              return;
+          }
+          for (size_t loc : traits){
+              if (loc > 3){
+                  throwError("test_derivatives: traits must be states 1 to 4");
+                  return;
+              }
+          }
+          size_t n_XF = XF.getDimensions()[0];
+          if (XF.getDimensions()[1] != 2 || MF_range.getDimensions()[0] != n_XF || MF_range.getDimensions()[1] != 2){
+              throwError("test_derivatives: XF and the MF intervals need two columns, and one row for each EPx");
+              return;
+          }
+          for (size_t i = 0; i < n_XF; i++){
+              double i_X = XF[i][0], i_F = XF[i][1];
+              if (i_X < 1 || i_X > traits.size() || i_F < 1 || i_F > Feff.size()){
+                  throwError("test_derivatives: XF refers to a trait or effect level that is not there");
+                  return;
+              }
+          }
+
+          vector<double> EPx(n_XF);
+          size_t n_sim;
+          try{
+              epx_evaluator ev(scalar_pars, model.vector_pars, model.scenario(conc), x0, t_req,
+                               Tbp, len, break_time, abs_err, rel_err, solver, traits);
+              for (size_t i = 0; i < n_XF; i++){
+                  size_t i_X = (size_t)(double)XF[i][0] - 1, i_F = (size_t)(double)XF[i][1] - 1;
+                  EPx[i] = epx_root(ev, i_X, Feff[i_F], MF_range[i][0], MF_range[i][1]);
+              }
+              n_sim = ev.n_sim;
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          outputs[0] = factory.createArray({n_XF, 1}, EPx.data(), EPx.data()+n_XF);
+          if (outputs.size() > 1){
+              outputs[1] = factory.createScalar((double)n_sim);
+          }
+      }
+
+      void solve_epx_window(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Robust EPx for moving time windows over an exposure profile,
+           * as calc_epx_window.m with opt_ecx.rob_win = 1. The unexposed
+           * control is solved once, and each window only from its first
+           * exposure on (see epx_window in debtox_core.hpp).
+           * Input parameters:
+           * -'epxwindow'
+           * -model handle (from 'register', for glo.feedb and glo.moa)
+           * -initial states
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m,
+           *  with the background hazard set to zero)
+           * -exposure profile (time and concentration in columns, extended
+           *  as in calc_epx_window.m)
+           * -start of each window
+           * -length of the windows
+           * -MFs for the robust EPx (opt_ecx.rob_rng)
+           * -effect levels Feff
+           * -traits (states, counting from 1)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * -number of threads (0 to use all available cores)
+           * Output: EPx (windows in rows, traits in columns, effect levels
+           * in the third dimension; NaN when there is no exposure or the
+           * trait is not returned), and a matrix with 1 for the traits
+           * that calc_epx.m returns for each window
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+
+          epx_window_problem prob;
+          prob.vector_pars = it->second.vector_pars;
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          prob.x0.assign(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> inArray2 = inputs[3];
+          prob.scalar_pars.assign(inArray2.begin(), inArray2.end());
+          prob.Cw = read_table(inputs[4]);
+          matlab::data::TypedArray<double> inArray3 = inputs[5];
+          prob.Trange.assign(inArray3.begin(), inArray3.end());
+          prob.Twin = inputs[6][0];
+          matlab::data::TypedArray<double> inArray4 = inputs[7];
+          prob.MF_test.assign(inArray4.begin(), inArray4.end());
+          matlab::data::TypedArray<double> inArray5 = inputs[8];
+          prob.Feff.assign(inArray5.begin(), inArray5.end());
+          matlab::data::TypedArray<double> inArray6 = inputs[9];
+          for (double loc : inArray6){
+              prob.traits.push_back((size_t)loc - 1); // MATLAB counts from 1
+          }
+          prob.N_t        = 20; // as in calc_epx.m
+          prob.solver     = (int)(double)inputs[10][0];
+          prob.abs_err    = inputs[11][0];
+          prob.rel_err    = inputs[12][0];
+          prob.Tbp        = inputs[13][0];
+          prob.len        = (int)(double)inputs[14][0];
+          prob.break_time = (double)inputs[15][0] == 1;
+          unsigned n_threads = (unsigned)(double)inputs[16][0];
+          if (prob.scalar_pars.size() != 22 || prob.x0.size() != 4){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars), and X0 4 (the states)");
+              return;
+          }
+          for (size_t loc : prob.traits){
+              if (loc > 3){
+                  throwError("test_derivatives: traits must be states 1 to 4");
+                  return;
+              }
+          }
+          if (prob.Cw.size() < 2 || prob.Cw[0].size() != 2 || prob.MF_test.empty() || prob.Feff.empty()){
+              throwError("test_derivatives: the profile needs two columns, and MF_test and Feff at least one element");
+              return;
+          }
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+
+          size_t n_win = prob.Trange.size(), n_X = prob.traits.size(), n_F = prob.Feff.size();
+          buffer_ptr_t<double> epx_buf  = factory.createBuffer<double>(n_win*n_X*n_F);
+          buffer_ptr_t<double> kept_buf = factory.createBuffer<double>(n_win*n_X);
+          try{
+              epx_window(prob, n_threads, epx_buf.get(), kept_buf.get());
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          outputs[0] = factory.createArrayFromBuffer<double>({n_win, n_X, n_F}, std::move(epx_buf));
+          if (outputs.size() > 1){
+              outputs[1] = factory.createArrayFromBuffer<double>({n_win, n_X}, std::move(kept_buf));
+          }
+      }
+
+      void calc_loglik(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Minus log-likelihood for a registered model, replacing the
+           * calculations in transfer.m: all scenarios are solved as in the
+           * 'batch' mode, and compared to the data in C++. This covers
+           * continuous data (lam >= 0) and survival data in the multinomial
+           * setting (lam = -1); priors are added in transfer.m.
+           * Input parameters:
+           * -'loglik'
+           * -model handle (from 'register')
+           * -time vector (ttot, the requested time points)
+           * -X0mat (columns in the order of ctot; first row is the scenario
+           *  identifier, next rows the initial states)
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m)
+           * -DATA and W (cell arrays of n_D x n_X)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * -same residual variance for data sets of a state (glo.sameres)
+           * -data-set specific residual variances (glo.var, may be empty)
+           * -data-set specific weight factors (glo.wts, may be empty)
+           * Output: minus log-likelihood
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          matlab::data::TypedArray<double> inArray2 = inputs[4];
+          vector<double> scalar_pars(inArray2.begin(), inArray2.end());
+          if (scalar_pars.size() != 22){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars)");
+              return;
+          }
+          loglik_problem prob = read_problem(it->second, inputs[2], inputs[3], inputs[5], inputs[6],
+              (int)(double)inputs[7][0], inputs[8][0], inputs[9][0], inputs[10][0],
+              (int)(double)inputs[11][0], (double)inputs[12][0] == 1, (double)inputs[13][0] == 1,
+              inputs[14], inputs[15]);
+
+          double minloglik;
+          try{
+              minloglik = prob.minloglik(scalar_pars);
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          outputs[0] = factory.createScalar(minloglik);
+      }
+
+      void explore_parspace(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Sampling rounds of calc_parspace.m (round 1 on a grid or Latin
+           * hypercube, and the rounds of mutations until the stop criteria
+           * are met), with the likelihood of all sets calculated on a pool
+           * of threads (see parspace.hpp).
+           * Input parameters:
+           * -'parspace'
+           * -structure from mex_problem.m
+           * -structure with the settings (see parspace_settings)
+           * -seed for the random numbers
+           * Output:
+           * -coll_all (fitted parameters and MLL in the last column, sorted)
+           * -number of rounds done
+           * -minmax (only when slow kinetics was caught, otherwise empty)
+           */
+
+          matlab::data::StructArray inStructProb = inputs[1];
+          matlab::data::StructArray PS = inputs[2];
+          loglik_problem prob;
+          fitted_pars fit;
+          if (!read_fitted(inStructProb, prob, fit)){
+              return;
+          }
+          unsigned n_threads = (unsigned)read_scalar(inStructProb, "n_cores");
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+          std::mt19937 rng((unsigned)(double)inputs[3][0]);
+
+          parspace_settings s;
+          matlab::data::TypedArray<double> chicrit_rnd = PS[0]["chicrit_rnd"];
+          matlab::data::TypedArray<double> n_tr = PS[0]["n_tr"];
+          matlab::data::TypedArray<double> f_d = PS[0]["f_d"];
+          matlab::data::TypedArray<double> n_conf = PS[0]["n_conf"];
+          s.chicrit_rnd.assign(chicrit_rnd.begin(), chicrit_rnd.end());
+          s.n_tr.assign(n_tr.begin(), n_tr.end());
+          s.f_d.assign(f_d.begin(), f_d.end());
+          s.chicrit_joint  = read_scalar(PS, "chicrit_joint");
+          s.chicrit_single = read_scalar(PS, "chicrit_single");
+          s.chicrit_max    = read_scalar(PS, "chicrit_max");
+          s.n_ok      = (size_t)read_scalar(PS, "n_ok");
+          s.n_conf[0] = (size_t)n_conf[0];
+          s.n_conf[1] = (size_t)n_conf[1];
+          s.tries     = (size_t)read_scalar(PS, "tries");
+          s.n_max     = (size_t)read_scalar(PS, "n_max");
+          s.n_opt     = (size_t)read_scalar(PS, "n_opt");
+          s.rough     = read_scalar(PS, "rough") == 1;
+          s.dupl      = read_scalar(PS, "dupl") == 1;
+          s.loc_kd    = (int)read_scalar(PS, "loc_kd") - 1; // MATLAB counts from 1 (0 to skip)
+          s.loc_mw    = (int)read_scalar(PS, "loc_mw") - 1;
+          s.slowkin_corr = read_scalar(PS, "slowkin_corr");
+          s.slowkin_pars = read_scalar(PS, "slowkin_pars");
+
+          objective_type mll = [&](const double* pfit){ return minloglik(prob, fit, pfit); };
+          // the messages are shown between the rounds, from the MATLAB thread
+          display_type disp = [&](const std::string& str){
+              std::ostringstream stream;
+              stream << str << "\n";
+              displayOnMATLAB(stream);
+          };
+          parspace_result res;
+          try{
+              res = ::explore_parspace(fit, mll, s, rng, n_threads, disp);
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          outputs[0] = write_coll(res.coll_all, fit.size()+1);
+          if (outputs.size() > 1){
+              outputs[1] = factory.createScalar((double)res.n_rnd);
+          }
+          if (outputs.size() > 2){
+              outputs[2] = write_coll(res.minmax, res.slowkin ? 2 : 0);
+          }
+      }
+
+      void mutate_sets(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Random mutations of a set of parameter sets, with their
+           * likelihood calculated on a pool of threads, replacing the
+           * parfor in rand_mutations.m.
+           * Input parameters:
+           * -'mutate'
+           * -structure from mex_problem.m
+           * -coll_ok (parameter sets to mutate, in rows)
+           * -number of new tries per set
+           * -maximum step for each parameter
+           * -seed for the random numbers
+           * Output: coll_tries (new sets with their MLL, sorted)
+           */
+
+          matlab::data::StructArray inStructProb = inputs[1];
+          loglik_problem prob;
+          fitted_pars fit;
+          if (!read_fitted(inStructProb, prob, fit)){
+              return;
+          }
+          unsigned n_threads = (unsigned)read_scalar(inStructProb, "n_cores");
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+          table_type coll_ok = read_coll(inputs[2]);
+          size_t n_tr_i = (size_t)(double)inputs[3][0];
+          matlab::data::TypedArray<double> inArray = inputs[4];
+          vector<double> d_grid_i(inArray.begin(), inArray.end());
+          std::mt19937 rng((unsigned)(double)inputs[5][0]);
+
+          objective_type mll = [&](const double* pfit){ return minloglik(prob, fit, pfit); };
+          table_type coll_tries;
+          try{
+              coll_tries = rand_mutations(coll_ok, fit.bnds, n_tr_i, d_grid_i, rng, mll, n_threads);
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+          outputs[0] = write_coll(coll_tries, fit.size()+1);
+      }
+
+      void sample_slice(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Sample from the posterior with the slice sampler of calc_slice.m,
+           * with several independent chains on a pool of threads (see
+           * slice.hpp).
+           * Input parameters:
+           * -'slice'
+           * -structure from mex_problem.m
+           * -parshat (starting point, fitted parameters on the fitting scale)
+           * -number of samples (for all chains together)
+           * -structure with the settings (thin, burn, slwidth, chains)
+           * -seed for the random numbers
+           * Output: rnd (the sample of all chains, one after the other, with
+           * the MLL in the last column)
+           */
+
+          matlab::data::StructArray inStructProb = inputs[1];
+          matlab::data::StructArray SL = inputs[4];
+          loglik_problem prob;
+          fitted_pars fit;
+          if (!read_fitted(inStructProb, prob, fit)){
+              return;
+          }
+          unsigned n_threads = (unsigned)read_scalar(inStructProb, "n_cores");
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> x0(inArray.begin(), inArray.end());
+          std::mt19937 rng((unsigned)(double)inputs[5][0]);
+
+          slice_settings s;
+          matlab::data::TypedArray<double> width = SL[0]["slwidth"];
+          s.nrs   = (size_t)(double)inputs[3][0];
+          s.thin  = (size_t)read_scalar(SL, "thin");
+          s.burn  = (size_t)read_scalar(SL, "burn");
+          s.width.assign(width.begin(), width.end());
+          s.n_chains = (size_t)read_scalar(SL, "chains");
+          if (s.n_chains == 0){ // one chain for each thread
+              s.n_chains = n_threads;
+          }
+          if (x0.size() != fit.size() || (s.width.size() != 1 && s.width.size() != x0.size())){
+              throwError("test_derivatives: parshat and slwidth should have one value for each fitted parameter");
+              return;
+          }
+
+          objective_type mll = [&](const double* pfit){ return minloglik(prob, fit, pfit); };
+          table_type rnd;
+          try{
+              rnd = slice_sample(mll, x0, s, rng, n_threads);
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+          outputs[0] = write_coll(rnd, fit.size()+1);
+      }
+
+      void profile_likelihood(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Profile likelihoods of calc_proflik.m, with all branches (each
+           * profiled parameter, down and up) on a pool of threads (see
+           * proflik.hpp).
+           * Input parameters:
+           * -'proflik'
+           * -structure from mex_problem.m (the profiled parameters are
+           *  included as fitted ones)
+           * -run_profs (location of the profiled parameter among those of
+           *  the problem, counting from 1, and 1 for down or 2 for up)
+           * -logical vector: parameters of the problem that are fitted
+           * -structure with the settings (see proflik_settings)
+           * -seed for the random numbers
+           * Output (with the number of the branch in the first column):
+           * -profiles (parameter value and likelihood ratio)
+           * -sets in the joint 95% region (fitted parameters and ratio)
+           * -better sets (all parameters of the problem), when found
+           * -log-likelihood of the best fit, for each branch
+           */
+
+          matlab::data::StructArray inStructProb = inputs[1];
+          matlab::data::StructArray PR = inputs[4];
+          loglik_problem prob;
+          fitted_pars fit;
+          if (!read_fitted(inStructProb, prob, fit)){
+              return;
+          }
+          unsigned n_threads = (unsigned)read_scalar(inStructProb, "n_cores");
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+          table_type run_profs = read_coll(inputs[2]);
+          matlab::data::TypedArray<double> inArray = inputs[3];
+          vector<bool> fitted;
+          for (double v : inArray) fitted.push_back(v == 1);
+          vector<double> phat(fit.size()); // best fit, on the fitting scale
+          for (size_t k = 0; k < fit.size(); k++){
+              phat[k] = fit.logscale[k] ? std::log10(fit.pvec[fit.loc[k]]) : fit.pvec[fit.loc[k]];
+              phat[k] = std::min(std::max(phat[k], fit.bnds[k][0]), fit.bnds[k][1]); // no round-off outside the bounds
+          }
+          std::mt19937 rng((unsigned)(double)inputs[5][0]);
+          if (fitted.size() != fit.size()){
+              throwError("test_derivatives: the fitted parameters do not match the problem");
+              return;
+          }
+          for (const vector<double>& r : run_profs){
+              if (r.size() < 2 || r[0] < 1 || r[0] > fit.size()){
+                  throwError("test_derivatives: profiled parameter outside the problem");
+                  return;
+              }
+          }
+
+          proflik_settings s;
+          s.detail   = (int)read_scalar(PR, "detail");
+          s.n_sub    = (size_t)read_scalar(PR, "subopt");
+          s.Fsub_opt = read_scalar(PR, "subrng");
+          s.brkprof  = (int)read_scalar(PR, "brkprof");
+          s.chicritJ = read_scalar(PR, "chicritJ");
+          s.n_par    = (size_t)read_scalar(PR, "n_par");
+
+          objective_type mll = [&](const double* pfit){ return minloglik(prob, fit, pfit); };
+          size_t n_run = run_profs.size();
+          vector<proflik_branch> res(n_run);
+          vector<std::mt19937::result_type> seeds(n_run);
+          for (size_t j = 0; j < n_run; j++) seeds[j] = rng();
+          try{
+              parallel_for(n_run, n_threads, [&](size_t j){
+                  std::mt19937 rng_j(seeds[j]);
+                  res[j] = profile_branch(mll, phat, fit.bnds, fit.logscale, fitted, (size_t)run_profs[j][0] - 1,
+                                          run_profs[j][1] == 1 ? -1 : 1, s, rng_j);
+              });
+          }
+          catch (const std::exception& e){
+              throwError(e.what());
+              return;
+          }
+
+          size_t n_fitted = std::count(fitted.begin(), fitted.end(), true);
+          table_type prof, acc, better;
+          vector<double> loglikmax(n_run);
+          for (size_t j = 0; j < n_run; j++){
+              for (size_t i = 0; i < res[j].Xcoll.size(); i++){
+                  prof.push_back({(double)(j+1), res[j].Xcoll[i], res[j].loglikrat[i]});
+              }
+              for (const vector<double>& r : res[j].sample_acc){
+                  acc.push_back({(double)(j+1)});
+                  acc.back().insert(acc.back().end(), r.begin(), r.end());
+              }
+              if (!res[j].p_better.empty()){
+                  better.push_back({(double)(j+1)});
+                  better.back().insert(better.back().end(), res[j].p_better.begin(), res[j].p_better.end());
+              }
+              loglikmax[j] = res[j].loglikmax;
+          }
+          outputs[0] = write_coll(prof, 3);
+          if (outputs.size() > 1){
+              outputs[1] = write_coll(acc, n_fitted+2);
+          }
+          if (outputs.size() > 2){
+              outputs[2] = write_coll(better, fit.size()+1);
+          }
+          if (outputs.size() > 3){
+              matlab::data::TypedArray<double> llmax = factory.createArray<double>({n_run, 1});
+              for (size_t j = 0; j < n_run; j++) llmax[j] = loglikmax[j];
+              outputs[3] = llmax;
+          }
+      }
+
+      void solve_batch(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Batched solve for all scenarios (columns of X0mat) in one call.
+           * This replaces the loop over the concentrations in transfer.m,
+           * for the C++ solvers (glo.break_time is followed as in call_deri.m).
+           * Input parameters:
+           * -'batch'
+           * -model handle (from 'register')
+           * -time vector (ttot, the requested time points)
+           * -X0mat (first row is the scenario identifier, next rows the initial states)
+           * -parameter vector (in the order of scalar_pars, see make_parvec.m)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * Output: 3D array with time in rows, states in columns and
+           * scenarios in the third dimension (same order as in X0mat)
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t_req(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> X0mat = inputs[3];
+          matlab::data::TypedArray<double> inArray2 = inputs[4];
+          vector<double> scalar_pars(inArray2.begin(), inArray2.end());
+          int solver      = (int)(double)inputs[5][0];
+          double abs_err  = inputs[6][0];
+          double rel_err  = inputs[7][0];
+          double Tbp      = inputs[8][0];
+          int len         = (int)(double)inputs[9][0];
+          bool break_time = (double)inputs[10][0] == 1;
+          if (scalar_pars.size() != 22){
+              throwError("test_derivatives: the parameter vector needs 22 elements (in the order of scalar_pars)");
+              return;
+          }
+
+          size_t n_scen = X0mat.getDimensions()[1];
+          size_t nt     = t_req.size();
+          vector<scenario_type> scenarios = read_scenarios(model, X0mat);
+
+          buffer_ptr_t<double> out_buf = factory.createBuffer<double>(nt*4*n_scen);
+          double* out = out_buf.get();
+
+          for (size_t k = 0; k < n_scen; k++){
+              vector<double> x0(4);
+              for (size_t j = 0; j < 4; j++){
+                  x0[j] = X0mat[j+1][k];
+              }
+              solve_requested(scalar_pars, model.vector_pars, scenarios[k], x0, t_req,
+                              Tbp, len, break_time, abs_err, rel_err, solver, out + nt*4*k);
+          }
+
+          outputs[0] = factory.createArrayFromBuffer<double>({nt, 4, n_scen}, std::move(out_buf));
+      }
+
+      void solve_ensemble(matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs){
+          using namespace std;
+
+          /* Solve all scenarios (columns of X0mat) for a whole set of
+           * parameter vectors in one call, on a pool of native threads.
+           * This replaces the (par)for loop over the parameter sets in
+           * calc_conf.m.
+           * Input parameters:
+           * -'ensemble'
+           * -model handle (from 'register')
+           * -time vector (the requested time points)
+           * -X0mat (first row is the scenario identifier, next rows the initial states)
+           * -matrix with parameter sets in rows (in the order of scalar_pars, see make_parvec.m)
+           * -solver (glo.stiff(1))
+           * -abstol (error tolerances of the ODE solver)
+           * -reltol
+           * -brood-pouch delay (glo.Tbp)
+           * -length switch (glo.len)
+           * -break time vector up for the solver (glo.break_time)
+           * -number of threads (0 to use all available cores)
+           * Output: 4D array with time in rows, states in columns,
+           * scenarios in the third dimension and parameter sets in the
+           * fourth
+           */
+
+          auto it = models.find((int)(double)inputs[1][0]);
+          if (it == models.end()){
+              throwError("test_derivatives:unknownHandle", "test_derivatives: unknown model handle (register glo first)");
+              return;
+          }
+          const model_type& model = it->second;
+          const vector<std::vector<double>>& vector_pars = model.vector_pars;
+
+          matlab::data::TypedArray<double> inArray = inputs[2];
+          vector<double> t_req(inArray.begin(), inArray.end());
+          matlab::data::TypedArray<double> X0mat = inputs[3];
+          matlab::data::TypedArray<double> par_sets = inputs[4];
+          int solver      = (int)(double)inputs[5][0];
+          double abs_err  = inputs[6][0];
+          double rel_err  = inputs[7][0];
+          double Tbp      = inputs[8][0];
+          int len         = (int)(double)inputs[9][0];
+          bool break_time = (double)inputs[10][0] == 1;
+          unsigned n_threads = (unsigned)(double)inputs[11][0];
+          if (n_threads == 0){
+              n_threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+
+          size_t n_scen = X0mat.getDimensions()[1];
+          size_t n_sets = par_sets.getDimensions()[0];
+          size_t n_pars = par_sets.getDimensions()[1];
+          size_t nt     = t_req.size();
+          if (n_pars != 22){
+              throwError("test_derivatives: the parameter sets need 22 columns (in the order of scalar_pars)");
+              return;
+          }
+
+          // everything that is needed from MATLAB is read before starting the threads
+          vector<vector<double>> scalar_sets(n_sets, vector<double>(n_pars));
+          for (size_t k = 0; k < n_sets; k++){
+              for (size_t i = 0; i < n_pars; i++){
+                  scalar_sets[k][i] = par_sets[k][i];
+              }
+          }
+
+          vector<scenario_type> scenarios = read_scenarios(model, X0mat);
+          vector<vector<double>> x0(n_scen, vector<double>(4));
+          for (size_t k = 0; k < n_scen; k++){
+              for (size_t j = 0; j < 4; j++){
+                  x0[k][j] = X0mat[j+1][k];
+              }
+          }
+
+          buffer_ptr_t<double> out_buf = factory.createBuffer<double>(nt*4*n_scen*n_sets);
+          double* out = out_buf.get();
+
+          // one task is one scenario for one parameter set
+          try{
+              parallel_for(n_sets*n_scen, n_threads, [&](size_t task){
+                  size_t k = task / n_scen; // parameter set
+                  size_t j = task % n_scen; // scenario
+                  solve_requested(scalar_sets[k], vector_pars, scenarios[j], x0[j], t_req,
+                                  Tbp, len, break_time, abs_err, rel_err, solver, out + nt*4*(j + n_scen*k));
+              });
+          }
+          catch (const std::exception& e){
+              throwError(std::string("test_derivatives: ") + e.what());
+              return;
+          }
+
+          outputs[0] = factory.createArrayFromBuffer<double>({nt, 4, n_scen, n_sets}, std::move(out_buf));
+      }
+};
@@ -157,6 +157,11 @@ if size(pmat,1) ~= length(glo2.names) || sum(ind_fit) ~= size(rnd,2)
     error('There is something wrong with the parameter vector!')
 end
 
+% the model calculates all samples in one go when the C++ code can be used
+% (see mex_settings.m in the Cdubia folder)
+use_batch = glo.batch >= 1 && isempty(namesz) && mex_settings(glo,X0mat(1,:));
+par_coll  = cell(n_samples,1); % cell array with a parameter structure for each sample (for use_batch)
+
 for k = 1:n_samples % run through all samples
     
     waitbar(k/n_samples,f) % update waiting bar
@@ -173,6 +178,10 @@ for k = 1:n_samples % run through all samples
     pmat(loc_zero,1) = 0; % make parameter zero in each set of the sample!
     % this has to be done after the tranformation to normal scale!
     par_k = packunpack(2,0,pmat); % transform parameter matrix into a structure
+    if use_batch
+        par_coll{k} = par_k; % collect it, and calculate all samples after this loop
+        continue
+    end
     
     for j = 1:n_s % run through our scenarios
         [Xout,~,~,zvd] = call_deri(t,par_k,X0mat(:,j),glo); % use call_deri.m to provide the output for one scenario
@@ -189,6 +198,16 @@ for k = 1:n_samples % run through all samples
 end
 close(f) % close the waiting bar
 
+if use_batch
+    Xall = call_deri_ensemble(t,par_coll,X0mat,glo,0); % use call_deri_ensemble.m for all samples and scenarios (on all cores)
+    % Note: Xall is a 4D matrix with time in rows, states in columns,
+    % scenarios in the third dimension, and samples in the fourth.
+    for i = 1:n_X  % run through state variables
+        X2{i} = reshape(Xall(:,i,:,:),length(t),n_s,n_samples); % collect state variable i into structure X2
+    end
+    clear par_coll Xall % clear these large variables as they are no longer needed
+end
+
 %% Calculating intervals on the model curves
 
 Xlo = cell(n_X,1); % pre-define structure
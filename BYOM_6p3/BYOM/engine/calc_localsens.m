@@ -70,20 +70,49 @@ sens = cell(n_X,1); % pre-define structure
 for i = 1:n_X % run through state variables
     sens{i} = zeros(length(t),n_s,size(pmat,1)); % initialise sensitivities matrix with zeros
 end
-for p = 1:n_p % run through all parameters for which to calculate sensitivity
-    pmat_tmp = pmat; % start from fresh parameter matrix
-    pmat_tmp(ind_use(p),1) = pmat_tmp(ind_use(p),1) * (1+Fchange); % change one parameter slightly
-    par_k = packunpack(2,0,pmat_tmp); % transform parameter matrix into a structure
+% With glo.batch>0, the C++ code solves the derivatives to all parameters
+% along with the states (see call_deri_sens.m in the Cdubia folder), which
+% replaces the extra runs with changed parameters below. It returns empty
+% when it cannot be used.
+dXdp = cell(n_s,1);
+if glo.batch >= 1 && exist('call_deri_sens','file')==2
     for j = 1:n_s % run through our scenarios
-        Xout = call_deri(t,par_k,X0mat(:,j),glo); % use call_deri.m to provide the output for one scenario
-        for i = 1:n_X  % run through all state variables
-            switch sens_type
-                case 1
-                    relstate = (Xout(:,i) - Xbase{i}(:,j)) ./ Xbase{i}(:,j); % relative change in state
-                case 2
-                    relstate = (Xout(:,i) - Xbase{i}(:,j)); % absolute change in state
+        [~,dXdp{j}] = call_deri_sens(t,par_plot,X0mat(:,j),glo,names);
+        if size(dXdp{j},2) < n_X % also when the model has more states than the C++ code
+            dXdp = cell(n_s,1);
+            break
+        end
+    end
+end
+if ~isempty(dXdp{1})
+    for p = 1:n_p % run through all parameters for which to calculate sensitivity
+        for j = 1:n_s % run through our scenarios
+            for i = 1:n_X  % run through all state variables
+                switch sens_type % the limit of the sensitivity below for a small change
+                    case 1
+                        sens{i}(:,j,p) = dXdp{j}(:,i,p) * pmat(ind_use(p),1) ./ Xbase{i}(:,j);
+                    case 2
+                        sens{i}(:,j,p) = dXdp{j}(:,i,p) * pmat(ind_use(p),1);
+                end
+            end
+        end
+    end
+else % finite differences, when there are no derivatives from the C++ code
+    for p = 1:n_p % run through all parameters for which to calculate sensitivity
+        pmat_tmp = pmat; % start from fresh parameter matrix
+        pmat_tmp(ind_use(p),1) = pmat_tmp(ind_use(p),1) * (1+Fchange); % change one parameter slightly
+        par_k = packunpack(2,0,pmat_tmp); % transform parameter matrix into a structure
+        for j = 1:n_s % run through our scenarios
+            Xout = call_deri(t,par_k,X0mat(:,j),glo); % use call_deri.m to provide the output for one scenario
+            for i = 1:n_X  % run through all state variables
+                switch sens_type
+                    case 1
+                        relstate = (Xout(:,i) - Xbase{i}(:,j)) ./ Xbase{i}(:,j); % relative change in state
+                    case 2
+                        relstate = (Xout(:,i) - Xbase{i}(:,j)); % absolute change in state
+                end
+                sens{i}(:,j,p) = relstate / Fchange; % sensitivity coefficient
             end
-            sens{i}(:,j,p) = relstate / Fchange; % sensitivity coefficient
         end
     end
 end
@@ -312,6 +312,9 @@ end
 if ~isfield(glo,'break_time')
     glo.break_time = 1; % break time vector up for ODE solver (1) or don't (0)
 end
+if ~isfield(glo,'batch')
+    glo.batch = 0; % calculate all scenarios in one call to call_deri_batch (1), also the likelihood with call_loglik (2), or call call_deri for each scenario (0)
+end
 
 if n_X ~= size(X0mat,1)-1 % this should not occur anymore
     error('The number of state variables in X0mat does not match the number of data sets entered. If you do not have data for a state, use DATA{x}=0.')
@@ -8,6 +8,8 @@ function [MinColl,MinCI,ind_traits] = calc_epx_window(par_plot,fname_prof,Twin,o
 % dedicated traits (whose position in the state vector is given by:
 % <glo.locS>, <glo.locL> or <glo.locR>). The actual calculations of the EPx
 % (with CI) is performed by calc_epx.
+% For the robust EPx without CIs and glo.batch>0, the C++ code does all
+% windows in one go (see call_epx_window.m in the Cdubia folder).
 % 
 % <par_plot>   parameter structure for the best-fit curve; if left empty the
 %              structure from the saved sample is used
@@ -30,7 +32,7 @@ function [MinColl,MinCI,ind_traits] = calc_epx_window(par_plot,fname_prof,Twin,o
 %  This source code is licensed under the MIT-style license found in the
 %  LICENSE.txt file in the root directory of BYOM. 
 
-global glo
+global glo X0mat
 
 filenm    = glo.basenm;
 
@@ -194,52 +196,75 @@ end
 % calc_epx.
 
 traitcoll = [];
-for i_T = 1:length(Trange) % run through all time points (start of window)
-    
-    if batch_epx == 0
-        waitbar(i_T/length(Trange),f) % update the waiting bar
-    end
-    
-    if prune_win == 1 && Trange_sel(i_T) == 0 % then this window is pruned
-        continue % so move to next window!
+EPx_win   = [];
+if rob_win == 1 && type_conf == 0 && calc_int == 0 && saveall == 0 && glo.batch >= 1 && exist('call_epx_window','file')==2
+    % The C++ code does all windows in one call (on all cores): the
+    % unexposed control is solved once, and each window only from its first
+    % exposure on (it returns empty when it cannot be used).
+    ind_win = 1:length(Trange);
+    if prune_win == 1
+        ind_win = find(Trange_sel ~= 0); % only the windows that are not pruned
     end
-    
-    T = [Trange(i_T);Trange(i_T)+Twin]; % time window of length Twin
-    % locate time window in exposure profile
-    ind_1  = find(Cw(:,1)>=T(1),1,'first');
-    ind_2  = find(Cw(:,1)>=T(2),1,'first');
-    
-    if ~isempty(ind_2) % then the end of the window is within the total profile
-        Cw_tmp = Cw(ind_1:ind_2,:); % extract only the profile that covers the time window
-    else % then the end of the window is outside of the profile
-        Cw_tmp = Cw(ind_1:end,:); % take the profile as is
-    end % NOTE: is this still needed with the extension of Cw above?
-    if Cw_tmp(1,1) > T(1) % if the profile does not start at the exact point where we want to start
-        Cw_0   = interp1(Cw(:,1),Cw(:,2),T(1)); % interpolate to the exact point in the profile
-        Cw_tmp = cat(1,[T(1) Cw_0],Cw_tmp);     % and add the interpolated point to the profile
+    loc_id = find(X0mat(1,:) == id_sel(1)); % find where specified ID is in X0mat (as in calc_epx)
+    if isempty(loc_id) % if we cannot find the specified ID ...
+        loc_id = 1; % take first column for our analysis
     end
-    
-    Cw_tmp(:,1) = Cw_tmp(:,1)-T(1); % make time vector for the short profile start at zero again
+    [EPx_win,kept_win] = call_epx_window(par_plot,X0mat(2:end,loc_id),Cw,Trange(ind_win),Twin,opt_ecx,ind_traits,glo,0);
+end
 
-    if ~all(Cw_tmp(:,2)==0) % if there is no exposure, there is no effect
-        if saveall == 0
-            [EPx,EPx_lo,EPx_hi,ind_traits_tmp] = calc_epx(par_plot,Cw_tmp,[],opt_ecx,opt_conf,[],rnd);
-        else % calling calc_epx with the start time for the window triggers saving of results!
-            [EPx,EPx_lo,EPx_hi,ind_traits_tmp] = calc_epx(par_plot,Cw_tmp,[],opt_ecx,opt_conf,[],rnd,Trange(i_T));
+if ~isempty(EPx_win)
+    traitcoll = ind_traits(any(kept_win==1,1)); % traits that have meaningful output, at some windows
+    for j_eff = 1:length(Feff)
+        Xcoll{j_eff}(ind_win,:) = EPx_win(:,:,j_eff);
+    end
+else
+    for i_T = 1:length(Trange) % run through all time points (start of window)
+        
+        if batch_epx == 0
+            waitbar(i_T/length(Trange),f) % update the waiting bar
         end
-        traitcoll = unique([traitcoll ind_traits_tmp]); % collect traits that have meaningful output, at some windows
-        for i_trt = 1:length(ind_traits_tmp)
-            [~,ind_trt] = ismember(ind_traits_tmp(i_trt),ind_traits);
-            for j_eff = 1:length(Feff)
-                Xcoll{j_eff}(i_T,ind_trt) = EPx{j_eff}(i_trt);
-                if type_conf > 0
-                    Xlo{j_eff}(i_T,ind_trt) = EPx_lo{j_eff}(i_trt);
-                    Xhi{j_eff}(i_T,ind_trt) = EPx_hi{j_eff}(i_trt);
+        
+        if prune_win == 1 && Trange_sel(i_T) == 0 % then this window is pruned
+            continue % so move to next window!
+        end
+        
+        T = [Trange(i_T);Trange(i_T)+Twin]; % time window of length Twin
+        % locate time window in exposure profile
+        ind_1  = find(Cw(:,1)>=T(1),1,'first');
+        ind_2  = find(Cw(:,1)>=T(2),1,'first');
+        
+        if ~isempty(ind_2) % then the end of the window is within the total profile
+            Cw_tmp = Cw(ind_1:ind_2,:); % extract only the profile that covers the time window
+        else % then the end of the window is outside of the profile
+            Cw_tmp = Cw(ind_1:end,:); % take the profile as is
+        end % NOTE: is this still needed with the extension of Cw above?
+        if Cw_tmp(1,1) > T(1) % if the profile does not start at the exact point where we want to start
+            Cw_0   = interp1(Cw(:,1),Cw(:,2),T(1)); % interpolate to the exact point in the profile
+            Cw_tmp = cat(1,[T(1) Cw_0],Cw_tmp);     % and add the interpolated point to the profile
+        end
+        
+        Cw_tmp(:,1) = Cw_tmp(:,1)-T(1); % make time vector for the short profile start at zero again
+
+        if ~all(Cw_tmp(:,2)==0) % if there is no exposure, there is no effect
+            if saveall == 0
+                [EPx,EPx_lo,EPx_hi,ind_traits_tmp] = calc_epx(par_plot,Cw_tmp,[],opt_ecx,opt_conf,[],rnd);
+            else % calling calc_epx with the start time for the window triggers saving of results!
+                [EPx,EPx_lo,EPx_hi,ind_traits_tmp] = calc_epx(par_plot,Cw_tmp,[],opt_ecx,opt_conf,[],rnd,Trange(i_T));
+            end
+            traitcoll = unique([traitcoll ind_traits_tmp]); % collect traits that have meaningful output, at some windows
+            for i_trt = 1:length(ind_traits_tmp)
+                [~,ind_trt] = ismember(ind_traits_tmp(i_trt),ind_traits);
+                for j_eff = 1:length(Feff)
+                    Xcoll{j_eff}(i_T,ind_trt) = EPx{j_eff}(i_trt);
+                    if type_conf > 0
+                        Xlo{j_eff}(i_T,ind_trt) = EPx_lo{j_eff}(i_trt);
+                        Xhi{j_eff}(i_T,ind_trt) = EPx_hi{j_eff}(i_trt);
+                    end
                 end
             end
         end
+        
     end
-    
 end
 
 if batch_epx == 0
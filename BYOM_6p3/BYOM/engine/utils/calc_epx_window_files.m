@@ -0,0 +1,129 @@
+function Res = calc_epx_window_files(par_plot,folder_prof,Twin,opt_ecx,opt_conf,file_res)
+
+% Usage: Res = calc_epx_window_files(par_plot,folder_prof,Twin,opt_ecx,opt_conf,file_res)
+% Batch calculations of EPx for all exposure profiles in a folder, with
+% moving time window. For each profile, calc_epx_window is used (without
+% CIs) to find the window with the lowest EPx, and calc_epx calculates the
+% EPx with CIs for that window. The sample for the CIs is loaded only once,
+% for all profiles. The results are written to a text file as soon as a
+% profile is done. When that file already exists, the profiles that are in
+% it are skipped, so an interrupted batch can simply be started again.
+%
+% With the robust EPx and glo.batch>0, the C++ code does all windows of a
+% profile in one call (see call_epx_window.m in the Cdubia folder). The
+% model is then registered once for all profiles, as the profile is passed
+% to the C++ code directly.
+%
+% <par_plot>    parameter structure for the best-fit curve; if left empty the
+%               structure from the saved sample is used
+% <folder_prof> folder with the exposure profiles (all txt files are used)
+% <Twin>        length of time window (days)
+% <opt_ecx>     options structure for ECx and EPx calculations
+% <opt_conf>    options structure for making confidence intervals
+% <file_res>    name of the text file for the results
+%
+% Output <Res> is a table with all lines in the results file: the profile,
+% effect level, start of the window with the lowest EPx (over all traits),
+% and for each trait (as state number) the EPx with its CI at that window.
+%
+% Author     : Tjalling Jager
+% Date       : October 2026
+% Web support: http://www.debtox.info/byom.html
+
+%  Copyright (c) 2012-2026, Tjalling Jager, all rights reserved.
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+global glo
+
+Feff = opt_ecx.Feff; % effect level (>0 en <1), x/100 in LCx (also used here for ECx)
+
+if isempty(opt_conf)
+    type_conf = 0; % then we don't need CIs
+else
+    type_conf = opt_conf.type; % use values from slice sampler (1), likelihood region(2) to make intervals
+    type_conf = max(0,type_conf); % if someone uses -1, set it to zero
+end
+
+% Load the best parameter set and the random sample from file, once for all
+% profiles (as calc_epx_window does for all windows)
+rnd = -1;
+if type_conf > 0 || isempty(par_plot) % also if par_plot is not provided
+    [rnd,par] = load_rnd(opt_conf); % loading and selecting the sample is handled in a separate function
+    if isempty(par_plot) % if no par structure was entered in this function ...
+        par_plot = par; % simply use the one from the sample file
+    end
+    if numel(rnd) == 1 || opt_ecx.par_read == 1 % no sample was found, or we don't want CIs
+        type_conf = 0;
+        rnd       = -1;
+    end
+end
+
+opt_ecx.batch_epx = 1; % set to batch mode so calc_epx_window and calc_epx provide no output
+opt_ecx.par_read  = 0; % the sample is already loaded here
+opt_conf_win      = []; % windows without CIs
+if type_conf > 0
+    opt_conf.type = type_conf;
+else
+    opt_conf = []; % so calc_epx does not load the sample again
+end
+
+%% Profiles that still need to be done
+
+files = dir(fullfile(folder_prof,'*.txt')); % all profiles in the folder
+names = {files.name};
+if exist(file_res,'file') == 2 % then we continue an earlier batch
+    fid = fopen(file_res,'r');
+    C   = textscan(fid,'%s %*[^\n]','HeaderLines',1,'Delimiter','\t');
+    fclose(fid);
+    names = setdiff(names,C{1},'stable'); % remove the profiles that are done
+else
+    fid = fopen(file_res,'w');
+    fprintf(fid,'profile\tFeff\tTstart\ttrait\tEPx\tEPx_lo\tEPx_hi\n');
+    fclose(fid);
+end
+
+%% Run through the profiles
+
+for i_p = 1:length(names)
+
+    fname_prof = fullfile(folder_prof,names{i_p});
+    [MinColl,~,ind_traits] = calc_epx_window(par_plot,fname_prof,Twin,opt_ecx,opt_conf_win);
+
+    lines = {};
+    if isempty(ind_traits) % there is not enough effect in any window
+        for i_F = 1:length(Feff)
+            lines{end+1} = sprintf('%s\t%g\tNaN\tNaN\tNaN\tNaN\tNaN',names{i_p},Feff(i_F)); %#ok<AGROW>
+        end
+    else
+        % Window with the lowest EPx for each effect level (over all traits)
+        Tstart = nan(1,length(Feff));
+        for i_F = 1:length(Feff)
+            [~,ind_min] = min(MinColl{i_F}(:,2)); % find where the lowest EPx is
+            Tstart(i_F) = MinColl{i_F}(ind_min,3); % start time for that window
+        end
+        % EPx with CIs, once for each of these windows
+        [T_u,~,ind_u] = unique(Tstart);
+        EPx_u = cell(1,length(T_u));
+        for i_T = 1:length(T_u)
+            [EPx,EPx_lo,EPx_hi,ind_traits_T] = calc_epx(par_plot,fname_prof,[T_u(i_T) T_u(i_T)+Twin],opt_ecx,opt_conf,[],rnd);
+            EPx_u{i_T} = {EPx,EPx_lo,EPx_hi,ind_traits_T};
+        end
+        for i_F = 1:length(Feff)
+            [EPx,EPx_lo,EPx_hi,ind_traits_T] = EPx_u{ind_u(i_F)}{:};
+            for i_X = 1:length(ind_traits_T)
+                lines{end+1} = sprintf('%s\t%g\t%g\t%d\t%g\t%g\t%g',names{i_p},Feff(i_F),Tstart(i_F),ind_traits_T(i_X),...
+                    EPx{i_F}(i_X),EPx_lo{i_F}(i_X),EPx_hi{i_F}(i_X)); %#ok<AGROW>
+            end
+        end
+    end
+
+    % write the results for this profile right away
+    fid = fopen(file_res,'a');
+    fprintf(fid,'%s\n',lines{:});
+    fclose(fid);
+
+    disp(['Profiles done: ',num2str(i_p),' of ',num2str(length(names))])
+end
+
+Res = readtable(file_res,'Delimiter','\t','FileType','text');
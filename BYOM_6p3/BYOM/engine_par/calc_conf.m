@@ -145,8 +145,13 @@ if size(pmat,1) ~= length(glo2.names) || sum(ind_fit) ~= size(rnd,2)
     error('There is something wrong with the parameter vector!')
 end
 
+% The model calculates all samples in one go when the C++ code can be used
+% (see mex_settings.m in the Cdubia folder); otherwise, the samples are
+% spread over the workers of the pool.
+use_batch = glo.batch >= 1 && isempty(glo.zvd) && mex_settings(glo,X0mat(1,:));
+
 % Start/check parallel pool
-if glo2.n_cores > 0
+if glo2.n_cores > 0 && ~use_batch % the batched calculation does not need a pool
     poolobj = gcp('nocreate'); % get info on current pool, but don't create one just yet
     if isempty(poolobj) % if there is no parallel pool ...
         parpool('local',glo2.n_cores) % create a local one with specified number of cores
@@ -188,18 +193,38 @@ else
     Zlohi    = [];
 end
 
-parfor k = 1:n_samples % run through all samples
-    zvd      = []; % initialise to prevent warning from parfor
-    pmat_tmp = pmat_coll{k}; % read it from huge matrix
-    par_k = packunpack(2,0,pmat_tmp,WRAP); % transform parameter matrix into a structure
-    for j = 1:n_s % run through our scenarios
-        [Xout_coll{j,k},~,~,zvd] = call_deri(t,par_k,X0mat_tmp(:,j),glo_tmp); % use call_deri.m to provide the output for one scenario
+if use_batch % the model calculates all samples in one go
+    
+    par_coll = cell(n_samples,1); % cell array with a parameter structure for each sample
+    for k = 1:n_samples % run through all samples
+        par_coll{k} = packunpack(2,0,pmat_coll{k},WRAP); % transform parameter matrix into a structure
     end
-    if ~isempty(namesz)
-        for i_zvd = 1:n_zvd
-            zvd_coll(k,i_zvd) = zvd.(namesz{i_zvd})(3); % Note: this collects only LAST scenario!
+    Xall = call_deri_ensemble(t,par_coll,X0mat_tmp,glo_tmp,glo2.n_cores); % use call_deri_ensemble.m for all samples and scenarios
+    % Note: Xall is a 4D matrix with time in rows, states in columns,
+    % scenarios in the third dimension, and samples in the fourth.
+    for k = 1:n_samples % run through all samples
+        for j = 1:n_s % run through our scenarios
+            Xout_coll{j,k} = Xall(:,:,j,k);
         end
     end
+    clear par_coll Xall % clear these large variables as they are no longer needed
+    
+else
+    
+    parfor k = 1:n_samples % run through all samples
+        zvd      = []; % initialise to prevent warning from parfor
+        pmat_tmp = pmat_coll{k}; % read it from huge matrix
+        par_k = packunpack(2,0,pmat_tmp,WRAP); % transform parameter matrix into a structure
+        for j = 1:n_s % run through our scenarios
+            [Xout_coll{j,k},~,~,zvd] = call_deri(t,par_k,X0mat_tmp(:,j),glo_tmp); % use call_deri.m to provide the output for one scenario
+        end
+        if ~isempty(namesz)
+            for i_zvd = 1:n_zvd
+                zvd_coll(k,i_zvd) = zvd.(namesz{i_zvd})(3); % Note: this collects only LAST scenario!
+            end
+        end
+    end
+    
 end
 clear pmat_coll % clear these large variables as they are no longer needed
 
@@ -434,17 +434,36 @@ if rob_win == 0
     EPx_coll = nan(size(XF,1),1); % initialise matrix to catch EPx
     glo_tmp  = glo; % copy the global to get parfor running ...
     
-    parfor i = 1:size(XF,1)
-        i_X = XF(i,1); % read correct index for trait
-        i_F = XF(i,2); % read correct index for effects
-        
-        ind1     = find(Xout_coll(:,i_X+1)<1-Feff(i_F),1,'first');
-        EP_range = Xout_coll([ind1-1 ind1],1); % range where EPx,t is located
-        if numel(EP_range) == 2
-            % use fzero to zero in on the exact value
-            EPx_coll(i) = fzero(@calc_epx_helper,EP_range,[],calc_int,t,par_plot,X0mat_tmp,glo_tmp,Xctrl(i_X),ind_traits(i_X),Feff(i_F),WRAP2);
-        else
-            EPx_coll(i) = NaN; % then a proper range was not found
+    EPx_mex = [];
+    if glo.batch >= 1 && calc_int == 0 && exist('call_epx_root','file')==2
+        % The C++ code does all combinations in one call, solving the
+        % control and each MF only once (it returns empty when it cannot
+        % be used).
+        MF_range = nan(size(XF,1),2); % range where EPx,t is located (NaN when not found)
+        for i = 1:size(XF,1)
+            ind1 = find(Xout_coll(:,XF(i,1)+1)<1-Feff(XF(i,2)),1,'first');
+            if ~isempty(ind1) && ind1 > 1
+                MF_range(i,:) = Xout_coll([ind1-1 ind1],1);
+            end
+        end
+        EPx_mex = call_epx_root(MF_range,XF,Feff,t,par_plot,X0mat_tmp,glo_tmp,ind_traits);
+    end
+    
+    if ~isempty(EPx_mex)
+        EPx_coll = EPx_mex;
+    else
+        parfor i = 1:size(XF,1)
+            i_X = XF(i,1); % read correct index for trait
+            i_F = XF(i,2); % read correct index for effects
+            
+            ind1     = find(Xout_coll(:,i_X+1)<1-Feff(i_F),1,'first');
+            EP_range = Xout_coll([ind1-1 ind1],1); % range where EPx,t is located
+            if numel(EP_range) == 2
+                % use fzero to zero in on the exact value
+                EPx_coll(i) = fzero(@calc_epx_helper,EP_range,[],calc_int,t,par_plot,X0mat_tmp,glo_tmp,Xctrl(i_X),ind_traits(i_X),Feff(i_F),WRAP2);
+            else
+                EPx_coll(i) = NaN; % then a proper range was not found
+            end
         end
     end
     
@@ -473,13 +492,23 @@ else
     glo_tmp    = glo; % use a temporary (local) version of glo
     
     i_end = length(MF_test);
-    parfor i = 1:length(MF_test) % run through multiplication factors
-        [~,Xout] = calc_epx_helper(MF_test(i),calc_int,t,par_plot,X0mat_tmp,glo_tmp,Xctrl,ind_traits,[],WRAP2);
-        Xout_coll2(i,:) = Xout; % collect the effect relative to the control
-        %     if i>1 && all(Xout_coll2(i,:)<1-max(Feff)) % if all endpoints have more than enough effect ...
-        %         i_end = i;
-        %         break % we can safely break the for loop
-        %     end % this is not a good idea when using a parfor loop!
+    Xout_mex = [];
+    if glo.batch >= 1 && calc_int == 0 && exist('call_epx','file')==2
+        % The C++ code does all MFs in one call, on a pool of threads (it
+        % returns empty when it cannot be used).
+        Xout_mex = call_epx(MF_test,t,par_plot,X0mat_tmp,glo_tmp,ind_traits,glo2.n_cores);
+    end
+    if ~isempty(Xout_mex)
+        Xout_coll2 = Xout_mex;
+    else
+        parfor i = 1:length(MF_test) % run through multiplication factors
+            [~,Xout] = calc_epx_helper(MF_test(i),calc_int,t,par_plot,X0mat_tmp,glo_tmp,Xctrl,ind_traits,[],WRAP2);
+            Xout_coll2(i,:) = Xout; % collect the effect relative to the control
+            %     if i>1 && all(Xout_coll2(i,:)<1-max(Feff)) % if all endpoints have more than enough effect ...
+            %         i_end = i;
+            %         break % we can safely break the for loop
+            %     end % this is not a good idea when using a parfor loop!
+        end
     end
     
     % Calculate EPx values by linear interpolation
@@ -644,12 +673,35 @@ if type_conf > 0 % if we make CIs ...
              
         if rob_win == 0 % regular EPx with fzero
             
-            for i_X = 1:N_traits % run through traits
-                for i_F = 1:L_i_F % run through effect levels
-                    if ~isnan(EPx{i_F}(i_X))
-                        % use fzero to zero in on the exact value
-                        EPx_tmp = fzero(@calc_epx_helper,EPx{i_F}(i_X),[],calc_int,t,par_k,X0mat_tmp,glo_tmp,Xctrl(i_X),ind_traits(i_X),Feff(i_F),WRAP3);
-                        EPx_coll(k,i_F,i_X) = EPx_tmp; % collect the answer!
+            EPx_mex = [];
+            if glo_tmp.batch >= 1 && calc_int == 0 && exist('call_epx_root','file')==2
+                % The C++ code does all combinations in one call, starting
+                % from the EPx of the best-fitting set, as fzero below.
+                XF_k     = nan(N_traits*L_i_F,2); % combine indices for traits and effects
+                MF_range = nan(N_traits*L_i_F,2); % starting values (second column NaN)
+                for i_X = 1:N_traits % run through traits
+                    for i_F = 1:L_i_F % run through effect levels
+                        XF_k((i_X-1)*L_i_F+i_F,:)     = [i_X i_F];
+                        MF_range((i_X-1)*L_i_F+i_F,1) = EPx{i_F}(i_X);
+                    end
+                end
+                EPx_mex = call_epx_root(MF_range,XF_k,Feff,t,par_k,X0mat_tmp,glo_tmp,ind_traits);
+            end
+            
+            if ~isempty(EPx_mex)
+                for i_X = 1:N_traits % run through traits
+                    for i_F = 1:L_i_F % run through effect levels
+                        EPx_coll(k,i_F,i_X) = EPx_mex((i_X-1)*L_i_F+i_F); % collect the answer!
+                    end
+                end
+            else
+                for i_X = 1:N_traits % run through traits
+                    for i_F = 1:L_i_F % run through effect levels
+                        if ~isnan(EPx{i_F}(i_X))
+                            % use fzero to zero in on the exact value
+                            EPx_tmp = fzero(@calc_epx_helper,EPx{i_F}(i_X),[],calc_int,t,par_k,X0mat_tmp,glo_tmp,Xctrl(i_X),ind_traits(i_X),Feff(i_F),WRAP3);
+                            EPx_coll(k,i_F,i_X) = EPx_tmp; % collect the answer!
+                        end
                     end
                 end
             end
@@ -658,13 +710,27 @@ if type_conf > 0 % if we make CIs ...
             
             Xout_coll2 = nan(length(MF_test),N_traits); % this matrix will collect the output
             i_end = length(MF_test);
-            for i = 1:length(MF_test)
-                [~,Xout] = calc_epx_helper(MF_test(i),calc_int,t,par_k,X0mat_tmp,glo_tmp,Xctrl,ind_traits,[],WRAP3);
-                % use of a sub-function is also needed to get parfor to cooperate
-                Xout_coll2(i,:) = Xout; % remember the relative output for the traits
-                if i>1 && all(Xout_coll2(i,:)<1-max(Feff)) % if all endpoints have more than enough effect ...
-                    i_end = i;
-                    break % we can safely break the for loop
+            Xout_mex = [];
+            if glo_tmp.batch >= 1 && calc_int == 0 && exist('call_epx','file')==2
+                % The C++ code does all MFs in one call (one thread, as we
+                % are already in a parfor loop over the sets).
+                Xout_mex = call_epx(MF_test,t,par_k,X0mat_tmp,glo_tmp,ind_traits,1);
+            end
+            if ~isempty(Xout_mex)
+                Xout_coll2 = Xout_mex;
+                i_tmp = find(all(Xout_coll2(2:end,:)<1-max(Feff),2),1,'first'); % same place as the break below
+                if ~isempty(i_tmp)
+                    i_end = i_tmp + 1;
+                end
+            else
+                for i = 1:length(MF_test)
+                    [~,Xout] = calc_epx_helper(MF_test(i),calc_int,t,par_k,X0mat_tmp,glo_tmp,Xctrl,ind_traits,[],WRAP3);
+                    % use of a sub-function is also needed to get parfor to cooperate
+                    Xout_coll2(i,:) = Xout; % remember the relative output for the traits
+                    if i>1 && all(Xout_coll2(i,:)<1-max(Feff)) % if all endpoints have more than enough effect ...
+                        i_end = i;
+                        break % we can safely break the for loop
+                    end
                 end
             end
             
@@ -11,6 +11,9 @@ function calc_pop(par_out,X0mat,t,c,Th,opt_conf,opt_pop)
 %
 % This function needs some work, and its call may be changed in the future.
 % It now makes use of calc_epx_helper to perform the rgr calculation.
+% With glo.batch >= 1, the rates for all treatments, food levels and sets
+% of the sample are calculated in C++ instead (see call_pop.m), which
+% needs neither fzero nor the parallel toolbox.
 %
 % par_out : fitted parameter structure
 % X0mat   : matrix with scenarios and initial values
@@ -61,6 +64,25 @@ else % a scenario range (e.g., a large concentration vector) is provided
 end
 
 rgr       = nan(length(cpop),length(fscen)); % initialise matrix to catch the pop. growth rate
+
+X0mat_pop = zeros(size(X0mat,1),length(cpop)); % initial states and concentration for each treatment
+for j = 1:length(cpop) % run through all treatments
+    if c(1) == -1
+        X0mat_pop(:,j) = X0mat(:,j); % take exact initial states for THIS treatment!
+    else
+        X0mat_pop(:,j) = X0mat(:,1); % take first set of initial states for ALL treatments!
+        X0mat_pop(1,j) = c(j); % only replace the concentration
+    end
+end
+
+rgr_mex = [];
+if glo.batch >= 1 && exist('call_pop','file')==2
+    % The C++ code does all treatments and food levels in one call,
+    % simulating each one only once (it returns empty when it cannot be
+    % used).
+    rgr_mex = call_pop(t,{par_out},fscen,X0mat_pop,Th,glo,glo2.n_cores);
+end
+
 [figh,ft] = make_fig(1,2); % make figure of correct size
 
 subplot(1,2,1) % first subplot is for absolute rgr, plotted on the fly
@@ -87,16 +109,13 @@ for i = 1:length(fscen) % run through scenarios (food levels)
     end
     
     for j = 1:length(cpop) % run through all treatments
-        if c(1) == -1
-            X0mat_tmp    = X0mat(:,j); % take exact initial states for THIS treatment!
+        if ~isempty(rgr_mex)
+            rgr_tmp = rgr_mex(j,i); % already calculated in C++
         else
-            X0mat_tmp    = X0mat(:,1); % take first set of initial states for ALL treatments!
-            X0mat_tmp(1) = c(j); % only replace the concentration
+            % continuous repro
+            WRAP2.rgr_init = rgr_init; % put it in the wrapper as well
+            [~,rgr_tmp] = calc_epx_helper(1,1,t,par_out,X0mat_pop(:,j),glo,1,[],[],WRAP2);
         end
-        
-        % continuous repro
-        WRAP2.rgr_init = rgr_init; % put it in the wrapper as well
-        [~,rgr_tmp] = calc_epx_helper(1,1,t,par_out,X0mat_tmp,glo,1,[],[],WRAP2);
         rgr(j,i)    = rgr_tmp;
         rgr_init    = rgr_tmp; % update initial guess (new one will not be far from old one)
         
@@ -163,14 +182,6 @@ if type_conf > 0
     
     drawnow % empty plot buffer if there's something in it
     
-    % Start/check parallel pool
-    if glo2.n_cores > 0
-        poolobj = gcp('nocreate'); % get info on current pool, but don't create one just yet
-        if isempty(poolobj) % if there is no parallel pool ...
-            parpool('local',glo2.n_cores) % create a local one with specified number of cores
-        end
-    end
-    
     if use_par_out == 1
         par = par_out; % then we'll use the input par, rather than the saved one
         % Note: par_plot must already be structured in the main script, such
@@ -190,7 +201,46 @@ if type_conf > 0
     ind_fit    = (pmat(:,2)==1); % indices to fitted parameters
     ind_logfit = (pmat(:,5)==0 & pmat(:,2)==1); % indices to pars on log scale that are also fitted!
     
-    disp('Parallel toolbox is used; no progress is shown.')
+    % some trickery to get parfor running ... First create a pmat_coll with
+    % all sets from the sample!
+    pmat_coll = cell(n_sets,1); % cell array to construct pmat for each sample
+    for k = 1:n_sets % run through all sets in the sample
+        pmat(ind_fit,1) = rnd(k,:); % replace values in pmat with the k-th random sample from the MCMC
+        % put parameters that need to be fitted on log scale back on normal
+        % scale (as call_deri requires normal scale, in contrast to transfer.m)
+        if sum(ind_logfit)>0
+            pmat(ind_logfit,1) = 10.^(pmat(ind_logfit,1));
+        end
+        % Note: pmat is still on normal scale here, but the sample in rnd
+        % contains the value on a log scale, if a parameter is fitted on log
+        % scale. Call_deri needs normal scale structure par_k.
+        
+        % this has to be done after the tranformation to normal scale!
+        pmat_coll{k} = pmat; % collect it in a huge cell array
+    end
+    
+    RGR_mex = [];
+    if glo.batch >= 1 && exist('call_pop','file')==2
+        % The C++ code does all sets, treatments and food levels in one
+        % call, on a pool of threads (it returns empty when it cannot be
+        % used).
+        par_coll = cell(n_sets,1); % parameter structure for each set
+        for k = 1:n_sets % run through all sets in the sample
+            par_coll{k} = packunpack(2,0,pmat_coll{k},WRAP); % transform parameter matrix into a structure
+        end
+        RGR_mex = call_pop(t,par_coll,fscen,X0mat_pop,Th,glo,glo2.n_cores);
+    end
+    
+    if isempty(RGR_mex)
+        % Start/check parallel pool
+        if glo2.n_cores > 0
+            poolobj = gcp('nocreate'); % get info on current pool, but don't create one just yet
+            if isempty(poolobj) % if there is no parallel pool ...
+                parpool('local',glo2.n_cores) % create a local one with specified number of cores
+            end
+        end
+        disp('Parallel toolbox is used; no progress is shown.')
+    end
     
     RGRlo_all = nan(length(cpop),length(fscen));
     RGRhi_all = nan(length(cpop),length(fscen));
@@ -200,54 +250,33 @@ if type_conf > 0
         rgr_init = rgr(1,i); % initial value for RGR for fzero, taken from best parameter run
         RGR_coll = zeros(n_sets,length(cpop)); % initialise vector to collect RGR values
         
-        % some trickery to get parfor running ... First create a pmat_coll with
-        % all sets from the sample!
-        pmat_coll = cell(n_sets,1); % cell array to construct pmat for each sample
-        for k = 1:n_sets % run through all sets in the sample
-            pmat(ind_fit,1) = rnd(k,:); % replace values in pmat with the k-th random sample from the MCMC
-            % put parameters that need to be fitted on log scale back on normal
-            % scale (as call_deri requires normal scale, in contrast to transfer.m)
-            if sum(ind_logfit)>0
-                pmat(ind_logfit,1) = 10.^(pmat(ind_logfit,1));
-            end
-            % Note: pmat is still on normal scale here, but the sample in rnd
-            % contains the value on a log scale, if a parameter is fitted on log
-            % scale. Call_deri needs normal scale structure par_k.
-            
-            % this has to be done after the tranformation to normal scale!
-            pmat_coll{k} = pmat; % collect it in a huge cell array
-        end
-        
         Lcpop   = length(cpop); % to get parfor running ...
         glo_tmp = glo; % copy the global to get parfor running ...
 
-        parfor k = 1:n_sets % run through all sets in the sample
-            
-            par_k = packunpack(2,0,pmat_coll{k},WRAP); % transform parameter matrix into a structure
-            
-            if length(fscen)>1
-                % different food levels are used, which means that parameter f is overwritten.
-                par_k.f(1) = fscen(i); % take the next scenario, replace f in par_out
-            end
-            
-            WRAP3          = WRAP2; % this is needed to please parfor
-            WRAP3.rgr_init = rgr_init; % put it in the wrapper as well
-            
-            for j = 1:Lcpop % run through all treatments
-                if c(1) == -1
-                    X0mat_tmp    = X0mat(:,j); % take exact initial states for THIS treatment!
-                else
-                    X0mat_tmp    = X0mat(:,1); % take first set of initial states for ALL treatments!
-                    X0mat_tmp(1) = c(j); % only replace the concentration
+        if ~isempty(RGR_mex) % already calculated in C++
+            RGR_coll = permute(RGR_mex(:,i,:),[3 1 2]); % sets in rows, treatments in columns
+        else
+            parfor k = 1:n_sets % run through all sets in the sample
+                
+                par_k = packunpack(2,0,pmat_coll{k},WRAP); % transform parameter matrix into a structure
+                
+                if length(fscen)>1
+                    % different food levels are used, which means that parameter f is overwritten.
+                    par_k.f(1) = fscen(i); % take the next scenario, replace f in par_out
                 end
                 
-                % continuous repro
-                [~,rgr_tmp]    = calc_epx_helper(1,1,t,par_k,X0mat_tmp,glo_tmp,1,[],[],WRAP3);
-                RGR_coll(k,j)  = rgr_tmp;
-                WRAP3.rgr_init = rgr_tmp; % update initial guess (new one will not be far from old one)
+                WRAP3          = WRAP2; % this is needed to please parfor
+                WRAP3.rgr_init = rgr_init; % put it in the wrapper as well
+                
+                for j = 1:Lcpop % run through all treatments
+                    % continuous repro
+                    [~,rgr_tmp]    = calc_epx_helper(1,1,t,par_k,X0mat_pop(:,j),glo_tmp,1,[],[],WRAP3);
+                    RGR_coll(k,j)  = rgr_tmp;
+                    WRAP3.rgr_init = rgr_tmp; % update initial guess (new one will not be far from old one)
+                    
+                end
                 
             end
-            
         end
         
         % No need to exclude NaNs for prctile and min/max as they are
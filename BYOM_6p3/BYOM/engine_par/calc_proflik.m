@@ -173,18 +173,32 @@ end
 %% Calculate the profile(s)
 % This uses the parallel toolbox. The up and down branches for all
 % parameters are done in parallel. 
+%
+% For glo.batch=2, the branches can be done by the C++ code of the model
+% (the 'proflik' mode of test_derivatives), as long as it can calculate the
+% likelihood itself (see <mex_problem>). The branches then run on a pool of
+% threads, with the same steps and optimisations as in sub_proflik below.
+% Simulated annealing (opt_prof.subann=1) is only done in Matlab.
 
 if saved ~= 1 % only when not using saved set
     
-    % Start/check parallel pool
-    if glo2.n_cores > 0
-        poolobj = gcp('nocreate'); % get info on current pool, but don't create one just yet
-        if isempty(poolobj) % if there is no parallel pool ...
-            parpool('local',glo2.n_cores) % create a local one with specified number of cores
-        end
+    prob = []; % this is empty when the C++ code cannot be used
+    if glo.batch == 2 && opt_prof.subann ~= 1 && exist('mex_problem','file')==2
+        [prob,ind_prob] = mex_proflik(pmat,parnum,WRAP);
     end
     
-    disp('Profiling is done using the parallel toolbox. No progress will be shown!')
+    if ~isempty(prob)
+        disp('Profiling is done using the C++ code. No progress will be shown!')
+    else
+        % Start/check parallel pool
+        if glo2.n_cores > 0
+            poolobj = gcp('nocreate'); % get info on current pool, but don't create one just yet
+            if isempty(poolobj) % if there is no parallel pool ...
+                parpool('local',glo2.n_cores) % create a local one with specified number of cores
+            end
+        end
+        disp('Profiling is done using the parallel toolbox. No progress will be shown!')
+    end
     disp(' ')
     
     run_profs = allcomb(parnum,[1 2]); % all combinations of parameters and up-down
@@ -202,14 +216,18 @@ if saved ~= 1 % only when not using saved set
         loglikmax   = Xcoll;
         sample_prof = Xcoll;
         
-        parfor j = 1:size(run_profs,1) % calculate from profile down and up from the ML estimate
-            [Xcoll_tmp,loglikrat_tmp,par_better_tmp,loglikmax_tmp,sample_acc_tmp] = ...
-                sub_proflik(pmat,run_profs(j,1),run_profs(j,2),opt_prof,WRAP);
-            Xcoll{j}      = Xcoll_tmp;
-            loglikrat{j}  = min(loglikrat_tmp,1000); % this should not be needed, but sometimes we get an Inf in there ...
-            par_better{j} = par_better_tmp;
-            loglikmax{j}  = loglikmax_tmp;
-            sample_prof{j} = sample_acc_tmp;
+        if ~isempty(prob) % all branches in one call to the C++ code
+            [Xcoll,loglikrat,par_better,loglikmax,sample_prof] = mex_proflik_run(prob,ind_prob,pmat,run_profs,opt_prof,WRAP);
+        else
+            parfor j = 1:size(run_profs,1) % calculate from profile down and up from the ML estimate
+                [Xcoll_tmp,loglikrat_tmp,par_better_tmp,loglikmax_tmp,sample_acc_tmp] = ...
+                    sub_proflik(pmat,run_profs(j,1),run_profs(j,2),opt_prof,WRAP);
+                Xcoll{j}      = Xcoll_tmp;
+                loglikrat{j}  = min(loglikrat_tmp,1000); % this should not be needed, but sometimes we get an Inf in there ...
+                par_better{j} = par_better_tmp;
+                loglikmax{j}  = loglikmax_tmp;
+                sample_prof{j} = sample_acc_tmp;
+            end
         end
         if no_rnds == 0 % in the first round ... collect the loglik
             loglikbest = -loglikmax{1};
@@ -246,6 +264,9 @@ if saved ~= 1 % only when not using saved set
             % Note that calc_optim will still put output to screen ...
             [par_best,loglik_disp] = calc_optim(par_best,opt_optim); % new par_tmp
             pmat     = packunpack(1,par_best,0,WRAP);  % transform structure into a regular matrix
+            if ~isempty(prob) % the C++ code needs the new best fit as well
+                [prob,ind_prob] = mex_proflik(pmat,parnum,WRAP);
+            end
         else
             hurrah = 1; % we can/must stop!
         end
@@ -752,3 +773,64 @@ sample_prof_acc(ind_acc:end,:) = []; % remove the extra entries that were initia
 Xcoll(i+1:end)     = []; % remove the extra entries that were initialised
 loglikrat(i+1:end) = []; % remove the extra entries that were initialised
 
+% =========================================================================
+% =========================================================================
+
+
+function [prob,ind_prob] = mex_proflik(pmat,parnum,WRAP)
+
+% This sub-function collects the likelihood problem for the C++ code (see
+% <mex_problem>). The profiled parameters are included as fitted ones, so
+% that the C++ code can change them as well; <ind_prob> are the rows of
+% pmat in the problem. The output <prob> is empty when the C++ code cannot
+% be used.
+
+pmat_mex = pmat;
+pmat_mex(parnum,2) = 1; % the profiled parameters are part of the problem
+pmat_mex(pmat_mex(:,5)==0,1) = log10(pmat_mex(pmat_mex(:,5)==0,1)); % log parameters on log10 scale, as mex_problem wants
+prob     = mex_problem(pmat_mex,WRAP);
+ind_prob = find(pmat_mex(:,2)==1);
+
+
+function [Xcoll,loglikrat,par_better,loglikmax,sample_prof] = mex_proflik_run(prob,ind_prob,pmat,run_profs,opt_prof,WRAP)
+
+% This sub-function does all branches of the profiling in one call to the
+% C++ code, and returns the same cell arrays as the parfor loop with
+% sub_proflik.
+
+prof_detail = opt_prof.detail; % detailed (1) or a coarse (2) calculation
+if  ~ismember(prof_detail,[1 2])
+    prof_detail = 2; % if a wrong value is entered, 'coarse' is default
+end
+chitable = [3.8415 5.9915 7.8147 9.4877 11.07]; % as in sub_proflik
+
+PR.detail   = prof_detail;
+PR.subopt   = opt_prof.subopt;
+PR.subrng   = opt_prof.subrng;
+PR.brkprof  = opt_prof.brkprof;
+PR.chicritJ = chitable(min(5,sum(pmat(:,2)==1)));
+PR.n_par    = size(pmat,1);
+
+[~,loc_prof] = ismember(run_profs(:,1),ind_prob); % location of the profiled parameters in the problem
+fitted = double(pmat(ind_prob,2)==1); % the parameters of the problem that are fitted
+[prof,acc,better,llmax] = mex_handle(WRAP.glo,'proflik',prob,[loc_prof run_profs(:,2)],fitted,PR,randi(2^31-1));
+
+n_run       = size(run_profs,1);
+Xcoll       = cell(n_run,1);
+loglikrat   = Xcoll;
+par_better  = Xcoll;
+loglikmax   = Xcoll;
+sample_prof = Xcoll;
+for j = 1:n_run
+    Xcoll{j}       = prof(prof(:,1)==j,2)';
+    loglikrat{j}   = min(prof(prof(:,1)==j,3)',1000); % as for the parfor loop
+    loglikmax{j}   = llmax(j);
+    sample_prof{j} = acc(acc(:,1)==j,2:end);
+    ind_better     = find(better(:,1)==j);
+    if ~isempty(ind_better) % return the better estimate as a structure, on normal scale
+        pmat_better = pmat;
+        pmat_better(ind_prob,1) = better(ind_better,2:end)';
+        pmat_better(pmat_better(:,5)==0,1) = 10.^(pmat_better(pmat_better(:,5)==0,1));
+        par_better{j} = packunpack(2,0,pmat_better,WRAP);
+    end
+end
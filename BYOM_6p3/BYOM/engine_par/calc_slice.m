@@ -48,6 +48,7 @@ thin         = max(1,opt_slice.thin); % minimum is 1; thinning of the sample (ke
 burn         = opt_slice.burn;        % number of burn-in samples (0 is no burn in)
 slwidth      = opt_slice.slwidth;     % initial width of the slice (Matlab default is 10) 
 alllog       = opt_slice.alllog;      % put all parameters on log-scale before taking the sample
+chains       = opt_slice.chains;      % number of independent chains for the sampler in C++ (0 for one per thread)
 testing      = opt_slice.testing;     % make additional tests on the sample: moving average and autocorrelation
 use_subplots = opt_slice.subplt;      % create single plot with subplots (1) or many individual plots (0)
 filenm       = glo.basenm;
@@ -63,9 +64,9 @@ end
 
 disp(' ')
 warning('off','backtrace')
-if exist('slicesample','file')~=2 % only when slicesample exists as an m-file in the path
+if exist('ksdensity','file')~=2 % only when ksdensity exists as an m-file in the path
     error('The function calc_slice needs the statistics toolbox installed ...')
-    % I need slicesample and ksdensity, and copying them is not a good idea ...
+    % I need ksdensity (and slicesample when the C++ sampler cannot be used), and copying them is not a good idea ...
 end
 if ~isfield(par,'tag_fitted') % apparently, parameters have not been fitted
     warning('Parameters have not been fitted, so results may not be very meaningful!')
@@ -156,7 +157,30 @@ if nrs ~= -1
     
     opt_test = 0; % 0) default, 1) option to use modified slice sampler
     
-    if opt_test == 0
+    % For glo.batch=2, the sample can be taken by the C++ code of the model
+    % (the 'slice' mode of test_derivatives), as long as it can calculate
+    % the likelihood itself (see <mex_problem>). This uses the same steps as
+    % slicesample, but with several independent chains (each with its own
+    % burn-in) on a pool of threads. The chains are placed one after the
+    % other in rnd, and the MLL of each set is saved as well.
+    minloglik_rnd = []; % the C++ code provides the MLL of each set
+    prob = [];
+    if glo.batch == 2 && opt_test == 0 && exist('mex_problem','file')==2
+        prob = mex_problem(pmat,WRAP); % this is empty when the C++ code cannot be used
+    end
+    
+    if ~isempty(prob)
+        SL.thin    = thin;
+        SL.burn    = burn;
+        SL.slwidth = slwidth;
+        SL.chains  = chains;
+        rnd = mex_handle(glo,'slice',prob,parshat,nrs,SL,randi(2^31-1));
+        minloglik_rnd = rnd(:,end);
+        rnd = rnd(:,1:end-1);
+    elseif opt_test == 0
+        if exist('slicesample','file')~=2 % only when slicesample exists as an m-file in the path
+            error('The function calc_slice needs the statistics toolbox installed ...')
+        end
         rnd = slicesample(parshat,nrs,'logpdf',@(pars) -1 * transfer(pars,pmat,WRAP),'thin',thin,'burnin',burn,'width',slwidth);
         % transfer gives the min log likelihood, here we need the log likelihood, so multiply by -1
     else % modifed slicesample, provided in BYOM, which can output the MLL and parameter sets
@@ -417,7 +441,9 @@ end
 % saved to the file. NOT USED ANYMORE.
 
 if nrs ~= -1 % don't calculate acc and save again when we use the saved sample anyway
-    minloglik_rnd = zeros(size(rnd,1),1); % pre-define with zeros
+    if isempty(minloglik_rnd) % not filled by the C++ sampler
+        minloglik_rnd = zeros(size(rnd,1),1); % pre-define with zeros
+    end
     
 %     for i = 1:nrs % run through all samples
 %         minloglik_rnd(i) = transfer(rnd(i,:),pmat,WRAP); % use transfer to obtain minloglikelihood!
@@ -191,446 +191,499 @@ chicrit_max    = max(1.2 * chicrit_joint,chicrit_single+1.5); % criterion for, r
 stats      = -1; % some statistics of the run
 pmat_print = -1; % this matrix collects best value and CIs
 
-%% BLOCK 3. Round 1 is using a regular grid over parameter space
-% The first round is special and different from the later rounds. Create
-% vectors with values to try for each parameter as a regular-spaced range
-% between the min and max bounds (for log-scale parameters, the range is
-% thus log-linear).
-%
-% Here, a cell array is used (<p_try>) as the number of trials differs
-% between parameters. This array is turned into a regular matrix with all
-% permutations of parameter values.
-
-% BLOCK 3.1. Initialisation.
-n_rnd   = 1;             % counter for rounds of optimisation
-p_try   = cell(1,n_fit); % initialise <p_try> as empty cell array (one cell for each parameter)
-d_grid  = nan(1,n_fit);  % initialise the grid spacing vector with NaNs (will collect spacing for each parameter)
-
-% BLOCK 3.2. Create parameter vectors for each fitted parameter, with a regular grid.
-for i_p = 1:n_fit % run through fitted parameters
-    p_try{i_p}  = linspace(bnds_tmp(i_p,1),bnds_tmp(i_p,2),tries_1(i_p)); % vector: first tries as linear range between min-max bounds
-    d_grid(i_p) = (bnds_tmp(i_p,2)-bnds_tmp(i_p,1))/(tries_1(i_p)-1); % difference between parameter values for parameter <i_p> (grid spacing)
+%% BLOCK 3ALT. Sampling rounds in C++
+% For glo.batch=2, the rounds of BLOCK 3 and 4 can be done by the C++ code
+% of the model (the 'parspace' mode of test_derivatives), as long as it can
+% calculate the likelihood itself (see <mex_problem>). The likelihood of
+% all sets in a round is then calculated on a pool of threads, without
+% calling <transfer>, and the same holds for the rough optimisations in
+% each round. There are no intermediate plots of the rounds in this case.
+% The slice sampler of BLOCK 4ALT is always run in Matlab.
+
+flag_mex = 0; % flag for when the rounds were done in C++ (1)
+if glo.batch == 2 && ~(opt_optim.ps_slice == 1 && exist('slicesample_byom','file')==2) && exist('mex_problem','file')==2
+    prob = mex_problem(pmat,WRAP); % this is empty when the C++ code cannot be used
+    if ~isempty(prob)
+        PS.chicrit_rnd    = chicrit_rnd;
+        PS.n_tr           = n_tr;
+        PS.f_d            = f_d;
+        PS.chicrit_joint  = chicrit_joint;
+        PS.chicrit_single = chicrit_single;
+        PS.chicrit_max    = chicrit_max;
+        PS.n_ok           = n_ok;
+        PS.n_conf         = n_conf;
+        PS.tries          = SETTINGS_OPTIM.tries;
+        PS.n_max          = n_max;
+        PS.n_opt          = min(4,glo2.n_cores); % same number of rough optimisations as in BLOCK 4.2
+        PS.rough          = opt_optim.ps_rough;
+        PS.dupl           = double(dupl == 1 && opt_optim.ps_profs ~= 0);
+        PS.loc_kd         = 0; % zero tells the C++ code to skip the check for slow kinetics
+        PS.loc_mw         = 0;
+        if loc_kd ~= -1
+            PS.loc_kd     = loc_kd_fit;
+            PS.loc_mw     = loc_mw_fit;
+        end
+        PS.slowkin_corr   = SETTINGS_OPTIM.slowkin_corr;
+        PS.slowkin_pars   = SETTINGS_OPTIM.slowkin_pars;
+        
+        [coll_all,n_rnd,minmax] = test_derivatives('parspace',prob,PS,randi(2^31-1));
+        mll = coll_all(1,end); % lowest MLL; <coll_all> is sorted, so first is the best fitting one so far
+        if ~isempty(minmax) % slow kinetics was caught (see BLOCK 4.4)
+            return % and go back to <calc_optim_ps> to force a restart
+        end
+        if n_fit > 5 || (n_fit == 5 && opt_optim.ps_rough == 1) % Latin-hypercube sampling in round 1
+            n_ok = min(n_ok,500); % as in BLOCK 3.3
+        end
+        if plot_intermed == 1
+            figh = plot_grid(pmat,[],coll_all,[],figh,SETTINGS_OPTIM,WRAP);
+        end
+        flag_mex = 1;
+    end
 end
 
-% BLOCK 3.3. Create a large matrix <coll_all> with all permutations of the
-% parameter values in <p_try>. For more than 5 fitted parameters, however,
-% a regular grid is impossibly slow ... therefore use Latin-Hypercube
-% sampling instead! If the user does not have the statistics toolbox,
-% regular random sampling will be used, but this will be less effective
-% (not tested). LHS sampling now also used for 5 parameters and rough
-% settings.
+if flag_mex == 0 % otherwise, do the rounds in Matlab (BLOCK 3 and 4)
+    %% BLOCK 3. Round 1 is using a regular grid over parameter space
+    % The first round is special and different from the later rounds. Create
+    % vectors with values to try for each parameter as a regular-spaced range
+    % between the min and max bounds (for log-scale parameters, the range is
+    % thus log-linear).
+    %
+    % Here, a cell array is used (<p_try>) as the number of trials differs
+    % between parameters. This array is turned into a regular matrix with all
+    % permutations of parameter values.
+
+    % BLOCK 3.1. Initialisation.
+    n_rnd   = 1;             % counter for rounds of optimisation
+    p_try   = cell(1,n_fit); % initialise <p_try> as empty cell array (one cell for each parameter)
+    d_grid  = nan(1,n_fit);  % initialise the grid spacing vector with NaNs (will collect spacing for each parameter)
+
+    % BLOCK 3.2. Create parameter vectors for each fitted parameter, with a regular grid.
+    for i_p = 1:n_fit % run through fitted parameters
+        p_try{i_p}  = linspace(bnds_tmp(i_p,1),bnds_tmp(i_p,2),tries_1(i_p)); % vector: first tries as linear range between min-max bounds
+        d_grid(i_p) = (bnds_tmp(i_p,2)-bnds_tmp(i_p,1))/(tries_1(i_p)-1); % difference between parameter values for parameter <i_p> (grid spacing)
+    end
 
-if n_fit < 5 || (n_fit == 5 && opt_optim.ps_rough == 0)% use the default approach of a regular grid
+    % BLOCK 3.3. Create a large matrix <coll_all> with all permutations of the
+    % parameter values in <p_try>. For more than 5 fitted parameters, however,
+    % a regular grid is impossibly slow ... therefore use Latin-Hypercube
+    % sampling instead! If the user does not have the statistics toolbox,
+    % regular random sampling will be used, but this will be less effective
+    % (not tested). LHS sampling now also used for 5 parameters and rough
+    % settings.
+
+    if n_fit < 5 || (n_fit == 5 && opt_optim.ps_rough == 0)% use the default approach of a regular grid
+    
+        % This is the same as in openGUTS
+        n_tries  = prod(tries_1); % total number of tries in this round (all permutations)
+        coll_all = 1./zeros(n_tries,n_fit+1); % initialise matrix to catch all tries and their minloglik with INF
     
-    % This is the same as in openGUTS
-    n_tries  = prod(tries_1); % total number of tries in this round (all permutations)
-    coll_all = 1./zeros(n_tries,n_fit+1); % initialise matrix to catch all tries and their minloglik with INF
+        coll_all(:,1:n_fit) = allcomb(p_try{1:n_fit}); % use smart function to make all permutations for all parameters (i.e., create a grid)
+        % THIS ALSO WORKS WHEN NR OF TRIES DIFFERS FOR THE PARAMETERS!
     
-    coll_all(:,1:n_fit) = allcomb(p_try{1:n_fit}); % use smart function to make all permutations for all parameters (i.e., create a grid)
-    % THIS ALSO WORKS WHEN NR OF TRIES DIFFERS FOR THE PARAMETERS!
+        % Perhaps a good idea to randomly shuffle this coll_all before parallel
+        % processing, to avoid all 'difficult parameter sets' to land on a
+        % single core. This is only for parallel processing.
+        ind_rnd  = randperm(size(coll_all,1));
+        coll_all = coll_all(ind_rnd,:);
     
-    % Perhaps a good idea to randomly shuffle this coll_all before parallel
-    % processing, to avoid all 'difficult parameter sets' to land on a
-    % single core. This is only for parallel processing.
-    ind_rnd  = randperm(size(coll_all,1));
-    coll_all = coll_all(ind_rnd,:);
+    else % THIS IS NEW AFTER V5.1 of BYOM
     
-else % THIS IS NEW AFTER V5.1 of BYOM
+        n_tries  = 10000; % number of elements in the latin hypercube sample
+        if opt_optim.ps_rough == 0
+            if n_fit < 6
+                n_tries  = 30000; % number of elements in the latin hypercube sample
+            elseif n_fit < 8
+                n_tries  = 60000; % number of elements in the latin hypercube sample
+            else
+                n_tries  = 100000; % number of elements in the latin hypercube sample
+            end
+        end
+        n_ok     = min(n_ok,500);   % test: default for 6/7 pars is 800, but for 5 it is 400
+        coll_all = 1./zeros(n_tries,n_fit+1); % initialise matrix to catch all tries and their minloglik with INF
     
-    n_tries  = 10000; % number of elements in the latin hypercube sample
-    if opt_optim.ps_rough == 0
-        if n_fit < 6
-            n_tries  = 30000; % number of elements in the latin hypercube sample
-        elseif n_fit < 8
-            n_tries  = 60000; % number of elements in the latin hypercube sample
+        if exist('lhsdesign','file')~=2 % when lhsdesign does not exist exists as an m-file in the path
+            sample_lhs = rand(n_tries,n_fit); % uniform random sample between 0 and 1
+            disp('Using random sampling in first round (Latin hypercube requires stats toolbox), instead of regular grid.')
         else
-            n_tries  = 100000; % number of elements in the latin hypercube sample
+            sample_lhs = lhsdesign(n_tries,n_fit); % Latin-hypercube sample between 0 and 1
+            disp('Using latin-hypercube sampling in first round, instead of regular grid.')
         end
-    end
-    n_ok     = min(n_ok,500);   % test: default for 6/7 pars is 800, but for 5 it is 400
-    coll_all = 1./zeros(n_tries,n_fit+1); % initialise matrix to catch all tries and their minloglik with INF
     
-    if exist('lhsdesign','file')~=2 % when lhsdesign does not exist exists as an m-file in the path
-        sample_lhs = rand(n_tries,n_fit); % uniform random sample between 0 and 1
-        disp('Using random sampling in first round (Latin hypercube requires stats toolbox), instead of regular grid.')
-    else
-        sample_lhs = lhsdesign(n_tries,n_fit); % Latin-hypercube sample between 0 and 1
-        disp('Using latin-hypercube sampling in first round, instead of regular grid.')
-    end
+        if n_fit > 5 && chicrit_joint < 6
+            disp('Using a limited outer rim (based of df=5 rather than the actual number of parameters)')
+            disp('   This implies that the blue points can no longer be interpreted as the joint CI!')
+        end
     
-    if n_fit > 5 && chicrit_joint < 6
-        disp('Using a limited outer rim (based of df=5 rather than the actual number of parameters)')
-        disp('   This implies that the blue points can no longer be interpreted as the joint CI!')
-    end
+        for i_p = 1:n_fit % go through the fitted parameters
+            sample_lhs(:,i_p) = sample_lhs(:,i_p)*(bnds_tmp(i_p,2) - bnds_tmp(i_p,1))+bnds_tmp(i_p,1);
+            % and change the sample to cover the bounds of the hypercube
+        end
+        coll_all(:,1:n_fit) = sample_lhs; % place sample in <coll_all>
+        clear sample_lhs; % clear the sample to save memory
     
-    for i_p = 1:n_fit % go through the fitted parameters
-        sample_lhs(:,i_p) = sample_lhs(:,i_p)*(bnds_tmp(i_p,2) - bnds_tmp(i_p,1))+bnds_tmp(i_p,1);
-        % and change the sample to cover the bounds of the hypercube
     end
-    coll_all(:,1:n_fit) = sample_lhs; % place sample in <coll_all>
-    clear sample_lhs; % clear the sample to save memory
-    
-end
 
-% BLOCK 3.4. Run through all elements of <coll_all> and calculate their
-% likelihood. This could be integrated into the previous series of <for>
-% loops ...
-disp(' ')
-disp(['Starting round 1 with initial grid of ',num2str(n_tries),' parameter sets'])
-
-mll_tmp  = 1./zeros(n_tries,1); % initialise matrix (with INFs) to catch all MLLs
-parfor i_t = 1:n_tries % run through all elements of <coll_all> and collect their likelihood
-%     waitbar(i_t/n_tries,f,'Round 1: initial grid') % update progress bar
-    pfit         = coll_all(i_t,1:n_fit); % next, try this set of parameter values
-    mll_tmp(i_t) = transfer(pfit,pmat,WRAP); % calculate the min-log-likelihood for this parameter combination,
-    % and collect it in the last column of <coll_all>
-end
-coll_all(:,end) = mll_tmp;
-
-% BLOCK 3.5. Extract some useful matrices from the total <coll_all> matrix.
-% Decide which sets to continue with in the next round. These will go into
-% the new matrix <coll_ok>.
-coll_all  = coll_all(~isinf(coll_all(:,end)),:); % remove the ones that have INF as minloglik
-coll_all  = sortrows(coll_all,n_fit+1); % sort based on the minloglik in the last column (keep parameter sets together)
-mll       = coll_all(1,end);            % lowest MLL; <coll_all> is sorted, so first is the best fitting one so far
-ind_cont  = find(coll_all(:,end) < mll + chicrit_rnd(1),1,'last'); % index to last MLL that is within the criterium to continue with
-ind_cont  = max(ind_cont,n_ok); % take at least the <n_ok> best ones ...
-ind_cont  = min(ind_cont,size(coll_all,1)); % <n_ok> should always be smaller than the length of <coll_all>
-% This latter check is only relevant when we fit two (or one?) parameters,
-% otherwise the number of initial tries will always exceed <n_ok>.
-
-% Check if we found a lot of ok values (that can for example happen when
-% the ranges are set much tighter by the user).
-if ind_cont > 1 * n_conf(1) % if we already have more than what we finally need ...
-    ind_cont2 = find(coll_all(:,end)-mll > chicrit_rnd(2),1,'first'); % how many within *next* chi2 criterion?
-    ind_cont  = max(n_conf(1),ind_cont2); % take highest from end number or the ones within the next chi-square criterion
-    % This ensures that rather bad values (within <chicrit_rndi(2)>) are
-    % still included at this point. We should take care not to remove too
-    % many values-to-try early in the run.
-end
-coll_ok = coll_all(1:ind_cont,:); % take the <ind_cont> best ones to continue with
+    % BLOCK 3.4. Run through all elements of <coll_all> and calculate their
+    % likelihood. This could be integrated into the previous series of <for>
+    % loops ...
+    disp(' ')
+    disp(['Starting round 1 with initial grid of ',num2str(n_tries),' parameter sets'])
+
+    mll_tmp  = 1./zeros(n_tries,1); % initialise matrix (with INFs) to catch all MLLs
+    parfor i_t = 1:n_tries % run through all elements of <coll_all> and collect their likelihood
+    %     waitbar(i_t/n_tries,f,'Round 1: initial grid') % update progress bar
+        pfit         = coll_all(i_t,1:n_fit); % next, try this set of parameter values
+        mll_tmp(i_t) = transfer(pfit,pmat,WRAP); % calculate the min-log-likelihood for this parameter combination,
+        % and collect it in the last column of <coll_all>
+    end
+    coll_all(:,end) = mll_tmp;
+
+    % BLOCK 3.5. Extract some useful matrices from the total <coll_all> matrix.
+    % Decide which sets to continue with in the next round. These will go into
+    % the new matrix <coll_ok>.
+    coll_all  = coll_all(~isinf(coll_all(:,end)),:); % remove the ones that have INF as minloglik
+    coll_all  = sortrows(coll_all,n_fit+1); % sort based on the minloglik in the last column (keep parameter sets together)
+    mll       = coll_all(1,end);            % lowest MLL; <coll_all> is sorted, so first is the best fitting one so far
+    ind_cont  = find(coll_all(:,end) < mll + chicrit_rnd(1),1,'last'); % index to last MLL that is within the criterium to continue with
+    ind_cont  = max(ind_cont,n_ok); % take at least the <n_ok> best ones ...
+    ind_cont  = min(ind_cont,size(coll_all,1)); % <n_ok> should always be smaller than the length of <coll_all>
+    % This latter check is only relevant when we fit two (or one?) parameters,
+    % otherwise the number of initial tries will always exceed <n_ok>.
+
+    % Check if we found a lot of ok values (that can for example happen when
+    % the ranges are set much tighter by the user).
+    if ind_cont > 1 * n_conf(1) % if we already have more than what we finally need ...
+        ind_cont2 = find(coll_all(:,end)-mll > chicrit_rnd(2),1,'first'); % how many within *next* chi2 criterion?
+        ind_cont  = max(n_conf(1),ind_cont2); % take highest from end number or the ones within the next chi-square criterion
+        % This ensures that rather bad values (within <chicrit_rndi(2)>) are
+        % still included at this point. We should take care not to remove too
+        % many values-to-try early in the run.
+    end
+    coll_ok = coll_all(1:ind_cont,:); % take the <ind_cont> best ones to continue with
 
-% BLOCK 3.6. Display status on screen, make plot, and prepare settings for next round.
-disp(['  Status: best fit so far is (minloglik) ',num2str(mll)])
+    % BLOCK 3.6. Display status on screen, make plot, and prepare settings for next round.
+    disp(['  Status: best fit so far is (minloglik) ',num2str(mll)])
 
-if plot_intermed == 1
-    % And make a plot of the progress so far (one plot that will be updated after each round)
-    figh = plot_grid(pmat,coll_ok,coll_all,[],figh,SETTINGS_OPTIM,WRAP); % returns the handle to the graph in <figh>, so we can update the same plot
-%     uistack(f,'top')  % but place progress bar on top!
-end
+    if plot_intermed == 1
+        % And make a plot of the progress so far (one plot that will be updated after each round)
+        figh = plot_grid(pmat,coll_ok,coll_all,[],figh,SETTINGS_OPTIM,WRAP); % returns the handle to the graph in <figh>, so we can update the same plot
+    %     uistack(f,'top')  % but place progress bar on top!
+    end
 
-% Set all settings for the next round of optimisation.
-n_rnd     = n_rnd + 1;   % increase counter for rounds by 1
-n_tr_i    = n_tr(n_rnd); % number of random parameter tries in round 2
-f_d_i     = f_d(n_rnd);  % maximum step as factor of grid spacing for random search
-chicrit_i = chicrit_rnd(n_rnd); % chi2 criterion to select ok values
-
-% Also check after first round if it's not too many. If we have a lot of
-% parameter sets to continue with, we can use less tries in the next round.
-if ind_cont > (1/2) * n_conf(1)   % if we have more than half of what we finally need ...
-    n_tr_i = floor(n_tr_i/2);     % decrease the number of tries per set for next round
-    if ind_cont >= 1 * n_conf(1)  % if we have more than what we finally need in total ...
-        n_tr_i = floor(n_tr_i/2); % AGAIN decrease the number of tries per set
+    % Set all settings for the next round of optimisation.
+    n_rnd     = n_rnd + 1;   % increase counter for rounds by 1
+    n_tr_i    = n_tr(n_rnd); % number of random parameter tries in round 2
+    f_d_i     = f_d(n_rnd);  % maximum step as factor of grid spacing for random search
+    chicrit_i = chicrit_rnd(n_rnd); % chi2 criterion to select ok values
+
+    % Also check after first round if it's not too many. If we have a lot of
+    % parameter sets to continue with, we can use less tries in the next round.
+    if ind_cont > (1/2) * n_conf(1)   % if we have more than half of what we finally need ...
+        n_tr_i = floor(n_tr_i/2);     % decrease the number of tries per set for next round
+        if ind_cont >= 1 * n_conf(1)  % if we have more than what we finally need in total ...
+            n_tr_i = floor(n_tr_i/2); % AGAIN decrease the number of tries per set
+        end
     end
-end
-n_tr_i = min(n_tr_i,max(2,floor(10*n_conf(1)/ind_cont))); % hard limit for the number of tries per set for next round
-% This allows a max of 10x the target value to be tried in the next round
-% (scaling back <n_tr_i>, with a minimum of 2). These checks should ensure
-% that we don't have a huge amount of sets to try in round 2.
+    n_tr_i = min(n_tr_i,max(2,floor(10*n_conf(1)/ind_cont))); % hard limit for the number of tries per set for next round
+    % This allows a max of 10x the target value to be tried in the next round
+    % (scaling back <n_tr_i>, with a minimum of 2). These checks should ensure
+    % that we don't have a huge amount of sets to try in round 2.
 
-%% BLOCK 4ALT. Use slice sampling rather than the openGUTS mutations
-% At this moment, this option is restricted to Tjalling. Since I modified a
-% Matlab function, distributing it on the web is likely a copyright
-% infringement.
+    %% BLOCK 4ALT. Use slice sampling rather than the openGUTS mutations
+    % At this moment, this option is restricted to Tjalling. Since I modified a
+    % Matlab function, distributing it on the web is likely a copyright
+    % infringement.
 
-flag_stop  = 0; % flag for when we can stop the analysis (sufficient points found: 1)
+    flag_stop  = 0; % flag for when we can stop the analysis (sufficient points found: 1)
 
-if opt_optim.ps_slice == 1 && exist('slicesample_byom','file')~=2 
-    % only when slicesample_byom exists as an m-file in the path
+    if opt_optim.ps_slice == 1 && exist('slicesample_byom','file')~=2 
+        % only when slicesample_byom exists as an m-file in the path
     
-    % We don't want to prune coll_all when going into the slice sampler;
-    % pruning will be done there were needed.
+        % We don't want to prune coll_all when going into the slice sampler;
+        % pruning will be done there were needed.
     
-    % Collect various input parameters for the slow-kinetics-catcher into a
-    % structure.
-    SLOKIN.loc_kd     = loc_kd;
-    if loc_kd ~= -1
-        SLOKIN.loc_mw_fit = loc_mw_fit;
-        SLOKIN.loc_kd_fit = loc_kd_fit;
-        SLOKIN.bnds_tmp   = bnds_tmp;
-    end
+        % Collect various input parameters for the slow-kinetics-catcher into a
+        % structure.
+        SLOKIN.loc_kd     = loc_kd;
+        if loc_kd ~= -1
+            SLOKIN.loc_mw_fit = loc_mw_fit;
+            SLOKIN.loc_kd_fit = loc_kd_fit;
+            SLOKIN.bnds_tmp   = bnds_tmp;
+        end
     
-    [coll_all,flag_stop,n_rnd,minmax] = calc_parspace_slice(coll_all,pmat,figh,plot_intermed,SLOKIN,SETTINGS_OPTIM,WRAP);
-    if flag_stop == 0 % then we returned prematurely, because slow kinetics was found
-        return % so return to calc_optim_ps
-    end
-    % Note: under normal conditions, flag_stop=1 after the call to
-    % calc_parspace_slice, which also implies that the regular mutation
-    % rounds in BLOCK 4 will be skipped.
+        [coll_all,flag_stop,n_rnd,minmax] = calc_parspace_slice(coll_all,pmat,figh,plot_intermed,SLOKIN,SETTINGS_OPTIM,WRAP);
+        if flag_stop == 0 % then we returned prematurely, because slow kinetics was found
+            return % so return to calc_optim_ps
+        end
+        % Note: under normal conditions, flag_stop=1 after the call to
+        % calc_parspace_slice, which also implies that the regular mutation
+        % rounds in BLOCK 4 will be skipped.
     
-else % prepare for regular openGUTS mutation rounds
+    else % prepare for regular openGUTS mutation rounds
     
-    % Prune <coll_all> to remove all values that are outside highest chi2 criterion.
-    coll_all = prune_mat(coll_all,mll + chicrit_max,[1 0]);
+        % Prune <coll_all> to remove all values that are outside highest chi2 criterion.
+        coll_all = prune_mat(coll_all,mll + chicrit_max,[1 0]);
     
-end
+    end
 
-%% BLOCK 4. Subsequent rounds are automated in a while loop
+    %% BLOCK 4. Subsequent rounds are automated in a while loop
 
-flag_inner = 0; % flag for when we will focus on inner rim (1)
+    flag_inner = 0; % flag for when we will focus on inner rim (1)
 
-while flag_stop ~= 1 % continue until this flag is set to 1
+    while flag_stop ~= 1 % continue until this flag is set to 1
     
-    disp(['Starting round ',num2str(n_rnd),', refining a selection of ',num2str(size(coll_ok,1)),' parameter sets, with ',num2str(n_tr_i),' tries each'])
-    % Note: waitbar updates are now dealt with within <rand_mutations>
-
-    % BLOCK 4.1. Call <rand_mutations> to mutate <coll_ok>, give each new set
-    % an MLL, and return it in <coll_tries>.
-    coll_tries = rand_mutations(pmat,coll_ok,bnds_tmp,n_tr_i,f_d_i*d_grid,WRAP);
-    coll_all   = cat(1,coll_all,coll_tries); % add the tries to the total <coll_all>
-    coll_all   = sortrows(coll_all,n_fit+1); % sort the combined set based on minloglik
+        disp(['Starting round ',num2str(n_rnd),', refining a selection of ',num2str(size(coll_ok,1)),' parameter sets, with ',num2str(n_tr_i),' tries each'])
+        % Note: waitbar updates are now dealt with within <rand_mutations>
+
+        % BLOCK 4.1. Call <rand_mutations> to mutate <coll_ok>, give each new set
+        % an MLL, and return it in <coll_tries>.
+        coll_tries = rand_mutations(pmat,coll_ok,bnds_tmp,n_tr_i,f_d_i*d_grid,WRAP);
+        coll_all   = cat(1,coll_all,coll_tries); % add the tries to the total <coll_all>
+        coll_all   = sortrows(coll_all,n_fit+1); % sort the combined set based on minloglik
     
-    % BLOCK 4.2. Do an optimisation here, with low precision, to improve
-    % the best value so far. Add the optimised best set to <coll_all>.
+        % BLOCK 4.2. Do an optimisation here, with low precision, to improve
+        % the best value so far. Add the optimised best set to <coll_all>.
     
-    % ---------------------------------------------------------------------
-    % TEST do not do 1 quick optimisation, but several in parallel!
-    % Depending on how many cores are used for parallel processing ... it
-    % starts from the best n_cores sets in coll_all. This is only done in
-    % the parallel version in engine_par. Don't overdo it, make 4 the max
-    % nr of sets to start with.
-    n_opt = min(4,glo2.n_cores);
-    pfit  = coll_all(1:n_opt,1:n_fit);
-    pcol  = nan(n_opt,n_fit+1);
-    parfor i = 1:n_opt
-        [phat,mll] = setup_simplex(pfit(i,:),0,pmat,WRAP); % do a rough optimisation
-        pcol(i,:)  = [phat mll]; % collect the output for this run in a matrix
-    end
-    coll_all = cat(1,pcol,coll_all); % add the best fitting set with the new fitted parameters and MLL
-    coll_all = sortrows(coll_all,n_fit+1); % sort based on the minloglik in the last column (keep parameter sets together)
-    mll      = coll_all(1,end);            % lowest MLL; <coll_all> is sorted, so first is the best fitting one so far
-    % ---------------------------------------------------------------------
+        % ---------------------------------------------------------------------
+        % TEST do not do 1 quick optimisation, but several in parallel!
+        % Depending on how many cores are used for parallel processing ... it
+        % starts from the best n_cores sets in coll_all. This is only done in
+        % the parallel version in engine_par. Don't overdo it, make 4 the max
+        % nr of sets to start with.
+        n_opt = min(4,glo2.n_cores);
+        pfit  = coll_all(1:n_opt,1:n_fit);
+        pcol  = nan(n_opt,n_fit+1);
+        parfor i = 1:n_opt
+            [phat,mll] = setup_simplex(pfit(i,:),0,pmat,WRAP); % do a rough optimisation
+            pcol(i,:)  = [phat mll]; % collect the output for this run in a matrix
+        end
+        coll_all = cat(1,pcol,coll_all); % add the best fitting set with the new fitted parameters and MLL
+        coll_all = sortrows(coll_all,n_fit+1); % sort based on the minloglik in the last column (keep parameter sets together)
+        mll      = coll_all(1,end);            % lowest MLL; <coll_all> is sorted, so first is the best fitting one so far
+        % ---------------------------------------------------------------------
     
-%     pfit = coll_all(1,1:n_fit)'; % copy best values to <pfit> (<coll_all> is sorted, so first is the best fitting one so far)
-%     % Only parameter values that are to be fitted; use as starting values for fitting.
-%     [phat,mll] = setup_simplex(pfit,0,pmat,WRAP); % do a rough optimisation
-%     coll_all   = cat(1,coll_all(1,:),coll_all);  % copy the previous best to the first position
-%     coll_all(1,:) = [phat' mll]; % update the best fitting one with the new fitted parameters and MLL
+    %     pfit = coll_all(1,1:n_fit)'; % copy best values to <pfit> (<coll_all> is sorted, so first is the best fitting one so far)
+    %     % Only parameter values that are to be fitted; use as starting values for fitting.
+    %     [phat,mll] = setup_simplex(pfit,0,pmat,WRAP); % do a rough optimisation
+    %     coll_all   = cat(1,coll_all(1,:),coll_all);  % copy the previous best to the first position
+    %     coll_all(1,:) = [phat' mll]; % update the best fitting one with the new fitted parameters and MLL
     
-    % BLOCK 4.3. Derive some useful indices from <coll_all> and
-    % <coll_tries>. Find the last value in <coll_all> and <coll_tries> that
-    % still is within a certain criterion.
-    ind_final  = find(coll_all(:,end)   < mll + chicrit_joint,1,'last');  % index in <coll_all> for total joint CI
-    ind_single = find(coll_all(:,end)   < mll + chicrit_single,1,'last'); % index in <coll_all> for inner rim
-    ind_cont_t = find(coll_tries(:,end) < mll + chicrit_i,1,'last');      % index in just-tried sets that qualify for continuation to next round
-    ind_cont_a = find(coll_all(:,end)   < mll + chicrit_i,1,'last');      % index in <coll_all> that qualify for continuation to next round
-    ind_inner  = find(coll_all(:,end)   < mll + chicrit_single + 0.2,1,'last'); % index for inner rim, with a little extra
+        % BLOCK 4.3. Derive some useful indices from <coll_all> and
+        % <coll_tries>. Find the last value in <coll_all> and <coll_tries> that
+        % still is within a certain criterion.
+        ind_final  = find(coll_all(:,end)   < mll + chicrit_joint,1,'last');  % index in <coll_all> for total joint CI
+        ind_single = find(coll_all(:,end)   < mll + chicrit_single,1,'last'); % index in <coll_all> for inner rim
+        ind_cont_t = find(coll_tries(:,end) < mll + chicrit_i,1,'last');      % index in just-tried sets that qualify for continuation to next round
+        ind_cont_a = find(coll_all(:,end)   < mll + chicrit_i,1,'last');      % index in <coll_all> that qualify for continuation to next round
+        ind_inner  = find(coll_all(:,end)   < mll + chicrit_single + 0.2,1,'last'); % index for inner rim, with a little extra
     
-    % Two additional indices (roughly for a 97.5% joint CI) in case we run
-    % into trouble (if we try too many new parameters with chicrit_i).
-    % These are indices to the last entry in the two matrices that still
-    % are within the total cloud that we like to calculate (slightly more
-    % than <chicrit_joint>).
-    ind_cont_t2 = find(coll_tries(:,end) < mll + chicrit_max,1,'last');
-    ind_cont_a2 = find(coll_all(:,end)   < mll + chicrit_max,1,'last');
+        % Two additional indices (roughly for a 97.5% joint CI) in case we run
+        % into trouble (if we try too many new parameters with chicrit_i).
+        % These are indices to the last entry in the two matrices that still
+        % are within the total cloud that we like to calculate (slightly more
+        % than <chicrit_joint>).
+        ind_cont_t2 = find(coll_tries(:,end) < mll + chicrit_max,1,'last');
+        ind_cont_a2 = find(coll_all(:,end)   < mll + chicrit_max,1,'last');
     
-    disp(['  Status: ',num2str(ind_final),' sets within total CI and ',num2str(ind_single),' within inner. Best fit: ',num2str(coll_all(1,end))])
+        disp(['  Status: ',num2str(ind_final),' sets within total CI and ',num2str(ind_single),' within inner. Best fit: ',num2str(coll_all(1,end))])
 
-    % BLOCK 4.4. Try to catch slow kinetics at this point: if there are
-    % signs, redo the first round with <mw> on log-scale! It tests on a
-    % part of <coll_all>: only the sets that are within the joint 95% CI
-    % (with a minimum of <n_ok> sets).
+        % BLOCK 4.4. Try to catch slow kinetics at this point: if there are
+        % signs, redo the first round with <mw> on log-scale! It tests on a
+        % part of <coll_all>: only the sets that are within the joint 95% CI
+        % (with a minimum of <n_ok> sets).
         
-    if loc_kd ~= -1 % only when we identified that it needs to be checked
+        if loc_kd ~= -1 % only when we identified that it needs to be checked
         
-        coll_tst = coll_all(1:max(ind_final,n_ok),:); % parameter set used to test for slow kinetics
+            coll_tst = coll_all(1:max(ind_final,n_ok),:); % parameter set used to test for slow kinetics
         
-        min_mw = min(coll_tst(:,loc_mw_fit)); % minimum (non-zero) value of <mw> in the test matrix
-        min_kd = min(coll_tst(:,loc_kd_fit)); % minimum value of <kd> in the test matrix
+            min_mw = min(coll_tst(:,loc_mw_fit)); % minimum (non-zero) value of <mw> in the test matrix
+            min_kd = min(coll_tst(:,loc_kd_fit)); % minimum value of <kd> in the test matrix
         
-        check_corr = corrcoef(log10(coll_tst(:,loc_mw_fit)),coll_tst(:,loc_kd_fit)); % correlation between <mw> and <kd> on log scale
-        % For slow kinetics, <mw> and <kd> will extend to the lower part of
-        % their range. This might fail when users modify the ranges.
-        % However, then we still have the check on the correlation
-        % coefficient.
-        crit_mw = (min_mw - bnds_tmp(loc_mw_fit,1)) / diff(bnds_tmp(loc_mw_fit,[1 2])); % distance from lower bound as fraction of range
-        crit_kd = (min_kd - bnds_tmp(loc_kd_fit,1)) / diff(bnds_tmp(loc_kd_fit,[1 2])); % distance from lower bound as fraction of range
+            check_corr = corrcoef(log10(coll_tst(:,loc_mw_fit)),coll_tst(:,loc_kd_fit)); % correlation between <mw> and <kd> on log scale
+            % For slow kinetics, <mw> and <kd> will extend to the lower part of
+            % their range. This might fail when users modify the ranges.
+            % However, then we still have the check on the correlation
+            % coefficient.
+            crit_mw = (min_mw - bnds_tmp(loc_mw_fit,1)) / diff(bnds_tmp(loc_mw_fit,[1 2])); % distance from lower bound as fraction of range
+            crit_kd = (min_kd - bnds_tmp(loc_kd_fit,1)) / diff(bnds_tmp(loc_kd_fit,[1 2])); % distance from lower bound as fraction of range
         
-        % The check is now pretty strict ... too strict? Want to avoid
-        % putting <mw> on log scale when we run into single-dose runaway ...
-        if check_corr(2) > SETTINGS_OPTIM.slowkin_corr % is there a sufficiently strong positive correlation between <mw> and <kd>?
-            if crit_mw < SETTINGS_OPTIM.slowkin_pars || crit_kd < SETTINGS_OPTIM.slowkin_pars
-                % And is either <kd> or <mw> at lower part of their bounds?
-                close(figh) % close the figure we have been building
-%                 delete(f) % delete progress bar
+            % The check is now pretty strict ... too strict? Want to avoid
+            % putting <mw> on log scale when we run into single-dose runaway ...
+            if check_corr(2) > SETTINGS_OPTIM.slowkin_corr % is there a sufficiently strong positive correlation between <mw> and <kd>?
+                if crit_mw < SETTINGS_OPTIM.slowkin_pars || crit_kd < SETTINGS_OPTIM.slowkin_pars
+                    % And is either <kd> or <mw> at lower part of their bounds?
+                    close(figh) % close the figure we have been building
+    %                 delete(f) % delete progress bar
                 
-                % Calculate min and max, of the parameter cloud we tested, for
-                % each parameter (this creates a matrix). This will be used to
-                % create new (smaller) starting ranges for a new round.
-                minmax = [min(coll_tst(:,1:end-1),[],1)' max(coll_tst(:,1:end-1),[],1)'];
-                minmax(ind_log,:) = 10.^minmax(ind_log,:); % and put on normal scale where needed
-                return % and go back to <calc_optim_ps> to force a restart
+                    % Calculate min and max, of the parameter cloud we tested, for
+                    % each parameter (this creates a matrix). This will be used to
+                    % create new (smaller) starting ranges for a new round.
+                    minmax = [min(coll_tst(:,1:end-1),[],1)' max(coll_tst(:,1:end-1),[],1)'];
+                    minmax(ind_log,:) = 10.^minmax(ind_log,:); % and put on normal scale where needed
+                    return % and go back to <calc_optim_ps> to force a restart
+                end
             end
-        end
         
-    end
+        end
     
-    % BLOCK 4.5. This is the tricky bit! This block is aiming to make sure
-    % not to try too few or too many points in the next round, but select
-    % an efficient set for continuation in <coll_ok>.
-    %
-    % Note: the settings here are all tweaked to get good results in the
-    % cases tested. These setting could be made part of the global setting
-    % <SETTINGS_OPTIM>. However, I feared that that would make the code
-    % unreadable (these settings only make sense in their context), and is
-    % not really necessary. However, for full flexibility, it can be
-    % considered to put them in the global.
+        % BLOCK 4.5. This is the tricky bit! This block is aiming to make sure
+        % not to try too few or too many points in the next round, but select
+        % an efficient set for continuation in <coll_ok>.
+        %
+        % Note: the settings here are all tweaked to get good results in the
+        % cases tested. These setting could be made part of the global setting
+        % <SETTINGS_OPTIM>. However, I feared that that would make the code
+        % unreadable (these settings only make sense in their context), and is
+        % not really necessary. However, for full flexibility, it can be
+        % considered to put them in the global.
     
-    if ind_final >= n_conf(1) % do we already have enough parameter sets in the total joint CI?
-        if ind_single >= n_conf(2) % and also enough in the inner rim?
-            flag_stop = 1; % then we can stop!
+        if ind_final >= n_conf(1) % do we already have enough parameter sets in the total joint CI?
+            if ind_single >= n_conf(2) % and also enough in the inner rim?
+                flag_stop = 1; % then we can stop!
             
-        else % what to do if there are enough within the outer rim, but few in the inner?
-            disp('  Next round will focus on inner rim (outer rim has enough points)')
-            coll_ok = coll_all(1:ind_inner,:); % only take the ones that are within the inner rim (plus a little extra)
-            flag_inner = 1; % signal that we'll do inner rim only in next round
-            if ind_inner < n_ok % if there are very few currently in the inner rim, take the <n_ok> best ones from <coll_all> ...
-                coll_ok = coll_all(1:n_ok,:); % take the best <n_ok> values to continue to next round
-            elseif ind_inner > 0.5 * n_conf(2) % if we already have quite some values in inner rim ...
-                % Focus on the <n_ok> sets close to the rim (now, <n_ok> on both sides of the cut-off)
-                coll_ok = coll_all(max(1,ind_single-n_ok):ind_single+n_ok,:);
-                coll_ok  = cat(1,coll_ok,coll_all(1,:)); % also add the optimised best value in there ... (helps to look for better optimum)
+            else % what to do if there are enough within the outer rim, but few in the inner?
+                disp('  Next round will focus on inner rim (outer rim has enough points)')
+                coll_ok = coll_all(1:ind_inner,:); % only take the ones that are within the inner rim (plus a little extra)
+                flag_inner = 1; % signal that we'll do inner rim only in next round
+                if ind_inner < n_ok % if there are very few currently in the inner rim, take the <n_ok> best ones from <coll_all> ...
+                    coll_ok = coll_all(1:n_ok,:); % take the best <n_ok> values to continue to next round
+                elseif ind_inner > 0.5 * n_conf(2) % if we already have quite some values in inner rim ...
+                    % Focus on the <n_ok> sets close to the rim (now, <n_ok> on both sides of the cut-off)
+                    coll_ok = coll_all(max(1,ind_single-n_ok):ind_single+n_ok,:);
+                    coll_ok  = cat(1,coll_ok,coll_all(1,:)); % also add the optimised best value in there ... (helps to look for better optimum)
+                end
             end
-        end
         
-    else % then there are not enough accepted parameter sets in the total joint CI
+        else % then there are not enough accepted parameter sets in the total joint CI
         
-        if ind_cont_t > n_ok % if there are enough in <coll_tries> to continue with ...
-            % in principle, the next round will continue from sets in
-            % <coll_tries> and not from <coll_all>. The reason is that it is
-            % better to propagate new sets than to continue propagating
-            % sets that have been propagated before already.
+            if ind_cont_t > n_ok % if there are enough in <coll_tries> to continue with ...
+                % in principle, the next round will continue from sets in
+                % <coll_tries> and not from <coll_all>. The reason is that it is
+                % better to propagate new sets than to continue propagating
+                % sets that have been propagated before already.
             
-            if ind_cont_t > 2 * n_conf(1) % if we will try more than 2 times of what we finally need ...
+                if ind_cont_t > 2 * n_conf(1) % if we will try more than 2 times of what we finally need ...
                 
-                if ind_final > 0.5 * n_conf(1) % if we already have half the values we need
-                    % focus on values around the edge of the inner rim as
-                    % that is where we need most precision.
-                    coll_ok = coll_tries(max(1,ind_single-n_ok):min(ind_cont_t,ind_single+n_ok),:);
+                    if ind_final > 0.5 * n_conf(1) % if we already have half the values we need
+                        % focus on values around the edge of the inner rim as
+                        % that is where we need most precision.
+                        coll_ok = coll_tries(max(1,ind_single-n_ok):min(ind_cont_t,ind_single+n_ok),:);
                     
-                else % then we have a lot of values to try, but not so much accepted yet
+                    else % then we have a lot of values to try, but not so much accepted yet
                     
-                    if coll_tries(2*n_conf(1),end) > mll + chicrit_max % at 2 * <n_conf(1)>, do we still include some bad points?
-                        ind_cont_t = 2 * n_conf(1); % limit continuation points to the best 2 * <n_conf(1)>
-                    else % then it is not a good idea to limit continuation to 2 * <n_conf(1)>
-                        ind_cont_t  = ind_cont_t2; % take the sets within <chicrit_max>
-                        % This could still be a lot ... but then we'll
-                        % trigger a reduction in new mutations.
+                        if coll_tries(2*n_conf(1),end) > mll + chicrit_max % at 2 * <n_conf(1)>, do we still include some bad points?
+                            ind_cont_t = 2 * n_conf(1); % limit continuation points to the best 2 * <n_conf(1)>
+                        else % then it is not a good idea to limit continuation to 2 * <n_conf(1)>
+                            ind_cont_t  = ind_cont_t2; % take the sets within <chicrit_max>
+                            % This could still be a lot ... but then we'll
+                            % trigger a reduction in new mutations.
+                        end
+                        coll_ok  = coll_tries(1:ind_cont_t,:);
                     end
+                else % then we don't try too much in the next round, so just use <ind_cont_t> as planned
                     coll_ok  = coll_tries(1:ind_cont_t,:);
                 end
-            else % then we don't try too much in the next round, so just use <ind_cont_t> as planned
-                coll_ok  = coll_tries(1:ind_cont_t,:);
-            end
-            coll_ok  = cat(1,coll_ok,coll_all(1,:)); % also add the optimised best value in there ... (helps to look for better optimum)
+                coll_ok  = cat(1,coll_ok,coll_all(1,:)); % also add the optimised best value in there ... (helps to look for better optimum)
             
-        else % there are NOT enough values in <coll_tries> to continu with ... then we need to look at <coll_all>.
-            if ind_cont_a > n_ok % if there are enough reasonable sets in total <coll_all>
-                if ind_cont_a > 2 * n_conf(1) % if we will try more than two times of what we finally need ...
-                    if coll_all(2 * n_conf(1),end) > mll + chicrit_max % at 2 * <n_conf(1)>, do we still include some bad points?
-                        ind_cont_a = 2 * n_conf(1); % limit to best 2 * <n_conf(1)> to continue
-                    else
-                        ind_cont_a = ind_cont_a2; % otherwise take the ones within <crit_max>
-                        % this could still be a lot ...
+            else % there are NOT enough values in <coll_tries> to continu with ... then we need to look at <coll_all>.
+                if ind_cont_a > n_ok % if there are enough reasonable sets in total <coll_all>
+                    if ind_cont_a > 2 * n_conf(1) % if we will try more than two times of what we finally need ...
+                        if coll_all(2 * n_conf(1),end) > mll + chicrit_max % at 2 * <n_conf(1)>, do we still include some bad points?
+                            ind_cont_a = 2 * n_conf(1); % limit to best 2 * <n_conf(1)> to continue
+                        else
+                            ind_cont_a = ind_cont_a2; % otherwise take the ones within <crit_max>
+                            % this could still be a lot ...
+                        end
                     end
+                    coll_ok  = coll_all(1:ind_cont_a,:); % continue with selection from the total <coll_all>
+                else % if all else fails ...
+                    coll_ok  = coll_all(1:n_ok,:); % take the best <n_ok> values from the total <coll_all>
                 end
-                coll_ok  = coll_all(1:ind_cont_a,:); % continue with selection from the total <coll_all>
-            else % if all else fails ...
-                coll_ok  = coll_all(1:n_ok,:); % take the best <n_ok> values from the total <coll_all>
             end
         end
-    end
     
-    % Now that we know the set that we will continue with, it is time to
-    % update the plot of parameter space. And make a plot of the progress
-    % so far
-    if plot_intermed == 1
-        if flag_inner == 0 && flag_stop ~= 1
-            figh = plot_grid(pmat,coll_ok,coll_all,[],figh,SETTINGS_OPTIM,WRAP);
-        else % if we were refining the inner rim, or will stop, we can plot the outer rim instead
-            figh = plot_grid(pmat,[],coll_all,[],figh,SETTINGS_OPTIM,WRAP);
+        % Now that we know the set that we will continue with, it is time to
+        % update the plot of parameter space. And make a plot of the progress
+        % so far
+        if plot_intermed == 1
+            if flag_inner == 0 && flag_stop ~= 1
+                figh = plot_grid(pmat,coll_ok,coll_all,[],figh,SETTINGS_OPTIM,WRAP);
+            else % if we were refining the inner rim, or will stop, we can plot the outer rim instead
+                figh = plot_grid(pmat,[],coll_all,[],figh,SETTINGS_OPTIM,WRAP);
+            end
+    %         uistack(f,'top')  % but place progress bar on top!
         end
-%         uistack(f,'top')  % but place progress bar on top!
-    end
     
-    % BLOCK 4.6. See if we need a new round, and if so, prepare for it.
-    % Again, special care is taken to avoid taking too few or too many new
-    % tries in the next round. Therefore, the tricky part is to come up
-    % with an efficient value for <n_tr_i> (number of random mutations per
-    % set in the next round).
-    %
-    % Note: the settings here are all tweaked to get good results in the
-    % cases tested. These setting could be made part of the global setting
-    % <SETTINGS_OPTIM>. However, I feared that that would make the code
-    % unreadable (these settings only make sense in their context), and is
-    % not really necessary. However, for full flexibility, it can be
-    % considered to put them in the global.
+        % BLOCK 4.6. See if we need a new round, and if so, prepare for it.
+        % Again, special care is taken to avoid taking too few or too many new
+        % tries in the next round. Therefore, the tricky part is to come up
+        % with an efficient value for <n_tr_i> (number of random mutations per
+        % set in the next round).
+        %
+        % Note: the settings here are all tweaked to get good results in the
+        % cases tested. These setting could be made part of the global setting
+        % <SETTINGS_OPTIM>. However, I feared that that would make the code
+        % unreadable (these settings only make sense in their context), and is
+        % not really necessary. However, for full flexibility, it can be
+        % considered to put them in the global.
     
-    if n_rnd == n_max && flag_stop == 0 % at some point, we need to force a stop ... and examine what went wrong
-        flag_stop = 1; % let's stop here
-        disp(' ')
-        disp(['We have now done ',num2str(n_rnd),' rounds without reaching the stopping criterion ... we stop here!'])
-    end
-        
-    % If we need another round, prepare for it.
-    if flag_stop ~= 1
-        n_rnd = n_rnd + 1; % increase counter for rounds by 1
-        if n_rnd <= length(n_tr)     % do we still have values for the optim. criteria left in our options set?
-            n_tr_i    = n_tr(n_rnd); % number of mutations per set
-            f_d_i     = f_d(n_rnd);  % maximum step as factor of grid spacing for mutations
-            chicrit_i = chicrit_rnd(n_rnd); % criterion to select ok values for continuation
-        else % otherwise, take the last values for any additional round
-            n_tr_i    = n_tr(end);
-            f_d_i     = f_d(end);
-            chicrit_i = chicrit_rnd(end);
+        if n_rnd == n_max && flag_stop == 0 % at some point, we need to force a stop ... and examine what went wrong
+            flag_stop = 1; % let's stop here
+            disp(' ')
+            disp(['We have now done ',num2str(n_rnd),' rounds without reaching the stopping criterion ... we stop here!'])
         end
         
-        % Modify number of tries if we have a lot or only few sets within the total cloud or inner rim.
-        crit_ntry = [ind_final/n_conf(1) ind_single/n_conf(2)]; % vector: how far are we from target number of sets in total and inner rim?
-        if crit_ntry(1+flag_inner) > 0.75 || size(coll_ok,1) > 2000
-            % If we already have more than 75% of what we finally need, or more than 2000 sets to continue with
-            % Note: when <flag_inner> = 1, we look at the status of the inner rim!
-            n_tr_i = floor(n_tr_i/2); % decrease the number of tries per set for next round
-        elseif n_rnd > 3 % starting at round 4, we start to worry if we haven't found so many yet
-            if size(coll_ok,1) < 0.5 * n_conf(1+flag_inner) && size(coll_ok,1) < 1000
-                % If we have less than 50% of what we finally need, and less than 1000 sets to try next ...
-                n_tr_i = 2 * n_tr_i; % use twice as many tries in the next round
-                if n_rnd > 4 && crit_ntry(1+flag_inner) < 0.25 % if there is very few when we start round 5 ...
-                    n_tr_i = 2 * n_tr_i; % use twice as many tries (again) in the next round
+        % If we need another round, prepare for it.
+        if flag_stop ~= 1
+            n_rnd = n_rnd + 1; % increase counter for rounds by 1
+            if n_rnd <= length(n_tr)     % do we still have values for the optim. criteria left in our options set?
+                n_tr_i    = n_tr(n_rnd); % number of mutations per set
+                f_d_i     = f_d(n_rnd);  % maximum step as factor of grid spacing for mutations
+                chicrit_i = chicrit_rnd(n_rnd); % criterion to select ok values for continuation
+            else % otherwise, take the last values for any additional round
+                n_tr_i    = n_tr(end);
+                f_d_i     = f_d(end);
+                chicrit_i = chicrit_rnd(end);
+            end
+        
+            % Modify number of tries if we have a lot or only few sets within the total cloud or inner rim.
+            crit_ntry = [ind_final/n_conf(1) ind_single/n_conf(2)]; % vector: how far are we from target number of sets in total and inner rim?
+            if crit_ntry(1+flag_inner) > 0.75 || size(coll_ok,1) > 2000
+                % If we already have more than 75% of what we finally need, or more than 2000 sets to continue with
+                % Note: when <flag_inner> = 1, we look at the status of the inner rim!
+                n_tr_i = floor(n_tr_i/2); % decrease the number of tries per set for next round
+            elseif n_rnd > 3 % starting at round 4, we start to worry if we haven't found so many yet
+                if size(coll_ok,1) < 0.5 * n_conf(1+flag_inner) && size(coll_ok,1) < 1000
+                    % If we have less than 50% of what we finally need, and less than 1000 sets to try next ...
+                    n_tr_i = 2 * n_tr_i; % use twice as many tries in the next round
+                    if n_rnd > 4 && crit_ntry(1+flag_inner) < 0.25 % if there is very few when we start round 5 ...
+                        n_tr_i = 2 * n_tr_i; % use twice as many tries (again) in the next round
+                    end
+                elseif n_rnd > 7 % in the last few rounds, always worry if we still have less than 75% of the final number ...
+                    n_tr_i = 2 * n_tr_i; % use twice as many tries in the next round
                 end
-            elseif n_rnd > 7 % in the last few rounds, always worry if we still have less than 75% of the final number ...
-                n_tr_i = 2 * n_tr_i; % use twice as many tries in the next round
             end
-        end
-        n_tr_i = min(n_tr_i,max(2,floor(10*n_conf(1+flag_inner)/size(coll_ok,1)))); % limit the number of tries per set for next round
-        % This allows a max of 10x the target value to be tried in the next
-        % round (scaling back <n_tr_i>). Well, sometimes more, as at least
-        % 2 tries will be allowed for each set in <coll_ok>. I used to have
-        % a check for whether we are in the final rounds or if we found
-        % very little, but I don't think that is needed (and sometimes
-        % leads to large numbers of new tries). If all fails, the extra
-        % sampling rounds will come to the rescue.
+            n_tr_i = min(n_tr_i,max(2,floor(10*n_conf(1+flag_inner)/size(coll_ok,1)))); % limit the number of tries per set for next round
+            % This allows a max of 10x the target value to be tried in the next
+            % round (scaling back <n_tr_i>). Well, sometimes more, as at least
+            % 2 tries will be allowed for each set in <coll_ok>. I used to have
+            % a check for whether we are in the final rounds or if we found
+            % very little, but I don't think that is needed (and sometimes
+            % leads to large numbers of new tries). If all fails, the extra
+            % sampling rounds will come to the rescue.
         
-    end
+        end
     
-    % Prune <coll_all> to remove all values that are outside highest chi2 criterion.
-    if flag_stop == 0
-        coll_all = prune_mat(coll_all,mll + chicrit_max,[1 0]);
-    elseif dupl == 1 && opt_optim.ps_profs ~= 0 % also remove douplicates at this point (profiling is next)
-        coll_all = prune_mat(coll_all,mll + chicrit_max,[1 1]);
-    end
+        % Prune <coll_all> to remove all values that are outside highest chi2 criterion.
+        if flag_stop == 0
+            coll_all = prune_mat(coll_all,mll + chicrit_max,[1 0]);
+        elseif dupl == 1 && opt_optim.ps_profs ~= 0 % also remove douplicates at this point (profiling is next)
+            coll_all = prune_mat(coll_all,mll + chicrit_max,[1 1]);
+        end
    
-end
+    end
+
+end % of the rounds in Matlab
 
 % BLOCK 4.7. We only get here when the while loop is finished. To improve
 % upon the best fit ... do a thorough optimisation
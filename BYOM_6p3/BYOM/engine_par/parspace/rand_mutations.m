@@ -54,6 +54,16 @@ function coll_tries = rand_mutations(pmat,coll_ok,bnds_tmp,n_tr_i,d_grid_i,WRAP)
 
 %% BLOCK 1. Initial things.
 
+% For glo.batch=2, the C++ code of the model does the mutations and
+% calculates the likelihood on a pool of threads (see <mex_problem>).
+if WRAP.glo.batch == 2 && exist('mex_problem','file')==2
+    prob = mex_problem(pmat,WRAP); % this is empty when the C++ code cannot be used
+    if ~isempty(prob)
+        coll_tries = test_derivatives('mutate',prob,coll_ok,n_tr_i,d_grid_i,randi(2^31-1));
+        return
+    end
+end
+
 n_fit      = sum(pmat(:,2));  % number of fitted parameters
 n_cont     = size(coll_ok,1); % how many sets to mutate with
 coll_tries = 1./zeros(n_cont*n_tr_i,n_fit+1); % initialise matrix (with INFs) to catch all new sets and their MLL
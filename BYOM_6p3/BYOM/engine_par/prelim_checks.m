@@ -107,6 +107,7 @@ opt_slice.slwidth  = 10; % initial width of the slice (Matlab default is 10)
 opt_slice.alllog   = 0; % set to 1 to put all parameters on log-scale before taking the sample
 opt_slice.testing  = 1; % make additional tests on the sample: moving average and autocorrelation
 opt_slice.subplt   = 1; % create single plot with subplots (1) or many individual plots (0)
+opt_slice.chains   = 0; % number of independent chains for the sampler in C++ (glo.batch=2), 0 for one per thread
 
 % Options for the calculation of confidence intervals (used in calc_conf and plot_guts)
 opt_conf.type     = 0; % use values from slice sampler (1), likelihood region (2), or parspace explorer (3) to make intervals
@@ -336,6 +337,9 @@ end
 if ~isfield(glo,'break_time')
     glo.break_time = 1; % break time vector up for ODE solver (1) or don't (0)
 end
+if ~isfield(glo,'batch')
+    glo.batch = 0; % calculate all scenarios in one call to call_deri_batch (1), also the likelihood with call_loglik (2), or call call_deri for each scenario (0)
+end
 
 if n_X ~= size(X0mat,1)-1 % this should not occur anymore
     error('The number of state variables in X0mat does not match the number of data sets entered. If you do not have data for a state, use DATA{x}=0.')
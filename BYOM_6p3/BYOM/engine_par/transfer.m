@@ -87,32 +87,67 @@ par = packunpack(2,0,p,WRAP); % transform parameter matrix into a structure
 %% Calculate model results
 % =========================================================================
 
-for i = 1:length(ctot) % run through all of our concentrations
-    % initial states to start the solver with, from X0mat
-    X0 = X0mat(2:end,X0mat(1,:) == ctot(i)); % read initial states from X0mat using "concentration" vector
-    
-    % Note: glo is here handed over with the call to call_deri. That means
-    % that it does not have to be global in call_deri. 
-    
-    [Xout,~,Xout2,zvd] = call_deri(ttot,par,[ctot(i);X0],glo); % use call_deri.m to provide the output per concentration
-    % Note: zvd is glo.zvd with an added (third) element: the estimated
-    % value based on the parameters in par (and possibly other things).
-    % Note: zvd should not depend on the scenarios/concentrations,
-    % otherwise only the last will be used!
-   
-    if size(Xout,1) == length(ttot)
-        for j = 1:n_X % now loop over the state variables
-            Xcoll{j}(:,i) = Xout(:,j); % and collect the results in the right part of Xcoll
+if glo.batch == 2 && n_X2 == 0 && nargout < 2 % the model calculates the likelihood for all data in one go
+    [~,locX0] = ismember(ctot,X0mat(1,:)); % location of each concentration in X0mat
+    minloglik = call_loglik(ttot,par,X0mat(:,locX0),DATA,W,glo); % use call_loglik.m to provide the minus log-likelihood
+    if ~isempty(minloglik) % otherwise, call_loglik cannot deal with these data, and we continue below
+        if ~isempty(glo2.pri) % note that par is on normal scale, so priors are defined at normal scale
+            minloglik = minloglik - calc_prior(par,glo2); % call function to calculate prior prob.
+        end
+        if isinf(minloglik) % the minloglik should not be calculated as infinite ...
+            error('The min-log-likelihood is calculated to be infinite ... check data set and derivatives or debug from transfer.m')
+        end
+        if isnan(minloglik) || ~isreal(minloglik) % when the loglik calculation returns NaN or complex numbers ...
+            minloglik = +inf; % give it a really bad likelihood value so the optimisation ignores it
         end
-    else % call_deri did not return all required time points, so something went wrong in calculating the derivatives
+        return
+    end
+end
+
+if glo.batch >= 1 && n_X2 == 0 % the model calculates all concentrations in one go
+    [~,locX0] = ismember(ctot,X0mat(1,:)); % location of each concentration in X0mat
+    [Xall,zvd] = call_deri_batch(ttot,par,X0mat(:,locX0),glo); % use call_deri_batch.m to provide the output for all concentrations
+    % Note: Xall is a 3D matrix with time in rows, states in columns, and
+    % concentrations in the third dimension.
+    
+    if size(Xall,1) ~= length(ttot) % call_deri_batch did not return all required time points, so something went wrong
         minloglik = +inf; % than make the minloglik infinite (very bad fit!)
-        % error('This should not happen anymore ...')
         return; % and return to the function calling this one
     end
-    for j = 1:n_X2 % now loop over the additional data sets
-        Xcoll2x{j}(:,i) = Xout2{j}(:,1); % collect the new x-values
-        Xcoll2y{j}(:,i) = Xout2{j}(:,2); % collect the new y-values
+    for j = 1:n_X % now loop over the state variables
+        Xcoll{j} = reshape(Xall(:,j,:),length(ttot),length(ctot)); % and collect the results in the right part of Xcoll
     end
+    
+else
+    
+    for i = 1:length(ctot) % run through all of our concentrations
+        % initial states to start the solver with, from X0mat
+        X0 = X0mat(2:end,X0mat(1,:) == ctot(i)); % read initial states from X0mat using "concentration" vector
+    
+        % Note: glo is here handed over with the call to call_deri. That means
+        % that it does not have to be global in call_deri. 
+    
+        [Xout,~,Xout2,zvd] = call_deri(ttot,par,[ctot(i);X0],glo); % use call_deri.m to provide the output per concentration
+        % Note: zvd is glo.zvd with an added (third) element: the estimated
+        % value based on the parameters in par (and possibly other things).
+        % Note: zvd should not depend on the scenarios/concentrations,
+        % otherwise only the last will be used!
+   
+        if size(Xout,1) == length(ttot)
+            for j = 1:n_X % now loop over the state variables
+                Xcoll{j}(:,i) = Xout(:,j); % and collect the results in the right part of Xcoll
+            end
+        else % call_deri did not return all required time points, so something went wrong in calculating the derivatives
+            minloglik = +inf; % than make the minloglik infinite (very bad fit!)
+            % error('This should not happen anymore ...')
+            return; % and return to the function calling this one
+        end
+        for j = 1:n_X2 % now loop over the additional data sets
+            Xcoll2x{j}(:,i) = Xout2{j}(:,1); % collect the new x-values
+            Xcoll2y{j}(:,i) = Xout2{j}(:,2); % collect the new y-values
+        end
+    end
+    
 end
 
 %% Calculate likelihood
@@ -0,0 +1,192 @@
+function Res = calc_epx_window_files(par_plot,folder_prof,Twin,opt_ecx,opt_conf,file_res)
+
+% Usage: Res = calc_epx_window_files(par_plot,folder_prof,Twin,opt_ecx,opt_conf,file_res)
+%           PART OF ENGINE_PAR
+% Batch calculations of EPx for all exposure profiles in a folder, with
+% moving time window. For each profile, calc_epx_window is used (without
+% CIs) to find the window with the lowest EPx, and calc_epx calculates the
+% EPx with CIs for that window. The sample for the CIs is loaded only once,
+% for all profiles. The results are written to a text file as soon as a
+% profile is done. When that file already exists, the profiles that are in
+% it are skipped, so an interrupted batch can simply be started again.
+%
+% The profiles are done in chunks, as many as there are workers in the
+% parallel pool. The profiles in a chunk are spread over the workers with
+% parfor, each worker doing all windows of one profile; with the robust
+% EPx and glo.batch>0, the C++ code does all windows of a profile on a
+% pool of threads instead (see call_epx_window.m in the Cdubia folder), so
+% the profiles are done one by one. The model is then registered once for all profiles, as the profile
+% is passed to the C++ code directly. The CIs are calculated per profile,
+% with calc_epx spreading the sets of the sample over the workers.
+%
+% <par_plot>    parameter structure for the best-fit curve; if left empty the
+%               structure from the saved sample is used
+% <folder_prof> folder with the exposure profiles (all txt files are used)
+% <Twin>        length of time window (days)
+% <opt_ecx>     options structure for ECx and EPx calculations
+% <opt_conf>    options structure for making confidence intervals
+% <file_res>    name of the text file for the results
+%
+% Output <Res> is a table with all lines in the results file: the profile,
+% effect level, start of the window with the lowest EPx (over all traits),
+% and for each trait (as state number) the EPx with its CI at that window.
+%
+% Author     : Tjalling Jager
+% Date       : October 2026
+% Web support: http://www.debtox.info/byom.html
+
+%  Copyright (c) 2012-2026, Tjalling Jager, all rights reserved.
+%  This source code is licensed under the MIT-style license found in the
+%  LICENSE.txt file in the root directory of BYOM.
+
+global glo glo2 X0mat
+
+Feff     = opt_ecx.Feff;     % effect level (>0 en <1), x/100 in LCx (also used here for ECx)
+rob_win  = opt_ecx.rob_win;  % set to 1 to use robust EPx calculation for moving time windows, rather than with fzero
+calc_int = opt_ecx.calc_int; % integrate survival and repro into 1) RGR, or 2) survival-corrected repro (experimental!)
+
+if isempty(opt_conf)
+    type_conf = 0; % then we don't need CIs
+else
+    type_conf = opt_conf.type; % use values from slice sampler (1), likelihood region(2) to make intervals
+    type_conf = max(0,type_conf); % if someone uses -1, set it to zero
+end
+
+% Load the best parameter set and the random sample from file, once for all
+% profiles (as calc_epx_window does for all windows)
+rnd = -1;
+if type_conf > 0 || isempty(par_plot) % also if par_plot is not provided
+    [rnd,par] = load_rnd(opt_conf); % loading and selecting the sample is handled in a separate function
+    if isempty(par_plot) % if no par structure was entered in this function ...
+        par_plot = par; % simply use the one from the sample file
+    end
+    if numel(rnd) == 1 || opt_ecx.par_read == 1 % no sample was found, or we don't want CIs
+        type_conf = 0;
+        rnd       = -1;
+    end
+end
+
+opt_ecx.batch_epx = 1; % set to batch mode so calc_epx_window and calc_epx provide no output
+opt_ecx.par_read  = 0; % the sample is already loaded here
+opt_conf_win      = []; % windows without CIs
+if type_conf > 0
+    opt_conf.type = type_conf;
+else
+    opt_conf = []; % so calc_epx does not load the sample again
+end
+
+%% Profiles that still need to be done
+
+files = dir(fullfile(folder_prof,'*.txt')); % all profiles in the folder
+names = {files.name};
+if exist(file_res,'file') == 2 % then we continue an earlier batch
+    fid = fopen(file_res,'r');
+    C   = textscan(fid,'%s %*[^\n]','HeaderLines',1,'Delimiter','\t');
+    fclose(fid);
+    names = setdiff(names,C{1},'stable'); % remove the profiles that are done
+else
+    fid = fopen(file_res,'w');
+    fprintf(fid,'profile\tFeff\tTstart\ttrait\tEPx\tEPx_lo\tEPx_hi\n');
+    fclose(fid);
+end
+
+% The windows of a profile are done by the C++ code in one call when it can
+% be used (same conditions as in calc_epx_window). Otherwise, the profiles
+% are spread over the workers.
+n_chunk = 1;
+if ~(rob_win == 1 && calc_int == 0 && glo.batch >= 1 && exist('call_epx_window','file')==2) && glo2.n_cores > 0
+    poolobj = gcp('nocreate'); % get info on current pool, but don't create one just yet
+    if isempty(poolobj) % if there is no parallel pool ...
+        poolobj = parpool('local',glo2.n_cores); % create a local one with specified number of cores
+    end
+    n_chunk = poolobj.NumWorkers;
+end
+
+% some trickery to get parfor running ... The workers have their own
+% globals, which are set from WRAP.
+WRAP.glo   = glo;
+WRAP.glo2  = glo2;
+WRAP.X0mat = X0mat;
+if n_chunk > 1
+    WRAP.glo2.n_cores = 0; % calc_epx on a worker should not start a pool
+end
+
+%% Run through the profiles in chunks
+
+for i_c = 1:n_chunk:length(names)
+
+    names_c  = names(i_c:min(i_c+n_chunk-1,length(names)));
+    win_coll = cell(length(names_c),1); % collect lowest EPx per window for each profile
+
+    if n_chunk > 1
+        parfor i = 1:length(names_c)
+            win_coll{i} = epx_profile(WRAP,par_plot,fullfile(folder_prof,names_c{i}),Twin,opt_ecx,opt_conf_win);
+        end
+    else
+        for i = 1:length(names_c)
+            [MinColl,~,ind_traits] = calc_epx_window(par_plot,fullfile(folder_prof,names_c{i}),Twin,opt_ecx,opt_conf_win);
+            win_coll{i} = {MinColl,ind_traits};
+        end
+    end
+
+    for i = 1:length(names_c)
+
+        MinColl    = win_coll{i}{1};
+        ind_traits = win_coll{i}{2};
+        fname_prof = fullfile(folder_prof,names_c{i});
+
+        lines = {};
+        if isempty(ind_traits) % there is not enough effect in any window
+            for i_F = 1:length(Feff)
+                lines{end+1} = sprintf('%s\t%g\tNaN\tNaN\tNaN\tNaN\tNaN',names_c{i},Feff(i_F)); %#ok<AGROW>
+            end
+        else
+            % Window with the lowest EPx for each effect level (over all traits)
+            Tstart = nan(1,length(Feff));
+            for i_F = 1:length(Feff)
+                [~,ind_min] = min(MinColl{i_F}(:,2)); % find where the lowest EPx is
+                Tstart(i_F) = MinColl{i_F}(ind_min,3); % start time for that window
+            end
+            % EPx with CIs, once for each of these windows (on the workers)
+            [T_u,~,ind_u] = unique(Tstart);
+            EPx_u = cell(1,length(T_u));
+            for i_T = 1:length(T_u)
+                [EPx,EPx_lo,EPx_hi,ind_traits_T] = calc_epx(par_plot,fname_prof,[T_u(i_T) T_u(i_T)+Twin],opt_ecx,opt_conf,[],rnd);
+                EPx_u{i_T} = {EPx,EPx_lo,EPx_hi,ind_traits_T};
+            end
+            for i_F = 1:length(Feff)
+                [EPx,EPx_lo,EPx_hi,ind_traits_T] = EPx_u{ind_u(i_F)}{:};
+                for i_X = 1:length(ind_traits_T)
+                    lines{end+1} = sprintf('%s\t%g\t%g\t%d\t%g\t%g\t%g',names_c{i},Feff(i_F),Tstart(i_F),ind_traits_T(i_X),...
+                        EPx{i_F}(i_X),EPx_lo{i_F}(i_X),EPx_hi{i_F}(i_X)); %#ok<AGROW>
+                end
+            end
+        end
+
+        % write the results for this profile right away
+        fid = fopen(file_res,'a');
+        fprintf(fid,'%s\n',lines{:});
+        fclose(fid);
+
+    end
+
+    disp(['Profiles done: ',num2str(min(i_c+n_chunk-1,length(names))),' of ',num2str(length(names))])
+end
+
+Res = readtable(file_res,'Delimiter','\t','FileType','text');
+
+%% Sub-function for the workers
+
+function out = epx_profile(WRAP,par_plot,fname_prof,Twin,opt_ecx,opt_conf)
+
+% The windows of one profile on a worker of the parallel pool. The globals
+% on the worker are set from WRAP first.
+
+global glo glo2 X0mat
+
+glo   = WRAP.glo;
+glo2  = WRAP.glo2;
+X0mat = WRAP.X0mat;
+
+[MinColl,~,ind_traits] = calc_epx_window(par_plot,fname_prof,Twin,opt_ecx,opt_conf);
+out = {MinColl,ind_traits};
@@ -188,13 +188,8 @@ opt_ecx.Feff = [0.10]; % effect levels (>0 en <1), x/100 in ECx/EPx
 %calc_epx_window_batch(par,Twin,opt_ecx,opt_conf);
 
 
-% in a loop analyse all the profiles
-files = dir(fullfile("profiles",'/*.txt'));  % get recursively in all the directories the profile files
-for i = 1:length(files)
-    [MinColl,MinCI,ind_traits]=calc_epx_window(par,fullfile(files(i).folder,files(i).name),Twin,opt_ecx,opt_conf);
-    [~,ind_min] = min(MinColl{opt_ecx.Feff==0.1}(:,2)); % find where lowest EP10 is 
-    Tstart = MinColl{opt_ecx.Feff==0.1}(ind_min,3); % start time for window with lowest EP10
-    Trng = [Tstart, Tstart + Twin];
-    calc_epx(par,fullfile(files(i).folder,files(i).name), ...
-            Trng,opt_ecx,opt_conf,opt_tktd)
-end
+% Analyse all the profiles in the folder. The sample is loaded once, the
+% profiles are spread over the workers, and the results are written to a
+% text file after each profile (when the batch is interrupted, running it
+% again skips the profiles that are already in that file).
+Res = calc_epx_window_files(par,'profiles',Twin,opt_ecx,opt_conf,[glo.basenm,'_epx.txt']);